@@ -1,4 +1,4 @@
-// * This file contains the implementation of the AVL tree data structure. The snc_index is a void pointer that represents some secondary key for each AVLNode, define the compare_scnd_index function to compare two secondary indexes in the file where you are using this AVLTree.
+// * This file contains the implementation of the AVL tree data structure. The snc_index is a void pointer that represents some secondary key for each AVLNode, define the compare_scnd_index function to order two secondary indexes in the file where you are using this AVLTree. Nodes are ordered by value, and nodes with equal values by secondary index, so every (value, secondary index) pair has a single place in the tree.
 
 #include "AVLTree.h"
 
@@ -108,6 +108,30 @@ AVLNode *avl_rotate_right(AVLNode *node)
     return new_root;
 }
 
+/**
+ * @brief Compare a (value, secondary index) pair with a node
+ *
+ * @param scnd_index The secondary index of the pair
+ * @param value The value of the pair
+ * @param node The node to compare with
+ *
+ * @return int negative if the pair comes before the node, 0 if it is the pair of the node, positive if it comes after it
+ */
+int avl_compare(void *scnd_index, double value, AVLNode *node)
+{
+    if (value < node->value)
+    {
+        return -1;
+    }
+
+    if (value > node->value)
+    {
+        return 1;
+    }
+
+    return compare_scnd_index(scnd_index, node->scnd_index);
+}
+
 /**
  * @brief Initialize a new AVLNode
  *
@@ -118,10 +142,10 @@ AVLNode *avl_rotate_right(AVLNode *node)
  *
  * @return AVLNode* The new AVLNode
  */
-AVLNode *avl_init(void *scnd_index, float value)
+AVLNode *avl_init(void *scnd_index, double value)
 {
 
-    AVLNode *node = (AVLNode *)calloc(1, sizeof(AVLNode));
+    AVLNode *node = (AVLNode *)slab_zalloc(sizeof(AVLNode));
     if (node == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
@@ -143,7 +167,7 @@ AVLNode *avl_init(void *scnd_index, float value)
 /**
  * @brief Insert a new node into the AVL tree
  *
- * This function inserts a new node into the AVL tree. If the value is less than the current node, it is inserted to the left, otherwise to the right. The tree is then balanced and returned.
+ * This function inserts a new node into the AVL tree. If the (value, secondary index) pair comes before the current node, it is inserted to the left, otherwise to the right. The tree is then balanced and returned.
  *
  * @param tree The AVL tree to insert into
  * @param scnd_index The secondary index of the node
@@ -151,21 +175,21 @@ AVLNode *avl_init(void *scnd_index, float value)
  *
  * @return AVLNode* The new root of the AVL tree
  */
-AVLNode *avl_insert(AVLNode *tree, void *scnd_index, float value)
+AVLNode *avl_insert(AVLNode *tree, void *scnd_index, double value)
 {
     if (tree == NULL)
     {
         return avl_init(scnd_index, value);
     }
-    else if (value < tree->value)
+    else if (avl_compare(scnd_index, value, tree) < 0)
     {
-        // if the value is less than the current node, insert it to the left
+        // if the pair comes before the current node, insert it to the left
         tree->left = avl_insert(tree->left, scnd_index, value);
         tree->left->parent = tree;
     }
     else
     {
-        // if the value is greater than or equal to the current node, insert it to the right
+        // otherwise insert it to the right
         tree->right = avl_insert(tree->right, scnd_index, value);
         tree->right->parent = tree;
     }
@@ -205,6 +229,46 @@ AVLNode *avl_insert(AVLNode *tree, void *scnd_index, float value)
     return tree;
 }
 
+/**
+ * @brief Builds a balanced AVL tree from nodes sorted by value, without any rotation
+ *
+ * The middle node becomes the root and both halves are built recursively, so the tree has the minimal height.
+ *
+ * @param scnd_indexes secondary indexes of the nodes, duplicated like by avl_init()
+ * @param values values of the nodes, in ascending order of (value, secondary index)
+ * @param count number of nodes
+ *
+ * @return AVLNode* The root of the new AVL tree, NULL if count is 0
+ */
+AVLNode *avl_build_sorted(void **scnd_indexes, double *values, int count)
+{
+    if (count <= 0)
+    {
+        return NULL;
+    }
+
+    int middle = count / 2;
+
+    AVLNode *tree = avl_init(scnd_indexes[middle], values[middle]);
+
+    tree->left = avl_build_sorted(scnd_indexes, values, middle);
+    tree->right = avl_build_sorted(scnd_indexes + middle + 1, values + middle + 1, count - middle - 1);
+
+    if (tree->left)
+    {
+        tree->left->parent = tree;
+    }
+
+    if (tree->right)
+    {
+        tree->right->parent = tree;
+    }
+
+    avl_update(tree);
+
+    return tree;
+}
+
 /**
  * @brief Get the node with the minimum value in the tree
  *
@@ -240,7 +304,7 @@ AVLNode *get_min_node(AVLNode *tree)
  *
  * @return AVLNode* The new root of the AVL tree
  */
-AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
+AVLNode *avl_delete(AVLNode *tree, void *scnd_index, double value)
 {
 
     if (tree == NULL)
@@ -248,15 +312,17 @@ AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
         return NULL;
     }
 
-    if (value < tree->value)
+    int cmp = avl_compare(scnd_index, value, tree);
+
+    if (cmp < 0)
     {
         tree->left = avl_delete(tree->left, scnd_index, value);
     }
-    else if (value > tree->value)
+    else if (cmp > 0)
     {
         tree->right = avl_delete(tree->right, scnd_index, value);
     }
-    else if (compare_scnd_index(scnd_index, tree->scnd_index) == 0)
+    else
     {
         // found the exact node to delete
         if (tree->left == NULL)
@@ -271,7 +337,7 @@ AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
 
             // free the node
             free(tree->scnd_index);
-            free(tree);
+            slab_free(tree);
             return temp;
         }
         else if (tree->right == NULL)
@@ -286,7 +352,7 @@ AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
 
             // free the node
             free(tree->scnd_index);
-            free(tree);
+            slab_free(tree);
             return temp;
         }
         else
@@ -305,11 +371,6 @@ AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
             tree->right = avl_delete(tree->right, temp->scnd_index, temp->value);
         }
     }
-    else
-    {
-        tree->right = avl_delete(tree->right, scnd_index, value);
-        tree->left = avl_delete(tree->left, scnd_index, value);
-    }
 
     // update the height and sub_tree_size of the current node
     avl_update(tree);
@@ -347,40 +408,43 @@ AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value)
 }
 
 /**
- * @brief Search for a node with a specific float value in the AVL tree
+ * @brief Search for a node with a specific value in the AVL tree
  *
- * This function searches for a node with a specific value in the AVL tree. If the value is less than the current node, it searches the left subtree, if the value is greater, it searches the right subtree. If the value is equal to the current node, it returns the node.
+ * This function searches for the first node with a specific value in the AVL tree, the one with the smallest secondary index when several nodes have the value. If the value is less than the current node, it searches the left subtree, if the value is greater, it searches the right subtree. If the value is equal to the current node, the node is remembered and the left subtree is searched for an earlier one.
  *
  * @param tree The AVL tree to search
  * @param value The value to search for
  *
- * @return AVLNode* The node with the specified value
+ * @return AVLNode* The first node with the specified value, NULL if there is none
  */
-AVLNode *avl_search_float(AVLNode *tree, float value)
+AVLNode *avl_search_float(AVLNode *tree, double value)
 {
-    if (tree == NULL)
-    {
-        return NULL;
-    }
+    AVLNode *found = NULL;
 
-    if (value < tree->value)
-    {
-        return avl_search_float(tree->left, value);
-    }
-    else if (value > tree->value)
+    while (tree != NULL)
     {
-        return avl_search_float(tree->right, value);
-    }
-    else
-    {
-        return tree;
+        if (value < tree->value)
+        {
+            tree = tree->left;
+        }
+        else if (value > tree->value)
+        {
+            tree = tree->right;
+        }
+        else
+        {
+            found = tree;
+            tree = tree->left;
+        }
     }
+
+    return found;
 }
 
 /**
- * @brief Search for a node with a specific float value and secondary index in the AVL tree
+ * @brief Search for a node with a specific value and secondary index in the AVL tree
  *
- * This function searches for a node with a specific value and secondary index in the AVL tree. If the value is less than the current node, it searches the left subtree, if the value is greater, it searches the right subtree. If the value is equal to the current node, it compares the secondary index. If the secondary index is equal, it returns the node. If the secondary index is not equal, it searches in both directions for the pair.
+ * This function searches for a node with a specific value and secondary index in the AVL tree. The tree is ordered by the pair, so a single path from the root is followed, even when many nodes share the value.
  *
  * @param tree The AVL tree to search
  * @param scnd_index The secondary index to search for
@@ -388,33 +452,121 @@ AVLNode *avl_search_float(AVLNode *tree, float value)
  *
  * @return AVLNode* The node with the specified value and secondary index
  */
-AVLNode *avl_search_pair(AVLNode *tree, void *scnd_index, float value)
+AVLNode *avl_search_pair(AVLNode *tree, void *scnd_index, double value)
 {
-    if (tree == NULL)
+    while (tree != NULL)
     {
-        return NULL;
-    }
+        int cmp = avl_compare(scnd_index, value, tree);
 
-    if (value < tree->value)
-    {
-        return avl_search_pair(tree->left, scnd_index, value);
+        if (cmp == 0)
+        {
+            return tree;
+        }
+
+        tree = (cmp < 0) ? tree->left : tree->right;
     }
-    else if (value > tree->value)
+
+    return NULL;
+}
+
+/**
+ * @brief Get the rank of a node, its position in the tree starting at 0
+ *
+ * @param tree The AVL tree to search
+ * @param scnd_index The secondary index of the node
+ * @param value The value of the node
+ *
+ * @return long The rank of the node, -1 if it is not in the tree
+ */
+long avl_rank(AVLNode *tree, void *scnd_index, double value)
+{
+    long rank = 0;
+
+    while (tree != NULL)
     {
-        return avl_search_pair(tree->right, scnd_index, value);
+        int cmp = avl_compare(scnd_index, value, tree);
+
+        if (cmp == 0)
+        {
+            return rank + avl_sub_tree_size(tree->left);
+        }
+
+        if (cmp < 0)
+        {
+            tree = tree->left;
+        }
+        else
+        {
+            // the left subtree and the node come before it
+            rank += avl_sub_tree_size(tree->left) + 1;
+            tree = tree->right;
+        }
     }
-    else if (compare_scnd_index(scnd_index, tree->scnd_index) == 0)
+
+    return -1;
+}
+
+/**
+ * @brief Number of nodes with a value below a bound, the rank of the first node past it
+ *
+ * @param tree The AVL tree to search
+ * @param value The bound
+ * @param inclusive Also count the nodes with the value itself
+ *
+ * @return long The number of nodes with a value less than (or equal to, when inclusive) the bound
+ */
+long avl_count_below(AVLNode *tree, double value, bool inclusive)
+{
+    long count = 0;
+
+    while (tree != NULL)
     {
-        return tree;
+        if (tree->value < value || (inclusive && tree->value == value))
+        {
+            // the left subtree and the node are below the bound
+            count += avl_sub_tree_size(tree->left) + 1;
+            tree = tree->right;
+        }
+        else
+        {
+            tree = tree->left;
+        }
     }
-    else
+
+    return count;
+}
+
+/**
+ * @brief Get the node at a rank, starting from the root
+ *
+ * @param tree The AVL tree to search
+ * @param rank The position of the node, starting at 0
+ *
+ * @return AVLNode* The node at the rank, NULL if the rank is out of bounds
+ */
+AVLNode *avl_at_rank(AVLNode *tree, long rank)
+{
+    while (tree != NULL)
     {
-        // look in both directions for the pair
-        AVLNode *left = avl_search_pair(tree->left, scnd_index, value);
-        AVLNode *right = avl_search_pair(tree->right, scnd_index, value);
+        long left_size = avl_sub_tree_size(tree->left);
 
-        return (left != NULL) ? left : right;
+        if (rank == left_size)
+        {
+            return tree;
+        }
+
+        if (rank < left_size)
+        {
+            tree = tree->left;
+        }
+        else
+        {
+            rank -= left_size + 1;
+            tree = tree->right;
+        }
     }
+
+    return NULL;
 }
 
 /**
@@ -494,7 +646,7 @@ void avl_free(AVLNode *tree)
     avl_free(tree->right);
 
     free(tree->scnd_index);
-    free(tree);
+    slab_free(tree);
 }
 
 /**
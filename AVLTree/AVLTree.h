@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+
+#include "../slab/slab.h"
 
 typedef struct AVLNode
 {
@@ -14,19 +17,24 @@ typedef struct AVLNode
     // store a reference to key(used in ZSet), used as a secondary index in the AVL tree, value is primary index. Set scnd_index to some common value if want to use normal AVL trees
     void *scnd_index;
 
-    float value;
+    double value;
 } AVLNode;
 
-// configure the compare function for the secondary index, meant to see if two secondary indexes are equal
+// configure the compare function for the secondary index, orders nodes with equal values like strcmp: negative if the first index comes first, 0 if they are equal, positive otherwise
 int compare_scnd_index(void *scnd_index1, void *scnd_index2);
 
 int avl_height(AVLNode *node);
+int avl_compare(void *scnd_index, double value, AVLNode *node);
 int avl_sub_tree_size(AVLNode *node);
-AVLNode *avl_init(void *snd_index, float value);
-AVLNode *avl_search_float(AVLNode *tree, float value);
-AVLNode *avl_search_pair(AVLNode *tree, void *scnd_index, float value);
-AVLNode *avl_insert(AVLNode *tree, void *scnd_index, float value);
-AVLNode *avl_delete(AVLNode *tree, void *scnd_index, float value);
+AVLNode *avl_init(void *snd_index, double value);
+AVLNode *avl_search_float(AVLNode *tree, double value);
+AVLNode *avl_search_pair(AVLNode *tree, void *scnd_index, double value);
+AVLNode *avl_insert(AVLNode *tree, void *scnd_index, double value);
+AVLNode *avl_delete(AVLNode *tree, void *scnd_index, double value);
+AVLNode *avl_build_sorted(void **scnd_indexes, double *values, int count);
+long avl_rank(AVLNode *tree, void *scnd_index, double value);
+long avl_count_below(AVLNode *tree, double value, bool inclusive);
+AVLNode *avl_at_rank(AVLNode *tree, long rank);
 AVLNode *avl_offset(AVLNode *node, int offset);
 AVLNode *get_min_node(AVLNode *tree);
 void avl_free(AVLNode *tree);
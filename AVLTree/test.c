@@ -3,15 +3,8 @@
 // in this AVLTree implementation, the secondary index is a string
 int compare_scnd_index(void *scnd_index1, void *scnd_index2)
 {
-    if (strcmp((char *)scnd_index1, (char *)scnd_index2) == 0)
-    {
-        // check if the strings are equal
-        return 0;
-    }
-    else
-    {
-        return 1;
-    }
+    // nodes with equal values are ordered by their secondary index
+    return strcmp((char *)scnd_index1, (char *)scnd_index2);
 }
 
 int main()
@@ -39,6 +32,13 @@ int main()
     tree = avl_insert(tree, strings[8], -3);
     tree = avl_insert(tree, strings[9], -4);
 
+    // test counting the nodes below a value, -3 is shared by two nodes
+    if (avl_count_below(tree, -3, false) != 1 || avl_count_below(tree, -3, true) != 3 || avl_count_below(tree, 2.5, false) != 8 || avl_count_below(tree, 100, true) != 10 || avl_count_below(tree, -10, true) != 0)
+    {
+        printf("AVL count below a value failed\n");
+        exit(EXIT_FAILURE);
+    }
+
     // test search by pair
     AVLNode *pair1 = avl_search_pair(tree, strings[7], -3);
     AVLNode *pair2 = avl_search_pair(tree, strings[8], -3);
@@ -137,6 +137,76 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    // build a tree from sorted values, it is balanced and searchable like an inserted one
+    double sorted_values[10];
+    for (int i = 0; i < 10; i++)
+    {
+        sorted_values[i] = i - 5;
+    }
+
+    AVLNode *built_tree = avl_build_sorted((void **)strings, sorted_values, 10);
+    if (built_tree->sub_tree_size != 10 || built_tree->height != 4 || built_tree->parent != NULL)
+    {
+        printf("AVL build from sorted values failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    AVLNode *found = avl_search_pair(built_tree, strings[7], 2);
+    if (!found || avl_offset(get_min_node(built_tree), 7) != found || avl_offset(found, -7)->value != -5)
+    {
+        printf("AVL search in a built tree failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    built_tree = avl_delete(built_tree, strings[0], -5);
+    if (built_tree->sub_tree_size != 9 || get_min_node(built_tree)->value != -4)
+    {
+        printf("AVL delete from a built tree failed\n");
+        exit(EXIT_FAILURE);
+    }
+    avl_free(built_tree);
+
+    // many nodes with the same value are ordered by secondary index, inserted in a scrambled order
+    char name[16];
+    AVLNode *tied_tree = NULL;
+    for (int i = 0; i < 1000; i++)
+    {
+        sprintf(name, "m%04d", (i * 7919) % 1000);
+        tied_tree = avl_insert(tied_tree, name, 0);
+    }
+
+    AVLNode *first = avl_search_float(tied_tree, 0);
+    if (tied_tree->sub_tree_size != 1000 || tied_tree->height > 15 || first != get_min_node(tied_tree) || strcmp(first->scnd_index, "m0000") != 0)
+    {
+        printf("AVL insert of equal values failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        sprintf(name, "m%04d", i);
+        AVLNode *tied = avl_search_pair(tied_tree, name, 0);
+        if (!tied || avl_offset(first, i) != tied)
+        {
+            printf("AVL search of equal values failed for %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // delete every other node
+    for (int i = 0; i < 1000; i += 2)
+    {
+        sprintf(name, "m%04d", i);
+        tied_tree = avl_delete(tied_tree, name, 0);
+    }
+
+    if (tied_tree->sub_tree_size != 500 || avl_search_pair(tied_tree, "m0002", 0) || strcmp(avl_offset(get_min_node(tied_tree), 250)->scnd_index, "m0501") != 0)
+    {
+        printf("AVL delete of equal values failed\n");
+        exit(EXIT_FAILURE);
+    }
+    avl_free(tied_tree);
+
     // free strings
     for (int i = 0; i < 10; i++)
     {
@@ -1,34 +1,221 @@
-// * This file contains the implementation of the ZSet data structure. The ZSet is a collection of key-value pairs, where each key is unique and maps to a float value. The ZSet is implemented using a hash table and an AVL tree. The hash table is used to store the key-value pairs, and the AVL tree is used to store the key-value pairs sorted by the value. The ZSet supports adding, removing, and searching for key-value pairs.
+// * This file contains the implementation of the ZSet data structure. The ZSet is a collection of key-value pairs, where each key is unique and maps to a double value. The ZSet is implemented using a hash table and an ordered index, small ZSets are compact and keep their key-value pairs in one sorted array until they outgrow it. The hash table is used to store the key-value pairs, and the ordered index, an AVL tree or a skip list (see ZSetEngine), is used to store the key-value pairs sorted by the value. The ZSet supports adding, removing, and searching for key-value pairs, and reading them by rank.
 
 #include "ZSet.h"
 
+ZSetEngine zset_default_engine = ZSET_ENGINE_AVL;
+
+int zset_max_compact_entries = ZSET_MAX_COMPACT_ENTRIES;
+int zset_max_compact_value = ZSET_MAX_COMPACT_VALUE;
+
 /**
  * @brief Compare two secondary indexes
  *
- * This function compares two secondary indexes (expected to be strings) and returns 0 if they are equal, 1 otherwise. Necessary since importing AVL Tree module.
+ * This function orders two secondary indexes (expected to be strings), members with equal scores are sorted by name in the AVL tree. Necessary since importing AVL Tree module.
  *
  * @param scnd_index1 The first secondary index
  * @param scnd_index2 The second secondary index
  *
- * @return int 0 if the secondary indexes are equal, 1 otherwise
+ * @return int negative if the first index comes first, 0 if they are equal, positive otherwise
  */
 int compare_scnd_index(void *scnd_index1, void *scnd_index2)
 {
-    if (strcmp((char *)scnd_index1, (char *)scnd_index2) == 0)
+    // members with equal scores are ordered by their bytes
+    return strcmp((char *)scnd_index1, (char *)scnd_index2);
+}
+
+/**
+ * @brief Removes a key from the ordered index of the ZSet
+ *
+ * @param zset The ZSet
+ * @param key The key to remove
+ * @param score The score of the key
+ */
+static void zset_index_delete(ZSet *zset, char *key, double score)
+{
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
     {
-        // check if the strings are equal
-        return 0;
+        skiplist_delete(zset->skiplist, key, score);
     }
     else
     {
-        return 1;
+        zset->avl_tree = avl_delete(zset->avl_tree, key, score);
+    }
+}
+
+/**
+ * @brief Compares a (score, key) pair with an entry of a compact ZSet
+ *
+ * @return int negative if the pair comes before the entry, 0 if it is the pair of the entry, positive if it comes after it
+ */
+static int zset_entry_compare(const char *key, double score, ZSetEntry *entry)
+{
+    if (score != entry->score)
+    {
+        return (score < entry->score) ? -1 : 1;
+    }
+
+    return strcmp(key, entry->member);
+}
+
+/**
+ * @brief Binary search of the entries of a compact ZSet
+ *
+ * @param zset The compact ZSet
+ * @param key The key
+ * @param score The score of the key
+ *
+ * @return int position of the first entry that does not come before (score, key), where it would be inserted
+ */
+static int zset_compact_position(ZSet *zset, const char *key, double score)
+{
+    int low = 0;
+    int high = zset->num_entries;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (zset_entry_compare(key, score, &zset->entries[mid]) > 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Finds a key in a compact ZSet, the entries are sorted by score so it is a scan of at most zset_max_compact_entries members
+ *
+ * @param zset The compact ZSet
+ * @param key The key
+ *
+ * @return int position of the entry of the key, -1 if it is not in the ZSet
+ */
+static int zset_compact_find(ZSet *zset, const char *key)
+{
+    for (int i = 0; i < zset->num_entries; i++)
+    {
+        if (!strcmp(zset->entries[i].member, key))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Inserts an entry at its position in a compact ZSet, the key must not be in it already
+ *
+ * @param zset The compact ZSet
+ * @param key The key, copied
+ * @param score The score of the key
+ */
+static void zset_compact_insert(ZSet *zset, const char *key, double score)
+{
+    if (zset->num_entries == zset->entries_capacity)
+    {
+        zset->entries_capacity = zset->entries_capacity ? zset->entries_capacity * 2 : 4;
+        zset->entries = realloc(zset->entries, sizeof(ZSetEntry) * zset->entries_capacity);
+        if (!zset->entries)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t key_len = strlen(key) + 1;
+    char *member = slab_alloc(key_len);
+    if (!member)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(member, key, key_len);
+
+    int pos = zset_compact_position(zset, key, score);
+    memmove(&zset->entries[pos + 1], &zset->entries[pos], sizeof(ZSetEntry) * (zset->num_entries - pos));
+
+    zset->entries[pos].score = score;
+    zset->entries[pos].member = member;
+    zset->num_entries++;
+}
+
+/**
+ * @brief Removes the entry at a position of a compact ZSet
+ *
+ * @param zset The compact ZSet
+ * @param pos The position of the entry
+ */
+static void zset_compact_delete(ZSet *zset, int pos)
+{
+    slab_free(zset->entries[pos].member);
+
+    memmove(&zset->entries[pos], &zset->entries[pos + 1], sizeof(ZSetEntry) * (zset->num_entries - pos - 1));
+    zset->num_entries--;
+}
+
+/**
+ * @brief Creates the empty hash table and ordered index of a ZSet that is not compact
+ *
+ * @param zset The ZSet
+ */
+static void zset_index_init(ZSet *zset)
+{
+    zset->hash_table = hcreate(INIT_TABLE_SIZE);
+    zset->avl_tree = NULL;
+    zset->skiplist = (zset->engine == ZSET_ENGINE_SKIPLIST) ? skiplist_create() : NULL;
+}
+
+/**
+ * @brief Converts a compact ZSet to a hash table and an ordered index, the entries are already sorted so the index is built directly
+ *
+ * @param zset The compact ZSet
+ */
+static void zset_convert(ZSet *zset)
+{
+    ZSetEntry *entries = zset->entries;
+    int count = zset->num_entries;
+
+    char **keys = malloc(sizeof(char *) * (count ? count : 1));
+    double *values = malloc(sizeof(double) * (count ? count : 1));
+    if (!keys || !values)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
     }
+
+    for (int i = 0; i < count; i++)
+    {
+        keys[i] = entries[i].member;
+        values[i] = entries[i].score;
+    }
+
+    zset->entries = NULL;
+    zset->num_entries = 0;
+    zset->entries_capacity = 0;
+
+    zset_index_init(zset);
+    zset_build_sorted(zset, keys, values, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        slab_free(entries[i].member);
+    }
+    free(entries);
+    free(keys);
+    free(values);
 }
 
 /**
  * @brief Initializes a new ZSet
  *
- * This function initializes a new ZSet with an empty hash table and an empty AVL tree.
+ * This function initializes a new ZSet, compact and empty unless compact ZSets are disabled, then with an empty hash table and an empty ordered index of the default engine.
  *
  * @return ZSet* The initialized ZSet
  */
@@ -41,12 +228,29 @@ ZSet *zset_init()
         exit(EXIT_FAILURE);
     }
 
-    zset->hash_table = hcreate(INIT_TABLE_SIZE);
-    zset->avl_tree = NULL;
+    // the engine is kept for the conversion of a compact ZSet
+    zset->engine = zset_default_engine;
+
+    if (zset_max_compact_entries <= 0)
+    {
+        zset_index_init(zset);
+    }
 
     return zset;
 }
 
+/**
+ * @brief Whether a ZSet keeps its keys in a single sorted array
+ *
+ * @param zset The ZSet
+ *
+ * @return bool true if the ZSet is compact
+ */
+bool zset_is_compact(ZSet *zset)
+{
+    return zset->hash_table == NULL;
+}
+
 // adds/updates a key in the ZSet
 /**
  * @brief Add a key to the ZSet
@@ -59,8 +263,25 @@ ZSet *zset_init()
  *
  * @return int 0 if successful, -1 if failed
  */
-int zset_add(ZSet *zset, char *key, float value)
+int zset_add(ZSet *zset, char *key, double value)
 {
+    if (zset_is_compact(zset))
+    {
+        int pos = zset_compact_find(zset, key);
+        if (pos >= 0)
+        {
+            zset_compact_delete(zset, pos);
+        }
+
+        if (zset->num_entries < zset_max_compact_entries && strlen(key) <= zset_max_compact_value)
+        {
+            zset_compact_insert(zset, key, value);
+            return 0;
+        }
+
+        // the key is added to the hash table and the ordered index below
+        zset_convert(zset);
+    }
 
     HashNode *hash_node = hget(zset->hash_table, key);
 
@@ -76,38 +297,30 @@ int zset_add(ZSet *zset, char *key, float value)
             return -1;
         }
 
-        float score = *(float *)hash_node->value;
+        double score = hash_node->floatValue;
 
-        // delete the hash node from the hash table and the AVL tree
+        // delete the hash node from the hash table and the ordered index
         hremove(zset->hash_table, key);
         hfree(hash_node);
 
-        zset->avl_tree = avl_delete(zset->avl_tree, key, score);
-    }
-
-    char *key_alloc = strdup(key);
-    if (key_alloc == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
-
-    float *value_alloc = (float *)calloc(1, sizeof(float));
-    if (value_alloc == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
+        zset_index_delete(zset, key, score);
     }
 
-    *value_alloc = value;
-
-    hash_node = hinit(key_alloc, FLOAT, value_alloc);
+    // the key and the score are stored in the same allocation as the hash node
+    hash_node = hinit_float(key, strlen(key), value);
 
     // insert the hash node into the hash table
     hinsert(zset->hash_table, hash_node);
 
-    // insert the hash node into the AVL tree
-    zset->avl_tree = avl_insert(zset->avl_tree, key, value);
+    // insert the key into the ordered index
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        skiplist_insert(zset->skiplist, key, value);
+    }
+    else
+    {
+        zset->avl_tree = avl_insert(zset->avl_tree, key, value);
+    }
 
     return 0;
 }
@@ -124,6 +337,19 @@ int zset_add(ZSet *zset, char *key, float value)
  */
 int zset_remove(ZSet *zset, char *key)
 {
+    if (zset_is_compact(zset))
+    {
+        int pos = zset_compact_find(zset, key);
+        if (pos < 0)
+        {
+            fprintf(stderr, "Key does not exist in the ZSet\n");
+            return -1;
+        }
+
+        zset_compact_delete(zset, pos);
+        return 0;
+    }
+
     HashNode *hash_node = hremove(zset->hash_table, key);
     if (!hash_node)
     {
@@ -139,34 +365,375 @@ int zset_remove(ZSet *zset, char *key)
         return -1;
     }
 
-    float score = *(float *)hash_node->value;
+    double score = hash_node->floatValue;
 
-    // delete the hash node from the hash table and the AVL tree, delete the hash node from the avl_tree first since hash node frees the key
-    zset->avl_tree = avl_delete(zset->avl_tree, key, score);
+    // delete the hash node from the hash table and the ordered index, delete it from the index first since hash node frees the key
+    zset_index_delete(zset, key, score);
     hfree(hash_node);
 
     return 0;
 }
 
 /**
- * @brief Search for a key in the ZSet
+ * @brief Fills an empty ZSet with keys sorted by value, the ordered index is built directly instead of by one insertion per key
  *
- * This function searches for a key in the ZSet and returns the hash node if found, NULL otherwise.
+ * @param zset The empty ZSet to fill
+ * @param keys The keys, which must be distinct
+ * @param values The values of the keys, in ascending order, keys with equal values sorted by name
+ * @param count The number of keys
+ *
+ * @return void
+ */
+void zset_build_sorted(ZSet *zset, char **keys, double *values, int count)
+{
+    if (zset_is_compact(zset))
+    {
+        bool fits = count <= zset_max_compact_entries;
+        for (int i = 0; i < count && fits; i++)
+        {
+            fits = strlen(keys[i]) <= zset_max_compact_value;
+        }
+
+        if (fits)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                zset_compact_insert(zset, keys[i], values[i]);
+            }
+            return;
+        }
+
+        zset_convert(zset);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        hinsert(zset->hash_table, hinit_float(keys[i], strlen(keys[i]), values[i]));
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        skiplist_build_sorted(zset->skiplist, keys, values, count);
+    }
+    else
+    {
+        zset->avl_tree = avl_build_sorted((void **)keys, values, count);
+    }
+}
+
+/**
+ * @brief Number of keys in the ZSet
+ *
+ * @param zset The ZSet
+ *
+ * @return long The number of keys
+ */
+long zset_size(ZSet *zset)
+{
+    if (zset_is_compact(zset))
+    {
+        return zset->num_entries;
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        return zset->skiplist->length;
+    }
+
+    return avl_sub_tree_size(zset->avl_tree);
+}
+
+/**
+ * @brief Rank of a key, its position by (value, key) starting at 0
+ *
+ * @param zset The ZSet
+ * @param key The key
+ * @param value The value of the key
+ *
+ * @return long The rank, -1 if the key does not have this value in the ZSet
+ */
+long zset_rank(ZSet *zset, char *key, double value)
+{
+    if (zset_is_compact(zset))
+    {
+        int pos = zset_compact_position(zset, key, value);
+
+        return (pos < zset->num_entries && zset_entry_compare(key, value, &zset->entries[pos]) == 0) ? pos : -1;
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        return skiplist_rank(zset->skiplist, key, value);
+    }
+
+    return avl_rank(zset->avl_tree, key, value);
+}
+
+/**
+ * @brief Rank of the first key with a value, the smallest key when several have it
+ *
+ * @param zset The ZSet
+ * @param value The value
+ *
+ * @return long The rank, -1 if no key has this value
+ */
+long zset_score_rank(ZSet *zset, double value)
+{
+    if (zset_is_compact(zset))
+    {
+        // the empty key comes before every other key with the value
+        int pos = zset_compact_position(zset, "", value);
+
+        return (pos < zset->num_entries && zset->entries[pos].score == value) ? pos : -1;
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        long rank;
+        SkipListNode *node = skiplist_lower_bound(zset->skiplist, value, false, &rank);
+
+        return (node && node->score == value) ? rank : -1;
+    }
+
+    AVLNode *node = avl_search_float(zset->avl_tree, value);
+
+    return node ? avl_rank(zset->avl_tree, node->scnd_index, node->value) : -1;
+}
+
+/**
+ * @brief Rank of the first key with a value of at least a bound, which is also the number of keys below the bound
+ *
+ * @param zset The ZSet
+ * @param value The bound
+ * @param exclusive skip the keys with the value too, to find the first key with a greater value
+ *
+ * @return long The rank, the size of the ZSet if every key is below the bound
+ */
+long zset_lower_bound(ZSet *zset, double value, bool exclusive)
+{
+    if (zset_is_compact(zset))
+    {
+        int low = 0;
+        int high = zset->num_entries;
+
+        while (low < high)
+        {
+            int mid = low + (high - low) / 2;
+            double score = zset->entries[mid].score;
+
+            if (score < value || (exclusive && score == value))
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        return low;
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        long rank;
+        skiplist_lower_bound(zset->skiplist, value, exclusive, &rank);
+
+        return rank;
+    }
+
+    return avl_count_below(zset->avl_tree, value, exclusive);
+}
+
+/**
+ * @brief Positions an iterator on the key at a rank
+ *
+ * @param zset The ZSet
+ * @param rank The rank to start at
+ * @param iter The iterator to position
+ *
+ * @return bool false if the rank is out of bounds, the iterator is then already at the end
+ */
+bool zset_iter_at(ZSet *zset, long rank, ZSetIter *iter)
+{
+    iter->avl_node = NULL;
+    iter->skiplist_node = NULL;
+    iter->entry = NULL;
+    iter->entries_begin = NULL;
+    iter->entries_end = NULL;
+
+    if (zset_is_compact(zset))
+    {
+        if (rank < 0 || rank >= zset->num_entries)
+        {
+            return false;
+        }
+
+        iter->entry = &zset->entries[rank];
+        iter->entries_begin = zset->entries;
+        iter->entries_end = &zset->entries[zset->num_entries];
+        return true;
+    }
+
+    if (zset->engine == ZSET_ENGINE_SKIPLIST)
+    {
+        iter->skiplist_node = skiplist_at_rank(zset->skiplist, rank);
+        return iter->skiplist_node != NULL;
+    }
+
+    iter->avl_node = (rank < 0) ? NULL : avl_at_rank(zset->avl_tree, rank);
+    return iter->avl_node != NULL;
+}
+
+/**
+ * @brief Reads the key an iterator is at and moves it to the next rank
+ *
+ * @param iter The iterator
+ * @param key Set to the key, owned by the ZSet
+ * @param value Set to the value of the key
+ *
+ * @return bool false once the iterator went past the last key
+ */
+bool zset_iter_next(ZSetIter *iter, char **key, double *value)
+{
+    if (iter->entry && iter->entry < iter->entries_end)
+    {
+        *key = iter->entry->member;
+        *value = iter->entry->score;
+
+        iter->entry++;
+        return true;
+    }
+
+    if (iter->skiplist_node)
+    {
+        *key = iter->skiplist_node->member;
+        *value = iter->skiplist_node->score;
+
+        // level 0 links the keys in order
+        iter->skiplist_node = iter->skiplist_node->levels[0].forward;
+        return true;
+    }
+
+    if (iter->avl_node)
+    {
+        *key = iter->avl_node->scnd_index;
+        *value = iter->avl_node->value;
+
+        iter->avl_node = avl_offset(iter->avl_node, 1);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Reads the key an iterator is at and moves it to the previous rank
+ *
+ * @param iter The iterator
+ * @param key Set to the key, owned by the ZSet
+ * @param value Set to the value of the key
+ *
+ * @return bool false once the iterator went past the first key
+ */
+bool zset_iter_prev(ZSetIter *iter, char **key, double *value)
+{
+    if (iter->entry && iter->entry < iter->entries_end)
+    {
+        *key = iter->entry->member;
+        *value = iter->entry->score;
+
+        // the iterator ends instead of pointing before the array
+        iter->entry = (iter->entry == iter->entries_begin) ? NULL : iter->entry - 1;
+        return true;
+    }
+
+    if (iter->skiplist_node)
+    {
+        *key = iter->skiplist_node->member;
+        *value = iter->skiplist_node->score;
+
+        iter->skiplist_node = iter->skiplist_node->backward;
+        return true;
+    }
+
+    if (iter->avl_node)
+    {
+        *key = iter->avl_node->scnd_index;
+        *value = iter->avl_node->value;
+
+        iter->avl_node = avl_offset(iter->avl_node, -1);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns the engine with a name
+ *
+ * @param name "avl" or "skiplist"
+ *
+ * @return int the ZSetEngine, -1 if the name is unknown
+ */
+int zset_engine_from_name(const char *name)
+{
+    if (!strcmp(name, "avl"))
+    {
+        return ZSET_ENGINE_AVL;
+    }
+
+    if (!strcmp(name, "skiplist"))
+    {
+        return ZSET_ENGINE_SKIPLIST;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the name of an engine
+ *
+ * @param engine The engine
+ *
+ * @return const char* its name
+ */
+const char *zset_engine_name(ZSetEngine engine)
+{
+    return (engine == ZSET_ENGINE_SKIPLIST) ? "skiplist" : "avl";
+}
+
+/**
+ * @brief Search for the value of a key in the ZSet
  *
  * @param zset The ZSet to search in
  * @param key The key to search for
+ * @param value Set to the value of the key if found
  *
- * @return HashNode* The hash node if found, NULL otherwise
+ * @return bool true if the key is in the ZSet
  */
-HashNode *zset_search_by_key(ZSet *zset, char *key)
+bool zset_score(ZSet *zset, char *key, double *value)
 {
+    if (zset_is_compact(zset))
+    {
+        int pos = zset_compact_find(zset, key);
+        if (pos < 0)
+        {
+            return false;
+        }
+
+        *value = zset->entries[pos].score;
+        return true;
+    }
+
     HashNode *hash_node = hget(zset->hash_table, key);
     if (!hash_node)
     {
-        return NULL;
+        return false;
     }
 
-    return hash_node;
+    *value = hash_node->floatValue;
+    return true;
 }
 
 /**
@@ -180,13 +747,45 @@ HashNode *zset_search_by_key(ZSet *zset, char *key)
  */
 void zset_free_contents(ZSet *zset)
 {
+    if (zset_is_compact(zset))
+    {
+        for (int i = 0; i < zset->num_entries; i++)
+        {
+            slab_free(zset->entries[i].member);
+        }
+        free(zset->entries);
+        return;
+    }
+
     hfree_table(zset->hash_table);
     avl_free(zset->avl_tree);
+
+    if (zset->skiplist)
+    {
+        skiplist_free(zset->skiplist);
+    }
 }
 
 // print the ZSet
 void zset_print(ZSet *zset)
 {
+    if (zset_is_compact(zset))
+    {
+        for (int i = 0; i < zset->num_entries; i++)
+        {
+            printf("value: %f , key: %s \n", zset->entries[i].score, zset->entries[i].member);
+        }
+        return;
+    }
+
     hprint(zset->hash_table);
     avl_print(zset->avl_tree);
+
+    ZSetIter iter;
+    char *key;
+    double value;
+    for (zset_iter_at(zset, 0, &iter); zset->skiplist && zset_iter_next(&iter, &key, &value);)
+    {
+        printf("value: %f , key: %s \n", value, key);
+    }
 }
@@ -1,21 +1,83 @@
 #include "../hashTable/hashTable.h"
 #include "../AVLTree/AVLTree.h"
+#include "../skipList/skipList.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 
+#ifndef ZSET_H
+#define ZSET_H
+
 // should be multiple of two
 #define INIT_TABLE_SIZE 1024
 
+// default limits of a compact sorted set, past either of them it is converted to a hash table and an ordered index
+#define ZSET_MAX_COMPACT_ENTRIES 128
+#define ZSET_MAX_COMPACT_VALUE 64
+
+// ordered index keeping the members of a sorted set by (score, member)
+typedef enum
+{
+    ZSET_ENGINE_AVL,
+    ZSET_ENGINE_SKIPLIST
+} ZSetEngine;
+
+// member of a compact sorted set
 typedef struct
 {
+    double score;
+    char *member;
+} ZSetEntry;
+
+typedef struct
+{
+    // NULL while the sorted set is compact
     HashTable *hash_table;
+
+    // only the index of the engine is used
+    ZSetEngine engine;
     AVLNode *avl_tree;
+    SkipList *skiplist;
+
+    // a small sorted set keeps its members in one array sorted by (score, member) instead
+    ZSetEntry *entries;
+    int num_entries;
+    int entries_capacity;
 } ZSet;
 
+// position in a sorted set, moved by zset_iter_next() or zset_iter_prev()
+typedef struct
+{
+    AVLNode *avl_node;
+    SkipListNode *skiplist_node;
+    ZSetEntry *entry;
+    ZSetEntry *entries_begin;
+    ZSetEntry *entries_end;
+} ZSetIter;
+
+// engine of the sorted sets created by zset_init()
+extern ZSetEngine zset_default_engine;
+
+// sorted sets are compact up to this many members (0 to never be compact), with members of at most zset_max_compact_value bytes
+extern int zset_max_compact_entries;
+extern int zset_max_compact_value;
+
 ZSet *zset_init();
-HashNode *zset_search_by_key(ZSet *zset, char *key);
-int zset_add(ZSet *zset, char *key, float value);
+bool zset_is_compact(ZSet *zset);
+bool zset_score(ZSet *zset, char *key, double *value);
+int zset_add(ZSet *zset, char *key, double value);
 int zset_remove(ZSet *zset, char *key);
+void zset_build_sorted(ZSet *zset, char **keys, double *values, int count);
+long zset_size(ZSet *zset);
+long zset_rank(ZSet *zset, char *key, double value);
+long zset_score_rank(ZSet *zset, double value);
+long zset_lower_bound(ZSet *zset, double value, bool exclusive);
+bool zset_iter_at(ZSet *zset, long rank, ZSetIter *iter);
+bool zset_iter_next(ZSetIter *iter, char **key, double *value);
+bool zset_iter_prev(ZSetIter *iter, char **key, double *value);
+int zset_engine_from_name(const char *name);
+const char *zset_engine_name(ZSetEngine engine);
 void zset_free_contents(ZSet *zset);
 void zset_print(ZSet *zset);
+
+#endif
@@ -0,0 +1,190 @@
+#include "ZSet.h"
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// microbenchmark of the sorted set engines, with every member sharing the same score like a fresh leaderboard, and with distinct scores
+
+#define NUM_MEMBERS 100000
+#define NUM_OPS 20000
+
+// members read by every range query, like a page of a leaderboard
+#define RANGE_LIMIT 10
+
+// many small sorted sets, like one per user
+#define NUM_SMALL_ZSETS 50000
+#define SMALL_ZSET_MEMBERS 5
+
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Times updates, rank lookups, range queries and removals on a sorted set
+ *
+ * @param engine ordered index of the sorted set
+ * @param name name of the run
+ * @param tied give every member the score 0, otherwise member i gets the score i
+ */
+void bench_zset(ZSetEngine engine, char *name, bool tied)
+{
+    char member[32];
+    zset_default_engine = engine;
+    ZSet *zset = zset_init();
+
+    double start = now_sec();
+    for (int i = 0; i < NUM_MEMBERS; i++)
+    {
+        sprintf(member, "member:%d", i);
+        zset_add(zset, member, tied ? 0 : i);
+    }
+    double add = now_sec() - start;
+
+    // re-adding a member with its score removes it from the tree and inserts it again
+    start = now_sec();
+    for (int i = 0; i < NUM_OPS; i++)
+    {
+        sprintf(member, "member:%d", (i * 7919) % NUM_MEMBERS);
+        zset_add(zset, member, tied ? 0 : (i * 7919) % NUM_MEMBERS);
+    }
+    double update = now_sec() - start;
+
+    start = now_sec();
+    for (int i = 0; i < NUM_OPS; i++)
+    {
+        sprintf(member, "member:%d", (i * 7919) % NUM_MEMBERS);
+        if (zset_rank(zset, member, tied ? 0 : (i * 7919) % NUM_MEMBERS) < 0)
+        {
+            fprintf(stderr, "member %s not found\n", member);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double search = now_sec() - start;
+
+    // a page of members from a score, the way ZQUERY reads them
+    ZSetIter iter;
+    char *key;
+    double value;
+    start = now_sec();
+    for (int i = 0; i < NUM_OPS; i++)
+    {
+        long rank = tied ? (i * 7919) % NUM_MEMBERS : zset_score_rank(zset, (i * 7919) % NUM_MEMBERS);
+        if (!zset_iter_at(zset, rank, &iter))
+        {
+            fprintf(stderr, "rank %ld not found\n", rank);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int j = 0; j < RANGE_LIMIT && zset_iter_next(&iter, &key, &value); j++)
+        {
+        }
+    }
+    double range = now_sec() - start;
+
+    start = now_sec();
+    for (int i = 0; i < NUM_OPS; i++)
+    {
+        sprintf(member, "member:%d", (i * 7919) % NUM_MEMBERS);
+        zset_remove(zset, member);
+    }
+    double remove = now_sec() - start;
+
+    printf("%-8s %-16s add %6.0f ns/op   update %6.0f ns/op   rank %6.0f ns/op   range %6.0f ns/op   remove %6.0f ns/op\n", zset_engine_name(engine), name, add / NUM_MEMBERS * 1e9, update / NUM_OPS * 1e9, search / NUM_OPS * 1e9, range / NUM_OPS * 1e9, remove / NUM_OPS * 1e9);
+
+    zset_free_contents(zset);
+    free(zset);
+}
+
+// resident memory of the process in bytes
+long resident_bytes()
+{
+    long pages = 0, resident = 0;
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm || fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+    {
+        fprintf(stderr, "Failed to read /proc/self/statm\n");
+        exit(EXIT_FAILURE);
+    }
+    fclose(statm);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Measures the memory and the time taken by many small sorted sets, in a child process so every run starts from the same heap
+ *
+ * @param max_compact_entries zset_max_compact_entries of the run, 0 for hash tables and ordered indexes only
+ */
+void bench_small_zsets(int max_compact_entries)
+{
+    // the child would print what is still buffered again
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    zset_max_compact_entries = max_compact_entries;
+
+    ZSet **zsets = malloc(sizeof(ZSet *) * NUM_SMALL_ZSETS);
+    char member[32];
+
+    long before = resident_bytes();
+    double start = now_sec();
+    for (int i = 0; i < NUM_SMALL_ZSETS; i++)
+    {
+        zsets[i] = zset_init();
+        for (int j = 0; j < SMALL_ZSET_MEMBERS; j++)
+        {
+            sprintf(member, "user:%d:%d", i, j);
+            zset_add(zsets[i], member, (i * 31 + j * 7) % 100);
+        }
+    }
+    double add = now_sec() - start;
+    long used = resident_bytes() - before;
+
+    double score;
+    start = now_sec();
+    for (int i = 0; i < NUM_SMALL_ZSETS; i++)
+    {
+        sprintf(member, "user:%d:%d", i, i % SMALL_ZSET_MEMBERS);
+        if (!zset_score(zsets[i], member, &score) || zset_rank(zsets[i], member, score) < 0)
+        {
+            fprintf(stderr, "member %s not found\n", member);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double search = now_sec() - start;
+
+    printf("%-8s %d zsets of %d members   %8.1f MB   %5.0f bytes/zset   add %6.0f ns/op   score and rank %6.0f ns/op\n", max_compact_entries ? "compact" : "indexed", NUM_SMALL_ZSETS, SMALL_ZSET_MEMBERS, used / 1e6, (double)used / NUM_SMALL_ZSETS, add / (NUM_SMALL_ZSETS * SMALL_ZSET_MEMBERS) * 1e9, search / NUM_SMALL_ZSETS * 1e9);
+
+    exit(EXIT_SUCCESS);
+}
+
+int main()
+{
+    printf("%d members, %d operations\n", NUM_MEMBERS, NUM_OPS);
+
+    // the large sorted sets are not compact
+    zset_max_compact_entries = 0;
+
+    ZSetEngine engines[] = {ZSET_ENGINE_AVL, ZSET_ENGINE_SKIPLIST};
+    for (int i = 0; i < 2; i++)
+    {
+        bench_zset(engines[i], "distinct scores", false);
+        bench_zset(engines[i], "equal scores", true);
+    }
+
+    bench_small_zsets(0);
+    bench_small_zsets(ZSET_MAX_COMPACT_ENTRIES);
+
+    return 0;
+}
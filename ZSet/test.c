@@ -1,8 +1,29 @@
 // test the Zset
 #include "ZSet.h"
 
-int main()
+// reads the keys of a zset in rank order into a string, e.g. "a b c"
+void zset_keys(ZSet *zset, long rank, char *out)
+{
+    ZSetIter iter;
+    zset_iter_at(zset, rank, &iter);
+
+    char *key;
+    double value;
+    out[0] = '\0';
+    while (zset_iter_next(&iter, &key, &value))
+    {
+        if (out[0])
+        {
+            strcat(out, " ");
+        }
+        strcat(out, key);
+    }
+}
+
+// tests every engine through the ZSet interface
+void test_engine(ZSetEngine engine)
 {
+    zset_default_engine = engine;
     ZSet *zset = zset_init();
 
     char *key1 = "key1";
@@ -22,8 +43,8 @@ int main()
     zset_add(zset, key7, 0.0);
 
     // search for a key
-    HashNode *hash_node = zset_search_by_key(zset, "key1");
-    if (!hash_node)
+    double score;
+    if (!zset_score(zset, "key1", &score) || score != 1.0)
     {
         fprintf(stderr, "key not found\n");
         exit(EXIT_FAILURE);
@@ -31,7 +52,7 @@ int main()
 
     // test delete
     zset_remove(zset, "key1");
-    if (zset_search_by_key(zset, "key1"))
+    if (zset_score(zset, "key1", &score))
     {
         fprintf(stderr, "key not deleted\n");
         exit(EXIT_FAILURE);
@@ -41,6 +62,188 @@ int main()
     zset_free_contents(zset);
     free(zset);
 
+    // fill a zset from keys sorted by score, as done when loading a snapshot
+    char *sorted_keys[] = {"a", "b", "c", "d", "e"};
+    double sorted_scores[] = {-2.0, 0.5, 0.5, 3.0, 7.0};
+
+    zset = zset_init();
+    zset_build_sorted(zset, sorted_keys, sorted_scores, 5);
+
+    if (!zset_score(zset, "c", &score) || score != 0.5 || zset_size(zset) != 5)
+    {
+        fprintf(stderr, "zset built from sorted keys is incomplete\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // it is updated like any other zset
+    zset_add(zset, "a", 10.0);
+    zset_remove(zset, "c");
+    char keys[64];
+    zset_keys(zset, 0, keys);
+    if (zset_score(zset, "c", &score) || zset_size(zset) != 4 || strcmp(keys, "b d e a") != 0)
+    {
+        fprintf(stderr, "zset built from sorted keys can't be updated\n");
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+
+    // ranks, keys with equal values are ordered by name
+    zset = zset_init();
+    zset_add(zset, "carol", 2.0);
+    zset_add(zset, "bob", 1.0);
+    zset_add(zset, "alice", 1.0);
+    zset_add(zset, "dave", 3.0);
+    zset_add(zset, "bob", 2.0);
+
+    zset_keys(zset, 1, keys);
+    if (zset_rank(zset, "alice", 1.0) != 0 || zset_rank(zset, "carol", 2.0) != 2 || zset_rank(zset, "bob", 1.0) != -1 || strcmp(keys, "bob carol dave") != 0)
+    {
+        fprintf(stderr, "%s: zset ranks are wrong\n", zset_engine_name(engine));
+        exit(EXIT_FAILURE);
+    }
+
+    ZSetIter iter;
+    if (zset_score_rank(zset, 2.0) != 1 || zset_score_rank(zset, 1.5) != -1 || zset_iter_at(zset, 4, &iter) || zset_iter_at(zset, -1, &iter))
+    {
+        fprintf(stderr, "%s: zset score ranks are wrong\n", zset_engine_name(engine));
+        exit(EXIT_FAILURE);
+    }
+
+    // ranks of score bounds, bob and carol share 2.0
+    if (zset_lower_bound(zset, 2.0, false) != 1 || zset_lower_bound(zset, 2.0, true) != 3 || zset_lower_bound(zset, 0, false) != 0 || zset_lower_bound(zset, 3.0, true) != 4 || zset_lower_bound(zset, 2.5, false) != 3)
+    {
+        fprintf(stderr, "%s: zset lower bounds are wrong\n", zset_engine_name(engine));
+        exit(EXIT_FAILURE);
+    }
+
+    // reverse iteration from the last key
+    keys[0] = '\0';
+    char *key;
+    for (zset_iter_at(zset, zset_size(zset) - 1, &iter); zset_iter_prev(&iter, &key, &score);)
+    {
+        strcat(keys, key);
+    }
+
+    if (strcmp(keys, "davecarolbobalice") != 0)
+    {
+        fprintf(stderr, "%s: zset reverse iteration is wrong\n", zset_engine_name(engine));
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+
+    // scores past 2^24 differ by less than the precision of a float
+    zset = zset_init();
+    zset_add(zset, "later", 16777217.0);
+    zset_add(zset, "earlier", 16777216.0);
+    zset_add(zset, "fraction", 0.1);
+
+    if (!zset_score(zset, "later", &score) || score != 16777217.0 || zset_rank(zset, "later", 16777217.0) != 2 || zset_lower_bound(zset, 16777216.0, true) != 2 || !zset_score(zset, "fraction", &score) || score != 0.1)
+    {
+        fprintf(stderr, "%s: zset scores lost precision\n", zset_engine_name(engine));
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+}
+
+// small zsets are compact until they outgrow the limits
+void test_compact()
+{
+    zset_max_compact_entries = 8;
+    zset_max_compact_value = 16;
+
+    char key[32];
+    char keys[128];
+    double score;
+    ZSet *zset = zset_init();
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(key, "k%d", i);
+        zset_add(zset, key, 8 - i);
+    }
+
+    // updating a key keeps the zset sorted
+    zset_add(zset, "k0", 0.5);
+    zset_keys(zset, 0, keys);
+    if (!zset_is_compact(zset) || zset_size(zset) != 8 || strcmp(keys, "k0 k7 k6 k5 k4 k3 k2 k1") != 0 || zset_rank(zset, "k5", 3) != 3 || zset_score_rank(zset, 2) != 2)
+    {
+        fprintf(stderr, "compact zset is not sorted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (zset_remove(zset, "missing") != -1 || zset_remove(zset, "k7") != 0 || zset_score(zset, "k7", &score))
+    {
+        fprintf(stderr, "compact zset remove failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the ninth key converts it, with every key kept in order
+    zset_add(zset, "k7", 1.0);
+    zset_add(zset, "k8", 100.0);
+    zset_keys(zset, 0, keys);
+    if (zset_is_compact(zset) || zset_size(zset) != 9 || strcmp(keys, "k0 k7 k6 k5 k4 k3 k2 k1 k8") != 0 || !zset_score(zset, "k3", &score) || score != 5)
+    {
+        fprintf(stderr, "compact zset was not converted past the number of entries\n");
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+
+    // a long key converts it too
+    zset = zset_init();
+    zset_add(zset, "short", 1.0);
+    zset_add(zset, "a key longer than 16 bytes", 2.0);
+    if (zset_is_compact(zset) || zset_rank(zset, "a key longer than 16 bytes", 2.0) != 1)
+    {
+        fprintf(stderr, "compact zset was not converted past the size of a key\n");
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+
+    // too many sorted keys are built into the hash table and the index directly
+    char *sorted_keys[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i"};
+    double sorted_scores[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    zset = zset_init();
+    zset_build_sorted(zset, sorted_keys, sorted_scores, 9);
+    if (zset_is_compact(zset) || zset_size(zset) != 9 || zset_rank(zset, "i", 9) != 8)
+    {
+        fprintf(stderr, "zset built from too many sorted keys should not be compact\n");
+        exit(EXIT_FAILURE);
+    }
+
+    zset_free_contents(zset);
+    free(zset);
+
+    zset_max_compact_entries = ZSET_MAX_COMPACT_ENTRIES;
+    zset_max_compact_value = ZSET_MAX_COMPACT_VALUE;
+}
+
+int main()
+{
+    // compact zsets, then every engine
+    test_engine(ZSET_ENGINE_AVL);
+
+    zset_max_compact_entries = 0;
+    test_engine(ZSET_ENGINE_AVL);
+    test_engine(ZSET_ENGINE_SKIPLIST);
+    zset_max_compact_entries = ZSET_MAX_COMPACT_ENTRIES;
+
+    test_compact();
+
+    if (zset_engine_from_name("skiplist") != ZSET_ENGINE_SKIPLIST || zset_engine_from_name("avl") != ZSET_ENGINE_AVL || zset_engine_from_name("btree") != -1)
+    {
+        fprintf(stderr, "engine names are wrong\n");
+        exit(EXIT_FAILURE);
+    }
+
     // All tests passed
     printf("All tests passed\n");
 }
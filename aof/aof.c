@@ -2,6 +2,13 @@
 // protocol header
 #include "../protocol.h"
 
+// size of a record in a ring, including its header and padding
+#define AOF_RECORD_SIZE(len) (sizeof(AOFRecord) + (((long)(len) + AOF_RECORD_ALIGN - 1) & ~(long)(AOF_RECORD_ALIGN - 1)))
+
+// ring of the current thread and the AOF it appends to
+static __thread AOFRing *thread_ring = NULL;
+static __thread AOF *thread_ring_aof = NULL;
+
 // initialize the AOF struct
 AOF *aof_init(char *aof_file_name, int flush_interval_sec, char *mode)
 {
@@ -12,12 +19,7 @@ AOF *aof_init(char *aof_file_name, int flush_interval_sec, char *mode)
         exit(EXIT_FAILURE);
     }
 
-    new_aof->file = fopen(aof_file_name, mode);
-    if (new_aof->file == NULL)
-    {
-        fprintf(stderr, "Failed to open file\n");
-        exit(EXIT_FAILURE);
-    }
+    new_aof->fd = -1;
 
     // initialize mutex
     if (pthread_mutex_init(&new_aof->mutex, NULL) != 0)
@@ -26,7 +28,19 @@ AOF *aof_init(char *aof_file_name, int flush_interval_sec, char *mode)
         exit(EXIT_FAILURE);
     }
 
+    new_aof->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (new_aof->wake_fd < 0)
+    {
+        perror("eventfd failed");
+        exit(EXIT_FAILURE);
+    }
+
     new_aof->flush_interval_sec = flush_interval_sec;
+    new_aof->fsync_policy = AOF_FSYNC_EVERYSEC;
+    new_aof->rewrite_percentage = AOF_REWRITE_PERCENTAGE;
+    new_aof->rewrite_min_size = AOF_REWRITE_MIN_SIZE;
+
+    aof_change_mode(new_aof, aof_file_name, mode);
 
     return new_aof;
 }
@@ -37,12 +51,39 @@ void aof_change_mode(AOF *aof, char *aof_filename, char *mode)
     // lock the mutex
     pthread_mutex_lock(&aof->mutex);
 
-    // close the file, this automatically flushes the buffer
-    fclose(aof->file);
+    // close the file, the rings are drained before the mode is changed
+    if (aof->fd >= 0)
+    {
+        close(aof->fd);
+        aof->fd = -1;
+    }
+
+    if (aof->file)
+    {
+        fclose(aof->file);
+        aof->file = NULL;
+    }
+
+    // records are appended with writev(), so they reach the file without going through a stdio buffer
+    if (mode[0] == 'a')
+    {
+        aof->fd = open(aof_filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        snprintf(aof->path, sizeof(aof->path), "%s", aof_filename);
+
+        // the automatic rewrite compares the growth of the file with its size when it was opened
+        struct stat st;
+        if (aof->fd >= 0 && fstat(aof->fd, &st) == 0)
+        {
+            atomic_store(&aof->size, st.st_size);
+            atomic_store(&aof->base_size, st.st_size);
+        }
+    }
+    else
+    {
+        aof->file = fopen(aof_filename, mode);
+    }
 
-    // open the file in the new mode
-    aof->file = fopen(aof_filename, mode);
-    if (aof->file == NULL)
+    if (aof->fd < 0 && aof->file == NULL)
     {
         fprintf(stderr, "Failed to open file\n");
         exit(EXIT_FAILURE);
@@ -52,56 +93,816 @@ void aof_change_mode(AOF *aof, char *aof_filename, char *mode)
     pthread_mutex_unlock(&aof->mutex);
 }
 
-// create a function for flushing file buffer to disk, a worker thread will call this function
+/**
+ * @brief Returns the fsync policy with the given name, as used by the appendfsync setting
+ *
+ * @param name "always", "everysec" or "no"
+ *
+ * @return int the policy, or -1 if the name is unknown
+ */
+int aof_fsync_policy_from_name(char *name)
+{
+    if (!strcmp(name, "always"))
+    {
+        return AOF_FSYNC_ALWAYS;
+    }
+
+    if (!strcmp(name, "everysec"))
+    {
+        return AOF_FSYNC_EVERYSEC;
+    }
+
+    if (!strcmp(name, "no"))
+    {
+        return AOF_FSYNC_NO;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the name of an fsync policy
+ *
+ * @param policy fsync policy
+ *
+ * @return const char* name of the policy
+ */
+const char *aof_fsync_policy_name(AOFFsyncPolicy policy)
+{
+    switch (policy)
+    {
+    case AOF_FSYNC_ALWAYS:
+        return "always";
+    case AOF_FSYNC_EVERYSEC:
+        return "everysec";
+    default:
+        return "no";
+    }
+}
+
+/**
+ * @brief Returns the ring of the current thread, registering a new one on the first append of the thread
+ *
+ * @param aof AOF the thread appends to
+ *
+ * @return AOFRing* ring of the thread
+ */
+static AOFRing *aof_thread_ring(AOF *aof)
+{
+    if (thread_ring && thread_ring_aof == aof)
+    {
+        return thread_ring;
+    }
+
+    AOFRing *ring = aligned_alloc(64, sizeof(AOFRing));
+    char *data = malloc(AOF_RING_SIZE);
+    if (ring == NULL || data == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(ring, 0, sizeof(AOFRing));
+    ring->data = data;
+
+    // claim a slot, the AOF thread skips the slot until the ring is stored in it
+    int slot = __atomic_fetch_add(&aof->num_rings, 1, __ATOMIC_ACQ_REL);
+    if (slot >= AOF_MAX_RINGS)
+    {
+        fprintf(stderr, "Too many threads appending to the AOF\n");
+        exit(EXIT_FAILURE);
+    }
+
+    __atomic_store_n(&aof->rings[slot], ring, __ATOMIC_RELEASE);
+
+    thread_ring = ring;
+    thread_ring_aof = aof;
+
+    return ring;
+}
+
+/**
+ * @brief Reserves room for a record in the ring of the current thread
+ *
+ * Only waits when the ring is full, until the AOF thread has written enough of it. The record is appended by aof_publish(), which must be called by the same thread before the next reservation.
+ *
+ * @param aof AOF to append to
+ * @param len maximum length of the record
+ *
+ * @return char* where to write the record
+ */
+char *aof_reserve(AOF *aof, int len)
+{
+    AOFRing *ring = aof_thread_ring(aof);
+
+    long pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    long index = pos & (AOF_RING_SIZE - 1);
+    long size = AOF_RECORD_SIZE(len);
+
+    // a record is never split, when it does not fit before the end of the ring it starts over at the beginning
+    long padding = (index + size > AOF_RING_SIZE) ? AOF_RING_SIZE - index : 0;
+
+    while (pos + padding + size - ring->cached_head > AOF_RING_SIZE)
+    {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (pos + padding + size - ring->cached_head > AOF_RING_SIZE)
+        {
+            aof_notify(aof);
+            sched_yield();
+        }
+    }
+
+    if (padding)
+    {
+        AOFRecord *skip = (AOFRecord *)(ring->data + index);
+        skip->seq = 0;
+        skip->len = 0;
+        pos += padding;
+    }
+
+    ring->reserved_pos = pos;
+
+    return ring->data + (pos & (AOF_RING_SIZE - 1)) + sizeof(AOFRecord);
+}
+
+/**
+ * @brief Appends the record reserved by aof_reserve(), without taking a lock
+ *
+ * @param aof AOF to append to
+ * @param len length of the record, at most the reserved length
+ *
+ * @return long sequence number of the record, pass it to aof_needs_commit() to know if it is durable
+ */
+long aof_publish(AOF *aof, int len)
+{
+    AOFRing *ring = thread_ring;
+    AOFRecord *record = (AOFRecord *)(ring->data + (ring->reserved_pos & (AOF_RING_SIZE - 1)));
+
+    long seq = atomic_fetch_add(&aof->appended, 1) + 1;
+    record->seq = seq;
+    record->len = len;
+
+    long tail = ring->reserved_pos + AOF_RECORD_SIZE(len);
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    // the AOF thread drains on its own every AOF_DRAIN_INTERVAL_MS, it is only woken up early when the ring is filling up. With the always policy the event loop wakes it up after every iteration
+    if (tail - ring->cached_head > AOF_RING_WAKE_SIZE)
+    {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (tail - ring->cached_head > AOF_RING_WAKE_SIZE)
+        {
+            aof_notify(aof);
+        }
+    }
+
+    return seq;
+}
+
+/**
+ * @brief Appends a command to the AOF
+ *
+ * @param aof AOF to append to
+ * @param message command followed by a newline, null terminated
+ *
+ * @return long sequence number of the record
+ */
+long aof_write(AOF *aof, char *message)
+{
+    int len = strlen(message);
+
+    memcpy(aof_reserve(aof, len), message, len);
+
+    return aof_publish(aof, len);
+}
+
+/**
+ * @brief Wakes the AOF thread up to write the appended records, at most one wake up is pending at a time
+ *
+ * @param aof AOF whose thread to wake up
+ */
+void aof_notify(AOF *aof)
+{
+    if (atomic_exchange(&aof->wake_pending, 1))
+    {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(aof->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("eventfd write failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Returns the next record of a ring, skipping the padding at the end of the ring
+ *
+ * @param ring ring to read
+ * @param cursor position of the record, moved past the padding
+ * @param tail end of the records published when the drain started
+ *
+ * @return AOFRecord* the record, or NULL if the ring has no record left
+ */
+static AOFRecord *aof_ring_peek(AOFRing *ring, long *cursor, long tail)
+{
+    while (*cursor < tail)
+    {
+        AOFRecord *record = (AOFRecord *)(ring->data + (*cursor & (AOF_RING_SIZE - 1)));
+        if (record->seq)
+        {
+            return record;
+        }
+
+        *cursor += AOF_RING_SIZE - (*cursor & (AOF_RING_SIZE - 1));
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Writes a batch of records to the file, handling partial writes
+ *
+ * @param fd file to write to
+ * @param iov records
+ * @param count number of records
+ */
+static void aof_writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written < 0)
+        {
+            perror("Error writing to file");
+            exit(EXIT_FAILURE);
+        }
+
+        // skip the records that were fully written, and the written part of the next one
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/**
+ * @brief Appends a record to the rewrite buffer, the caller must hold the mutex
+ *
+ * @param aof AOF being rewritten
+ * @param data record
+ * @param len length of the record
+ */
+static void aof_rewrite_buffer_append(AOF *aof, char *data, long len)
+{
+    if (aof->rewrite_buffer_size + len > aof->rewrite_buffer_capacity)
+    {
+        long capacity = aof->rewrite_buffer_capacity ? aof->rewrite_buffer_capacity : AOF_RING_SIZE;
+        while (capacity < aof->rewrite_buffer_size + len)
+        {
+            capacity *= 2;
+        }
+
+        char *buffer = realloc(aof->rewrite_buffer, capacity);
+        if (!buffer)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        aof->rewrite_buffer = buffer;
+        aof->rewrite_buffer_capacity = capacity;
+    }
+
+    memcpy(aof->rewrite_buffer + aof->rewrite_buffer_size, data, len);
+    aof->rewrite_buffer_size += len;
+}
+
+/**
+ * @brief Writes the records of all the rings to the file in the order they were appended, the caller must hold the mutex
+ *
+ * The rings are merged by sequence number. A record whose sequence number was taken but that is not published yet stops the drain, its producer wakes the AOF thread again once it is.
+ *
+ * @param aof AOF to drain
+ *
+ * @return long sequence number up to which the records are written
+ */
+static long aof_drain_locked(AOF *aof)
+{
+    long next = atomic_load(&aof->written) + 1;
+
+    if (aof->fd < 0)
+    {
+        return next - 1;
+    }
+
+    struct iovec iov[AOF_MAX_IOV];
+    long cursors[AOF_MAX_RINGS];
+    long tails[AOF_MAX_RINGS];
+
+    while (1)
+    {
+        int num_rings = atomic_load(&aof->num_rings);
+        num_rings = num_rings < AOF_MAX_RINGS ? num_rings : AOF_MAX_RINGS;
+
+        for (int i = 0; i < num_rings; i++)
+        {
+            AOFRing *ring = __atomic_load_n(&aof->rings[i], __ATOMIC_ACQUIRE);
+            cursors[i] = ring ? atomic_load_explicit(&ring->head, memory_order_relaxed) : 0;
+            tails[i] = ring ? atomic_load_explicit(&ring->tail, memory_order_acquire) : 0;
+        }
+
+        int count = 0;
+        int last = 0;
+        long first = next;
+        long bytes = 0;
+
+        while (count < AOF_MAX_IOV)
+        {
+            // consecutive records usually come from the same ring, so it is looked at first
+            AOFRecord *record = NULL;
+            int found = -1;
+
+            for (int n = 0; n < num_rings && found < 0; n++)
+            {
+                int i = (last + n) % num_rings;
+                AOFRing *ring = __atomic_load_n(&aof->rings[i], __ATOMIC_ACQUIRE);
+
+                if (ring && (record = aof_ring_peek(ring, &cursors[i], tails[i])) && record->seq == (uint64_t)next)
+                {
+                    found = i;
+                }
+            }
+
+            if (found < 0)
+            {
+                break;
+            }
+
+            iov[count].iov_base = record + 1;
+            iov[count].iov_len = record->len;
+            bytes += record->len;
+            count++;
+
+            cursors[found] += AOF_RECORD_SIZE(record->len);
+            last = found;
+            next++;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        // while a rewrite runs, the records missing from its snapshot are kept for the rewritten file. Copied first, since writing moves the iovecs along
+        if (aof->rewrite_pid > 0)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                if (first + i > aof->rewrite_seq)
+                {
+                    aof_rewrite_buffer_append(aof, iov[i].iov_base, iov[i].iov_len);
+                }
+            }
+        }
+
+        aof_writev_all(aof->fd, iov, count);
+        atomic_fetch_add(&aof->size, bytes);
+
+        // hand the written part of the rings back to their producers
+        for (int i = 0; i < num_rings; i++)
+        {
+            AOFRing *ring = __atomic_load_n(&aof->rings[i], __ATOMIC_ACQUIRE);
+            if (ring)
+            {
+                atomic_store_explicit(&ring->head, cursors[i], memory_order_release);
+            }
+        }
+
+        atomic_store(&aof->written, next - 1);
+    }
+
+    return next - 1;
+}
+
+/**
+ * @brief Writes the appended records to the file, without syncing it
+ *
+ * @param aof AOF to drain
+ *
+ * @return long sequence number up to which the records are written
+ */
+long aof_drain(AOF *aof)
+{
+    pthread_mutex_lock(&aof->mutex);
+    long written = aof_drain_locked(aof);
+    pthread_mutex_unlock(&aof->mutex);
+
+    return written;
+}
+
+/**
+ * @brief Writes the appended records to the file and syncs it, all the records appended while the previous sync ran are committed together
+ *
+ * @param aof AOF to commit
+ *
+ * @return long sequence number up to which the records are durable
+ */
+long aof_commit(AOF *aof)
+{
+    pthread_mutex_lock(&aof->mutex);
+
+    long end = aof_drain_locked(aof);
+    bool synced = false;
+
+    if (aof->fd >= 0 && end > atomic_load(&aof->synced))
+    {
+        if (fdatasync(aof->fd) < 0)
+        {
+            perror("Error syncing file");
+            exit(EXIT_FAILURE);
+        }
+
+        atomic_store(&aof->synced, end);
+        synced = true;
+    }
+
+    pthread_mutex_unlock(&aof->mutex);
+
+    if (synced && aof->on_sync)
+    {
+        aof->on_sync(aof, end);
+    }
+
+    return atomic_load(&aof->synced);
+}
+
+/**
+ * @brief Checks if replies depending on the records up to a sequence number have to wait for a commit, which is only the case with the always policy
+ *
+ * @param aof AOF the records were appended to
+ * @param offset sequence number of the last record
+ *
+ * @return bool true if the records are not durable yet and the policy requires them to be
+ */
+bool aof_needs_commit(AOF *aof, long offset)
+{
+    return aof->fsync_policy == AOF_FSYNC_ALWAYS && offset > atomic_load(&aof->synced);
+}
+
+// seconds of CLOCK_MONOTONIC, used to delay the retry of a failed rewrite
+static long aof_now_sec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+/**
+ * @brief Claims the right to rewrite the AOF, only one rewrite runs at a time
+ *
+ * @param aof AOF to rewrite
+ *
+ * @return bool true if no other rewrite is running, the caller then either forks the child writing the snapshot and calls aof_rewrite_started(), or calls aof_rewrite_abort()
+ */
+bool aof_rewrite_begin(AOF *aof)
+{
+    int expected = 0;
+
+    return atomic_compare_exchange_strong(&aof->rewriting, &expected, 1);
+}
+
+/**
+ * @brief Records the child writing the snapshot of the keyspace, must be called before any command is appended after the snapshot was taken
+ *
+ * The records appended up to now are in the snapshot, the ones appended after are also kept in the rewrite buffer until the child exits.
+ *
+ * @param aof AOF being rewritten
+ * @param pid child process writing the snapshot, 0 if the caller writes it and then calls aof_rewrite_finish()
+ * @param path file the child writes
+ */
+void aof_rewrite_started(AOF *aof, pid_t pid, char *path)
+{
+    pthread_mutex_lock(&aof->mutex);
+
+    aof->rewrite_seq = atomic_load(&aof->appended);
+    aof->rewrite_pid = pid;
+    aof->rewrite_buffer_size = 0;
+    snprintf(aof->rewrite_path, sizeof(aof->rewrite_path), "%s", path);
+
+    pthread_mutex_unlock(&aof->mutex);
+
+    // the AOF thread polls the child more often while it runs
+    aof_notify(aof);
+}
+
+/**
+ * @brief Gives up a rewrite claimed by aof_rewrite_begin() whose child could not be started
+ *
+ * @param aof AOF that was to be rewritten
+ */
+void aof_rewrite_abort(AOF *aof)
+{
+    atomic_store(&aof->rewrite_failed_at, aof_now_sec());
+    atomic_store(&aof->rewriting, 0);
+}
+
+/**
+ * @brief Syncs the directory holding a file, so that a rename into it is durable
+ *
+ * @param path path of the file
+ *
+ * @return bool true on success
+ */
+static bool aof_sync_dir(char *path)
+{
+    char dir[AOF_PATH_SIZE];
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    char *slash = strrchr(dir, '/');
+    if (slash)
+    {
+        *(slash == dir ? slash + 1 : slash) = '\0';
+    }
+    else
+    {
+        strcpy(dir, ".");
+    }
+
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool ok = fsync(fd) == 0;
+    close(fd);
+
+    return ok;
+}
+
+/**
+ * @brief Appends the rewrite buffer to the snapshot written by the child and replaces the AOF with it, the caller must hold the mutex
+ *
+ * @param aof AOF being rewritten
+ *
+ * @return bool true if the rewritten file replaced the AOF
+ */
+static bool aof_rewrite_install(AOF *aof)
+{
+    // the records still in the rings go to the old file and to the rewrite buffer
+    aof_drain_locked(aof);
+
+    int fd = open(aof->rewrite_path, O_WRONLY | O_APPEND);
+    if (fd < 0)
+    {
+        perror("Failed to open the rewritten AOF");
+        return false;
+    }
+
+    struct iovec iov = {.iov_base = aof->rewrite_buffer, .iov_len = aof->rewrite_buffer_size};
+    aof_writev_all(fd, &iov, 1);
+
+    if (fdatasync(fd) < 0 || rename(aof->rewrite_path, aof->path) < 0 || !aof_sync_dir(aof->path))
+    {
+        perror("Failed to replace the AOF with the rewritten file");
+        close(fd);
+        return false;
+    }
+
+    // the new file holds every record written so far, and is durable
+    close(aof->fd);
+    aof->fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        atomic_store(&aof->size, st.st_size);
+        atomic_store(&aof->base_size, st.st_size);
+    }
+
+    atomic_store(&aof->synced, atomic_load(&aof->written));
+
+    return true;
+}
+
+/**
+ * @brief Ends a rewrite, installing the rewritten file if it was written completely
+ *
+ * Called by the AOF thread once the child exited, or by the thread that wrote the file itself (SAVE).
+ *
+ * @param aof AOF being rewritten
+ * @param written whether the file holding the snapshot was written completely
+ *
+ * @return bool true if the rewritten file replaced the AOF
+ */
+bool aof_rewrite_finish(AOF *aof, bool written)
+{
+    pthread_mutex_lock(&aof->mutex);
+
+    bool installed = written && aof_rewrite_install(aof);
+    if (!installed)
+    {
+        fprintf(stderr, "AOF rewrite failed, keeping the current file\n");
+        unlink(aof->rewrite_path);
+        atomic_store(&aof->rewrite_failed_at, aof_now_sec());
+    }
+
+    free(aof->rewrite_buffer);
+    aof->rewrite_buffer = NULL;
+    aof->rewrite_buffer_size = 0;
+    aof->rewrite_buffer_capacity = 0;
+    aof->rewrite_pid = 0;
+    long synced = atomic_load(&aof->synced);
+
+    pthread_mutex_unlock(&aof->mutex);
+
+    atomic_store(&aof->rewriting, 0);
+
+    if (installed && aof->on_sync)
+    {
+        aof->on_sync(aof, synced);
+    }
+
+    return installed;
+}
+
+/**
+ * @brief Checks if the child writing the snapshot exited, and ends the rewrite if so. Called by the AOF thread
+ *
+ * @param aof AOF being rewritten
+ *
+ * @return int 1 if the rewritten file replaced the AOF, -1 if the rewrite failed, 0 if it is still running or no child was started
+ */
+int aof_rewrite_poll(AOF *aof)
+{
+    pthread_mutex_lock(&aof->mutex);
+    pid_t pid = aof->rewrite_pid;
+    pthread_mutex_unlock(&aof->mutex);
+
+    if (pid <= 0)
+    {
+        return 0;
+    }
+
+    int status;
+    pid_t ret = waitpid(pid, &status, WNOHANG);
+    if (ret == 0)
+    {
+        return 0;
+    }
+
+    bool written = ret == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    return aof_rewrite_finish(aof, written) ? 1 : -1;
+}
+
+/**
+ * @brief Checks if the AOF grew enough since it was opened or last rewritten to be rewritten automatically
+ *
+ * @param aof AOF to check
+ *
+ * @return bool true if no rewrite is running or failed in the last AOF_REWRITE_RETRY_DELAY_SEC seconds, the file is at least rewrite_min_size bytes and grew by rewrite_percentage percent of its base size
+ */
+bool aof_rewrite_due(AOF *aof)
+{
+    if (aof->rewrite_percentage <= 0 || atomic_load(&aof->rewriting))
+    {
+        return false;
+    }
+
+    // the base size is unchanged after a failure, retrying right away would fork again on every event loop iteration
+    long failed_at = atomic_load(&aof->rewrite_failed_at);
+    if (failed_at && aof_now_sec() - failed_at < AOF_REWRITE_RETRY_DELAY_SEC)
+    {
+        return false;
+    }
+
+    long size = atomic_load(&aof->size);
+    long base_size = atomic_load(&aof->base_size);
+
+    return size >= aof->rewrite_min_size && size - base_size >= base_size * aof->rewrite_percentage / 100;
+}
+
+// background thread draining the rings when woken up by the event loops or every AOF_DRAIN_INTERVAL_MS, it syncs the file after every drain with the always policy and once per flush interval with everysec
 void *aof_flush(void *aof)
 {
     AOF *aof_ptr = (AOF *)aof;
+
+    struct timespec last_sync;
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
     while (1)
     {
-        // sleep for the flush interval
-        sleep(aof_ptr->flush_interval_sec);
+        struct pollfd wake = {.fd = aof_ptr->wake_fd, .events = POLLIN};
+        int timeout_ms = (aof_ptr->fsync_policy == AOF_FSYNC_ALWAYS && !atomic_load(&aof_ptr->rewriting)) ? aof_ptr->flush_interval_sec * 1000 : AOF_DRAIN_INTERVAL_MS;
+        if (poll(&wake, 1, timeout_ms) < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            exit(EXIT_FAILURE);
+        }
 
-        // lock the mutex
-        pthread_mutex_lock(&aof_ptr->mutex);
+        // reset the wake up before draining, so a producer publishing during the drain wakes the thread again
+        uint64_t count;
+        if (read(aof_ptr->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            perror("eventfd read failed");
+            exit(EXIT_FAILURE);
+        }
+        atomic_store(&aof_ptr->wake_pending, 0);
 
-        // flush the file buffer
-        fflush(aof_ptr->file);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        bool interval_passed = now.tv_sec - last_sync.tv_sec >= aof_ptr->flush_interval_sec;
 
-        // unlock the mutex
-        pthread_mutex_unlock(&aof_ptr->mutex);
+        if (aof_ptr->fsync_policy == AOF_FSYNC_ALWAYS || (aof_ptr->fsync_policy == AOF_FSYNC_EVERYSEC && interval_passed))
+        {
+            aof_commit(aof_ptr);
+            last_sync = now;
+        }
+        else
+        {
+            aof_drain(aof_ptr);
+        }
+
+        // install the rewritten file once its child is done
+        aof_rewrite_poll(aof_ptr);
     }
 
     return NULL;
 }
 
-// ensure the file is closed and the mutex is destroyed
+// ensure the appended records are written, the file is closed and the mutex is destroyed
 void aof_close(AOF *aof)
 {
+    if (aof->fsync_policy == AOF_FSYNC_NO)
+    {
+        aof_drain(aof);
+    }
+    else
+    {
+        aof_commit(aof);
+    }
+
     // wait for the mutex to be unlocked, to ensure no other thread is using the file
     pthread_mutex_lock(&aof->mutex);
 
+    // a rewrite that did not finish is discarded
+    if (aof->rewrite_pid > 0)
+    {
+        kill(aof->rewrite_pid, SIGKILL);
+        waitpid(aof->rewrite_pid, NULL, 0);
+        unlink(aof->rewrite_path);
+    }
+    free(aof->rewrite_buffer);
+
     // close the file resources
-    fclose(aof->file);
-    pthread_mutex_destroy(&aof->mutex);
+    if (aof->fd >= 0)
+    {
+        close(aof->fd);
+    }
 
-    // free aof
-    free(aof);
-}
+    if (aof->file)
+    {
+        fclose(aof->file);
+    }
 
-// write to the file
-void aof_write(AOF *aof, char *message)
-{
-    pthread_mutex_lock(&aof->mutex);
+    close(aof->wake_fd);
+    pthread_mutex_destroy(&aof->mutex);
 
-    // write the message to the file
-    if (fprintf(aof->file, "%s", message) < 0)
+    for (int i = 0; i < aof->num_rings && i < AOF_MAX_RINGS; i++)
     {
-        fprintf(stderr, "Error writing to file\n");
-        exit(EXIT_FAILURE);
+        if (aof->rings[i])
+        {
+            free(aof->rings[i]->data);
+            free(aof->rings[i]);
+        }
     }
 
-    // unlock the mutex
-    pthread_mutex_unlock(&aof->mutex);
+    if (thread_ring_aof == aof)
+    {
+        thread_ring = NULL;
+        thread_ring_aof = NULL;
+    }
+
+    // free aof
+    free(aof);
 }
 
 char *aof_read_line(AOF *aof)
@@ -2,21 +2,159 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+// size of the ring of each thread appending to the AOF, a power of 2. A producer only waits when its ring is full
+#define AOF_RING_SIZE (1 << 22)
+
+// maximum number of threads appending to the AOF, every event loop has its own ring
+#define AOF_MAX_RINGS 64
+
+// with the everysec and no policies, the AOF thread drains the rings this often, or earlier once a ring holds AOF_RING_WAKE_SIZE bytes
+#define AOF_DRAIN_INTERVAL_MS 100
+#define AOF_RING_WAKE_SIZE (AOF_RING_SIZE / 8)
+
+// maximum number of records written by a single writev() call
+#define AOF_MAX_IOV 1024
+
+// default thresholds of the automatic rewrite, see aof_rewrite_due()
+#define AOF_REWRITE_PERCENTAGE 100
+#define AOF_REWRITE_MIN_SIZE (64L * 1024 * 1024)
+
+// an automatic rewrite is not retried until this many seconds after a rewrite failed
+#define AOF_REWRITE_RETRY_DELAY_SEC 5
+
+// maximum length of the path of the AOF and of its rewritten file
+#define AOF_PATH_SIZE 256
+
+// every record starts with a header and is padded to this many bytes, so a header always fits before the end of the ring
+#define AOF_RECORD_ALIGN 16
+
+// when the appended commands are made durable with fdatasync()
+typedef enum
+{
+    // every event loop iteration that logged commands syncs them before releasing its replies
+    AOF_FSYNC_ALWAYS,
+    // a background thread syncs the file once per flush interval
+    AOF_FSYNC_EVERYSEC,
+    // the file is never synced, the OS writes it back when it wants to
+    AOF_FSYNC_NO
+} AOFFsyncPolicy;
+
+// header of a record in a ring, followed by the command
+typedef struct
+{
+    // position of the record in the order of all the records appended to the AOF, 0 for the padding that skips to the start of the ring
+    uint64_t seq;
+    uint32_t len;
+    uint32_t reserved;
+} AOFRecord;
+
+// single producer single consumer ring of records, the thread owning it appends without taking a lock and the AOF thread drains it
+typedef struct
+{
+    // positions grow forever, the index in the data is the position modulo AOF_RING_SIZE
+    _Alignas(64) _Atomic long tail;
+    // position of the record reserved by aof_reserve(), and the head the producer last saw
+    long reserved_pos;
+    long cached_head;
+
+    _Alignas(64) _Atomic long head;
+
+    char *data;
+} AOFRing;
 
 typedef struct AOF
 {
+    // used while the file is read, NULL in append mode
     FILE *file;
+    // used while the file is appended to, -1 in read mode
+    int fd;
+
     int flush_interval_sec;
+    AOFFsyncPolicy fsync_policy;
 
-    // mutex for file access
+    // mutex for file access, held by the thread draining the rings and by mode changes
     pthread_mutex_t mutex;
+
+    // rings of the producer threads, registered on their first append
+    AOFRing *rings[AOF_MAX_RINGS];
+    _Atomic int num_rings;
+
+    // number of records appended, the sequence number of the last record
+    _Atomic long appended;
+
+    // sequence numbers up to which the records were written to the file and made durable
+    _Atomic long written;
+    _Atomic long synced;
+
+    // wakes the AOF thread, written at most once until the thread drains the rings
+    int wake_fd;
+    _Atomic int wake_pending;
+
+    // called by the AOF thread after the file was synced, to release the replies waiting for it
+    void (*on_sync)(struct AOF *aof, long synced);
+
+    // path of the file in append mode, the rewritten file is renamed over it
+    char path[AOF_PATH_SIZE];
+
+    // size of the file, and its size after the last rewrite or when it was opened
+    _Atomic long size;
+    _Atomic long base_size;
+
+    // automatic rewrite, once the file is rewrite_min_size bytes and grew by rewrite_percentage percent of its base size. 0 disables it
+    int rewrite_percentage;
+    long rewrite_min_size;
+
+    // set from aof_rewrite_begin() until the AOF thread installed or discarded the rewritten file
+    _Atomic int rewriting;
+
+    // CLOCK_MONOTONIC seconds of the last failed rewrite, 0 if none failed
+    _Atomic long rewrite_failed_at;
+
+    // child process writing the snapshot, 0 until it is forked, and the file it writes
+    pid_t rewrite_pid;
+    char rewrite_path[AOF_PATH_SIZE];
+
+    // the snapshot holds the records up to this sequence number, the records after it are also copied to the rewrite buffer, which is appended to the rewritten file
+    long rewrite_seq;
+    char *rewrite_buffer;
+    long rewrite_buffer_size;
+    long rewrite_buffer_capacity;
 } AOF;
 
 // aof functions
 AOF *aof_init(char *aof_file_name, int flush_interval_sec, char *mode);
 void aof_change_mode(AOF *aof, char *aof_filename, char *mode);
+int aof_fsync_policy_from_name(char *name);
+const char *aof_fsync_policy_name(AOFFsyncPolicy policy);
 void *aof_flush(void *aof);
 void aof_close(AOF *aof);
-void aof_write(AOF *aof, char *message);
-char *aof_read_line(AOF *aof);
\ No newline at end of file
+char *aof_reserve(AOF *aof, int len);
+long aof_publish(AOF *aof, int len);
+long aof_write(AOF *aof, char *message);
+void aof_notify(AOF *aof);
+long aof_drain(AOF *aof);
+long aof_commit(AOF *aof);
+bool aof_needs_commit(AOF *aof, long offset);
+char *aof_read_line(AOF *aof);
+
+bool aof_rewrite_begin(AOF *aof);
+void aof_rewrite_started(AOF *aof, pid_t pid, char *path);
+void aof_rewrite_abort(AOF *aof);
+bool aof_rewrite_finish(AOF *aof, bool written);
+int aof_rewrite_poll(AOF *aof);
+bool aof_rewrite_due(AOF *aof);
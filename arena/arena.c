@@ -0,0 +1,154 @@
+// * This file contains the implementation of a bump allocator. Memory is handed out from large blocks by moving an offset forward, and is released all at once when the arena is reset. It suits memory that lives as long as a single request, like the responses built by the server.
+
+#include "arena.h"
+
+// rounds a size up to the alignment of the allocations
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/**
+ * @brief Adds a new block to the arena, large enough to hold an allocation of the given size
+ *
+ * @param arena arena to add the block to
+ * @param size size of the allocation the block must hold
+ */
+static void arena_add_block(Arena *arena, size_t size)
+{
+    size_t block_size = arena->head ? arena->head->size * 2 : ARENA_BLOCK_SIZE;
+    while (block_size < size)
+    {
+        block_size *= 2;
+    }
+
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+    if (block == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+}
+
+/**
+ * @brief Allocates memory from an arena, the memory is not zeroed
+ *
+ * @param arena arena to allocate from
+ * @param size number of bytes to allocate
+ *
+ * @return void* the memory, valid until the arena is reset
+ */
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = ARENA_ALIGN(size);
+
+    if (!arena->head || arena->head->used + size > arena->head->size)
+    {
+        arena_add_block(arena, size);
+    }
+
+    void *ptr = arena->head->data + arena->head->used;
+    arena->head->used += size;
+
+    return ptr;
+}
+
+/**
+ * @brief Grows an allocation of an arena, like realloc()
+ *
+ * The allocation is extended in place when it is the last one of the arena and its block has room left, otherwise it is copied to a new allocation. The memory of the old allocation is only released by arena_reset().
+ *
+ * @param arena arena the allocation belongs to
+ * @param ptr allocation to grow
+ * @param old_size size the allocation was made with
+ * @param new_size new size of the allocation
+ *
+ * @return void* the grown allocation, its first old_size bytes are the ones of ptr
+ */
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    old_size = ARENA_ALIGN(old_size);
+    new_size = ARENA_ALIGN(new_size);
+
+    ArenaBlock *block = arena->head;
+
+    // the last allocation of the current block ends at the end of the used part of the block
+    if (block && (char *)ptr + old_size == block->data + block->used && block->used - old_size + new_size <= block->size)
+    {
+        block->used += new_size - old_size;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+/**
+ * @brief Checks if a pointer was allocated from an arena
+ *
+ * @param arena arena to check
+ * @param ptr pointer to check
+ *
+ * @return bool true if the pointer is in one of the blocks of the arena
+ */
+bool arena_owns(Arena *arena, const void *ptr)
+{
+    for (ArenaBlock *block = arena->head; block; block = block->next)
+    {
+        if ((const char *)ptr >= block->data && (const char *)ptr < block->data + block->size)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Releases all the allocations of an arena
+ *
+ * Only the first block, of ARENA_BLOCK_SIZE bytes, is kept. The larger blocks added for a large response are freed, so one large response does not keep its memory in the arena until the process exits.
+ *
+ * @param arena arena to reset
+ */
+void arena_reset(Arena *arena)
+{
+    ArenaBlock *kept = NULL;
+
+    ArenaBlock *block = arena->head;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+
+        // the oldest block is the first one, unless the first allocation was already larger than it
+        if (!next && block->size == ARENA_BLOCK_SIZE)
+        {
+            kept = block;
+            kept->used = 0;
+        }
+        else
+        {
+            free(block);
+        }
+
+        block = next;
+    }
+
+    arena->head = kept;
+}
+
+/**
+ * @brief Frees all the memory of an arena, it is empty afterwards and can be used again
+ *
+ * @param arena arena to free
+ */
+void arena_free(Arena *arena)
+{
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
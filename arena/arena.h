@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+// size of the first block of an arena, later blocks are at least twice as large as the one before them
+#define ARENA_BLOCK_SIZE 16384
+
+// allocations are rounded up to this many bytes, so every allocation is aligned on it
+#define ARENA_ALIGNMENT 8
+
+typedef struct ArenaBlock
+{
+    // blocks are chained from the newest, which is also the largest, to the oldest
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} ArenaBlock;
+
+// bump allocator, allocations are only released all at once by arena_reset(). A zeroed arena is empty and ready to use
+typedef struct
+{
+    ArenaBlock *head;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+bool arena_owns(Arena *arena, const void *ptr);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#endif
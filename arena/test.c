@@ -0,0 +1,94 @@
+// test the bump allocator
+#include "arena.h"
+
+int main()
+{
+    Arena arena = {0};
+
+    // test allocations are aligned and don't overlap
+    char *first = arena_alloc(&arena, 5);
+    char *second = arena_alloc(&arena, 3);
+    if (((size_t)first % ARENA_ALIGNMENT) != 0 || second != first + ARENA_ALIGNMENT)
+    {
+        fprintf(stderr, "allocations should be aligned and follow each other\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(first, "hello", 5);
+    memcpy(second, "abc", 3);
+
+    // test the last allocation grows in place
+    char *grown = arena_grow(&arena, second, 3, 100);
+    if (grown != second || memcmp(grown, "abc", 3) != 0)
+    {
+        fprintf(stderr, "the last allocation should grow in place\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test an allocation that is not the last one is copied
+    grown = arena_grow(&arena, first, 5, 16);
+    if (grown == first || memcmp(grown, "hello", 5) != 0)
+    {
+        fprintf(stderr, "an allocation that is not the last one should be copied\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test growing past the end of the block moves the allocation to a larger block
+    ArenaBlock *block = arena.head;
+    grown = arena_grow(&arena, grown, 16, 3 * ARENA_BLOCK_SIZE);
+    if (arena.head == block || arena.head->next != block || arena.head->size < 3 * ARENA_BLOCK_SIZE || memcmp(grown, "hello", 5) != 0)
+    {
+        fprintf(stderr, "growing past the block should add a larger block\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!arena_owns(&arena, first) || !arena_owns(&arena, grown) || arena_owns(&arena, &arena))
+    {
+        fprintf(stderr, "arena_owns should only find allocations of the arena\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test reset frees the larger block and keeps only the first one, and allocations start over
+    block = arena.head->next;
+    arena_reset(&arena);
+    if (arena.head != block || arena.head->next || arena.head->size != ARENA_BLOCK_SIZE || arena.head->used != 0 || arena_alloc(&arena, 1) != block->data)
+    {
+        fprintf(stderr, "reset should keep the first block and empty it\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test many small allocations spill over several blocks
+    for (int i = 0; i < 10000; i++)
+    {
+        int *value = arena_alloc(&arena, sizeof(int) * 4);
+        value[0] = i;
+    }
+
+    arena_free(&arena);
+
+    // test an arena whose first allocation is larger than a block gets back to a single block of ARENA_BLOCK_SIZE
+    arena_alloc(&arena, 4 * ARENA_BLOCK_SIZE);
+    arena_alloc(&arena, 8 * ARENA_BLOCK_SIZE);
+    arena_reset(&arena);
+    if (arena.head)
+    {
+        fprintf(stderr, "reset should free the blocks larger than ARENA_BLOCK_SIZE\n");
+        exit(EXIT_FAILURE);
+    }
+
+    arena_alloc(&arena, 1);
+    if (arena.head->next || arena.head->size != ARENA_BLOCK_SIZE)
+    {
+        fprintf(stderr, "the arena should start over with a block of ARENA_BLOCK_SIZE\n");
+        exit(EXIT_FAILURE);
+    }
+
+    arena_free(&arena);
+    if (arena.head)
+    {
+        fprintf(stderr, "a freed arena should hold no blocks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
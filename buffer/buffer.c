@@ -0,0 +1,191 @@
+// * This file contains the implementation of a growable byte buffer built from a chain of fixed size chunks. Chunks come from a per-thread pool, so a buffer only holds memory while it has pending data and busy buffers reuse chunks instead of going back to malloc. Data is appended at the tail and consumed from the head, which makes it suitable for queueing responses that are written out incrementally with writev().
+
+#include "buffer.h"
+
+// chunks released by this thread, reused before allocating new ones
+static __thread BufferChunk *pool_head = NULL;
+static __thread int pool_size = 0;
+
+/**
+ * @brief Get an empty chunk, from the pool of the current thread if possible
+ *
+ * @return BufferChunk* The empty chunk
+ */
+BufferChunk *buffer_chunk_acquire()
+{
+    BufferChunk *chunk = pool_head;
+
+    if (chunk)
+    {
+        pool_head = chunk->next;
+        pool_size--;
+    }
+    else
+    {
+        chunk = (BufferChunk *)malloc(sizeof(BufferChunk));
+        if (chunk == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = 0;
+
+    return chunk;
+}
+
+/**
+ * @brief Return a chunk to the pool of the current thread, or free it if the pool is full
+ *
+ * @param chunk The chunk to release
+ *
+ * @return void
+ */
+void buffer_chunk_release(BufferChunk *chunk)
+{
+    if (pool_size >= BUFFER_POOL_MAX_CHUNKS)
+    {
+        free(chunk);
+        return;
+    }
+
+    chunk->next = pool_head;
+    pool_head = chunk;
+    pool_size++;
+}
+
+/**
+ * @brief Number of chunks in the pool of the current thread
+ *
+ * @return int The number of pooled chunks
+ */
+int buffer_pool_size()
+{
+    return pool_size;
+}
+
+/**
+ * @brief Append data to the end of the buffer, spilling into new chunks as needed
+ *
+ * @param buffer The buffer to append to
+ * @param data The data to append
+ * @param len The length of the data
+ *
+ * @return void
+ */
+void buffer_append(Buffer *buffer, const void *data, long len)
+{
+    const char *src = (const char *)data;
+
+    while (len > 0)
+    {
+        if (!buffer->tail || buffer->tail->end == BUFFER_CHUNK_SIZE)
+        {
+            BufferChunk *chunk = buffer_chunk_acquire();
+
+            if (buffer->tail)
+            {
+                buffer->tail->next = chunk;
+            }
+            else
+            {
+                buffer->head = chunk;
+            }
+
+            buffer->tail = chunk;
+        }
+
+        BufferChunk *tail = buffer->tail;
+        long space = BUFFER_CHUNK_SIZE - tail->end;
+        long n = len < space ? len : space;
+
+        memcpy(tail->data + tail->end, src, n);
+        tail->end += n;
+        buffer->size += n;
+
+        src += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Describe the pending data of the buffer as an iovec array, for use with writev()
+ *
+ * @param buffer The buffer to describe
+ * @param iov The iovec array to fill
+ * @param max_iov The maximum number of entries of the iovec array
+ *
+ * @return int The number of entries filled
+ */
+int buffer_iovec(Buffer *buffer, struct iovec *iov, int max_iov)
+{
+    int count = 0;
+
+    for (BufferChunk *chunk = buffer->head; chunk && count < max_iov; chunk = chunk->next)
+    {
+        iov[count].iov_base = chunk->data + chunk->start;
+        iov[count].iov_len = chunk->end - chunk->start;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Remove data from the front of the buffer, chunks that were fully consumed are released
+ *
+ * @param buffer The buffer to consume from
+ * @param len The number of bytes to consume
+ *
+ * @return void
+ */
+void buffer_consume(Buffer *buffer, long len)
+{
+    while (len > 0 && buffer->head)
+    {
+        BufferChunk *head = buffer->head;
+        long available = head->end - head->start;
+        long n = len < available ? len : available;
+
+        head->start += n;
+        buffer->size -= n;
+        len -= n;
+
+        if (head->start == head->end)
+        {
+            buffer->head = head->next;
+            if (!buffer->head)
+            {
+                buffer->tail = NULL;
+            }
+
+            buffer_chunk_release(head);
+        }
+    }
+}
+
+/**
+ * @brief Release all the chunks of the buffer, the buffer can be reused afterwards
+ *
+ * @param buffer The buffer to free
+ *
+ * @return void
+ */
+void buffer_free(Buffer *buffer)
+{
+    BufferChunk *chunk = buffer->head;
+
+    while (chunk)
+    {
+        BufferChunk *next = chunk->next;
+        buffer_chunk_release(chunk);
+        chunk = next;
+    }
+
+    buffer->head = NULL;
+    buffer->tail = NULL;
+    buffer->size = 0;
+}
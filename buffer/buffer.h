@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// size of the data of one chunk, must be able to hold a full request (4 + MAX_MESSAGE_SIZE + 1)
+#define BUFFER_CHUNK_SIZE 16384
+
+// maximum number of released chunks kept for reuse by each thread
+#define BUFFER_POOL_MAX_CHUNKS 64
+
+typedef struct BufferChunk
+{
+    struct BufferChunk *next;
+
+    // bytes in [start, end) have been written but not consumed yet
+    int start;
+    int end;
+
+    char data[BUFFER_CHUNK_SIZE];
+} BufferChunk;
+
+// growable byte queue made of a chain of pooled chunks, an empty buffer holds no memory
+typedef struct
+{
+    BufferChunk *head;
+    BufferChunk *tail;
+    long size;
+} Buffer;
+
+BufferChunk *buffer_chunk_acquire();
+void buffer_chunk_release(BufferChunk *chunk);
+int buffer_pool_size();
+
+void buffer_append(Buffer *buffer, const void *data, long len);
+int buffer_iovec(Buffer *buffer, struct iovec *iov, int max_iov);
+void buffer_consume(Buffer *buffer, long len);
+void buffer_free(Buffer *buffer);
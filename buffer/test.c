@@ -0,0 +1,87 @@
+// test the chunked buffer
+#include "buffer.h"
+
+int main()
+{
+    Buffer buffer = {0};
+
+    // test append within a single chunk
+    buffer_append(&buffer, "hello", 5);
+    if (buffer.size != 5 || buffer.head != buffer.tail)
+    {
+        fprintf(stderr, "small append should use a single chunk\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test append spilling into several chunks
+    int big_len = 3 * BUFFER_CHUNK_SIZE;
+    char *big = malloc(big_len);
+    for (int i = 0; i < big_len; i++)
+    {
+        big[i] = (char)(i % 251);
+    }
+
+    buffer_append(&buffer, big, big_len);
+    if (buffer.size != 5 + big_len)
+    {
+        fprintf(stderr, "buffer size should be %d\n", 5 + big_len);
+        exit(EXIT_FAILURE);
+    }
+
+    struct iovec iov[8];
+    int count = buffer_iovec(&buffer, iov, 8);
+    if (count != 4)
+    {
+        fprintf(stderr, "buffer should span 4 chunks, got %d\n", count);
+        exit(EXIT_FAILURE);
+    }
+
+    // test the data is kept in order across chunks
+    if (memcmp(iov[0].iov_base, "hello", 5) != 0 || memcmp((char *)iov[0].iov_base + 5, big, iov[0].iov_len - 5) != 0)
+    {
+        fprintf(stderr, "first chunk has wrong contents\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test partial consume
+    buffer_consume(&buffer, 5 + BUFFER_CHUNK_SIZE);
+    count = buffer_iovec(&buffer, iov, 8);
+    if (count != 3 || buffer.size != big_len - BUFFER_CHUNK_SIZE || memcmp(iov[0].iov_base, big + BUFFER_CHUNK_SIZE, 16) != 0)
+    {
+        fprintf(stderr, "partial consume failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test consumed chunks are pooled and reused
+    if (buffer_pool_size() != 1)
+    {
+        fprintf(stderr, "the consumed chunk should be pooled, got %d\n", buffer_pool_size());
+        exit(EXIT_FAILURE);
+    }
+
+    buffer_consume(&buffer, buffer.size);
+    if (buffer.size != 0 || buffer.head || buffer.tail || buffer_pool_size() != 4)
+    {
+        fprintf(stderr, "empty buffer should hold no chunks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buffer_append(&buffer, "again", 5);
+    if (buffer_pool_size() != 3)
+    {
+        fprintf(stderr, "append should reuse a pooled chunk\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buffer_free(&buffer);
+    free(big);
+
+    // drain the pool so no memory is leaked
+    while (buffer_pool_size() > 0)
+    {
+        free(buffer_chunk_acquire());
+    }
+
+    // All tests passed
+    printf("All tests passed\n");
+}
@@ -112,17 +112,18 @@ int process_server_response(int confd)
         return err;
     }
 
+    type = 0;
+    memcpy(&type, buffer, 1);
+
     memcpy(&message_size, buffer + 1, 4);
 
-    if (message_size > MAX_MESSAGE_SIZE)
+    // for arrays the size is the number of elements, which is not limited, each element is checked on its own
+    if (type != SER_ARR && message_size > MAX_MESSAGE_SIZE)
     {
         fprintf(stderr, "Message too long\n");
         return -1;
     }
 
-    type = 0;
-    memcpy(&type, buffer, 1);
-
     message_size = 0;
     memcpy(&message_size, buffer + 1, 4);
 
@@ -186,8 +187,8 @@ int process_server_response(int confd)
             return err;
         }
 
-        int value = *(int *)(buffer + 5);
-        printf("(int) %d\n", value);
+        // integers are always sent as 64 bit integers
+        printf("(int) %" PRId64 "\n", *(int64_t *)(buffer + 5));
         return 0;
         break;
     case SER_FLOAT:
@@ -206,8 +207,8 @@ int process_server_response(int confd)
             return err;
         }
 
-        float fvalue = *(float *)(buffer + 5);
-        printf("(float) %f\n", fvalue);
+        // floats are always sent as doubles
+        printf("(float) %f\n", *(double *)(buffer + 5));
         return 0;
         break;
 
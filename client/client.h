@@ -9,6 +9,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 int read_tcp_socket(int fd, char *buffer, int size);
 int write_tcp_socket(int fd, char *buffer, int size);
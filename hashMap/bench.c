@@ -0,0 +1,122 @@
+#include "hashMap.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// memory and time taken by many small hashes, like one user profile per key
+
+#define NUM_HASHES 100000
+#define NUM_FIELDS 6
+
+// buckets of the table every hash used to start with
+#define LEGACY_TABLE_SIZE 1024
+
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// resident memory of the process in bytes
+long resident_bytes()
+{
+    long pages = 0, resident = 0;
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm || fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+    {
+        fprintf(stderr, "Failed to read /proc/self/statm\n");
+        exit(EXIT_FAILURE);
+    }
+    fclose(statm);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static const char *fields[NUM_FIELDS] = {"name", "email", "country", "lang", "plan", "created"};
+
+/**
+ * @brief Fills many small hashes and reads a field of each, in a child process so every run starts from the same heap
+ *
+ * @param name name of the run
+ * @param max_compact_fields hmap_max_compact_fields of the run, 0 for hash tables only
+ * @param legacy store every hash in a table of LEGACY_TABLE_SIZE buckets instead of a HashMap
+ */
+void bench_hashes(char *name, int max_compact_fields, bool legacy)
+{
+    // the child would print what is still buffered again
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    hmap_max_compact_fields = max_compact_fields;
+
+    void **hashes = malloc(sizeof(void *) * NUM_HASHES);
+    char value[32];
+
+    long before = resident_bytes();
+    double start = now_sec();
+    for (int i = 0; i < NUM_HASHES; i++)
+    {
+        hashes[i] = legacy ? (void *)hcreate(LEGACY_TABLE_SIZE) : (void *)hmap_init();
+
+        for (int j = 0; j < NUM_FIELDS; j++)
+        {
+            int len = sprintf(value, "%s-of-user-%d", fields[j], i);
+
+            if (legacy)
+            {
+                hinsert(hashes[i], hinit_inline(fields[j], strlen(fields[j]), STRING, value, len));
+            }
+            else
+            {
+                hmap_set(hashes[i], fields[j], strlen(fields[j]), value, len);
+            }
+        }
+    }
+    double set = now_sec() - start;
+    long used = resident_bytes() - before;
+
+    start = now_sec();
+    for (int i = 0; i < NUM_HASHES; i++)
+    {
+        const char *field = fields[i % NUM_FIELDS];
+        char *found = NULL;
+
+        if (legacy)
+        {
+            HashNode *node = hget(hashes[i], (char *)field);
+            found = node ? node->value : NULL;
+        }
+        else
+        {
+            hmap_get(hashes[i], field, &found, NULL);
+        }
+
+        if (!found)
+        {
+            fprintf(stderr, "field %s not found\n", field);
+            exit(EXIT_FAILURE);
+        }
+    }
+    double get = now_sec() - start;
+
+    printf("%-10s %d hashes of %d fields   %8.1f MB   %6.0f bytes/hash   set %5.0f ns/op   get %5.0f ns/op\n", name, NUM_HASHES, NUM_FIELDS, used / 1e6, (double)used / NUM_HASHES, set / (NUM_HASHES * NUM_FIELDS) * 1e9, get / NUM_HASHES * 1e9);
+
+    exit(EXIT_SUCCESS);
+}
+
+int main()
+{
+    bench_hashes("1024 slots", 0, true);
+    bench_hashes("table", 0, false);
+    bench_hashes("compact", HMAP_MAX_COMPACT_FIELDS, false);
+
+    return 0;
+}
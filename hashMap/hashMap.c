@@ -0,0 +1,440 @@
+// * This file contains the value of a hash key. A small hash is compact: its fields and values are stored one after the other in a single buffer, which is scanned to find a field. Once it has too many fields, or a field or value too long, it is converted to a hash table of nodes holding a field and its value, sized for its fields and shrunk again once most of them are removed.
+
+#include "hashMap.h"
+
+int hmap_max_compact_fields = HMAP_MAX_COMPACT_FIELDS;
+int hmap_max_compact_value = HMAP_MAX_COMPACT_VALUE;
+
+/**
+ * @brief Reads the header of the field of a compact hash at an offset
+ *
+ * @param map The compact hash
+ * @param offset Offset of the field in the entries
+ * @param field_len Set to the length of the field
+ * @param value_len Set to the length of its value
+ *
+ * @return uint32_t size of the field and its value in the entries, with the header and the null terminators
+ */
+static uint32_t hmap_entry(HashMap *map, uint32_t offset, uint32_t *field_len, uint32_t *value_len)
+{
+    memcpy(field_len, map->entries + offset, sizeof(uint32_t));
+    memcpy(value_len, map->entries + offset + sizeof(uint32_t), sizeof(uint32_t));
+
+    return HMAP_ENTRY_HEADER_SIZE + *field_len + 1 + *value_len + 1;
+}
+
+/**
+ * @brief Finds a field in a compact hash, the lengths are compared before the bytes
+ *
+ * @param map The compact hash
+ * @param field The field, null terminated
+ * @param field_len The length of the field
+ *
+ * @return long offset of the field in the entries, -1 if it is not in the hash
+ */
+static long hmap_compact_find(HashMap *map, const char *field, uint32_t field_len)
+{
+    uint32_t offset = 0;
+
+    while (offset < map->entries_len)
+    {
+        uint32_t len, value_len;
+        uint32_t size = hmap_entry(map, offset, &len, &value_len);
+
+        if (len == field_len && !memcmp(map->entries + offset + HMAP_ENTRY_HEADER_SIZE, field, field_len))
+        {
+            return offset;
+        }
+
+        offset += size;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Removes the field at an offset of a compact hash, the fields after it are moved down
+ *
+ * @param map The compact hash
+ * @param offset Offset of the field in the entries
+ */
+static void hmap_compact_delete(HashMap *map, uint32_t offset)
+{
+    uint32_t field_len, value_len;
+    uint32_t size = hmap_entry(map, offset, &field_len, &value_len);
+
+    memmove(map->entries + offset, map->entries + offset + size, map->entries_len - offset - size);
+    map->entries_len -= size;
+    map->num_fields--;
+}
+
+/**
+ * @brief Appends a field and its value to a compact hash, the field must not be in it already
+ *
+ * @param map The compact hash
+ * @param field The field
+ * @param field_len The length of the field
+ * @param value The value
+ * @param value_len The length of the value
+ */
+static void hmap_compact_append(HashMap *map, const char *field, uint32_t field_len, const char *value, uint32_t value_len)
+{
+    uint32_t size = HMAP_ENTRY_HEADER_SIZE + field_len + 1 + value_len + 1;
+
+    if (map->entries_len + size > map->entries_capacity)
+    {
+        uint32_t capacity = map->entries_capacity ? map->entries_capacity : 64;
+        while (capacity < map->entries_len + size)
+        {
+            capacity *= 2;
+        }
+
+        map->entries = realloc(map->entries, capacity);
+        if (!map->entries)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        map->entries_capacity = capacity;
+    }
+
+    char *entry = map->entries + map->entries_len;
+    memcpy(entry, &field_len, sizeof(uint32_t));
+    memcpy(entry + sizeof(uint32_t), &value_len, sizeof(uint32_t));
+
+    entry += HMAP_ENTRY_HEADER_SIZE;
+    memcpy(entry, field, field_len);
+    entry[field_len] = '\0';
+
+    entry += field_len + 1;
+    memcpy(entry, value, value_len);
+    entry[value_len] = '\0';
+
+    map->entries_len += size;
+    map->num_fields++;
+}
+
+/**
+ * @brief Creates the hash table of a hash, sized to hold a number of fields without being resized
+ *
+ * @param count The number of fields
+ *
+ * @return HashTable* The empty table
+ */
+static HashTable *hmap_create_table(int count)
+{
+    // same load limit as hinsert(), at most 7/8 of the slots used
+    int size = HT_GROUP_SIZE;
+    while ((long)count * 8 > (long)size * 7)
+    {
+        size *= 2;
+    }
+
+    return hcreate(size);
+}
+
+/**
+ * @brief Converts a compact hash to a hash table
+ *
+ * @param map The compact hash
+ * @param count number of fields the table is sized for, at least the number of fields of the hash
+ */
+static void hmap_convert(HashMap *map, int count)
+{
+    HashTable *table = hmap_create_table(count);
+
+    uint32_t offset = 0;
+    while (offset < map->entries_len)
+    {
+        uint32_t field_len, value_len;
+        uint32_t size = hmap_entry(map, offset, &field_len, &value_len);
+
+        char *field = map->entries + offset + HMAP_ENTRY_HEADER_SIZE;
+        hinsert(table, hinit_inline(field, field_len, STRING, field + field_len + 1, value_len));
+
+        offset += size;
+    }
+
+    free(map->entries);
+    map->entries = NULL;
+    map->entries_len = 0;
+    map->entries_capacity = 0;
+    map->num_fields = 0;
+
+    map->table = table;
+}
+
+/**
+ * @brief Creates an empty hash, compact unless compact hashes are disabled
+ *
+ * @return HashMap* The new hash
+ */
+HashMap *hmap_init()
+{
+    HashMap *map = calloc(1, sizeof(HashMap));
+    if (!map)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (hmap_max_compact_fields <= 0)
+    {
+        map->table = hcreate(HT_GROUP_SIZE);
+    }
+
+    return map;
+}
+
+/**
+ * @brief Makes room for a number of fields, a compact hash that can't hold them is converted right away
+ *
+ * @param map The hash
+ * @param count The number of fields
+ */
+void hmap_reserve(HashMap *map, int count)
+{
+    if (hmap_is_compact(map))
+    {
+        if (count > hmap_max_compact_fields)
+        {
+            hmap_convert(map, count);
+        }
+    }
+    else if ((long)count * 8 > (long)(map->table->mask + 1) * 7)
+    {
+        hresize(map->table, count);
+    }
+}
+
+/**
+ * @brief Whether a hash keeps its fields in a single buffer
+ *
+ * @param map The hash
+ *
+ * @return bool true if the hash is compact
+ */
+bool hmap_is_compact(HashMap *map)
+{
+    return map->table == NULL;
+}
+
+/**
+ * @brief Sets the value of a field, replacing its previous value
+ *
+ * @param map The hash
+ * @param field The field, null terminated
+ * @param field_len The length of the field
+ * @param value The value, copied
+ * @param value_len The length of the value
+ *
+ * @return bool true if the field was added, false if it was already in the hash
+ */
+bool hmap_set(HashMap *map, const char *field, int field_len, const char *value, int value_len)
+{
+    if (hmap_is_compact(map))
+    {
+        long offset = hmap_compact_find(map, field, field_len);
+        if (offset >= 0)
+        {
+            hmap_compact_delete(map, offset);
+        }
+
+        if (map->num_fields < hmap_max_compact_fields && field_len <= hmap_max_compact_value && value_len <= hmap_max_compact_value)
+        {
+            hmap_compact_append(map, field, field_len, value, value_len);
+            return offset < 0;
+        }
+
+        // the field is inserted into the table below
+        hmap_convert(map, map->num_fields + 1);
+
+        if (offset >= 0)
+        {
+            hinsert(map->table, hinit_inline(field, field_len, STRING, value, value_len));
+            return false;
+        }
+    }
+
+    // if it already exists, remove the old value
+    HashNode *old_node = hremove(map->table, (char *)field);
+    if (old_node)
+    {
+        hfree(old_node);
+    }
+
+    hinsert(map->table, hinit_inline(field, field_len, STRING, value, value_len));
+
+    return old_node == NULL;
+}
+
+/**
+ * @brief Gets the value of a field
+ *
+ * @param map The hash
+ * @param field The field, null terminated
+ * @param value Set to the value, null terminated and owned by the hash
+ * @param value_len Set to the length of the value, may be NULL
+ *
+ * @return bool true if the field is in the hash
+ */
+bool hmap_get(HashMap *map, const char *field, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+
+    if (hmap_is_compact(map))
+    {
+        uint32_t field_len = strlen(field);
+        long offset = hmap_compact_find(map, field, field_len);
+        if (offset < 0)
+        {
+            return false;
+        }
+
+        hmap_entry(map, offset, &field_len, &len);
+        *value = map->entries + offset + HMAP_ENTRY_HEADER_SIZE + field_len + 1;
+    }
+    else
+    {
+        HashNode *node = hget(map->table, (char *)field);
+        if (!node)
+        {
+            return false;
+        }
+
+        *value = node->value;
+        len = node->valueLen;
+    }
+
+    if (value_len)
+    {
+        *value_len = len;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Removes a field, a hash table starts shrinking once less than 1/8 of its slots are used
+ *
+ * The fields are moved into the smaller table incrementally by the following updates of the hash, and by hmap_rehash_step().
+ *
+ * @param map The hash
+ * @param field The field, null terminated
+ *
+ * @return bool true if the field was in the hash
+ */
+bool hmap_remove(HashMap *map, const char *field)
+{
+    if (hmap_is_compact(map))
+    {
+        long offset = hmap_compact_find(map, field, strlen(field));
+        if (offset < 0)
+        {
+            return false;
+        }
+
+        hmap_compact_delete(map, offset);
+        return true;
+    }
+
+    HashNode *node = hremove(map->table, (char *)field);
+    if (!node)
+    {
+        return false;
+    }
+    hfree(node);
+
+    // a shrink already in progress is left to finish first, starting another one would move the remaining fields at once
+    int capacity = map->table->mask + 1;
+    if (!map->table->old_groups && capacity > HT_GROUP_SIZE && map->table->size * 8 < capacity)
+    {
+        hstart_resize(map->table, map->table->size);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Moves the fields of a hash table that is being resized along
+ *
+ * @param map The hash
+ * @param num_groups maximum number of groups of slots to move
+ *
+ * @return bool true if the hash is still being resized
+ */
+bool hmap_rehash_step(HashMap *map, int num_groups)
+{
+    return !hmap_is_compact(map) && hrehash_step(map->table, num_groups);
+}
+
+/**
+ * @brief Number of fields of a hash
+ *
+ * @param map The hash
+ *
+ * @return int The number of fields
+ */
+int hmap_size(HashMap *map)
+{
+    return hmap_is_compact(map) ? map->num_fields : map->table->size;
+}
+
+/**
+ * @brief Iterates over the fields of a hash, which must not be updated while iterating
+ *
+ * @param map The hash
+ * @param pos position of the iteration, must be 0 for the first call
+ * @param field Set to the field, null terminated and owned by the hash
+ * @param field_len Set to the length of the field
+ * @param value Set to the value, null terminated and owned by the hash
+ * @param value_len Set to the length of the value
+ *
+ * @return bool false once all fields were visited
+ */
+bool hmap_next(HashMap *map, int *pos, char **field, uint32_t *field_len, char **value, uint32_t *value_len)
+{
+    if (hmap_is_compact(map))
+    {
+        if ((uint32_t)*pos >= map->entries_len)
+        {
+            return false;
+        }
+
+        uint32_t size = hmap_entry(map, *pos, field_len, value_len);
+        *field = map->entries + *pos + HMAP_ENTRY_HEADER_SIZE;
+        *value = *field + *field_len + 1;
+
+        *pos += size;
+        return true;
+    }
+
+    HashNode *node = hnext(map->table, pos);
+    if (!node)
+    {
+        return false;
+    }
+
+    *field = node->key;
+    *field_len = node->keyLen;
+    *value = node->value;
+    *value_len = node->valueLen;
+
+    return true;
+}
+
+/**
+ * @brief Frees the fields of a hash, but not the hash itself
+ *
+ * @param map The hash
+ */
+void hmap_free_contents(HashMap *map)
+{
+    if (hmap_is_compact(map))
+    {
+        free(map->entries);
+        return;
+    }
+
+    hfree_table(map->table);
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../hashTable/hashTable.h"
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+// default limits of a compact hash, past either of them it is converted to a hash table
+#define HMAP_MAX_COMPACT_FIELDS 128
+#define HMAP_MAX_COMPACT_VALUE 64
+
+// bytes in front of every field of a compact hash, the lengths of the field and of its value
+#define HMAP_ENTRY_HEADER_SIZE (2 * sizeof(uint32_t))
+
+// the value of a hash key, fields and values are strings
+typedef struct
+{
+    // NULL while the hash is compact
+    HashTable *table;
+
+    // a small hash keeps its fields in one buffer instead, every field is: uint32 field length, uint32 value length, field, '\0', value, '\0'
+    char *entries;
+    uint32_t entries_len;
+    uint32_t entries_capacity;
+    int num_fields;
+} HashMap;
+
+// hashes are compact up to this many fields (0 to never be compact), with fields and values of at most hmap_max_compact_value bytes
+extern int hmap_max_compact_fields;
+extern int hmap_max_compact_value;
+
+HashMap *hmap_init();
+void hmap_reserve(HashMap *map, int count);
+bool hmap_is_compact(HashMap *map);
+bool hmap_set(HashMap *map, const char *field, int field_len, const char *value, int value_len);
+bool hmap_get(HashMap *map, const char *field, char **value, uint32_t *value_len);
+bool hmap_remove(HashMap *map, const char *field);
+bool hmap_rehash_step(HashMap *map, int num_groups);
+int hmap_size(HashMap *map);
+bool hmap_next(HashMap *map, int *pos, char **field, uint32_t *field_len, char **value, uint32_t *value_len);
+void hmap_free_contents(HashMap *map);
+
+#endif
@@ -0,0 +1,177 @@
+// test the hash of fields and values
+#include "hashMap.h"
+
+// checks that the hash holds fields "f<i>" with values "v<i>" for i in [from, to), and nothing else
+bool check_fields(HashMap *map, int from, int to)
+{
+    char field[32], expected[32];
+    char *value;
+    uint32_t value_len;
+
+    for (int i = from; i < to; i++)
+    {
+        sprintf(field, "f%d", i);
+        int len = sprintf(expected, "v%d", i);
+        if (!hmap_get(map, field, &value, &value_len) || value_len != len || strcmp(value, expected) != 0)
+        {
+            return false;
+        }
+    }
+
+    // every field is visited once
+    int pos = 0;
+    int visited = 0;
+    char *name;
+    uint32_t name_len;
+    while (hmap_next(map, &pos, &name, &name_len, &value, &value_len))
+    {
+        if (name_len != strlen(name) || value_len != strlen(value) || strcmp(name + 1, value + 1) != 0)
+        {
+            return false;
+        }
+        visited++;
+    }
+
+    return visited == to - from && hmap_size(map) == to - from;
+}
+
+int main()
+{
+    hmap_max_compact_fields = 16;
+    hmap_max_compact_value = 8;
+
+    char field[32], value[32];
+    char *found;
+
+    // Test 1: a small hash is compact, updates replace the value of a field
+    HashMap *map = hmap_init();
+    for (int i = 0; i < 16; i++)
+    {
+        sprintf(field, "f%d", i);
+        sprintf(value, "v%d", i);
+        if (!hmap_set(map, field, strlen(field), value, strlen(value)))
+        {
+            fprintf(stderr, "Test 1 (Add a field) failed\n");
+            return 1;
+        }
+    }
+
+    if (hmap_set(map, "f3", 2, "updated", 7) || !hmap_get(map, "f3", &found, NULL) || strcmp(found, "updated") != 0 || hmap_set(map, "f3", 2, "v3", 2))
+    {
+        fprintf(stderr, "Test 1 (Update a field) failed\n");
+        return 1;
+    }
+
+    if (!hmap_is_compact(map) || !check_fields(map, 0, 16) || hmap_get(map, "f16", &found, NULL) || hmap_get(map, "f", &found, NULL))
+    {
+        fprintf(stderr, "Test 1 (Compact hash) failed\n");
+        return 1;
+    }
+
+    // Test 2: removing fields from a compact hash
+    if (!hmap_remove(map, "f0") || hmap_remove(map, "f0") || !hmap_is_compact(map) || !check_fields(map, 1, 16))
+    {
+        fprintf(stderr, "Test 2 (Remove from a compact hash) failed\n");
+        return 1;
+    }
+
+    // Test 3: past the number of fields the hash is converted to a table, with every field kept
+    hmap_set(map, "f0", 2, "v0", 2);
+    hmap_set(map, "f16", 3, "v16", 3);
+    if (hmap_is_compact(map) || !check_fields(map, 0, 17))
+    {
+        fprintf(stderr, "Test 3 (Convert to a hash table) failed\n");
+        return 1;
+    }
+
+    // Test 4: the table grows, then shrinks once most fields are removed, which iterating over it finishes
+    for (int i = 17; i < 1000; i++)
+    {
+        sprintf(field, "f%d", i);
+        sprintf(value, "v%d", i);
+        hmap_set(map, field, strlen(field), value, strlen(value));
+    }
+
+    int grown = map->table->mask + 1;
+    for (int i = 0; i < 990; i++)
+    {
+        sprintf(field, "f%d", i);
+        hmap_remove(map, field);
+    }
+
+    if (grown < 1024 || map->table->mask + 1 > 64 || !check_fields(map, 990, 1000))
+    {
+        fprintf(stderr, "Test 4 (Shrink the hash table) failed\n");
+        return 1;
+    }
+
+    hmap_free_contents(map);
+    free(map);
+
+    // Test 5: a long value converts it too, updating a field already in the hash
+    map = hmap_init();
+    hmap_set(map, "f1", 2, "v1", 2);
+    if (hmap_set(map, "f1", 2, "longer than 8 bytes", 19) || hmap_is_compact(map) || hmap_size(map) != 1 || !hmap_get(map, "f1", &found, NULL) || strcmp(found, "longer than 8 bytes") != 0)
+    {
+        fprintf(stderr, "Test 5 (Convert on a long value) failed\n");
+        return 1;
+    }
+
+    hmap_free_contents(map);
+    free(map);
+
+    // Test 6: without compact hashes, values may hold any byte
+    hmap_max_compact_fields = 0;
+    map = hmap_init();
+    uint32_t len;
+    hmap_set(map, "bin", 3, "a\0b", 3);
+    if (hmap_is_compact(map) || !hmap_get(map, "bin", &found, &len) || len != 3 || memcmp(found, "a\0b", 3) != 0)
+    {
+        fprintf(stderr, "Test 6 (Hash table without compact hashes) failed\n");
+        return 1;
+    }
+
+    hmap_free_contents(map);
+    free(map);
+
+    // Test 7: a large table is shrunk incrementally, its fields stay readable until every group was moved
+    map = hmap_init();
+    for (int i = 0; i < 4096; i++)
+    {
+        sprintf(field, "f%d", i);
+        sprintf(value, "v%d", i);
+        hmap_set(map, field, strlen(field), value, strlen(value));
+    }
+
+    grown = map->table->mask + 1;
+    int i = 0;
+    while (!map->table->old_groups)
+    {
+        sprintf(field, "f%d", i++);
+        hmap_remove(map, field);
+    }
+
+    if (map->table->mask + 1 > grown / 4 || !hmap_get(map, "f4095", &found, NULL) || strcmp(found, "v4095") != 0)
+    {
+        fprintf(stderr, "Test 7 (Start shrinking the hash table) failed\n");
+        return 1;
+    }
+
+    int steps = 0;
+    while (hmap_rehash_step(map, 1))
+    {
+        steps++;
+    }
+
+    if (steps < 2 || map->table->old_groups || !check_fields(map, i, 4096))
+    {
+        fprintf(stderr, "Test 7 (Shrink the hash table incrementally) failed\n");
+        return 1;
+    }
+
+    hmap_free_contents(map);
+    free(map);
+
+    printf("All tests passed\n");
+    return 0;
+}
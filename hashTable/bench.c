@@ -0,0 +1,167 @@
+#include "hashTable.h"
+#include <time.h>
+
+// microbenchmark of the hash function, compares it with the previous byte at a time hash on realistic key sets
+
+#define NUM_KEYS (1 << 20)
+#define NUM_KEY_SETS 3
+
+// the hash function used before, kept here for comparison
+int legacy_hash(char *key)
+{
+    unsigned int hash = 0;
+    for (int i = 0; key[i] != '\0'; i++)
+    {
+        hash = 31 * hash + key[i];
+    }
+
+    return (int)hash;
+}
+
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Fills a key set, the keys share long prefixes like the keys of a real application
+ *
+ * @param keys array of NUM_KEYS keys to fill
+ * @param set index of the key set
+ *
+ * @return char* name of the key set
+ */
+char *make_keys(char **keys, int set)
+{
+    char key[128];
+
+    for (int i = 0; i < NUM_KEYS; i++)
+    {
+        if (set == 0)
+        {
+            sprintf(key, "user:%d:session", i);
+        }
+        else if (set == 1)
+        {
+            sprintf(key, "tenant:acme-corporation:region:eu-west-1:object:%08d:metadata", i);
+        }
+        else
+        {
+            sprintf(key, "%d", i * 16);
+        }
+
+        keys[i] = strdup(key);
+    }
+
+    return set == 0 ? "user:<n>:session" : set == 1 ? "long prefix (70 bytes)" : "numbers, multiples of 16";
+}
+
+/**
+ * @brief Prints the chain lengths the keys would have in a chained table with NUM_KEYS buckets, indexed by the low bits of the hash
+ *
+ * @param buckets hash of every key, masked to a bucket index
+ */
+void print_chains(const char *name, unsigned int *buckets)
+{
+    int *counts = calloc(NUM_KEYS, sizeof(int));
+
+    for (int i = 0; i < NUM_KEYS; i++)
+    {
+        counts[buckets[i]]++;
+    }
+
+    int max_chain = 0;
+    int empty = 0;
+    long sum_squares = 0;
+
+    for (int i = 0; i < NUM_KEYS; i++)
+    {
+        max_chain = counts[i] > max_chain ? counts[i] : max_chain;
+        empty += counts[i] == 0;
+        sum_squares += (long)counts[i] * counts[i];
+    }
+
+    // the average length of the chain a lookup of a present key walks, 1.5 for a perfectly random hash at load factor 1
+    printf("    %-8s max chain %6d, empty buckets %5.1f%%, average probed chain %.2f\n", name, max_chain, 100.0 * empty / NUM_KEYS, (double)sum_squares / NUM_KEYS);
+
+    free(counts);
+}
+
+int main()
+{
+    char **keys = malloc(sizeof(char *) * NUM_KEYS);
+    unsigned int *buckets = malloc(sizeof(unsigned int) * NUM_KEYS);
+
+    hash_set_seed(0x1234567890abcdefull);
+
+    for (int set = 0; set < NUM_KEY_SETS; set++)
+    {
+        char *name = make_keys(keys, set);
+        printf("%s, %d keys\n", name, NUM_KEYS);
+
+        // throughput of the hash functions
+        unsigned int sink = 0;
+
+        double start = now_sec();
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            sink += legacy_hash(keys[i]);
+        }
+        double legacy_ns = (now_sec() - start) * 1e9 / NUM_KEYS;
+
+        start = now_sec();
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            sink += hash(keys[i]);
+        }
+        double hash_ns = (now_sec() - start) * 1e9 / NUM_KEYS;
+
+        printf("    legacy   %.1f ns/key, hash %.1f ns/key (%u)\n", legacy_ns, hash_ns, sink & 1);
+
+        // chain lengths with the low bits used as the bucket index
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            buckets[i] = legacy_hash(keys[i]) & (NUM_KEYS - 1);
+        }
+        print_chains("legacy", buckets);
+
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            buckets[i] = hash(keys[i]) & (NUM_KEYS - 1);
+        }
+        print_chains("hash", buckets);
+
+        // throughput of the table itself
+        HashTable *table = hcreate(1024);
+
+        start = now_sec();
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            hinsert(table, hinit(strdup(keys[i]), STRING, NULL));
+        }
+        double insert_ns = (now_sec() - start) * 1e9 / NUM_KEYS;
+
+        start = now_sec();
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            // visit the keys in a scattered order
+            sink += hget(table, keys[(i * 7919L) & (NUM_KEYS - 1)]) != NULL;
+        }
+        double get_ns = (now_sec() - start) * 1e9 / NUM_KEYS;
+
+        printf("    table    hinsert %.1f ns/op, hget %.1f ns/op\n", insert_ns, get_ns);
+
+        hfree_table(table);
+        for (int i = 0; i < NUM_KEYS; i++)
+        {
+            free(keys[i]);
+        }
+    }
+
+    free(keys);
+    free(buckets);
+
+    return 0;
+}
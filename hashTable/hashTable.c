@@ -2,24 +2,125 @@
 
 #include "hashTable.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// seed of the hash function, set once per process by hash_set_seed() so that the bucket of a key can't be predicted by clients
+static uint64_t hash_seed = 0x9E3779B97F4A7C15ull;
+
+// secrets of the hash function
+static const uint64_t hash_secret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
 /**
- * @brief Hash function
+ * @brief Multiplies two 64 bit words into a 128 bit product, then folds it into 64 bits
+ */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/**
+ * @brief Sets the seed of the hash function
  *
- * This function is the djb2 hash function, which is a simple hash function that is used to hash strings.
+ * Must be called before any table is created, the hash of a key changes with the seed.
  *
- * @param key The key to hash
+ * @param seed The new seed
  *
- * @return int The hash value
+ * @return void
  */
-int hash(char *key)
+void hash_set_seed(uint64_t seed)
 {
-    int hash = 0;
-    for (int i = 0; key[i] != '\0'; i++)
+    hash_seed = seed;
+}
+
+/**
+ * @brief Hash function for arbitrary bytes
+ *
+ * A seeded hash in the style of wyhash, the input is consumed 8 or 16 bytes at a time and mixed with 64x64->128 bit multiplications. All bits of the result depend on all bits of the input, so both the low bits (bucket) and the high bits (shard) of the hash can be used.
+ *
+ * @param data The bytes to hash
+ * @param len number of bytes
+ *
+ * @return uint64_t The hash value
+ */
+uint64_t hash_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t seed = hash_seed ^ hash_mix(hash_seed ^ hash_secret[0], hash_secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16)
     {
-        hash = 31 * hash + key[i];
+        if (len >= 4)
+        {
+            // two overlapping reads cover 4 to 16 bytes
+            a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
     }
+    else
+    {
+        size_t i = len;
 
-    return hash;
+        while (i > 16)
+        {
+            seed = hash_mix(read64(p) ^ hash_secret[1], read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        // the last 16 bytes, overlapping the ones already consumed
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= hash_secret[1];
+    b ^= seed;
+
+    __uint128_t product = (__uint128_t)a * b;
+    a = (uint64_t)product;
+    b = (uint64_t)(product >> 64);
+
+    return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+/**
+ * @brief Hash function
+ *
+ * Hashes a null terminated key with hash_bytes().
+ *
+ * @param key The key to hash
+ *
+ * @return uint64_t The hash value
+ */
+uint64_t hash(char *key)
+{
+    return hash_bytes(key, strlen(key));
 }
 
 /**
@@ -35,7 +136,7 @@ int hash(char *key)
  */
 HashNode *hinit(char *key, ValueType type, void *value)
 {
-    HashNode *node = calloc(sizeof(HashNode), 1);
+    HashNode *node = slab_zalloc(sizeof(HashNode));
 
     if (node == NULL)
     {
@@ -45,16 +146,144 @@ HashNode *hinit(char *key, ValueType type, void *value)
 
     // does not dupliate the key, caller is responsible for freeing the key
     node->key = key;
+    node->keyLen = strlen(key);
+    node->valueType = type;
+    node->value = value;
+
+    return node;
+}
+
+// offset of an inline value in the data of a node, after the null terminated key and aligned so that numeric values can be read in place
+#define HN_VALUE_OFFSET(key_len) (((size_t)(key_len) + 1 + 7) & ~(size_t)7)
+
+/**
+ * @brief Allocates a node with its key, and optionally its value, stored right after it
+ *
+ * @param key The key of the node, does not need to be null terminated
+ * @param key_len The length of the key
+ * @param value_len The number of value bytes to reserve in the node, or -1 if the value is not inline
+ *
+ * @return HashNode* The node, its key is copied and null terminated
+ */
+static HashNode *halloc_inline(const char *key, int key_len, int value_len)
+{
+    size_t value_size = value_len >= 0 ? (size_t)value_len + 1 : 0;
+
+    HashNode *node = slab_alloc(sizeof(HashNode) + HN_VALUE_OFFSET(key_len) + value_size);
+    if (node == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(node->data, key, key_len);
+    node->data[key_len] = '\0';
+
+    node->key = node->data;
+    node->keyLen = key_len;
+    node->valueLen = 0;
+    node->value = NULL;
+    node->hashCode = 0;
+    node->flags = HN_KEY_INLINE;
+
+    return node;
+}
+
+/**
+ * @brief Initializes a new hash node stored in a single allocation together with its key and value
+ *
+ * Both the key and the value are copied, so short entries like the string values of SET cost one allocation instead of three. The value is null terminated, so string values can be used as C strings.
+ *
+ * @param key The key of the node, does not need to be null terminated
+ * @param key_len The length of the key
+ * @param type The type of the value
+ * @param value The bytes of the value
+ * @param value_len The number of bytes of the value
+ *
+ * @return HashNode* The initialized node
+ */
+HashNode *hinit_inline(const char *key, int key_len, ValueType type, const void *value, int value_len)
+{
+    HashNode *node = halloc_inline(key, key_len, value_len);
+
+    char *value_data = node->data + HN_VALUE_OFFSET(key_len);
+    memcpy(value_data, value, value_len);
+    value_data[value_len] = '\0';
+
+    node->valueType = type;
+    node->value = value_data;
+    node->valueLen = value_len;
+    node->flags |= HN_VALUE_INLINE;
+
+    return node;
+}
+
+/**
+ * @brief Initializes a new hash node stored in a single allocation together with its key
+ *
+ * Used for values that are data structures of their own, like lists and sets. The value is NOT duplicated, it is freed by hfree().
+ *
+ * @param key The key of the node, does not need to be null terminated
+ * @param key_len The length of the key
+ * @param type The type of the value
+ * @param value The heap allocated value of the node
+ *
+ * @return HashNode* The initialized node
+ */
+HashNode *hinit_key(const char *key, int key_len, ValueType type, void *value)
+{
+    HashNode *node = halloc_inline(key, key_len, -1);
+
     node->valueType = type;
     node->value = value;
 
     return node;
 }
 
+/**
+ * @brief Initializes a new INTEGER hash node, stored in a single allocation together with its key
+ *
+ * @param key The key of the node, does not need to be null terminated
+ * @param key_len The length of the key
+ * @param value The integer, stored in the value slot of the node
+ *
+ * @return HashNode* The initialized node
+ */
+HashNode *hinit_int(const char *key, int key_len, int64_t value)
+{
+    HashNode *node = halloc_inline(key, key_len, -1);
+
+    node->valueType = INTEGER;
+    node->intValue = value;
+    node->flags |= HN_VALUE_INLINE;
+
+    return node;
+}
+
+/**
+ * @brief Initializes a new FLOAT hash node, stored in a single allocation together with its key
+ *
+ * @param key The key of the node, does not need to be null terminated
+ * @param key_len The length of the key
+ * @param value The number, stored in the value slot of the node
+ *
+ * @return HashNode* The initialized node
+ */
+HashNode *hinit_float(const char *key, int key_len, double value)
+{
+    HashNode *node = halloc_inline(key, key_len, -1);
+
+    node->valueType = FLOAT;
+    node->floatValue = value;
+    node->flags |= HN_VALUE_INLINE;
+
+    return node;
+}
+
 /**
  * @brief Free a single hash node
  *
- * This function frees a single hash node, including the key and value.
+ * This function frees a single hash node, including the key and value. Keys and values stored inline are freed with the node.
  *
  * @param node The node to free
  *
@@ -62,15 +291,258 @@ HashNode *hinit(char *key, ValueType type, void *value)
  */
 void hfree(HashNode *node)
 {
-    free(node->key);
-    free(node->value);
-    free(node);
+    if (!(node->flags & HN_KEY_INLINE))
+    {
+        free(node->key);
+    }
+
+    if (!(node->flags & HN_VALUE_INLINE))
+    {
+        free(node->value);
+    }
+
+    slab_free(node);
+}
+
+/**
+ * @brief Returns a bitmask of the slots of a group whose control byte equals the given byte
+ *
+ * @param ctrl control bytes of the group
+ * @param byte control byte to look for
+ *
+ * @return uint32_t bit i is set if slot i of the group matches
+ */
+static inline uint32_t group_match(const int8_t *ctrl, int8_t byte)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_SIZE; i++)
+    {
+        mask |= (uint32_t)(ctrl[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @brief Returns a bitmask of the slots of a group that are free, either empty or deleted
+ *
+ * @param ctrl control bytes of the group
+ *
+ * @return uint32_t bit i is set if slot i of the group is free
+ */
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+#ifdef __SSE2__
+    // used control bytes are the only negative ones, movemask collects the sign bits
+    return ~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl)) & 0xFFFF;
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_SIZE; i++)
+    {
+        mask |= (uint32_t)(ctrl[i] >= 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @brief Finds the slot holding a key in an array of groups
+ *
+ * Groups are probed with a triangular sequence, which visits every group since the number of groups is a power of 2. Within a group, the tags of all slots are compared at once, only the nodes with a matching tag are dereferenced.
+ *
+ * @param groups groups of slots to search
+ * @param mask number of slots - 1
+ * @param key The key to look for
+ * @param hashCode hash of the key
+ *
+ * @return int index of the slot, -1 if the key is not in the groups
+ */
+static int hfind_slot(HashGroup *groups, int mask, char *key, uint64_t hashCode)
+{
+    // the low 7 bits are the tag, the next ones select the first group to probe
+    int8_t tag = HT_CTRL_FULL(hashCode & 0x7F);
+
+    int group_mask = (mask + 1) / HT_GROUP_SIZE - 1;
+    int group = (hashCode >> 7) & group_mask;
+
+    for (int step = 1;; step++)
+    {
+        HashGroup *cur = &groups[group];
+
+        uint32_t matches = group_match(cur->ctrl, tag);
+        while (matches)
+        {
+            int i = __builtin_ctz(matches);
+            HashNode *node = cur->slots[i];
+
+            // use lazy evaluation to potentially avoid the strcmp call
+            if (node->hashCode == hashCode && strcmp(node->key, key) == 0)
+            {
+                return group * HT_GROUP_SIZE + i;
+            }
+
+            matches &= matches - 1;
+        }
+
+        // a key is always inserted in the first free slot of its probe sequence, so it can't be past a group with an empty slot
+        if (group_match(cur->ctrl, HT_CTRL_EMPTY))
+        {
+            return -1;
+        }
+
+        group = (group + step) & group_mask;
+    }
+}
+
+/**
+ * @brief Finds the first free slot for a hash, the key must not already be in the table
+ *
+ * @param table The hashtable to insert into
+ * @param hashCode hash of the key
+ *
+ * @return int index of the slot in the current groups
+ */
+static int hfind_free_slot(HashTable *table, uint64_t hashCode)
+{
+    int group_mask = (table->mask + 1) / HT_GROUP_SIZE - 1;
+    int group = (hashCode >> 7) & group_mask;
+
+    for (int step = 1;; step++)
+    {
+        uint32_t free_slots = group_match_free(table->groups[group].ctrl);
+        if (free_slots)
+        {
+            return group * HT_GROUP_SIZE + __builtin_ctz(free_slots);
+        }
+
+        group = (group + step) & group_mask;
+    }
+}
+
+/**
+ * @brief Stores a node in a free slot of the current groups, without checking the load of the table
+ *
+ * @param table The hashtable to insert into
+ * @param node The node to insert, its hashCode must be set
+ */
+static void hplace(HashTable *table, HashNode *node)
+{
+    int slot = hfind_free_slot(table, node->hashCode);
+    HashGroup *group = &table->groups[slot / HT_GROUP_SIZE];
+    int i = slot % HT_GROUP_SIZE;
+
+    if (group->ctrl[i] == HT_CTRL_DELETED)
+    {
+        table->tombstones--;
+    }
+
+    group->ctrl[i] = HT_CTRL_FULL(node->hashCode & 0x7F);
+    group->slots[i] = node;
+}
+
+/**
+ * @brief Allocates an array of groups of slots, all slots start empty
+ *
+ * @param capacity number of slots, a power of 2 and a multiple of HT_GROUP_SIZE
+ *
+ * @return HashGroup* the groups
+ */
+static HashGroup *halloc_groups(int capacity)
+{
+    int num_groups = capacity / HT_GROUP_SIZE;
+
+    // zeroed memory is all empty slots, large allocations get fresh zero pages, so the cost of touching them is spread over the inserts instead of paid up front
+    HashGroup *groups = calloc(num_groups, sizeof(HashGroup));
+    if (groups == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return groups;
+}
+
+/**
+ * @brief Starts rehashing the table into new groups of the given capacity
+ *
+ * The nodes are moved over by hrehash_step(), until then lookups check both the new and the old groups. A rehash already in progress is finished first.
+ *
+ * @param table The hashtable to rehash
+ * @param capacity new number of slots, a power of 2 and a multiple of HT_GROUP_SIZE
+ */
+static void hstart_rehash(HashTable *table, int capacity)
+{
+    while (hrehash_step(table, (table->old_mask + 1) / HT_GROUP_SIZE))
+    {
+    };
+
+    table->old_groups = table->groups;
+    table->old_mask = table->mask;
+    table->rehash_pos = 0;
+
+    table->groups = halloc_groups(capacity);
+    table->mask = capacity - 1;
+    table->tombstones = 0;
+
+    table->loadFactor = (float)table->size / (table->mask + 1);
+}
+
+/**
+ * @brief Moves the nodes of some of the old groups into the current groups, while the table is rehashed
+ *
+ * Called for a few groups on every insert and remove, and by the event loop when it is idle, so that a resize never stalls a single command.
+ *
+ * @param table The hashtable being rehashed
+ * @param num_groups maximum number of old groups to move
+ *
+ * @return int 1 if the table is still being rehashed, 0 once it is done
+ */
+int hrehash_step(HashTable *table, int num_groups)
+{
+    if (!table->old_groups)
+    {
+        return 0;
+    }
+
+    int old_num_groups = (table->old_mask + 1) / HT_GROUP_SIZE;
+
+    for (; num_groups > 0 && table->rehash_pos < old_num_groups; num_groups--)
+    {
+        HashGroup *group = &table->old_groups[table->rehash_pos++];
+
+        for (int i = 0; i < HT_GROUP_SIZE; i++)
+        {
+            if (group->ctrl[i] < 0)
+            {
+                hplace(table, group->slots[i]);
+
+                // the slot becomes a tombstone, so lookups for nodes further along the probe sequence still get past it
+                group->ctrl[i] = HT_CTRL_DELETED;
+            }
+        }
+    }
+
+    if (table->rehash_pos < old_num_groups)
+    {
+        return 1;
+    }
+
+    free(table->old_groups);
+    table->old_groups = NULL;
+    table->old_mask = 0;
+    table->rehash_pos = 0;
+
+    return 0;
 }
 
 /**
  * @brief Creates a new hashtable
  *
- * This function creates a new hashtable with the specified size. The size must be a power of 2.
+ * This function creates a new hashtable with the specified size. The size must be a power of 2, tables smaller than one group of slots are rounded up to HT_GROUP_SIZE slots.
  *
  * @param size The size of the hashtable
  *
@@ -91,15 +563,10 @@ HashTable *hcreate(int size)
         exit(EXIT_FAILURE);
     }
 
-    table->nodes = calloc(sizeof(HashNode *), size);
-    if (table->nodes == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
+    int capacity = size < HT_GROUP_SIZE ? HT_GROUP_SIZE : size;
 
-    table->size = 0;
-    table->mask = size - 1;
+    table->groups = halloc_groups(capacity);
+    table->mask = capacity - 1;
 
     return table;
 }
@@ -107,7 +574,7 @@ HashTable *hcreate(int size)
 /**
  * @brief Inserts a node into the hashtable
  *
- * This function inserts a node into the hashtable. If the key already exists in the hashtable, it returns NULL. If the hashtable is full or the load factor is too high, it resizes the hashtable.
+ * This function inserts a node into the hashtable. If the key already exists in the hashtable, it returns NULL. Once 7/8 of the slots are used (including deleted ones), the hashtable is resized, or rehashed in place when most of the used slots are deleted ones.
  *
  * @param table The hashtable to insert the node into
  * @param node The node to insert
@@ -116,25 +583,9 @@ HashTable *hcreate(int size)
  */
 HashNode *hinsert(HashTable *table, HashNode *node)
 {
-    // check if the table is full or if load factor is too high
-    if ((table->size == table->mask + 1) || (table->size / (table->mask + 1) > table->loadFactor))
-    {
-
-        table->size == table->mask + 1 ? printf("Table is full, resizing\n") : printf("Load factor is too high\n");
-
-        // replace old table with new table
-        table = hresize(table);
-        if (table == NULL)
-        {
-            fprintf(stderr, "Table resize has failed\n");
-            return NULL;
-        }
-    }
-
-    // calculate the index
-    int hashCode = hash(node->key);
+    // calculate the hash code
+    uint64_t hashCode = hash(node->key);
     node->hashCode = hashCode;
-    int index = hashCode & table->mask;
 
     // make sure the key is unique
     if (hget(table, node->key) != NULL)
@@ -143,10 +594,18 @@ HashNode *hinsert(HashTable *table, HashNode *node)
         return NULL;
     }
 
-    // insert the node at the head of the linked list
-    node->next = table->nodes[index];
-    table->nodes[index] = node;
+    // spread the cost of a resize over the inserts that follow it
+    hrehash_step(table, HT_REHASH_GROUPS_PER_INSERT);
+
+    // keep at least 1/8 of the slots empty, so that every probe sequence ends quickly. The nodes still in the old groups will move into the current ones too
+    int capacity = table->mask + 1;
+    if ((table->size + table->tombstones + 1) * 8 > capacity * 7)
+    {
+        // mostly deleted slots are reclaimed without growing
+        hstart_rehash(table, (table->tombstones > table->size) ? capacity : capacity * 2);
+    }
 
+    hplace(table, node);
     table->size++;
 
     // update the load factor
@@ -167,24 +626,22 @@ HashNode *hinsert(HashTable *table, HashNode *node)
  */
 HashNode *hget(HashTable *table, char *key)
 {
-    // calculate the hash value for the key
-    int hashCode = hash(key);
+    uint64_t hashCode = hash(key);
 
-    // calculate the index
-    int index = hashCode & table->mask;
-
-    // search for the node in the linked list
-    HashNode *traverseList = table->nodes[index];
+    int slot = hfind_slot(table->groups, table->mask, key, hashCode);
+    if (slot >= 0)
+    {
+        return table->groups[slot / HT_GROUP_SIZE].slots[slot % HT_GROUP_SIZE];
+    }
 
-    while (traverseList != NULL)
+    // while rehashing, the node may not have been moved yet
+    if (table->old_groups)
     {
-        // use lazy evaluation to potentially avoid the strcmp call
-        if (traverseList->hashCode == hashCode && strcmp(traverseList->key, key) == 0)
+        slot = hfind_slot(table->old_groups, table->old_mask, key, hashCode);
+        if (slot >= 0)
         {
-            return traverseList;
+            return table->old_groups[slot / HT_GROUP_SIZE].slots[slot % HT_GROUP_SIZE];
         }
-
-        traverseList = traverseList->next;
     }
 
     return NULL;
@@ -202,90 +659,142 @@ HashNode *hget(HashTable *table, char *key)
  */
 HashNode *hremove(HashTable *table, char *key)
 {
-    // calculate the hash value for the key
-    int hashCode = hash(key);
+    uint64_t hashCode = hash(key);
 
-    // calculate the index
-    int index = hashCode & table->mask;
+    // tables mostly read and deleted from finish their rehash too, instead of probing both groups for long
+    hrehash_step(table, HT_REHASH_GROUPS_PER_INSERT);
 
-    // search for the node in the linked list
-    HashNode *traverseList = table->nodes[index];
-    HashNode *prev = NULL;
+    HashGroup *groups = table->groups;
+    int slot = hfind_slot(groups, table->mask, key, hashCode);
 
-    while (traverseList != NULL)
+    // while rehashing, the node may not have been moved yet
+    if (slot < 0 && table->old_groups)
     {
-        if (traverseList->hashCode == hashCode && strcmp(traverseList->key, key) == 0)
-        {
-            // first node in the linked list
-            if (prev == NULL)
-            {
-                table->nodes[index] = traverseList->next;
-            }
-            else
-            {
-                prev->next = traverseList->next;
-            }
+        groups = table->old_groups;
+        slot = hfind_slot(groups, table->old_mask, key, hashCode);
+    }
+
+    if (slot < 0)
+    {
+        return NULL;
+    }
 
-            table->size--;
+    HashGroup *group = &groups[slot / HT_GROUP_SIZE];
+    int i = slot % HT_GROUP_SIZE;
+    HashNode *node = group->slots[i];
 
-            return traverseList;
-        }
+    // if the group still has an empty slot, no probe sequence continued past it, so the slot can become empty again. Otherwise it must stay a tombstone
+    if (group_match(group->ctrl, HT_CTRL_EMPTY))
+    {
+        group->ctrl[i] = HT_CTRL_EMPTY;
+    }
+    else
+    {
+        group->ctrl[i] = HT_CTRL_DELETED;
 
-        prev = traverseList;
-        traverseList = traverseList->next;
+        // the old groups are freed once rehashed, their tombstones don't count
+        if (groups == table->groups)
+        {
+            table->tombstones++;
+        }
     }
 
-    return NULL;
+    table->size--;
+    table->loadFactor = (float)table->size / (table->mask + 1);
+
+    return node;
 }
 
 /**
- * @brief resizes the hashtable to double the size
+ * @brief Iterates over the nodes of the hashtable
  *
- * This function is called when the load factor exceeds a certain threshold, and the hashtable is resized to double the size.
+ * Nodes may be removed from the table while iterating, but not inserted, since an insert may start a rehash that moves nodes. A rehash in progress is finished by the first call, as it costs about as much as visiting every slot, so the removals while iterating, which also rehash, have no nodes left to move.
  *
- * @param table The hashtable to free
+ * @param table The hashtable to iterate over
+ * @param pos position of the iteration, must be 0 for the first call
  *
- * @return HashTable* The resized hashtable
+ * @return HashNode* The next node, NULL once all nodes were visited
  */
-HashTable *hresize(HashTable *table)
+HashNode *hnext(HashTable *table, int *pos)
 {
-
-    int newSize = (table->mask + 1) * 2;
-    if (newSize % 2 != 0)
+    if (*pos == 0)
     {
-        fprintf(stderr, "new size is not a multiple of 2, not resized\n");
-        return table;
+        while (hrehash_step(table, (table->old_mask + 1) / HT_GROUP_SIZE))
+        {
+        };
     }
 
-    HashTable *newTable = hcreate(newSize);
+    int capacity = table->mask + 1;
 
-    // iterate through the old table and reinsert the nodes into the new table
-    for (int i = 0; i <= table->mask; i++)
+    while (*pos < capacity)
     {
-        HashNode *traverseList = table->nodes[i];
+        int slot = (*pos)++;
 
-        while (traverseList != NULL)
+        HashGroup *group = &table->groups[slot / HT_GROUP_SIZE];
+        if (group->ctrl[slot % HT_GROUP_SIZE] < 0)
         {
-            HashNode *temp = traverseList->next;
+            return group->slots[slot % HT_GROUP_SIZE];
+        }
+    }
 
-            // insert the node into the new table
-            hinsert(newTable, traverseList);
+    return NULL;
+}
 
-            traverseList = temp;
-        }
+/**
+ * @brief Starts resizing the hashtable to the smallest number of slots that holds size nodes without growing, which may shrink it
+ *
+ * The nodes are moved over by hrehash_step(), like when an insert grows the table, so shrinking a large table does not stall a single command. A rehash already in progress is finished first.
+ *
+ * @param table The hashtable to resize
+ * @param size number of nodes the table should hold, at least the number of nodes already in it
+ *
+ * @return int 1 if the table is being rehashed, 0 if it could not be resized
+ */
+int hstart_resize(HashTable *table, int size)
+{
+    if (size < table->size)
+    {
+        size = table->size;
     }
 
-    // free the old nodes
-    free(table->nodes);
+    // same load limit as hinsert(), at most 7/8 of the slots used
+    long newSize = HT_GROUP_SIZE;
+    while ((long)size * 8 > newSize * 7)
+    {
+        newSize *= 2;
+    }
 
-    // copy the new table into the old table
-    table->nodes = newTable->nodes;
-    table->loadFactor = newTable->loadFactor;
-    table->size = newTable->size;
-    table->mask = newTable->mask;
+    if (newSize > INT32_MAX / 2 + 1)
+    {
+        fprintf(stderr, "new size overflows, not resized\n");
+        return 0;
+    }
 
-    // free old table
-    free(newTable);
+    hstart_rehash(table, newSize);
+
+    return 1;
+}
+
+/**
+ * @brief resizes the hashtable to the smallest number of slots that holds size nodes without growing, which may shrink it
+ *
+ * The nodes are moved into the new slots right away, use hstart_resize() to move them incrementally instead.
+ *
+ * @param table The hashtable to resize
+ * @param size number of nodes the table should hold, at least the number of nodes already in it
+ *
+ * @return HashTable* The resized hashtable
+ */
+HashTable *hresize(HashTable *table, int size)
+{
+    if (!hstart_resize(table, size))
+    {
+        return table;
+    }
+
+    while (hrehash_step(table, (table->old_mask + 1) / HT_GROUP_SIZE))
+    {
+    };
 
     return table;
 }
@@ -299,21 +808,7 @@ HashTable *hresize(HashTable *table)
  */
 void hfree_table(HashTable *table)
 {
-    for (int i = 0; i <= table->mask; i++)
-    {
-        HashNode *traverseList = table->nodes[i];
-
-        while (traverseList != NULL)
-        {
-            HashNode *temp = traverseList->next;
-            free(traverseList->key);
-            free(traverseList->value);
-            free(traverseList);
-            traverseList = temp;
-        }
-    }
-
-    free(table->nodes);
+    hfree_table_contents(table);
     free(table);
 }
 
@@ -326,50 +821,46 @@ void hfree_table(HashTable *table)
  */
 void hfree_table_contents(HashTable *table)
 {
-    for (int i = 0; i <= table->mask; i++)
-    {
-        HashNode *traverseList = table->nodes[i];
+    int pos = 0;
+    HashNode *node;
 
-        while (traverseList != NULL)
-        {
-            HashNode *temp = traverseList->next;
-            free(traverseList->key);
-            free(traverseList->value);
-            free(traverseList);
-            traverseList = temp;
-        }
+    while ((node = hnext(table, &pos)) != NULL)
+    {
+        hfree(node);
     }
 
-    free(table->nodes);
+    free(table->groups);
+    free(table->old_groups);
 }
 
 // Print the hashtable
 void hprint(HashTable *table)
 {
-    for (int i = 0; i <= table->mask; i++)
+    int pos = 0;
+    HashNode *node;
+
+    while ((node = hnext(table, &pos)) != NULL)
     {
-        HashNode *traverseList = table->nodes[i];
+        int i = pos - 1;
 
         printf("--------------------\n");
         printf("Index: %d\n", i);
 
-        while (traverseList != NULL)
+        if (node->valueType == STRING)
         {
-            // printf("Key: %s, Value: %s\n", traverseList->key, traverseList->value);
-            if (traverseList->valueType == STRING)
-            {
-                printf("Key: %s, Value: %s\n", traverseList->key, (char *)traverseList->value);
-            }
-            else if (traverseList->valueType == FLOAT)
-            {
-                printf("Key: %s, Value: %f\n", traverseList->key, *(float *)traverseList->value);
-            }
-            else
-            {
-                fprintf(stderr, "Value type not supported\n");
-            }
-
-            traverseList = traverseList->next;
+            printf("Key: %s, Value: %s\n", node->key, (char *)node->value);
+        }
+        else if (node->valueType == FLOAT)
+        {
+            printf("Key: %s, Value: %f\n", node->key, node->floatValue);
+        }
+        else if (node->valueType == INTEGER)
+        {
+            printf("Key: %s, Value: %ld\n", node->key, node->intValue);
+        }
+        else
+        {
+            fprintf(stderr, "Value type not supported\n");
         }
 
         printf("--------------------\n");
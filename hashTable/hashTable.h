@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "../slab/slab.h"
 
 // Define the value type enum
 typedef enum
@@ -18,38 +24,103 @@ typedef struct HashNode
 {
     char *key;
 
+    union
+    {
+        // value is a pointer that can be cast to the appropriate type based on the valueType
+        void *value;
+        // INTEGER and FLOAT values are stored in the node itself, without an allocation
+        int64_t intValue;
+        double floatValue;
+    };
+
+    // full 64 bit hash of the key, compared before the keys themselves
+    uint64_t hashCode;
+
     ValueType valueType;
-    // value is a pointer that can be cast to the appropriate type based on the valueType
-    void *value;
 
-    struct HashNode *next;
-    int hashCode;
+    // lengths of the key and of a value stored in the node, without the null terminators
+    uint32_t keyLen;
+    uint32_t valueLen;
+    // HN_KEY_INLINE and HN_VALUE_INLINE, which of key and value point into the node allocation
+    uint8_t flags;
+
+    // inline key and value bytes follow the node in the same allocation, each null terminated
+    _Alignas(8) char data[];
 } HashNode;
 
+// the key is stored in the node allocation, hfree() does not free it separately
+#define HN_KEY_INLINE 0x1
+// the value is stored in the node allocation, hfree() does not free it separately
+#define HN_VALUE_INLINE 0x2
+
+// the table is open addressed, slots are probed in groups of this many, matching the width of one SSE2 register
+#define HT_GROUP_SIZE 16
+
+// control byte of a slot that was never used, probing for a key stops at a group containing one. It is 0 so that zeroed memory is a table of empty slots
+#define HT_CTRL_EMPTY ((int8_t)0x00)
+// control byte of a slot whose node was removed, probing for a key continues past it
+#define HT_CTRL_DELETED ((int8_t)0x01)
+// control byte of a used slot, the high bit is set and the low 7 bits are the tag of the hash of its key
+#define HT_CTRL_FULL(tag) ((int8_t)(0x80 | (tag)))
+
+// the control bytes of a group are stored next to its slots, so a lookup usually touches a single group of cache lines before reaching the node
+typedef struct
+{
+    // control byte of every slot, HT_CTRL_EMPTY, HT_CTRL_DELETED or HT_CTRL_FULL(tag), used slots are the only negative ones
+    int8_t ctrl[HT_GROUP_SIZE];
+    // node stored in every slot, only valid when the control byte is a tag
+    HashNode *slots[HT_GROUP_SIZE];
+} HashGroup;
+
 typedef struct
 {
-    // Array of HashNode pointers
-    HashNode **nodes;
+    // (mask + 1) / HT_GROUP_SIZE groups of slots
+    HashGroup *groups;
 
     float loadFactor;
     int size;
+    // number of slots - 1, the number of slots is a power of 2 and at least HT_GROUP_SIZE
     int mask;
+    // number of HT_CTRL_DELETED slots in groups, they are reclaimed when the table is rehashed
+    int tombstones;
+
+    // while the table is rehashed into groups, the nodes not moved yet are still in old_groups (NULL otherwise). Groups of old_groups before rehash_pos have been moved, their slots are left as tombstones
+    HashGroup *old_groups;
+    int old_mask;
+    int rehash_pos;
 } HashTable;
 
+// number of old groups moved by every insert and remove while a table is rehashed
+#define HT_REHASH_GROUPS_PER_INSERT 1
+
 // Function prototypes
-int hash(char *key);
+uint64_t hash(char *key);
+uint64_t hash_bytes(const void *data, size_t len);
+void hash_set_seed(uint64_t seed);
 
 // size is the initial size of the hash table, must be a power of 2
 HashTable *hcreate(int size);
 
 // To insert a node, need to dynamically allocate memory for the node, key, and value. Then, calculate the hash code for the key and store it in the node
 HashNode *hinit(char *key, ValueType type, void *value);
+// Allocates the node, the key and a copy of the value_len bytes of value in one allocation, nothing has to be allocated by the caller
+HashNode *hinit_inline(const char *key, int key_len, ValueType type, const void *value, int value_len);
+// Allocates the node and the key in one allocation, the node takes ownership of the heap allocated value
+HashNode *hinit_key(const char *key, int key_len, ValueType type, void *value);
+// Allocates an INTEGER or FLOAT node, the number is stored in the node itself
+HashNode *hinit_int(const char *key, int key_len, int64_t value);
+HashNode *hinit_float(const char *key, int key_len, double value);
 HashTable *hcreate(int size);
-HashTable *hresize(HashTable *table);
+HashTable *hresize(HashTable *table, int size);
+int hstart_resize(HashTable *table, int size);
 HashNode *hinsert(HashTable *table, HashNode *node);
 HashNode *hget(HashTable *table, char *key);
 HashNode *hremove(HashTable *table, char *key);
+HashNode *hnext(HashTable *table, int *pos);
+int hrehash_step(HashTable *table, int num_groups);
 void hfree(HashNode *node);
 void hfree_table(HashTable *table);
 void hfree_table_contents(HashTable *table);
 void hprint(HashTable *table);
+
+#endif
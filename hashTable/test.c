@@ -10,27 +10,8 @@ int main()
         return 1;
     }
 
-    // * since enum ValueType of string has a value of 0, calloc will initialize the value to 0
-    HashNode *node = calloc(sizeof(HashNode), 1);
-    if (node == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        return 1;
-    }
-
-    node->key = calloc(sizeof(char), strlen("key1") + 1);
-    node->value = calloc(sizeof(char), strlen("value1") + 1);
-
-    if (node->key == NULL || node->value == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        return 1;
-    }
-
-    strcpy(node->key, "key1");
-    strcpy(node->value, "value1");
-
-    node->hashCode = hash(node->key);
+    // nodes are allocated by hinit(), which takes ownership of the heap allocated key and value
+    HashNode *node = hinit(strdup("key1"), STRING, strdup("value1"));
 
     hinsert(table, node);
 
@@ -47,120 +28,237 @@ int main()
     }
 
     // insert another node
-    HashNode *node2 = calloc(sizeof(HashNode), 1);
-    if (node2 == NULL)
+    HashNode *node2 = hinit(strdup("key20"), STRING, strdup("value2"));
+
+    hinsert(table, node2);
+
+    result = hget(table, "key20");
+    if (result == NULL)
     {
-        fprintf(stderr, "Memory allocation failed\n");
         return 1;
     }
 
-    node2->key = calloc(sizeof(char), strlen("key20") + 1);
-
-    if (node2->key == NULL)
+    if (strcmp(result->value, "value2") != 0)
     {
-        fprintf(stderr, "Memory allocation failed\n");
+        fprintf(stderr, "Test 2 failed (Insert 2 nodes to one slot)\n");
         return 1;
     }
 
-    node2->value = calloc(sizeof(char), strlen("value2") + 1);
+    HashNode *node3 = hinit(strdup("key2@"), STRING, strdup("value3"));
 
-    strcpy(node2->key, "key20");
-    strcpy(node2->value, "value2");
-
-    node2->hashCode = hash(node2->key);
+    hinsert(table, node3);
 
-    hinsert(table, node2);
+    // test remove
+    HashNode *removedNode = hremove(table, "key20");
+    if (removedNode)
+    {
+        hfree(removedNode);
+    }
 
     result = hget(table, "key20");
-    if (result == NULL)
+    if (result != NULL)
     {
+        fprintf(stderr, "Test 3 failed (Delete a node from a 2 slot spot)\n");
         return 1;
     }
 
-    if (strcmp(result->value, "value2") != 0)
+    // reinsert node2, storing an integer value
+    node2 = hinit_int("key20", strlen("key20"), 43);
+
+    hinsert(table, node2);
+
+    // test resize, 20 nodes need 32 slots
+    int oldSize = table->size;
+    table = hresize(table, 20);
+
+    if (oldSize != table->size || table->mask != 31)
     {
-        fprintf(stderr, "Test 2 failed (Insert 2 nodes to one slot)\n");
+        fprintf(stderr, "Test 4 (Resizing hashtable) failed\n");
         return 1;
     }
 
-    HashNode *node3 = calloc(sizeof(HashNode), 1);
+    // insert enough nodes to resize several times, then remove every other one
+    char key[32];
+    for (int i = 0; i < 10000; i++)
+    {
+        sprintf(key, "user:%d:session", i);
+        if (!hinsert(table, hinit(strdup(key), STRING, strdup(key))))
+        {
+            fprintf(stderr, "Test 5 (Insert many nodes) failed\n");
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < 10000; i += 2)
+    {
+        sprintf(key, "user:%d:session", i);
+        HashNode *removed = hremove(table, key);
+        if (!removed)
+        {
+            fprintf(stderr, "Test 5 (Remove many nodes) failed\n");
+            return 1;
+        }
+        hfree(removed);
+    }
+
+    for (int i = 0; i < 10000; i++)
+    {
+        sprintf(key, "user:%d:session", i);
+        HashNode *found = hget(table, key);
+        if ((i % 2 == 0) != (found == NULL) || (found && strcmp(found->value, key) != 0))
+        {
+            fprintf(stderr, "Test 5 (Lookup after removals) failed\n");
+            return 1;
+        }
+    }
+
+    // iterate, the 3 nodes inserted first are still in the table
+    int pos = 0;
+    int visited = 0;
+    while (hnext(table, &pos) != NULL)
+    {
+        visited++;
+    }
 
-    if (node3 == NULL)
+    if (visited != 5000 + 3 || table->size != visited)
     {
-        fprintf(stderr, "Memory allocation failed\n");
+        fprintf(stderr, "Test 6 (Iterate over the nodes) failed\n");
         return 1;
     }
 
-    node3->key = calloc(sizeof(char), strlen("key2@") + 1);
-    node3->value = calloc(sizeof(char), strlen("value3") + 1);
+    // shrink the table once most of its nodes were removed
+    for (int i = 1; i < 10000; i += 2)
+    {
+        sprintf(key, "user:%d:session", i);
+        if (i > 200)
+        {
+            hfree(hremove(table, key));
+        }
+    }
 
-    if (node3->key == NULL || node3->value == NULL)
+    table = hresize(table, table->size);
+    if (table->size != 100 + 3 || table->mask != 127 || table->old_groups || !hget(table, "user:199:session") || hget(table, "user:201:session"))
     {
-        fprintf(stderr, "Memory allocation failed\n");
+        fprintf(stderr, "Test 7 (Shrink the hashtable) failed\n");
         return 1;
     }
 
-    strcpy(node3->key, "key2@");
-    strcpy(node3->value, "value3");
+    // free
+    hfree_table(table);
 
-    // manipulate hash key for testing
-    node3->hashCode = hash(node3->key);
+    // grow a table until it is rehashed incrementally, lookups and removals have to check both sets of groups
+    table = hcreate(1024);
+    int inserted = 0;
+    while (!table->old_groups || table->rehash_pos < 8)
+    {
+        sprintf(key, "key:%d", inserted++);
+        hinsert(table, hinit(strdup(key), STRING, strdup(key)));
+    }
 
-    hinsert(table, node3);
+    for (int i = 0; i < inserted; i++)
+    {
+        sprintf(key, "key:%d", i);
+        if (!hget(table, key))
+        {
+            fprintf(stderr, "Test 7 (Lookup while rehashing) failed\n");
+            return 1;
+        }
+    }
 
-    // test remove
-    HashNode *removedNode = hremove(table, "key20");
-    if (removedNode)
+    // removals move old groups too, a table that is only read and deleted from still finishes its rehash
+    for (int i = 0; i < inserted; i += 3)
     {
-        hfree(removedNode);
+        sprintf(key, "key:%d", i);
+        hfree(hremove(table, key));
     }
 
-    result = hget(table, "key20");
-    if (result != NULL)
+    if (table->old_groups || table->mask != 2047)
     {
-        fprintf(stderr, "Test 3 failed (Delete a node from a 2 slot spot)\n");
+        fprintf(stderr, "Test 7 (Finish rehashing) failed\n");
         return 1;
     }
 
-    // reinsert node2
-    node2 = calloc(sizeof(HashNode), 1);
-    if (node2 == NULL)
+    for (int i = 0; i < inserted; i++)
     {
-        fprintf(stderr, "Memory allocation failed\n");
-        return 1;
+        sprintf(key, "key:%d", i);
+        if ((i % 3 == 0) != (hget(table, key) == NULL))
+        {
+            fprintf(stderr, "Test 7 (Lookup after rehashing) failed\n");
+            return 1;
+        }
     }
 
-    node2->key = calloc(sizeof(char), strlen("key20") + 1);
+    hfree_table(table);
 
-    if (node2->key == NULL)
+    // removing every node while iterating over a table being rehashed visits every node once
+    table = hcreate(1024);
+    inserted = 0;
+    while (!table->old_groups || table->rehash_pos < 8)
     {
-        fprintf(stderr, "Memory allocation failed\n");
+        sprintf(key, "key:%d", inserted++);
+        hinsert(table, hinit(strdup(key), STRING, strdup(key)));
+    }
+
+    int removed = 0;
+    pos = 0;
+    while ((node = hnext(table, &pos)) != NULL)
+    {
+        hfree(hremove(table, node->key));
+        removed++;
+    }
+
+    if (removed != inserted || table->size != 0)
+    {
+        fprintf(stderr, "Test 7 (Remove while iterating) failed\n");
         return 1;
     }
 
-    strcpy(node2->key, "key20");
+    hfree_table(table);
 
-    // store an integer value
-    node2->value = calloc(sizeof(int), 1);
-    *(int *)node2->value = 43;
+    // Test 8: Keys and values stored in the node allocation
+    table = hcreate(16);
 
-    node2->valueType = INTEGER;
+    // the key and value are not null terminated, only their lengths are used
+    HashNode *inline_node = hinit_inline("inline_key_rest", 10, STRING, "inline_value_rest", 12);
+    HashNode *float_node = hinit_float("float_key", 9, 2.5);
+    HashNode *int_node = hinit_int("int_key", 7, -42);
+    HashNode *key_node = hinit_key("heap_value_key", 14, STRING, strdup("heap_value"));
 
-    node2->hashCode = hash(node2->key);
+    hinsert(table, inline_node);
+    hinsert(table, float_node);
+    hinsert(table, int_node);
+    hinsert(table, key_node);
 
-    hinsert(table, node2);
+    HashNode *fetched = hget(table, "inline_key");
+    if (fetched != inline_node || fetched->keyLen != 10 || fetched->valueLen != 12 || strcmp(fetched->value, "inline_value") != 0 || ((uintptr_t)fetched->value & 7) != 0)
+    {
+        fprintf(stderr, "Test 8 (Inline key and value) failed\n");
+        return 1;
+    }
 
-    // test resize
-    int oldSize = table->size;
-    table = hresize(table);
+    fetched = hget(table, "float_key");
+    if (fetched != float_node || fetched->valueType != FLOAT || fetched->floatValue != 2.5)
+    {
+        fprintf(stderr, "Test 8 (Inline float value) failed\n");
+        return 1;
+    }
 
-    if (oldSize != table->size || table->mask != 31)
+    fetched = hget(table, "int_key");
+    if (fetched != int_node || fetched->valueType != INTEGER || fetched->intValue != -42)
     {
-        fprintf(stderr, "Test 4 (Resizing hashtable) failed\n");
+        fprintf(stderr, "Test 8 (Inline integer value) failed\n");
         return 1;
     }
 
-    // free
+    fetched = hget(table, "heap_value_key");
+    if (fetched != key_node || strcmp(fetched->value, "heap_value") != 0 || (fetched->flags & HN_VALUE_INLINE))
+    {
+        fprintf(stderr, "Test 8 (Inline key with heap value) failed\n");
+        return 1;
+    }
+
+    // hfree only frees what is not inline
+    hfree(hremove(table, "inline_key"));
     hfree_table(table);
 
     printf("All tests passed\n");
@@ -104,7 +104,7 @@ bool list_contains(List *list, void *data, ListType listType)
  */
 int list_linsert(List *list, void *data, ListType listType)
 {
-    ListNode *new_node = (ListNode *)calloc(1, sizeof(ListNode));
+    ListNode *new_node = (ListNode *)slab_zalloc(sizeof(ListNode));
     if (new_node == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
@@ -178,7 +178,7 @@ int list_linsert(List *list, void *data, ListType listType)
  */
 int list_rinsert(List *list, void *data, ListType listType)
 {
-    ListNode *new_node = (ListNode *)calloc(1, sizeof(ListNode));
+    ListNode *new_node = (ListNode *)slab_zalloc(sizeof(ListNode));
     if (new_node == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
@@ -250,7 +250,7 @@ int list_rinsert(List *list, void *data, ListType listType)
 void list_free_node(ListNode *node)
 {
     free(node->data);
-    free(node);
+    slab_free(node);
 }
 
 /**
@@ -583,7 +583,7 @@ void list_free_contents(List *list)
     {
         ListNode *temp = traverse->next;
         free(traverse->data);
-        free(traverse);
+        slab_free(traverse);
         traverse = temp;
     }
 }
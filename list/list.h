@@ -4,6 +4,8 @@
 #include <math.h>
 #include <stdbool.h>
 
+#include "../slab/slab.h"
+
 typedef enum ListType
 {
     LIST_TYPE_INT,
@@ -3,7 +3,6 @@
 
 #define MAX_MESSAGE_SIZE 4096
 #define MAX_CLIENTS 2047
-#define MAX_ARGS 10
 #define SERVERPORT 9255
 
 typedef enum
@@ -0,0 +1,98 @@
+// * This file contains the implementation of an intrusive, lock-free multi-producer single-consumer queue (Vyukov's MPSC queue). Producers only perform a single atomic exchange, so pushing never blocks and never allocates. The consumer pops nodes in FIFO order. The queue does not own the nodes, the caller is responsible for allocating and freeing them.
+
+#include "queue.h"
+
+/**
+ * @brief Initializes an empty queue
+ *
+ * @param queue The queue to initialize
+ *
+ * @return void
+ */
+void queue_init(Queue *queue)
+{
+    atomic_store_explicit(&queue->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&queue->head, &queue->stub, memory_order_relaxed);
+    queue->tail = &queue->stub;
+}
+
+/**
+ * @brief Pushes a node onto the queue, safe to call from any thread
+ *
+ * @param queue The queue to push onto
+ * @param node The node to push
+ *
+ * @return void
+ */
+void queue_push(Queue *queue, QueueNode *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+
+    // claim the head, then link the previous head to the new node
+    QueueNode *prev = atomic_exchange_explicit(&queue->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/**
+ * @brief Pops the oldest node from the queue, must only be called by the consumer thread
+ *
+ * This function may return NULL while a producer is between its exchange and its link, the producer is expected to notify the consumer after the push completes.
+ *
+ * @param queue The queue to pop from
+ *
+ * @return QueueNode* The popped node, or NULL if no node is available
+ */
+QueueNode *queue_pop(Queue *queue)
+{
+    QueueNode *tail = queue->tail;
+    QueueNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    // skip over the stub node
+    if (tail == &queue->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    // tail is the last linked node, if it is not the head a producer has not finished linking yet
+    if (tail != atomic_load_explicit(&queue->head, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    // re-insert the stub so the last real node can be handed out
+    queue_push(queue, &queue->stub);
+
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Checks if the queue has no nodes, must only be called by the consumer thread
+ *
+ * @param queue The queue to check
+ *
+ * @return bool true if the queue is empty, false otherwise
+ */
+bool queue_empty(Queue *queue)
+{
+    return queue->tail == &queue->stub && atomic_load_explicit(&queue->stub.next, memory_order_acquire) == NULL && atomic_load_explicit(&queue->head, memory_order_acquire) == &queue->stub;
+}
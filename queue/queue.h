@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Intrusive node, embed it as the FIRST member of the struct that is pushed onto the queue so a popped node can be cast back to that struct
+typedef struct QueueNode
+{
+    _Atomic(struct QueueNode *) next;
+} QueueNode;
+
+// Lock-free multi-producer single-consumer queue, any thread may push, only the owning thread may pop
+typedef struct
+{
+    // producers swap themselves in at the head
+    _Atomic(QueueNode *) head;
+
+    // only touched by the consumer
+    QueueNode *tail;
+
+    // dummy node so the queue is never physically empty
+    QueueNode stub;
+} Queue;
+
+void queue_init(Queue *queue);
+void queue_push(Queue *queue, QueueNode *node);
+QueueNode *queue_pop(Queue *queue);
+bool queue_empty(Queue *queue);
@@ -0,0 +1,110 @@
+// test the MPSC queue
+#include "queue.h"
+#include <pthread.h>
+
+#define NUM_PRODUCERS 4
+#define ITEMS_PER_PRODUCER 10000
+
+typedef struct
+{
+    QueueNode node;
+    int producer;
+    int seq;
+} Item;
+
+Queue queue;
+
+void *produce(void *arg)
+{
+    int producer = *(int *)arg;
+
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        Item *item = calloc(1, sizeof(Item));
+        item->producer = producer;
+        item->seq = i;
+        queue_push(&queue, &item->node);
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    queue_init(&queue);
+
+    // test single threaded FIFO order
+    if (!queue_empty(&queue) || queue_pop(&queue) != NULL)
+    {
+        fprintf(stderr, "new queue should be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Item items[3];
+    for (int i = 0; i < 3; i++)
+    {
+        items[i].seq = i;
+        queue_push(&queue, &items[i].node);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        Item *item = (Item *)queue_pop(&queue);
+        if (!item || item->seq != i)
+        {
+            fprintf(stderr, "items should be popped in FIFO order\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!queue_empty(&queue) || queue_pop(&queue) != NULL)
+    {
+        fprintf(stderr, "queue should be empty after popping all items\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test concurrent producers, every item must arrive once and in order per producer
+    pthread_t threads[NUM_PRODUCERS];
+    int ids[NUM_PRODUCERS];
+    int next_seq[NUM_PRODUCERS] = {0};
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, produce, &ids[i]);
+    }
+
+    int received = 0;
+    while (received < NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+    {
+        Item *item = (Item *)queue_pop(&queue);
+        if (!item)
+        {
+            continue;
+        }
+
+        if (item->seq != next_seq[item->producer])
+        {
+            fprintf(stderr, "items from one producer should be popped in order\n");
+            exit(EXIT_FAILURE);
+        }
+
+        next_seq[item->producer]++;
+        received++;
+        free(item);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (!queue_empty(&queue))
+    {
+        fprintf(stderr, "queue should be empty after all items were received\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // All tests passed
+    printf("All tests passed\n");
+}
@@ -10,7 +10,14 @@
 
 void handle_sigint()
 {
-    // close the server socket
+    // close the server socket(s)
+    for (int i = 0; event_loops && i < num_loops; i++)
+    {
+        if (event_loops[i].listen_fd != server_socket)
+        {
+            close(event_loops[i].listen_fd);
+        }
+    }
     close(server_socket);
 
     // close all client connections
@@ -19,12 +26,15 @@ void handle_sigint()
         if (fd2conn[i])
         {
             close(fd2conn[i]->fd);
-            free(fd2conn[i]);
+            conn_free(fd2conn[i]);
         }
     }
 
-    // free the global table
-    hfree_table(global_table);
+    // free the global table, with several event loops the other loop threads may still be using their shards, so leave them to the OS
+    if (event_loops && num_loops == 1)
+    {
+        hfree_table(event_loops[0].table);
+    }
 
     // close the aof file
     aof_close(global_aof);
@@ -35,70 +45,39 @@ void handle_sigint()
     exit(EXIT_SUCCESS);
 }
 
-// Event loop for the server
-int main(int argc, char *argv[])
+/**
+ * @brief Creates a non-blocking listening socket bound to the server port
+ *
+ * @param reuse_addr set SO_REUSEADDR, only for debugging
+ * @param reuse_port set SO_REUSEPORT, so that several sockets can listen on the port and the kernel spreads new connections between them
+ *
+ * @return int file descriptor of the listening socket
+ */
+int create_listen_socket(bool reuse_addr, bool reuse_port)
 {
-    signal(SIGINT, handle_sigint);
-    int debugMode = 0;
-
-    // Parse command line arguments for debug mode
-    for (int i = 1; i < argc; i++)
-    {
-        if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug"))
-        {
-            debugMode = 1;
-            break;
-        }
-    }
-
-    // create aof file if it does not exist
-    FILE *file = fopen(AOF_FILE, "a");
-    fclose(file);
-
-    // Initialize global structures
-    global_table = hcreate(INIT_TABLE_SIZE);
-    global_aof = aof_init(AOF_FILE, FLUSH_INTERVAL_SEC, "r");
-
-    // restore state of database from AOF file
-    aof_restore_db();
-
-    // change the aof back to append mode, so that new commands are appended to the file
-    aof_change_mode(global_aof, AOF_FILE, "a");
-
-    // set up for starting the aof thread in a detached state (so that it cleans up after itself without needing to be joined) since it is in an infinite loop
-    pthread_attr_t aof_thread_attr;
-    pthread_attr_init(&aof_thread_attr);
-    pthread_attr_setdetachstate(&aof_thread_attr, PTHREAD_CREATE_DETACHED);
-
-    // start the aof flushing thread in a detached state
-    int ret = pthread_create(&aof_thread, &aof_thread_attr, aof_flush, (void *)global_aof);
-    if (ret)
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
     {
-        fprintf(stderr, "Failed to create AOF flush thread\n");
+        perror("server socket creation failed");
         exit(EXIT_FAILURE);
     }
 
-    // initialize the server socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0)
+    int optval = 1;
+    if (reuse_addr && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0)
     {
-        perror("server socket creation failed");
+        perror("setsockopt failed");
         exit(EXIT_FAILURE);
     }
 
-    // set the socket options to allow address reuse, only for debugging
-    if (debugMode)
+    if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0)
     {
-        int optval = 1;
-        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0)
-        {
-            perror("setsockopt failed");
-            exit(EXIT_FAILURE);
-        }
+        perror("setsockopt failed");
+        exit(EXIT_FAILURE);
     }
 
     // define the server address
     struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
 
     server_address.sin_family = AF_INET;
     server_address.sin_port = htons(SERVERPORT);
@@ -107,95 +86,436 @@ int main(int argc, char *argv[])
     server_address.sin_addr.s_addr = htonl(INADDR_ANY);
 
     // bind the socket to the specified IP and port
-    if (bind(server_socket, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    if (bind(listen_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
     {
         perror("bind failed");
         exit(EXIT_FAILURE);
     };
 
     // listen for incoming connections, allow maximum number of connections allowed by the OS
-    if (listen(server_socket, SOMAXCONN) < 0)
+    if (listen(listen_fd, SOMAXCONN) < 0)
     {
         perror("listen failed");
         exit(EXIT_FAILURE);
     }
 
     // set the server socket to non-blocking
-    set_fd_nonblocking(server_socket);
+    set_fd_nonblocking(listen_fd);
 
-    // set up the poll arguments
-    struct pollfd poll_args[MAX_CLIENTS + 1];
-    memset(poll_args, 0, sizeof(poll_args));
+    return listen_fd;
+}
 
-    printf("Server running in debug mode? : %s\n", debugMode ? "true" : "false");
-    printf("Server listening on port %d\n", SERVERPORT);
+/**
+ * @brief Initializes an event loop, its epoll instance, wake up eventfd and shard of the keyspace
+ *
+ * @param loop event loop to initialize
+ * @param id index of the event loop
+ * @param listen_fd listening socket the loop accepts connections on
+ * @param shared_listener whether other loops accept on the same listening socket
+ */
+void event_loop_init(EventLoop *loop, int id, int listen_fd, bool shared_listener)
+{
+    loop->id = id;
+    loop->listen_fd = listen_fd;
+    loop->table = hcreate(INIT_TABLE_SIZE);
+    queue_init(&loop->inbox);
+
+    loop->epoll_fd = epoll_create1(0);
+    if (loop->epoll_fd < 0)
+    {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (loop->wake_fd < 0)
+    {
+        perror("eventfd failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // the loop itself is used as the event data of its wake up fd
+    struct epoll_event wake_event;
+    memset(&wake_event, 0, sizeof(wake_event));
+    wake_event.events = EPOLLIN;
+    wake_event.data.ptr = loop;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event) < 0)
+    {
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // register the server socket, level-triggered so that every pending connection keeps it ready. When the socket is shared, only one of the loops is woken up per connection
+    struct epoll_event server_event;
+    memset(&server_event, 0, sizeof(server_event));
+    server_event.events = EPOLLIN | (shared_listener ? EPOLLEXCLUSIVE : 0);
+    server_event.data.ptr = NULL;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &server_event) < 0)
+    {
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Runs an event loop, one loop runs per thread
+ *
+ * Client connections are registered once when accepted, so each iteration only visits the fds that are ready. The loop only executes commands against its own shard of the keyspace, requests for other shards are forwarded to the owning loop.
+ *
+ * @param arg event loop to run
+ */
+void *event_loop_run(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+
+    current_loop = loop;
+    global_table = loop->table;
+
+    struct epoll_event events[MAX_EVENTS];
 
-    // the event loop, note: there is only on server socket responsible for interating with other client fd's
     while (1)
     {
-        // prepare the arguments of the poll(), the first argument is the server socket, the events specifies that we are interested in reading from the server socket,
-        poll_args[0].fd = server_socket;
-        poll_args[0].events = POLLIN;
-        poll_args[0].revents = 0;
+        // while the shard or some of its hashes are being resized, don't block so the idle time can be spent rehashing them
+        int timeout = (loop->table->old_groups || loop->num_rehash_keys) ? 0 : 1000;
+        int num_events = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
 
-        // handle the client connections
-        for (int i = 0; i < MAX_CLIENTS; i++)
+        if (num_events < 0)
         {
-            if (!fd2conn[i])
+            if (errno == EINTR)
             {
                 continue;
             }
 
-            // set the poll arguments for the client fd
-            poll_args[i + 1].fd = fd2conn[i]->fd;
+            perror("epoll_wait failed");
+            exit(1);
+        }
 
-            // set the events to read from the client fd
-            poll_args[i + 1].events = fd2conn[i]->state == STATE_REQ ? POLLIN : POLLOUT;
+        if (num_events == 0 && (loop->table->old_groups || loop->num_rehash_keys))
+        {
+            loop_rehash_idle(loop);
+            continue;
+        }
+
+        for (int i = 0; i < num_events; i++)
+        {
+            void *data = events[i].data.ptr;
 
-            poll_args[i + 1].revents = 0;
+            if (!data)
+            {
+                // the server socket is ready, accept all pending connections
+                accept_new_connection(fd2conn, loop->listen_fd, loop->epoll_fd);
+                continue;
+            }
 
-            // make sure thhe OS listens to errors on the client fd
-            poll_args[i].events |= POLLERR;
+            if (data == loop)
+            {
+                // other loops sent requests or responses
+                loop_process_inbox(loop);
+                continue;
+            }
+
+            Conn *conn = (Conn *)data;
+            enum Conn_State prev_state = conn->state;
+
+            connection_io(conn);
+
+            conn_after_io(loop->epoll_fd, conn, prev_state);
         }
 
-        // call poll() to wait for events
-        int ret = poll(poll_args, MAX_CLIENTS + 1, 1000);
+        // hand the commands logged in this iteration to the AOF thread, with appendfsync always the replies are only sent once they are durable
+        loop_release_replies(loop);
 
-        if (ret < 0)
+        // rewrite the AOF in the background once it grew past the auto-aof-rewrite thresholds
+        if (loop->id == 0 && aof_rewrite_due(global_aof))
         {
-            perror("poll failed");
-            exit(1);
+            aof_rewrite_background(aof_use_snapshot);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parses a size in bytes, optionally followed by a kb, mb or gb unit
+ *
+ * @param str size to parse, e.g. "64mb"
+ *
+ * @return long size in bytes, -1 if the size is invalid
+ */
+long parse_size(char *str)
+{
+    char *end;
+    long size = strtol(str, &end, 10);
+
+    if (end == str || size < 0)
+    {
+        return -1;
+    }
+
+    if (!strcasecmp(end, "kb"))
+    {
+        return size * 1024;
+    }
+
+    if (!strcasecmp(end, "mb"))
+    {
+        return size * 1024 * 1024;
+    }
+
+    if (!strcasecmp(end, "gb"))
+    {
+        return size * 1024 * 1024 * 1024;
+    }
+
+    return *end == '\0' ? size : -1;
+}
+
+// Event loop for the server
+int main(int argc, char *argv[])
+{
+    signal(SIGINT, handle_sigint);
+
+    // writes to a client that disconnected are handled as write errors
+    signal(SIGPIPE, SIG_IGN);
+
+    int debugMode = 0;
+    int reusePort = 0;
+    AOFFsyncPolicy fsyncPolicy = AOF_FSYNC_EVERYSEC;
+    int rewritePercentage = AOF_REWRITE_PERCENTAGE;
+    long rewriteMinSize = AOF_REWRITE_MIN_SIZE;
+    int restoreBenchmark = 0;
+
+    // Parse command line arguments for debug mode, the number of event loops, listener sharding, the fsync policy of the AOF and when it is rewritten
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug"))
+        {
+            debugMode = 1;
+        }
+        else if (!strcmp(argv[i], "--reuseport"))
+        {
+            reusePort = 1;
         }
+        else if (!strcmp(argv[i], "--restore-benchmark"))
+        {
+            restoreBenchmark = 1;
+        }
+        else if ((!strcmp(argv[i], "-t") || !strcmp(argv[i], "--threads")) && i + 1 < argc)
+        {
+            num_loops = atoi(argv[++i]);
 
-        // process ready client connections
-        for (int i = 1; i < MAX_CLIENTS + 1; i++)
+            if (num_loops < 1 || num_loops > MAX_LOOPS)
+            {
+                fprintf(stderr, "Number of threads must be between 1 and %d\n", MAX_LOOPS);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--appendfsync") && i + 1 < argc)
         {
-            if (poll_args[i].revents == 0)
+            int policy = aof_fsync_policy_from_name(argv[++i]);
+
+            if (policy < 0)
             {
-                // no events on this fd, not interested
-                continue;
+                fprintf(stderr, "appendfsync must be one of always, everysec or no\n");
+                exit(EXIT_FAILURE);
             }
 
-            Conn *conn = fd2conn[i - 1];
+            fsyncPolicy = policy;
+        }
+        else if (!strcmp(argv[i], "--zset-engine") && i + 1 < argc)
+        {
+            int engine = zset_engine_from_name(argv[++i]);
 
-            connection_io(conn);
+            if (engine < 0)
+            {
+                fprintf(stderr, "zset-engine must be avl or skiplist\n");
+                exit(EXIT_FAILURE);
+            }
+
+            zset_default_engine = engine;
+        }
+        else if (!strcmp(argv[i], "--zset-max-compact-entries") && i + 1 < argc)
+        {
+            zset_max_compact_entries = atoi(argv[++i]);
+
+            if (zset_max_compact_entries < 0)
+            {
+                fprintf(stderr, "zset-max-compact-entries must not be negative, 0 disables compact sorted sets\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--zset-max-compact-value") && i + 1 < argc)
+        {
+            zset_max_compact_value = atoi(argv[++i]);
+
+            if (zset_max_compact_value < 0)
+            {
+                fprintf(stderr, "zset-max-compact-value must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--hash-max-compact-fields") && i + 1 < argc)
+        {
+            hmap_max_compact_fields = atoi(argv[++i]);
 
-            if (conn->state == STATE_DONE)
+            if (hmap_max_compact_fields < 0)
             {
-                // close the connection
-                close(conn->fd);
-                free(conn);
-                fd2conn[i - 1] = 0;
-                memset(&poll_args[i], 0, sizeof(poll_args[i]));
+                fprintf(stderr, "hash-max-compact-fields must not be negative, 0 disables compact hashes\n");
+                exit(EXIT_FAILURE);
             }
         }
+        else if (!strcmp(argv[i], "--hash-max-compact-value") && i + 1 < argc)
+        {
+            hmap_max_compact_value = atoi(argv[++i]);
 
-        // try to accept new connections if server socket is ready
-        if (poll_args[0].revents)
+            if (hmap_max_compact_value < 0)
+            {
+                fprintf(stderr, "hash-max-compact-value must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--aof-snapshot-preamble") && i + 1 < argc)
         {
-            accept_new_connection(fd2conn, server_socket);
+            i++;
+            if (strcmp(argv[i], "yes") && strcmp(argv[i], "no"))
+            {
+                fprintf(stderr, "aof-snapshot-preamble must be yes or no\n");
+                exit(EXIT_FAILURE);
+            }
+
+            aof_use_snapshot = !strcmp(argv[i], "yes");
         }
+        else if (!strcmp(argv[i], "--auto-aof-rewrite-percentage") && i + 1 < argc)
+        {
+            rewritePercentage = atoi(argv[++i]);
+
+            if (rewritePercentage < 0)
+            {
+                fprintf(stderr, "auto-aof-rewrite-percentage must not be negative, 0 disables the automatic rewrite\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--auto-aof-rewrite-min-size") && i + 1 < argc)
+        {
+            rewriteMinSize = parse_size(argv[++i]);
+
+            if (rewriteMinSize < 0)
+            {
+                fprintf(stderr, "auto-aof-rewrite-min-size must be a size in bytes, optionally followed by kb, mb or gb\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    // seed the hash function, so that clients can't pick keys that collide in the hash tables
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+    {
+        seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    hash_set_seed(seed);
+
+    // create aof file if it does not exist
+    FILE *file = fopen(AOF_FILE, "a");
+    fclose(file);
+
+    // initialize the server socket, with --reuseport every event loop gets its own listening socket on the same port
+    server_socket = create_listen_socket(debugMode, reusePort);
+
+    // Initialize global structures, each event loop owns one shard of the keyspace
+    event_loops = calloc(num_loops, sizeof(EventLoop));
+    if (!event_loops)
+    {
+        fprintf(stderr, "Failed to allocate memory for event loops\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_loops; i++)
+    {
+        int listen_fd = (reusePort && i > 0) ? create_listen_socket(debugMode, reusePort) : server_socket;
+
+        event_loop_init(&event_loops[i], i, listen_fd, !reusePort && num_loops > 1);
     }
 
+    global_table = event_loops[0].table;
+    global_aof = aof_init(AOF_FILE, FLUSH_INTERVAL_SEC, "r");
+    global_aof->fsync_policy = fsyncPolicy;
+    global_aof->on_sync = aof_synced;
+    global_aof->rewrite_percentage = rewritePercentage;
+    global_aof->rewrite_min_size = rewriteMinSize;
+
+    // restore state of database from AOF file
+    struct timespec restore_start, restore_end;
+    clock_gettime(CLOCK_MONOTONIC, &restore_start);
+
+    long restored_lines = aof_restore_db();
+
+    clock_gettime(CLOCK_MONOTONIC, &restore_end);
+
+    // with --restore-benchmark, report how fast the AOF was replayed and exit without serving
+    if (restoreBenchmark)
+    {
+        double seconds = (restore_end.tv_sec - restore_start.tv_sec) + (restore_end.tv_nsec - restore_start.tv_nsec) / 1e9;
+        long num_keys = 0;
+        for (int i = 0; i < num_loops; i++)
+        {
+            num_keys += event_loops[i].table->size;
+        }
+
+        printf("Restored %ld keys from the AOF in %.3f s with %d thread(s)\n", num_keys, seconds, num_loops);
+        printf("Replayed %ld command lines, %.0f lines/sec\n", restored_lines, seconds > 0 ? restored_lines / seconds : 0);
+
+        aof_close(global_aof);
+        exit(EXIT_SUCCESS);
+    }
+
+    // change the aof back to append mode, so that new commands are appended to the file
+    aof_change_mode(global_aof, AOF_FILE, "a");
+
+    // set up for starting the aof thread in a detached state (so that it cleans up after itself without needing to be joined) since it is in an infinite loop
+    pthread_attr_t aof_thread_attr;
+    pthread_attr_init(&aof_thread_attr);
+    pthread_attr_setdetachstate(&aof_thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // start the aof thread in a detached state, it drains the rings the event loops append to and syncs the file according to appendfsync
+    int ret = pthread_create(&aof_thread, &aof_thread_attr, aof_flush, (void *)global_aof);
+    if (ret)
+    {
+        fprintf(stderr, "Failed to create AOF flush thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Server running in debug mode? : %s\n", debugMode ? "true" : "false");
+    printf("Server listening on port %d with %d event loop(s)%s\n", SERVERPORT, num_loops, reusePort ? ", one SO_REUSEPORT listener per loop" : "");
+    printf("AOF appendfsync: %s\n", aof_fsync_policy_name(fsyncPolicy));
+    printf("Sorted set engine: %s, compact up to %d members of at most %d bytes\n", zset_engine_name(zset_default_engine), zset_max_compact_entries, zset_max_compact_value);
+    printf("Hashes compact up to %d fields of at most %d bytes\n", hmap_max_compact_fields, hmap_max_compact_value);
+    if (rewritePercentage > 0)
+    {
+        printf("AOF auto rewrite: at %d%% growth, once at least %ld bytes\n", rewritePercentage, rewriteMinSize);
+    }
+
+    // start the other event loops, SIGINT is blocked in them so the main thread handles it
+    sigset_t sigint_set, old_set;
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint_set, &old_set);
+
+    for (int i = 1; i < num_loops; i++)
+    {
+        if (pthread_create(&event_loops[i].thread, NULL, event_loop_run, &event_loops[i]))
+        {
+            fprintf(stderr, "Failed to create event loop thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+    // the main thread runs the first event loop
+    event_loop_run(&event_loops[0]);
+
     return 0;
 }
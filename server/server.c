@@ -4,8 +4,14 @@
 #include "../protocol.h"
 
 // global variables
-HashTable *global_table;
+__thread HashTable *global_table;
+__thread EventLoop *current_loop = NULL;
+__thread Arena response_arena;
+EventLoop *event_loops = NULL;
+int num_loops = 1;
 AOF *global_aof;
+// rewrites of the AOF start with a binary snapshot of the keyspace instead of commands
+bool aof_use_snapshot = true;
 pthread_t aof_thread;
 int server_socket;
 Conn *fd2conn[MAX_CLIENTS] = {0};
@@ -44,60 +50,122 @@ void set_fd_nonblocking(int fd)
 }
 
 /**
- * @brief Accept a new pending client connection and add it to the list of client connections
+ * @brief Register, modify or remove the epoll interest of a connection
  *
- * @param fd2conn array of client connections
- * @param server_socket file descriptor of the server socket
+ * Connections are registered edge-triggered, so the kernel only reports a fd when it becomes ready. The interest is EPOLLIN while the connection is waiting for a request and EPOLLOUT while it has a response to flush. The connection itself is stored as the event data, so the event loop never has to look it up.
  *
- * @return int 0 on success, -1 on failure
+ * @param epoll_fd epoll instance of the event loop
+ * @param conn connection object
+ * @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
  */
-int accept_new_connection(Conn *fd2conn[], int server_socket)
+void conn_update_events(int epoll_fd, Conn *conn, int op)
 {
-    // accept the new connection
-    struct sockaddr_in client_address;
-    socklen_t client_address_len = sizeof(client_address);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
 
-    int confd = accept(server_socket, (struct sockaddr *)&client_address, &client_address_len);
-    if (confd < 0)
+    // a connection waiting on another loop keeps EPOLLIN, input is drained once the response was written
+    event.events = (conn->state == STATE_RESP ? EPOLLOUT : EPOLLIN) | EPOLLET;
+    event.data.ptr = conn;
+
+    if (epoll_ctl(epoll_fd, op, conn->fd, &event) < 0)
     {
-        perror("accept failed");
-        return -1;
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
     }
+}
 
-    // set the new connection to non-blocking
-    set_fd_nonblocking(confd);
+/**
+ * @brief Accept all pending client connections and add them to the list of client connections
+ *
+ * Connections are accepted until the backlog of the server socket is drained (EAGAIN), so a burst of reconnecting clients does not cost one event loop wakeup per connection. Each connection is stored in fd2conn at the index of its file descriptor and registered once with the epoll instance of the event loop.
+ *
+ * @param fd2conn array of client connections, indexed by file descriptor
+ * @param server_socket file descriptor of the server socket
+ * @param epoll_fd epoll instance to register the new connections with
+ *
+ * @return int number of connections accepted, -1 on failure
+ */
+int accept_new_connection(Conn *fd2conn[], int server_socket, int epoll_fd)
+{
+    int accepted = 0;
 
-    // find an empty slot in the fd2conn array
-    int i;
-    for (i = 0; i < MAX_CLIENTS; i++)
+    while (1)
     {
-        if (!fd2conn[i])
+        // accept the new connection
+        struct sockaddr_in client_address;
+        socklen_t client_address_len = sizeof(client_address);
+
+        int confd = accept(server_socket, (struct sockaddr *)&client_address, &client_address_len);
+        if (confd < 0)
         {
-            break;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // no more pending connections, or another event loop accepted them first
+                return accepted;
+            }
+
+            perror("accept failed");
+            return -1;
         }
-    }
 
-    if (i == MAX_CLIENTS)
-    {
-        fprintf(stderr, "Too many clients\n");
-        close(confd);
-        return -1;
+        // the fd is used as the index into fd2conn
+        if (confd >= MAX_CLIENTS)
+        {
+            fprintf(stderr, "Too many clients\n");
+            close(confd);
+            continue;
+        }
+
+        // set the new connection to non-blocking
+        set_fd_nonblocking(confd);
+
+        // create a new connection object
+        Conn *conn = (Conn *)calloc(1, sizeof(Conn));
+        if (!conn)
+        {
+            fprintf(stderr, "Failed to allocate memory for connection\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = confd;
+        conn->state = STATE_REQ;
+
+        // add the connection to the fd2conn array
+        fd2conn[confd] = conn;
+
+        // register the connection with the event loop, it stays registered until it is closed
+        conn_update_events(epoll_fd, conn, EPOLL_CTL_ADD);
+
+        accepted++;
     }
+}
 
-    // create a new connection object
-    Conn *conn = (Conn *)calloc(1, sizeof(Conn));
-    if (!conn)
+/**
+ * @brief Resumes reading requests on a connection after its response was flushed
+ *
+ * Processes the pipelined requests that are already buffered, then drains the socket. Needed since with edge-triggered epoll the readiness of the socket may have been reported while the connection was busy writing.
+ *
+ * @param conn connection object
+ */
+void conn_resume_requests(Conn *conn)
+{
+    if (conn->state != STATE_REQ)
     {
-        fprintf(stderr, "Failed to allocate memory for connection\n");
-        exit(EXIT_FAILURE);
+        return;
     }
-    conn->fd = confd;
-    conn->state = STATE_REQ;
 
-    // add the connection to the fd2conn array
-    fd2conn[i] = conn;
+    while (try_process_single_request(conn))
+    {
+    };
 
-    return 0;
+    if (conn->state == STATE_REQ)
+    {
+        state_req(conn);
+    }
 }
 
 /**
@@ -114,6 +182,14 @@ void connection_io(Conn *conn)
     else if (conn->state == STATE_RESP)
     {
         state_resp(conn);
+
+        // the response was flushed, the edge for pending input may already have been consumed
+        conn_resume_requests(conn);
+    }
+    else if (conn->state == STATE_WAIT)
+    {
+        // the response is produced by another event loop, input is handled once it arrives
+        return;
     }
     else
     {
@@ -123,6 +199,86 @@ void connection_io(Conn *conn)
     }
 }
 
+/**
+ * @brief Allocates a response from the response arena of the current thread
+ *
+ * The size of the response is kept in front of it, so it can be written out without walking its elements. The response is valid until the arena is reset by response_arena_reset(), responses that outlive the request are copied with response_detach().
+ *
+ * @param size size of the response in bytes
+ *
+ * @return char* the response, not zeroed
+ */
+char *response_alloc(int size)
+{
+    char *response = (char *)arena_alloc(&response_arena, RESPONSE_HEADER_SIZE + size) + RESPONSE_HEADER_SIZE;
+    memcpy(response - RESPONSE_HEADER_SIZE, &size, sizeof(int));
+
+    return response;
+}
+
+/**
+ * @brief Returns the size of a response in bytes
+ *
+ * @param response response allocated by response_alloc() or response_detach()
+ *
+ * @return int size of the response
+ */
+int response_size(char *response)
+{
+    int size = 0;
+    memcpy(&size, response - RESPONSE_HEADER_SIZE, sizeof(int));
+
+    return size;
+}
+
+/**
+ * @brief Moves a response out of the response arena, for responses that outlive the request like the ones sent to other event loops
+ *
+ * @param response response to detach
+ *
+ * @return char* heap allocated copy of the response, or the response itself if it is not in the arena. Freed with response_free()
+ */
+char *response_detach(char *response)
+{
+    if (!response || !arena_owns(&response_arena, response))
+    {
+        return response;
+    }
+
+    int size = response_size(response);
+    char *copy = malloc(RESPONSE_HEADER_SIZE + size);
+    if (!copy)
+    {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(copy, response - RESPONSE_HEADER_SIZE, RESPONSE_HEADER_SIZE + size);
+
+    return copy + RESPONSE_HEADER_SIZE;
+}
+
+/**
+ * @brief Frees a response, responses in the response arena are released all at once by response_arena_reset()
+ *
+ * @param response response to free, may be NULL
+ */
+void response_free(char *response)
+{
+    if (response && !arena_owns(&response_arena, response))
+    {
+        free(response - RESPONSE_HEADER_SIZE);
+    }
+}
+
+/**
+ * @brief Releases the responses of the current thread, once the response of a request was written out
+ */
+void response_arena_reset()
+{
+    arena_reset(&response_arena);
+}
+
 /**
  * @brief Creates an array response with 0 elements (empty array)
  *
@@ -134,14 +290,7 @@ char *empty_array_response()
     SerialType type = SER_ARR;
     int num_elements = 0;
 
-    // null terminate the response
-    char *response = calloc(1 + 4, sizeof(char));
-
-    if (!response)
-    {
-        fprintf(stderr, "Failed to allocate memory for empty array response\n");
-        exit(EXIT_FAILURE);
-    }
+    char *response = response_alloc(1 + 4);
 
     // write the type of the response, 1 byte
     memcpy(response, &type, 1);
@@ -152,59 +301,80 @@ char *empty_array_response()
     return response;
 }
 
+/**
+ * @brief Generates a response holding a single value according to the liteDB protocol
+ *
+ * @param ser_type type of the response
+ * @param value bytes of the value, will NOT be freed after memcpy to the response
+ * @param value_len number of bytes of the value
+ *
+ * @return char* response
+ */
+char *value_response(SerialType ser_type, const void *value, int value_len)
+{
+    char *response = response_alloc(1 + 4 + value_len);
+
+    // write the type of the response, 1 byte
+    memcpy(response, &ser_type, 1);
+
+    // write the length of the value, 4 bytes
+    memcpy(response + 1, &value_len, 4);
+
+    // write the value
+    memcpy(response + 1 + 4, value, value_len);
+
+    return response;
+}
+
 /**
  * @brief Generates a value response according to the liteDB protocol
  *
  *  See README for more information on protocol
  *
  * @param type type of the value
- * @param value value to send to the client, will NOT be freed after memcpy to the response
+ * @param value value to send to the client, a string, an int64_t for INTEGER or a double for FLOAT, will NOT be freed after memcpy to the response
  *
  * @return char* response
  */
 char *get_response(ValueType type, void *value)
 {
-    SerialType ser_type;
-    int value_len = 0;
-
     switch (type)
     {
     case STRING:
-        ser_type = SER_STR;
-        value_len = strlen(value);
-        break;
+        return value_response(SER_STR, value, strlen(value));
     case INTEGER:
-        ser_type = SER_INT;
-        value_len = sizeof(int);
-        break;
+        // numbers have a single width on the wire, integers are 64 bit and floats are doubles
+        return value_response(SER_INT, value, sizeof(int64_t));
     case FLOAT:
-        ser_type = SER_FLOAT;
-        value_len = sizeof(float);
-        break;
+        return value_response(SER_FLOAT, value, sizeof(double));
     default:
         fprintf(stderr, "Invalid value type\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    // null terminate the response
-    char *response = calloc(1 + 4 + value_len, sizeof(char));
-
-    if (!response)
-    {
-        fprintf(stderr, "Failed to allocate memory for get response\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // write the type of the response, 1 byte
-    memcpy(response, &ser_type, 1);
-
-    // write the length of the value, 4 bytes
-    memcpy(response + 1, &value_len, 4);
-
-    // write the value
-    memcpy(response + 1 + 4, value, value_len);
+/**
+ * @brief Generates an integer response holding a 64 bit integer, like the values of counters
+ *
+ * @param value integer to send to the client
+ *
+ * @return char* response
+ */
+char *int64_response(int64_t value)
+{
+    return value_response(SER_INT, &value, sizeof(int64_t));
+}
 
-    return response;
+/**
+ * @brief Generates a float response holding a double, like the values of float counters
+ *
+ * @param value number to send to the client
+ *
+ * @return char* response
+ */
+char *double_response(double value)
+{
+    return value_response(SER_FLOAT, &value, sizeof(double));
 }
 
 /**
@@ -234,14 +404,7 @@ char *null_response()
     SerialType type = SER_NIL;
     int value_len = 0;
 
-    // null terminate the response
-    char *response = calloc(1 + 4, sizeof(char));
-
-    if (!response)
-    {
-        fprintf(stderr, "Failed to allocate memory for set response\n");
-        exit(EXIT_FAILURE);
-    }
+    char *response = response_alloc(1 + 4);
 
     // write the type of the response, 1 byte
     memcpy(response, &type, 1);
@@ -266,14 +429,7 @@ char *error_response(char *err_msg)
     SerialType type = SER_ERR;
     int err_msg_len = strlen(err_msg);
 
-    // null terminate the response
-    char *response = calloc(1 + 4 + err_msg_len, sizeof(char));
-
-    if (!response)
-    {
-        fprintf(stderr, "Failed to allocate memory for error response\n");
-        exit(EXIT_FAILURE);
-    }
+    char *response = response_alloc(1 + 4 + err_msg_len);
 
     // write the type of the response, 1 byte
     memcpy(response, &type, 1);
@@ -287,59 +443,209 @@ char *error_response(char *err_msg)
     return response;
 }
 
-// Parse a request from the client(not null terminated) , need to free the returned command and it's args
 /**
- * @brief Parse an input string from the client into a Command struct
- *
- * Spaces are used as a delimiter to toknize the characters in the input string,
- * The first token is expected to be the command name, and the rest are expected to be the arguments.
+ * @brief Initializes an empty, growable array response
  *
- * @param cmd_string input string from the client
- * @param size size of the input string
+ * @param arr array response to initialize
+ */
+void array_response_init(ArrayResponse *arr)
+{
+    arr->capacity = 1 + 4 + 256;
+    arr->data = response_alloc(arr->capacity);
+
+    // leave room for the type and length of the array, written by array_response_finish()
+    arr->size = 1 + 4;
+    arr->num_elements = 0;
+}
+
+/**
+ * @brief Appends an element to an array response, growing the response as needed
  *
- * @return Command* - parsed command
+ * @param arr array response to append to
+ * @param type type of the element
+ * @param value value of the element, copied into the response
+ * @param value_len length of the value in bytes
  */
-Command *parse_cmd_string(char *cmd_string, int size)
+void array_response_add(ArrayResponse *arr, SerialType type, void *value, int value_len)
 {
-    Command *cmd = calloc(1, sizeof(Command));
-    if (!cmd)
+    if (arr->size + 5 + value_len > arr->capacity)
     {
-        fprintf(stderr, "Failed to allocate memory for Command\n");
-        exit(EXIT_FAILURE);
-    }
+        int new_capacity = arr->capacity * 2;
+        while (arr->size + 5 + value_len > new_capacity)
+        {
+            new_capacity *= 2;
+        }
 
-    // Create a new null-terminated string to hold the command string
-    char *n_cmd_string = calloc(size + 1, sizeof(char));
-    if (!n_cmd_string)
-    {
-        fprintf(stderr, "Failed to allocate memory for n_cmd_string\n");
-        exit(EXIT_FAILURE);
+        // the array is usually the last allocation of the arena, so it grows in place
+        char *header = arena_grow(&response_arena, arr->data - RESPONSE_HEADER_SIZE, RESPONSE_HEADER_SIZE + arr->capacity, RESPONSE_HEADER_SIZE + new_capacity);
+
+        arr->data = header + RESPONSE_HEADER_SIZE;
+        arr->capacity = new_capacity;
     }
-    strncpy(n_cmd_string, cmd_string, size);
 
-    // Tokenize the command string by splitting at spaces
-    char *token = strtok(n_cmd_string, " ");
-    int args = 0;
+    // write the type and length of the element, then the element itself
+    memcpy(arr->data + arr->size, &type, 1);
+    memcpy(arr->data + arr->size + 1, &value_len, 4);
+    memcpy(arr->data + arr->size + 5, value, value_len);
+
+    arr->size += 5 + value_len;
+    arr->num_elements++;
+}
+
+/**
+ * @brief Writes the header of an array response and returns it
+ *
+ * @param arr array response to finish
+ *
+ * @return char* response
+ */
+char *array_response_finish(ArrayResponse *arr)
+{
+    SerialType type = SER_ARR;
+    memcpy(arr->data, &type, 1);
+    memcpy(arr->data + 1, &arr->num_elements, 4);
+
+    // the size of the response is the size of its elements, not the capacity it was allocated with
+    memcpy(arr->data - RESPONSE_HEADER_SIZE, &arr->size, sizeof(int));
+
+    return arr->data;
+}
+
+/**
+ * @brief Parse a request from the client into a Command struct, in place and without allocating
+ *
+ * Spaces are used as a delimiter to tokenize the request, the first token is the command name and the rest are the arguments. Each token is null terminated in place by overwriting the delimiter after it, so the name and args of the command point into the request itself. The byte after the request (cmd_string[size]) must be writable, it is overwritten with the terminator of the last token.
+ *
+ * @param cmd_string request from the client, not null terminated
+ * @param size size of the request
+ * @param cmd Command to fill in, usually on the stack of the caller. The arguments are stored in the command itself unless there are more than CMD_INLINE_ARGS of them, call cmd_release() once done with it
+ */
+void parse_cmd(char *cmd_string, int size, Command *cmd)
+{
+    cmd->name = NULL;
+    cmd->name_len = 0;
+    cmd->num_args = 0;
+    cmd->args = cmd->inline_args;
+    cmd->arg_lens = cmd->inline_arg_lens;
+    cmd->args_capacity = CMD_INLINE_ARGS;
+
+    char *end = cmd_string + size;
+    char *cur = cmd_string;
 
-    while (token != NULL)
+    while (cur < end)
     {
-        if (args == 0)
+        // skip the delimiters before the token
+        if (*cur == ' ')
+        {
+            cur++;
+            continue;
+        }
+
+        char *token = cur;
+        char *token_end = memchr(cur, ' ', end - cur);
+        if (!token_end)
         {
-            cmd->name = strdup(token); // Use strdup for convenience
+            token_end = end;
+        }
+
+        int token_len = token_end - token;
+
+        if (!cmd->name)
+        {
+            cmd->name = token;
+            cmd->name_len = token_len;
         }
         else
         {
-            cmd->args[args - 1] = strdup(token); // Assuming args array is preallocated
+            if (cmd->num_args == cmd->args_capacity)
+            {
+                cmd_grow_args(cmd);
+            }
+
+            cmd->args[cmd->num_args] = token;
+            cmd->arg_lens[cmd->num_args] = token_len;
+            cmd->num_args++;
         }
-        token = strtok(NULL, " ");
-        args++;
+
+        // terminate the token, the delimiter (or the byte after the request) is overwritten
+        *token_end = '\0';
+        cur = token_end + 1;
+    }
+}
+
+/**
+ * @brief Doubles the number of arguments a command can hold, moving its argv from the command itself to the heap the first time
+ *
+ * @param cmd command being parsed
+ */
+void cmd_grow_args(Command *cmd)
+{
+    int capacity = cmd->args_capacity * 2;
+
+    char **args = malloc(capacity * sizeof(char *));
+    int *arg_lens = malloc(capacity * sizeof(int));
+    if (!args || !arg_lens)
+    {
+        fprintf(stderr, "Failed to allocate memory for command arguments\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(args, cmd->args, cmd->num_args * sizeof(char *));
+    memcpy(arg_lens, cmd->arg_lens, cmd->num_args * sizeof(int));
+
+    cmd_release(cmd);
+
+    cmd->args = args;
+    cmd->arg_lens = arg_lens;
+    cmd->args_capacity = capacity;
+}
+
+/**
+ * @brief Frees the argv of a command if it was moved to the heap, the arguments themselves belong to the request
+ *
+ * @param cmd parsed command
+ */
+void cmd_release(Command *cmd)
+{
+    if (cmd->args != cmd->inline_args)
+    {
+        free(cmd->args);
+        free(cmd->arg_lens);
+    }
+
+    cmd->args = cmd->inline_args;
+    cmd->arg_lens = cmd->inline_arg_lens;
+    cmd->args_capacity = CMD_INLINE_ARGS;
+}
+
+/**
+ * @brief Writes a parsed command back into its request form, the tokens are separated by single spaces
+ *
+ * @param cmd parsed command
+ * @param out buffer to write to, must hold at least the size of the request the command was parsed from
+ *
+ * @return int number of bytes written, the output is not null terminated
+ */
+int serialize_cmd(Command *cmd, char *out)
+{
+    int size = 0;
+
+    if (!cmd->name)
+    {
+        return 0;
     }
 
-    cmd->num_args = args - 1;
+    memcpy(out, cmd->name, cmd->name_len);
+    size += cmd->name_len;
 
-    free(n_cmd_string);
+    for (int i = 0; i < cmd->num_args; i++)
+    {
+        out[size++] = ' ';
+        memcpy(out + size, cmd->args[i], cmd->arg_lens[i]);
+        size += cmd->arg_lens[i];
+    }
 
-    return cmd;
+    return size;
 }
 
 /**
@@ -359,23 +665,24 @@ void handle_aof_write(Command *cmd)
         exit(EXIT_FAILURE);
     }
 
-    // create a string from the command
-    char message[MAX_MESSAGE_SIZE + 1] = {'\0'};
-
-    // write the command name
-    snprintf(message, MAX_MESSAGE_SIZE, "%s", cmd->name);
-
-    // write the command arguments
+    // the record is the command followed by a newline, serialized straight into the ring of this thread
+    int size = cmd->name_len + 1;
     for (int i = 0; i < cmd->num_args; i++)
     {
-        snprintf(message + strlen(message), MAX_MESSAGE_SIZE - strlen(message) - 1, " %s", cmd->args[i]);
+        size += 1 + cmd->arg_lens[i];
     }
 
-    // write the final newline character`
-    snprintf(message + strlen(message), MAX_MESSAGE_SIZE - strlen(message) - 1, "\n");
+    char *record = aof_reserve(global_aof, size);
+    size = serialize_cmd(cmd, record);
+    record[size++] = '\n';
 
-    // write the command to the AOF
-    aof_write(global_aof, message);
+    // append the record to the AOF, replies sent by this loop from now on depend on it
+    long offset = aof_publish(global_aof, size);
+
+    if (current_loop && offset > current_loop->aof_offset)
+    {
+        current_loop->aof_offset = offset;
+    }
 }
 
 /**
@@ -398,9 +705,9 @@ void global_table_del(char *key, char *value, ValueType type)
     }
     else if (type == HASHTABLE)
     {
-        // free the hashtable, don't free the hashtable itself
-        HashTable *table = (HashTable *)value;
-        hfree_table_contents(table);
+        // free the fields of the hash, don't free the hash itself
+        HashMap *hash = (HashMap *)value;
+        hmap_free_contents(hash);
     }
     else if (type == LIST)
     {
@@ -417,133 +724,158 @@ void global_table_del(char *key, char *value, ValueType type)
 /**
  * @brief Ping command to check if the server is alive, returns PONG
  */
-char *ping_command()
+char *ping_command(Command *cmd, bool aof_restore)
 {
     ValueType type = STRING;
     return get_response(type, "PONG");
 }
 
 /**
- *  EXISTS (key) -  Checks if the specified key exists in the database. Returns an integer response, 1 if the key exists, 0 otherwise.
+ *  EXISTS (key [key ...]) -  Checks if the specified keys exist in the database. Returns an integer response, the number of keys that exist.
  *
- * @param cmd Command structure containing the (key)
+ * @param cmd Command structure containing the (key [key ...])
  * @return char* response
  */
-char *exists_command(Command *cmd)
+char *exists_command(Command *cmd, bool aof_restore)
 {
 
     ValueType response_type = INTEGER;
-    int elem_exists = 0;
+    int64_t elem_exists = 0;
 
-    if (cmd->num_args != 1)
+    for (int i = 0; i < cmd->num_args; i++)
     {
-        return error_response("exists command requires 1 argument (key)");
-    }
-
-    HashNode *fetched_node = hget(global_table, cmd->args[0]);
-    if (!fetched_node)
-    {
-        elem_exists = 0;
-    }
-    else
-    {
-        elem_exists = 1;
+        if (key_in_shard(cmd->args[i]) && hget(global_table, cmd->args[i]))
+        {
+            elem_exists++;
+        }
     }
 
     return get_response(response_type, &elem_exists);
 }
 
 /**
- * @brief Deletes a key-value pair from the global table ,where value is a string and handles AOF logging if necessary.
+ * @brief Deletes key-value pairs from the global table, whatever the type of their value.
  *
- * @param cmd Command structure containing the (key)
- * @param aof_restore Flag indicating whether to log the deletion to the AOF file.
+ * @param cmd Command structure containing the (key [key ...])
+ * @param aof_restore Flag indicating whether the command is restored from the AOF file.
  *
- * @return char* A string response indicating the number of elements removed, or NULL if AOF restore is enabled.
+ * @return char* A response indicating the number of keys removed. It is also returned during AOF restore, since every shard reports the keys it removed
  */
 char *del_command(Command *cmd, bool aof_restore)
 {
 
     ValueType response_type = INTEGER;
-    int elem_removed = 0;
+    int64_t elem_removed = 0;
 
-    if (cmd->num_args != 1)
+    for (int i = 0; i < cmd->num_args; i++)
     {
-        return error_response("del command requires 1 argument (key)");
-    }
+        if (!key_in_shard(cmd->args[i]))
+        {
+            continue;
+        }
 
-    HashNode *fetched_node = hget(global_table, cmd->args[0]);
-    if (!fetched_node)
-    {
-        return error_response("key not in database");
+        HashNode *fetched_node = hget(global_table, cmd->args[i]);
+        if (!fetched_node)
+        {
+            continue;
+        }
+
+        // execute delete
+        global_table_del(fetched_node->key, fetched_node->value, fetched_node->valueType);
+        elem_removed++;
     }
 
-    // execute delete
-    global_table_del(fetched_node->key, fetched_node->value, fetched_node->valueType);
-    elem_removed++;
+    return get_response(response_type, &elem_removed);
+}
 
-    if (!aof_restore)
-    {
-        handle_aof_write(cmd);
-        return get_response(response_type, &elem_removed);
-    }
-    else
+/**
+ * @brief Returns a protocol string containing all keys in the global hash table.
+ *
+ * @return char* Protocol string with keys.
+ */
+char *keys_command(Command *cmd, bool aof_restore)
+{
+    ArrayResponse arr;
+    array_response_init(&arr);
+
+    // iterate through the hash table and write the keys to the response
+    int pos = 0;
+    HashNode *node;
+
+    while ((node = hnext(global_table, &pos)) != NULL)
     {
-        return NULL;
+        array_response_add(&arr, SER_STR, node->key, strlen(node->key));
     }
+
+    return array_response_finish(&arr);
 }
 
 /**
- * @brief Returns a protocol string containing all keys in the global hash table.
+ * @brief Reports the occupancy of the slabs the nodes of every shard are allocated from. Returns an array with one string per object size, e.g. "size 48: 2 slabs, 1500/2728 used, occupancy 100% 10%", listing the occupancy of every slab
  *
- * @return char* Protocol string with keys.
+ * @return char* response
  */
-char *keys_command()
+char *slabstats_command(Command *cmd, bool aof_restore)
 {
-    // get all the keys in the hash table
-    int num_keys = 0;
-    int inc_buffer = 5;
+    // other event loops may create slabs in the meantime, those that don't fit are left out
+    int max_slabs = slab_occupancy(NULL, 0) + 16;
+
+    SlabInfo *info = malloc(sizeof(SlabInfo) * max_slabs);
+    if (!info)
+    {
+        fprintf(stderr, "Failed to allocate memory for slab stats\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int num_slabs = slab_occupancy(info, max_slabs);
+    if (num_slabs > max_slabs)
+    {
+        num_slabs = max_slabs;
+    }
+
+    ArrayResponse arr;
+    array_response_init(&arr);
 
-    // buffer for the data
-    char *buffer = calloc(1 + 4 + MAX_MESSAGE_SIZE, sizeof(char));
+    char line[MAX_MESSAGE_SIZE];
 
-    // iterate through the hash table and write the keys to the buffer
-    for (int i = 0; i <= global_table->mask; i++)
+    for (int class_index = 0; class_index < SLAB_NUM_CLASSES; class_index++)
     {
-        HashNode *traverseList = global_table->nodes[i];
+        uint32_t object_size = slab_class_size(class_index);
+        int slabs = 0;
+        long used = 0;
+        long capacity = 0;
 
-        while (traverseList != NULL)
+        for (int i = 0; i < num_slabs; i++)
         {
-            // write the key to the buffer
-            int type = SER_STR;
-            int key_len = strlen(traverseList->key);
-
-            // check if the buffer has enough space to write the key
-            if (inc_buffer + 5 + key_len > MAX_MESSAGE_SIZE)
+            if (info[i].object_size == object_size)
             {
-                fprintf(stderr, "Failed to reallocate memory for keys response\n");
-                exit(EXIT_FAILURE);
+                slabs++;
+                used += info[i].used;
+                capacity += info[i].capacity;
             }
+        }
 
-            // write the type and length of the response, 1 byte
-            memcpy(buffer + inc_buffer, &type, 1);
-            memcpy(buffer + inc_buffer + 1, &key_len, 4);
+        if (slabs == 0)
+        {
+            continue;
+        }
 
-            // write the key
-            memcpy(buffer + inc_buffer + 5, traverseList->key, key_len);
+        int len = snprintf(line, sizeof(line), "size %u: %d slabs, %ld/%ld used, occupancy", object_size, slabs, used, capacity);
 
-            inc_buffer += 5 + key_len;
-            num_keys++;
-            traverseList = traverseList->next;
+        for (int i = 0; i < num_slabs && len < (int)sizeof(line) - 8; i++)
+        {
+            if (info[i].object_size == object_size)
+            {
+                len += snprintf(line + len, sizeof(line) - len, " %d%%", (int)(100L * info[i].used / info[i].capacity));
+            }
         }
+
+        array_response_add(&arr, SER_STR, line, len);
     }
 
-    // write the type and length of array to buffer
-    int type = SER_ARR;
-    memcpy(buffer, &type, 1);
-    memcpy(buffer + 1, &num_keys, 4);
+    free(info);
 
-    return buffer;
+    return array_response_finish(&arr);
 }
 
 /**
@@ -556,25 +888,18 @@ char *keys_command()
  */
 char *flushall_cmd(Command *cmd, bool aof_restore)
 {
-    // iterate through the hash table and free all the nodes
-    for (int i = 0; i <= global_table->mask; i++)
-    {
-        HashNode *traverseList = global_table->nodes[i];
-
-        while (traverseList != NULL)
-        {
-            HashNode *next = traverseList->next;
-
-            // execute delete
-            global_table_del(traverseList->key, traverseList->value, traverseList->valueType);
+    // iterate through the hash table and free all the nodes, removing nodes while iterating is allowed
+    int pos = 0;
+    HashNode *node;
 
-            traverseList = next;
-        }
+    while ((node = hnext(global_table, &pos)) != NULL)
+    {
+        // execute delete
+        global_table_del(node->key, node->value, node->valueType);
     }
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return null_response();
     }
     else
@@ -584,21 +909,74 @@ char *flushall_cmd(Command *cmd, bool aof_restore)
 }
 
 /**
- * @brief Get the value of a key, it the key does not exist return nil. Returns the value
+ * @brief Starts rewriting the AOF in the background, the rewritten file starts with a binary snapshot of the keyspace, or with the fewest commands that restore it when snapshots are disabled
  *
- * @param cmd Command structure specifying the (key)
+ * @return char* response, an error if a rewrite is already running
+ */
+char *bgrewriteaof_command(Command *cmd, bool aof_restore)
+{
+    if (!aof_rewrite_background(aof_use_snapshot))
+    {
+        return error_response("Background AOF rewrite already in progress or could not be started");
+    }
+
+    char *msg = "Background append only file rewriting started";
+    return value_response(SER_STR, msg, strlen(msg));
+}
+
+/**
+ * @brief Saves a binary snapshot of the keyspace as the start of the AOF, the server waits until it is written
  *
- * @return char* response
+ * @return char* response, an error if a rewrite is already running or the snapshot could not be written
  */
-char *get_command(Command *cmd)
+char *save_command(Command *cmd, bool aof_restore)
 {
+    if (!aof_save())
+    {
+        return error_response("Snapshot could not be saved, or a rewrite is in progress");
+    }
+
+    return value_response(SER_STR, "OK", 2);
+}
 
-    // check if the command has the correct number of arguments
-    if (cmd->num_args != 1)
+/**
+ * @brief Saves a binary snapshot of the keyspace as the start of the AOF in the background
+ *
+ * @return char* response, an error if a rewrite is already running
+ */
+char *bgsave_command(Command *cmd, bool aof_restore)
+{
+    if (!aof_rewrite_background(true))
     {
-        return error_response("get command requires 1 argument (key)");
+        return error_response("Background save already in progress or could not be started");
     }
 
+    char *msg = "Background saving started";
+    return value_response(SER_STR, msg, strlen(msg));
+}
+
+/**
+ * @brief Returns the length of a string value
+ *
+ * @param node node holding a STRING value
+ *
+ * @return uint32_t length of the value, strings not stored in the node were allocated by hinit() and are null terminated
+ */
+uint32_t string_value_len(HashNode *node)
+{
+    return (node->flags & HN_VALUE_INLINE) ? node->valueLen : strlen(node->value);
+}
+
+/**
+ * @brief Get the value of a key, it the key does not exist return nil. Returns the value
+ *
+ * @param cmd Command structure specifying the (key)
+ *
+ * @return char* response
+ */
+char *get_command(Command *cmd, bool aof_restore)
+{
+
     // get the value from the hash table
     HashNode *fetched_node = hget(global_table, cmd->args[0]);
     if (!fetched_node)
@@ -609,195 +987,163 @@ char *get_command(Command *cmd)
     // get the value from the hash node
     ValueType type = fetched_node->valueType;
 
+    if (type == INTEGER || type == FLOAT)
+    {
+        // numbers are stored natively, the client gets them back the way they were set
+        char number[32];
+        int len = format_number(fetched_node, number, sizeof(number));
+
+        return value_response(SER_STR, number, len);
+    }
+
     if (type != STRING)
     {
         return error_response("Value for this key is not a string");
     }
 
-    char *value = fetched_node->value;
-
-    return get_response(type, value);
+    // the stored length is sent, so values holding null bytes come back whole
+    return value_response(SER_STR, fetched_node->value, string_value_len(fetched_node));
 }
 
 // returns null response for the set command
 
 /**
- * @brief Executes a SET command and optionally logs the action to the AOF file. All values are stored as strings in the global hashtable.
- *
- * @param cmd Command structure specifying the (key, value)
- * @param aof_restore Flag indicating whether to log the SET operation to the AOF file.
+ * @brief Parses a base 10 64 bit integer
  *
- * @return char* response if AOF restore is disabled, or NULL otherwise.
+ * @param str digits of the integer, optionally preceded by a minus sign
+ * @param len length of str
+ * @param out the parsed integer
+ * @param canonical only accept the shortest form of the integer, without leading zeros, so that printing the integer gives back str
  *
+ * @return bool true if str is an integer that fits in 64 bits, false otherwise
  */
-char *set_command(Command *cmd, bool aof_restore)
+bool parse_int64(const char *str, int len, int64_t *out, bool canonical)
 {
+    bool negative = len > 0 && str[0] == '-';
+    int i = negative ? 1 : 0;
 
-    // obtain type of the value
-    if (cmd->num_args != 2)
+    // at most 19 digits fit in 64 bits
+    if (len == i || len - i > 19)
     {
-        return error_response("set command requires 2 arguments (key, value)");
+        return false;
     }
 
-    // * All data is stored as strings except for the ZSET values
-    HashNode *new_node = hinit(strdup(cmd->args[0]), STRING, strdup(cmd->args[1]));
-    if (new_node == NULL)
+    if (canonical && str[i] == '0' && (len - i > 1 || negative))
     {
-        fprintf(stderr, "Error creating new node for hashtable\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
 
-    HashNode *ret = hinsert(global_table, new_node);
-    if (ret == NULL)
+    // accumulate as a negative number, which also covers INT64_MIN
+    int64_t value = 0;
+    for (; i < len; i++)
     {
-        return error_response("Failed to insert new node into global table");
-    }
+        if (str[i] < '0' || str[i] > '9')
+        {
+            return false;
+        }
 
-    if (!aof_restore)
-    {
-        handle_aof_write(cmd);
-        return null_response();
+        if (__builtin_mul_overflow(value, 10, &value) || __builtin_sub_overflow(value, str[i] - '0', &value))
+        {
+            return false;
+        }
     }
-    else
+
+    if (!negative && value == INT64_MIN)
     {
-        return NULL;
+        return false;
     }
+
+    *out = negative ? value : -value;
+    return true;
 }
 
 /**
- * The HEXISTS (key, field) command checks if a field exists in a hash . Returns an integer response indicating the number of fields found.
+ * @brief Parses a finite floating point number
  *
- * @param cmd Command structure specifying the (key, field)
- * @return char* response
+ * @param str the number, null terminated
+ * @param len length of str
+ * @param out the parsed number
+ *
+ * @return bool true if all of str is a finite number, false otherwise
  */
-char *hexists_command(Command *cmd)
+bool parse_double(const char *str, int len, double *out)
 {
-    int response_type = INTEGER;
-    int elem_exists = 0;
-
-    if (cmd->num_args < 2)
+    if (len == 0 || isspace((unsigned char)str[0]))
     {
-        return error_response("hexists command requires at least 2 arguments (key, field)");
+        return false;
     }
 
-    char *global_table_key = cmd->args[0];
-    char *field_key = cmd->args[1];
-
-    // fetch the hashtable from the global table
-    HashNode *fetched_node = hget(global_table, global_table_key);
-
-    if (!fetched_node)
-    {
-        fprintf(stderr, "key not in database\n");
-        return get_response(response_type, 0);
-    }
+    char *end;
+    double value = strtod(str, &end);
 
-    // check if the value is a hashtable
-    if (fetched_node->valueType != HASHTABLE)
+    if (end != str + len || !isfinite(value))
     {
-        fprintf(stderr, "key is not for a hashtable\n");
-        return get_response(response_type, 0);
+        return false;
     }
 
-    HashTable *cur_table = (HashTable *)fetched_node->value;
-
-    // check if the field exists in the hashtable
-    HashNode *ret_node = hget(cur_table, field_key);
+    *out = value;
+    return true;
+}
 
-    if (ret_node)
+/**
+ * @brief Prints the value of an INTEGER or FLOAT node, floats are printed with as few digits as possible while still reading back as the same number
+ *
+ * @param node node holding a number
+ * @param buffer buffer to print into
+ * @param size size of the buffer, 32 bytes is enough for any number
+ *
+ * @return int number of characters printed
+ */
+int format_number(HashNode *node, char *buffer, int size)
+{
+    if (node->valueType == INTEGER)
     {
-        elem_exists = 1;
+        return snprintf(buffer, size, "%" PRId64, node->intValue);
     }
-    else
+
+    int len = snprintf(buffer, size, "%.15g", node->floatValue);
+    if (strtod(buffer, NULL) != node->floatValue)
     {
-        elem_exists = 0;
+        len = snprintf(buffer, size, "%.17g", node->floatValue);
     }
 
-    return get_response(response_type, &elem_exists);
+    return len;
 }
 
 /**
- * @brief Executes an HSET command and optionally logs the action to the AOF file.
- *
- * The HSET (key, field, value) command sets the value of a key in a hash table. If the key does not exist, a new hash table is created. Returns a response which containts the number of elements added/updated.
+ * @brief Executes a SET command and optionally logs the action to the AOF file. Values that are integers are stored as INTEGER, all other values are stored as strings in the global hashtable.
  *
- * @param cmd Command structure specifying the (key, field, value)
- * @param aof_restore Flag indicating whether to log the HSET operation to the AOF file.
+ * @param cmd Command structure specifying the (key, value)
+ * @param aof_restore Flag indicating whether to log the SET operation to the AOF file.
  *
  * @return char* response if AOF restore is disabled, or NULL otherwise.
+ *
  */
-char *hset_command(Command *cmd, bool aof_restore)
+char *set_command(Command *cmd, bool aof_restore)
 {
+    HashNode *new_node;
+    int64_t int_value;
 
-    ValueType response_type = INTEGER;
-    int elem_added = 0;
-
-    if (cmd->num_args < 3)
+    // only integers that print back exactly as they were given are stored natively, so GET returns the same string
+    if (parse_int64(cmd->args[1], cmd->arg_lens[1], &int_value, true))
     {
-        return error_response("hset command requires at least 3 arguments (key, field, value)");
-    }
-
-    char *global_table_key = cmd->args[0];
-    char *field_key = cmd->args[1];
-    char *value = cmd->args[2];
-
-    // fetch the hashtable from the global table
-    HashTable *cur_table;
-
-    HashNode *fetched_node = hget(global_table, global_table_key);
-    if (!fetched_node)
-    {
-        // create a new hashtable
-        HashTable *new_hash_table = hcreate(INIT_TABLE_SIZE);
-
-        // insert the new hashtable into the global table
-        HashNode *new_node = hinit(strdup(global_table_key), HASHTABLE, new_hash_table);
-
-        HashNode *ret = hinsert(global_table, new_node);
-        if (!ret)
-        {
-            return error_response("Failed to insert new hash table into global table");
-        }
-
-        cur_table = new_hash_table;
+        new_node = hinit_int(cmd->args[0], cmd->arg_lens[0], int_value);
     }
     else
     {
-        // check if the value is a hashtable
-        if (fetched_node->valueType != HASHTABLE)
-        {
-            return error_response("key is not for a hashtable");
-        }
-
-        cur_table = (HashTable *)fetched_node->value;
-    }
-
-    // add the value to the hashtable
-    HashNode *new_node = hinit(strdup(field_key), STRING, strdup(value));
-    if (!new_node)
-    {
-        return error_response("Failed to create new node for hashtable");
+        new_node = hinit_inline(cmd->args[0], cmd->arg_lens[0], STRING, cmd->args[1], cmd->arg_lens[1]);
     }
 
-    // if it already exists, remove the old value
-    HashNode *old_node = hremove(cur_table, field_key);
-    if (old_node)
-    {
-        hfree(old_node);
-    }
-
-    HashNode *ret = hinsert(cur_table, new_node);
-    if (!ret)
+    HashNode *ret = hinsert(global_table, new_node);
+    if (ret == NULL)
     {
-        return error_response("Failed to insert new node into hashtable");
+        hfree(new_node);
+        return error_response("Failed to insert new node into global table");
     }
 
-    elem_added++;
-
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
-        return get_response(response_type, &elem_added);
+        return null_response();
     }
     else
     {
@@ -806,104 +1152,114 @@ char *hset_command(Command *cmd, bool aof_restore)
 }
 
 /**
- * @brief Executes an HGET command and returns the corresponding response string according to the liteDB protocol.
- *
- * Gets the value of field from the hash specified by key. Returns the value. If the key, or field don't exist in database, return nil
- *
- * @param cmd Command structure specifying the (key, field)
+ * MGET (key [key ...]) - Gets the values of several keys in one request. Returns an array with one element per key, nil for keys that don't exist or don't hold a string
  *
+ * @param cmd Command structure specifying the (key [key ...])
  * @return char* response
  */
-char *hget_command(Command *cmd)
+char *mget_command(Command *cmd, bool aof_restore)
 {
-    if (cmd->num_args < 2)
-    {
-        return error_response("hget command requires at least 2 arguments (key, field)");
-    }
-
-    char *global_table_key = cmd->args[0];
-    char *field_key = cmd->args[1];
-
-    // fetch the hashtable from the global table
-    HashNode *fetched_node = hget(global_table, global_table_key);
-    if (!fetched_node)
-    {
-        return null_response();
-    }
+    ArrayResponse arr;
+    array_response_init(&arr);
 
-    // check if the value is a hashtable
-    if (fetched_node->valueType != HASHTABLE)
+    for (int i = 0; i < cmd->num_args; i++)
     {
-        return error_response("key is not for a hashtable");
-    }
-
-    HashTable *cur_table = (HashTable *)fetched_node->value;
+        // keys of other shards are answered by their own shard, the placeholder is replaced when the responses are merged
+        HashNode *fetched_node = key_in_shard(cmd->args[i]) ? hget(global_table, cmd->args[i]) : NULL;
 
-    // fetch the value from the hashtable
-    HashNode *ret_node = hget(cur_table, field_key);
-    if (!ret_node)
-    {
-        return null_response();
+        if (!fetched_node)
+        {
+            array_response_add(&arr, SER_NIL, "", 0);
+        }
+        else if (fetched_node->valueType == STRING)
+        {
+            array_response_add(&arr, SER_STR, fetched_node->value, string_value_len(fetched_node));
+        }
+        else if (fetched_node->valueType == INTEGER || fetched_node->valueType == FLOAT)
+        {
+            char number[32];
+            int len = format_number(fetched_node, number, sizeof(number));
+            array_response_add(&arr, SER_STR, number, len);
+        }
+        else
+        {
+            array_response_add(&arr, SER_NIL, "", 0);
+        }
     }
 
-    return get_response(ret_node->valueType, ret_node->value);
+    return array_response_finish(&arr);
 }
 
 /**
- * @brief Executes an HDEL command and optionally logs the action to the AOF file.
- *
- * The HDEL command removes a field from a hash table. Returns an integer response indicating the number of elements removed.
- *
- * @param cmd Command structure specifying the (key, field)
- * @param aof_restore Flag indicating whether to log the HDEL operation to the AOF file.
+ * MSET (key value [key value ...]) - Sets several keys in one request, like SET keys that already exist are left unchanged. The whole request is logged to the AOF as a single record. Returns nil
  *
- * @return char* response if AOF restore is disabled, or NULL otherwise.
+ * @param cmd Command structure specifying the (key value [key value ...])
+ * @return char* response
  */
-char *hdel_command(Command *cmd, bool aof_restore)
+char *mset_command(Command *cmd, bool aof_restore)
 {
+    for (int i = 0; i + 1 < cmd->num_args; i += 2)
+    {
+        if (!key_in_shard(cmd->args[i]) || hget(global_table, cmd->args[i]))
+        {
+            continue;
+        }
 
-    ValueType response_type = INTEGER;
-    int elem_removed = 0;
+        HashNode *new_node;
+        int64_t int_value;
 
-    if (cmd->num_args < 2)
-    {
-        return error_response("hdel command requires at least 2 arguments (key, field)");
+        if (parse_int64(cmd->args[i + 1], cmd->arg_lens[i + 1], &int_value, true))
+        {
+            new_node = hinit_int(cmd->args[i], cmd->arg_lens[i], int_value);
+        }
+        else
+        {
+            new_node = hinit_inline(cmd->args[i], cmd->arg_lens[i], STRING, cmd->args[i + 1], cmd->arg_lens[i + 1]);
+        }
+
+        hinsert(global_table, new_node);
     }
 
-    char *global_table_key = cmd->args[0];
-    char *field_key = cmd->args[1];
+    return null_response();
+}
 
-    // fetch the hashtable from the global table
-    HashNode *fetched_node = hget(global_table, global_table_key);
+/**
+ * @brief Adds an increment to the INTEGER value of a key, a key that does not exist is created with the value 0 first
+ *
+ * @param cmd Command structure specifying the (key)
+ * @param increment amount to add, negative to decrement
+ * @param aof_restore Flag indicating whether the command is restored from the AOF file
+ *
+ * @return char* response with the new value if AOF restore is disabled, or NULL otherwise.
+ */
+char *incr_by(Command *cmd, int64_t increment, bool aof_restore)
+{
+    int64_t result = increment;
+
+    HashNode *fetched_node = hget(global_table, cmd->args[0]);
     if (!fetched_node)
     {
-        return error_response("key not in database");
+        hinsert(global_table, hinit_int(cmd->args[0], cmd->arg_lens[0], increment));
     }
-
-    // check if the value is a hashtable
-    if (fetched_node->valueType != HASHTABLE)
+    else
     {
-        return error_response("key is not for a hashtable");
-    }
+        if (fetched_node->valueType != INTEGER)
+        {
+            return error_response("value is not an integer or out of range");
+        }
 
-    HashTable *cur_table = (HashTable *)fetched_node->value;
+        if (__builtin_add_overflow(fetched_node->intValue, increment, &result))
+        {
+            return error_response("increment or decrement would overflow");
+        }
 
-    // remove the value from the hashtable
-    HashNode *removed_node = hremove(cur_table, field_key);
-    if (!removed_node)
-    {
-        return error_response("Failed to remove value from hashtable");
+        // the integer is updated in place
+        fetched_node->intValue = result;
     }
 
-    // free the removed node
-    hfree(removed_node);
-
-    elem_removed++;
-
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
-        return get_response(response_type, &elem_removed);
+        return int64_response(result);
     }
     else
     {
@@ -912,148 +1268,144 @@ char *hdel_command(Command *cmd, bool aof_restore)
 }
 
 /**
- * @brief Executes an HGETALL command and returns the corresponding response string according to the liteDB protocol.
+ * INCR (key) - Increments the integer value of a key by one, returns the new value
  *
- * The HGETALL command retrieves all fields and values in a hash table. Returns an error response if the key does not exist.
+ * @param cmd Command structure specifying the (key)
+ * @return char* response
+ */
+char *incr_command(Command *cmd, bool aof_restore)
+{
+    return incr_by(cmd, 1, aof_restore);
+}
+
+/**
+ * DECR (key) - Decrements the integer value of a key by one, returns the new value
  *
- * @param cmd Command structure specifying (key)
+ * @param cmd Command structure specifying the (key)
+ * @return char* response
+ */
+char *decr_command(Command *cmd, bool aof_restore)
+{
+    return incr_by(cmd, -1, aof_restore);
+}
+
+/**
+ * INCRBY (key, increment) - Increments the integer value of a key by increment, returns the new value
  *
+ * @param cmd Command structure specifying the (key, increment)
  * @return char* response
  */
-char *hgetall_command(Command *cmd)
+char *incrby_command(Command *cmd, bool aof_restore)
 {
-    if (cmd->num_args < 1)
+    int64_t increment;
+    if (!parse_int64(cmd->args[1], cmd->arg_lens[1], &increment, false))
     {
-        return error_response("hgetall command requires at least 1 argument (key)");
+        return error_response("increment is not an integer or out of range");
     }
 
-    char *global_table_key = cmd->args[0];
+    return incr_by(cmd, increment, aof_restore);
+}
 
-    // fetch the hashtable from the global table
-    HashNode *fetched_node = hget(global_table, global_table_key);
-    if (!fetched_node)
+/**
+ * INCRBYFLOAT (key, increment) - Increments the value of a key by a floating point increment, returns the new value. The value becomes a FLOAT, integers and strings holding a number are converted in place
+ *
+ * @param cmd Command structure specifying the (key, increment)
+ * @return char* response
+ */
+char *incrbyfloat_command(Command *cmd, bool aof_restore)
+{
+    double increment;
+    if (!parse_double(cmd->args[1], cmd->arg_lens[1], &increment))
     {
-        fprintf(stderr, "key not in database\n");
-        return empty_array_response();
+        return error_response("increment is not a valid float");
     }
 
-    // check if the value is a hashtable
-    if (fetched_node->valueType != HASHTABLE)
+    double result = increment;
+
+    HashNode *fetched_node = hget(global_table, cmd->args[0]);
+    if (!fetched_node)
     {
-        fprintf(stderr, "key is not for a hashtable");
-        return empty_array_response();
+        hinsert(global_table, hinit_float(cmd->args[0], cmd->arg_lens[0], increment));
     }
-
-    HashTable *cur_table = (HashTable *)fetched_node->value;
-
-    // get all the keys in the hashtable
-    int num_elem = 0;
-    int inc_buffer = 5;
-
-    // buffer for the data
-    char *buffer = calloc(1 + 4 + MAX_MESSAGE_SIZE, sizeof(char));
-
-    // iterate through the hash table and write the keys to the buffer
-    for (int i = 0; i <= cur_table->mask; i++)
+    else
     {
-        HashNode *traverseList = cur_table->nodes[i];
+        double current;
 
-        while (traverseList != NULL)
+        if (fetched_node->valueType == FLOAT)
         {
-            // write the key to the buffer
-            int type = SER_STR;
-            int key_len = strlen(traverseList->key);
-
-            // check if the buffer has enough space to write the key
-            if (inc_buffer + 5 + key_len > MAX_MESSAGE_SIZE)
-            {
-                fprintf(stderr, "Failed to reallocate memory for hgetall response\n");
-                exit(EXIT_FAILURE);
-            }
-
-            // write the type and length of the response, 1 byte
-            memcpy(buffer + inc_buffer, &type, 1);
-            memcpy(buffer + inc_buffer + 1, &key_len, 4);
-
-            // write the key
-            memcpy(buffer + inc_buffer + 5, traverseList->key, key_len);
-
-            inc_buffer += 5 + key_len;
-            num_elem++;
-
-            // write the value to the buffer
-            type = SER_STR;
-            int value_len = strlen(traverseList->value);
-
-            // check if the buffer has enough space to write the value
-            if (inc_buffer + 5 + value_len > MAX_MESSAGE_SIZE)
-            {
-                fprintf(stderr, "Failed to reallocate memory for hgetall response\n");
-                exit(EXIT_FAILURE);
-            }
-
-            // write the type and length of the response, 1 byte
-            memcpy(buffer + inc_buffer, &type, 1);
-            memcpy(buffer + inc_buffer + 1, &value_len, 4);
-
-            // write the value
-            memcpy(buffer + inc_buffer + 5, traverseList->value, value_len);
+            current = fetched_node->floatValue;
+        }
+        else if (fetched_node->valueType == INTEGER)
+        {
+            current = (double)fetched_node->intValue;
+        }
+        else if (fetched_node->valueType != STRING || !parse_double(fetched_node->value, fetched_node->valueLen, &current))
+        {
+            return error_response("value is not a valid float");
+        }
 
-            inc_buffer += 5 + value_len;
-            num_elem++;
+        result = current + increment;
+        if (!isfinite(result))
+        {
+            return error_response("increment would produce NaN or Infinity");
+        }
 
-            traverseList = traverseList->next;
+        // the number replaces the previous value in the value slot of the node
+        if (!(fetched_node->flags & HN_VALUE_INLINE))
+        {
+            free(fetched_node->value);
+            fetched_node->flags |= HN_VALUE_INLINE;
         }
-    }
 
-    // write the type and length of array to buffer
-    int type = SER_ARR;
-    memcpy(buffer, &type, 1);
-    memcpy(buffer + 1, &num_elem, 4);
+        fetched_node->valueType = FLOAT;
+        fetched_node->floatValue = result;
+    }
 
-    return buffer;
+    if (!aof_restore)
+    {
+        return double_response(result);
+    }
+    else
+    {
+        return NULL;
+    }
 }
 
 /**
- *  LEXISTS (key, value) - Checks if a value exists in a list. Returns an integer response indicating the number of values found.
+ * The HEXISTS (key, field) command checks if a field exists in a hash . Returns an integer response indicating the number of fields found.
  *
- * @param cmd Command structure specifying the (key, value)
+ * @param cmd Command structure specifying the (key, field)
  * @return char* response
- *
  */
-char *lexists_command(Command *cmd)
+char *hexists_command(Command *cmd, bool aof_restore)
 {
-    ValueType response_type = INTEGER;
-    int elem_exists = 0;
-
-    if (cmd->num_args < 2)
-    {
-        return error_response("lexists command requires at least 2 arguments (key, value)");
-    }
+    int response_type = INTEGER;
+    int64_t elem_exists = 0;
 
     char *global_table_key = cmd->args[0];
-    char *value = cmd->args[1];
+    char *field_key = cmd->args[1];
 
-    // fetch the list from the global table
+    // fetch the hashtable from the global table
     HashNode *fetched_node = hget(global_table, global_table_key);
+
     if (!fetched_node)
     {
         fprintf(stderr, "key not in database\n");
         return get_response(response_type, &elem_exists);
     }
 
-    // check if the value is a list
-    if (fetched_node->valueType != LIST)
+    // check if the value is a hashtable
+    if (fetched_node->valueType != HASHTABLE)
     {
-        fprintf(stderr, "key is not for a list\n");
+        fprintf(stderr, "key is not for a hashtable\n");
         return get_response(response_type, &elem_exists);
     }
 
-    List *list = (List *)fetched_node->value;
+    HashMap *cur_hash = (HashMap *)fetched_node->value;
 
-    // check if the value exists in the list
-    int ret = list_contains(list, value, LIST_TYPE_STRING);
-    if (ret)
+    // check if the field exists in the hashtable
+    char *value;
+    if (hmap_get(cur_hash, field_key, &value, NULL))
     {
         elem_exists = 1;
     }
@@ -1066,66 +1418,69 @@ char *lexists_command(Command *cmd)
 }
 
 /**
- * @brief Executes an LPUSH command and optionally logs the action to the AOF file.
+ * @brief Executes an HSET command and optionally logs the action to the AOF file.
  *
- * The LPUSH command adds a value to the head of a list. If the key does not exist, a new list is created. Returns an integer response indicating the number of elements added.
+ * The HSET (key, field, value [field, value ...]) command sets the values of fields in a hash table. If the key does not exist, a new hash table is created. Returns a response which containts the number of elements added/updated.
  *
- * @param cmd Command structure specifying (key, value)
- * @param aof_restore Flag indicating whether to log the LPUSH operation to the AOF file.
+ * @param cmd Command structure specifying the (key, field, value [field, value ...])
+ * @param aof_restore Flag indicating whether to log the HSET operation to the AOF file.
  *
  * @return char* response if AOF restore is disabled, or NULL otherwise.
  */
-char *lpush_command(Command *cmd, bool aof_restore)
+char *hset_command(Command *cmd, bool aof_restore)
 {
+
     ValueType response_type = INTEGER;
-    int elem_added = 0;
+    int64_t elem_added = 0;
 
-    if (cmd->num_args < 2)
+    char *global_table_key = cmd->args[0];
+
+    if ((cmd->num_args - 1) % 2 != 0)
     {
-        return error_response("lpush command requires at least 2 arguments (key, value)");
+        return error_response("hset command requires key, field, value [field, value ...]");
     }
 
-    char *global_table_key = cmd->args[0];
-    char *value = cmd->args[1];
+    // fetch the hashtable from the global table
+    HashMap *cur_hash;
 
-    // fetch the list from the global table
     HashNode *fetched_node = hget(global_table, global_table_key);
     if (!fetched_node)
     {
-        // create a new list
-        List *new_list = list_init();
+        // create a new hash, compact until it outgrows the limits of compact hashes
+        HashMap *new_hash = hmap_init();
 
-        // create a new hash node
-        HashNode *new_node = hinit(strdup(global_table_key), LIST, new_list);
+        // insert the new hash into the global table
+        HashNode *new_node = hinit_key(cmd->args[0], cmd->arg_lens[0], HASHTABLE, new_hash);
 
         HashNode *ret = hinsert(global_table, new_node);
         if (!ret)
         {
-            return error_response("Failed to insert new list into global table");
+            return error_response("Failed to insert new hash table into global table");
         }
 
-        fetched_node = new_node;
+        cur_hash = new_hash;
     }
-
-    // check if the value is a list
-    if (fetched_node->valueType != LIST)
+    else
     {
-        return error_response("key is not for a list");
-    }
+        // check if the value is a hashtable
+        if (fetched_node->valueType != HASHTABLE)
+        {
+            return error_response("key is not for a hashtable");
+        }
 
-    List *list = (List *)fetched_node->value;
+        cur_hash = (HashMap *)fetched_node->value;
+    }
 
-    // add the value to the list
-    int ret = list_linsert(list, value, LIST_TYPE_STRING);
-    if (ret)
+    for (int i = 1; i < cmd->num_args; i += 2)
     {
-        return error_response("Failed to add value to list");
+        // add the value to the hash, replacing the old value if it already exists
+        hmap_set(cur_hash, cmd->args[i], cmd->arg_lens[i], cmd->args[i + 1], cmd->arg_lens[i + 1]);
+
+        elem_added++;
     }
-    elem_added++;
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return get_response(response_type, &elem_added);
     }
     else
@@ -1135,107 +1490,355 @@ char *lpush_command(Command *cmd, bool aof_restore)
 }
 
 /**
- * @brief Executes an RPUSH command and optionally logs the action to the AOF file.
+ * @brief Executes an HGET command and returns the corresponding response string according to the liteDB protocol.
  *
- * The RPUSH command adds a value to the tail of a list. If the key does not exist, a new list is created. Returns an integer response indicating the number of elements added.
+ * Gets the value of field from the hash specified by key. Returns the value. If the key, or field don't exist in database, return nil
  *
- * @param cmd Command structure specifying the (key,value)
- * @param aof_restore Flag indicating whether to log the RPUSH operation to the AOF file.
+ * @param cmd Command structure specifying the (key, field)
  *
- * @return char* response if AOF restore is disabled, or NULL otherwise.
+ * @return char* response
  */
-char *rpush_command(Command *cmd, bool aof_restore)
+char *hget_command(Command *cmd, bool aof_restore)
 {
-    ValueType response_type = INTEGER;
-    int elem_added = 0;
-
-    if (cmd->num_args < 2)
-    {
-        return error_response("rpush command requires at least 2 arguments (key, value)");
-    }
 
     char *global_table_key = cmd->args[0];
-    char *value = cmd->args[1];
+    char *field_key = cmd->args[1];
 
-    // fetch the list from the global table
+    // fetch the hashtable from the global table
     HashNode *fetched_node = hget(global_table, global_table_key);
     if (!fetched_node)
     {
-        // create a new list
-        List *new_list = list_init();
-
-        // create a new hash node
-        HashNode *new_node = hinit(strdup(global_table_key), LIST, new_list);
-
-        HashNode *ret = hinsert(global_table, new_node);
-        if (!ret)
-        {
-            return error_response("Failed to insert new list into global table");
-        }
-
-        fetched_node = new_node;
+        return null_response();
     }
 
-    // check if the value is a list
-    if (fetched_node->valueType != LIST)
+    // check if the value is a hashtable
+    if (fetched_node->valueType != HASHTABLE)
     {
-        return error_response("key is not for a list");
+        return error_response("key is not for a hashtable");
     }
 
-    List *list = (List *)fetched_node->value;
+    HashMap *cur_hash = (HashMap *)fetched_node->value;
 
-    // add the value to the list
-    int ret = list_rinsert(list, value, LIST_TYPE_STRING);
-    if (ret)
+    // fetch the value from the hashtable
+    char *value;
+    uint32_t value_len;
+    if (!hmap_get(cur_hash, field_key, &value, &value_len))
     {
-        return error_response("Failed to add value to list");
+        return null_response();
     }
-    elem_added++;
 
-    return get_response(response_type, &elem_added);
+    return value_response(SER_STR, value, value_len);
 }
 
 /**
- * @brief Executes an LPOP command and optionally logs the action to the AOF file.
+ * @brief Executes an HDEL command and optionally logs the action to the AOF file.
  *
- * The LPOP command removes a value from the head of a list. Returns the value removed.
+ * The HDEL command removes a field from a hash table. Returns an integer response indicating the number of elements removed.
  *
- * @param cmd Command structure specifying the (key)
- * @param aof_restore Flag indicating whether to log the LPOP operation to the AOF file.
+ * @param cmd Command structure specifying the (key, field)
+ * @param aof_restore Flag indicating whether to log the HDEL operation to the AOF file.
  *
  * @return char* response if AOF restore is disabled, or NULL otherwise.
  */
-char *lpop_command(Command *cmd, bool aof_restore)
+char *hdel_command(Command *cmd, bool aof_restore)
 {
-    ValueType response_type = STRING;
 
-    if (cmd->num_args < 1)
-    {
-        return error_response("lpop command requires at least 1 argument (key)");
-    }
+    ValueType response_type = INTEGER;
+    int64_t elem_removed = 0;
 
     char *global_table_key = cmd->args[0];
+    char *field_key = cmd->args[1];
 
-    // fetch the list from the global table
+    // fetch the hashtable from the global table
     HashNode *fetched_node = hget(global_table, global_table_key);
     if (!fetched_node)
     {
         return error_response("key not in database");
     }
 
-    // check if the value is a list
-    if (fetched_node->valueType != LIST)
+    // check if the value is a hashtable
+    if (fetched_node->valueType != HASHTABLE)
     {
-        return error_response("key is not for a list");
+        return error_response("key is not for a hashtable");
     }
 
-    List *list = (List *)fetched_node->value;
+    HashMap *cur_hash = (HashMap *)fetched_node->value;
 
-    // remove the value from the list
-    ListNode *removedNode = list_lremove(list);
-    if (!removedNode)
+    // remove the value from the hashtable, it is freed with its field
+    if (!hmap_remove(cur_hash, field_key))
     {
-        return error_response("Failed to remove value from list");
+        return error_response("Failed to remove value from hashtable");
+    }
+
+    elem_removed++;
+
+    // the table of the hash may have started shrinking, the loop owning the shard moves it along while idle
+    if (!hmap_is_compact(cur_hash) && cur_hash->table->old_groups)
+    {
+        loop_track_rehash(global_table_key);
+    }
+
+    if (!aof_restore)
+    {
+        return get_response(response_type, &elem_removed);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+/**
+ * @brief Executes an HGETALL command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * The HGETALL command retrieves all fields and values in a hash table. Returns an error response if the key does not exist.
+ *
+ * @param cmd Command structure specifying (key)
+ *
+ * @return char* response
+ */
+char *hgetall_command(Command *cmd, bool aof_restore)
+{
+
+    char *global_table_key = cmd->args[0];
+
+    // fetch the hashtable from the global table
+    HashNode *fetched_node = hget(global_table, global_table_key);
+    if (!fetched_node)
+    {
+        fprintf(stderr, "key not in database\n");
+        return empty_array_response();
+    }
+
+    // check if the value is a hashtable
+    if (fetched_node->valueType != HASHTABLE)
+    {
+        fprintf(stderr, "key is not for a hashtable");
+        return empty_array_response();
+    }
+
+    HashMap *cur_hash = (HashMap *)fetched_node->value;
+
+    ArrayResponse arr;
+    array_response_init(&arr);
+
+    // iterate through the hash and write the fields and values to the response, with the lengths the hash keeps
+    int pos = 0;
+    char *field, *value;
+    uint32_t field_len, value_len;
+
+    while (hmap_next(cur_hash, &pos, &field, &field_len, &value, &value_len))
+    {
+        array_response_add(&arr, SER_STR, field, field_len);
+        array_response_add(&arr, SER_STR, value, value_len);
+    }
+
+    return array_response_finish(&arr);
+}
+
+/**
+ *  LEXISTS (key, value) - Checks if a value exists in a list. Returns an integer response indicating the number of values found.
+ *
+ * @param cmd Command structure specifying the (key, value)
+ * @return char* response
+ *
+ */
+char *lexists_command(Command *cmd, bool aof_restore)
+{
+    ValueType response_type = INTEGER;
+    int64_t elem_exists = 0;
+
+    char *global_table_key = cmd->args[0];
+    char *value = cmd->args[1];
+
+    // fetch the list from the global table
+    HashNode *fetched_node = hget(global_table, global_table_key);
+    if (!fetched_node)
+    {
+        fprintf(stderr, "key not in database\n");
+        return get_response(response_type, &elem_exists);
+    }
+
+    // check if the value is a list
+    if (fetched_node->valueType != LIST)
+    {
+        fprintf(stderr, "key is not for a list\n");
+        return get_response(response_type, &elem_exists);
+    }
+
+    List *list = (List *)fetched_node->value;
+
+    // check if the value exists in the list
+    int ret = list_contains(list, value, LIST_TYPE_STRING);
+    if (ret)
+    {
+        elem_exists = 1;
+    }
+    else
+    {
+        elem_exists = 0;
+    }
+
+    return get_response(response_type, &elem_exists);
+}
+
+/**
+ * @brief Executes an LPUSH command and optionally logs the action to the AOF file.
+ *
+ * The LPUSH command adds a value to the head of a list. If the key does not exist, a new list is created. Returns an integer response indicating the number of elements added.
+ *
+ * @param cmd Command structure specifying (key, value)
+ * @param aof_restore Flag indicating whether to log the LPUSH operation to the AOF file.
+ *
+ * @return char* response if AOF restore is disabled, or NULL otherwise.
+ */
+char *lpush_command(Command *cmd, bool aof_restore)
+{
+    ValueType response_type = INTEGER;
+    int64_t elem_added = 0;
+
+    char *global_table_key = cmd->args[0];
+    char *value = cmd->args[1];
+
+    // fetch the list from the global table
+    HashNode *fetched_node = hget(global_table, global_table_key);
+    if (!fetched_node)
+    {
+        // create a new list
+        List *new_list = list_init();
+
+        // create a new hash node
+        HashNode *new_node = hinit_key(cmd->args[0], cmd->arg_lens[0], LIST, new_list);
+
+        HashNode *ret = hinsert(global_table, new_node);
+        if (!ret)
+        {
+            return error_response("Failed to insert new list into global table");
+        }
+
+        fetched_node = new_node;
+    }
+
+    // check if the value is a list
+    if (fetched_node->valueType != LIST)
+    {
+        return error_response("key is not for a list");
+    }
+
+    List *list = (List *)fetched_node->value;
+
+    // add the value to the list
+    int ret = list_linsert(list, value, LIST_TYPE_STRING);
+    if (ret)
+    {
+        return error_response("Failed to add value to list");
+    }
+    elem_added++;
+
+    if (!aof_restore)
+    {
+        return get_response(response_type, &elem_added);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+/**
+ * @brief Executes an RPUSH command and optionally logs the action to the AOF file.
+ *
+ * The RPUSH command adds values to the tail of a list, in the order they are given. If the key does not exist, a new list is created. Returns an integer response indicating the number of elements added.
+ *
+ * @param cmd Command structure specifying the (key, value [value ...])
+ * @param aof_restore Flag indicating whether to log the RPUSH operation to the AOF file.
+ *
+ * @return char* response if AOF restore is disabled, or NULL otherwise.
+ */
+char *rpush_command(Command *cmd, bool aof_restore)
+{
+    ValueType response_type = INTEGER;
+    int64_t elem_added = 0;
+
+    char *global_table_key = cmd->args[0];
+
+    // fetch the list from the global table
+    HashNode *fetched_node = hget(global_table, global_table_key);
+    if (!fetched_node)
+    {
+        // create a new list
+        List *new_list = list_init();
+
+        // create a new hash node
+        HashNode *new_node = hinit_key(cmd->args[0], cmd->arg_lens[0], LIST, new_list);
+
+        HashNode *ret = hinsert(global_table, new_node);
+        if (!ret)
+        {
+            return error_response("Failed to insert new list into global table");
+        }
+
+        fetched_node = new_node;
+    }
+
+    // check if the value is a list
+    if (fetched_node->valueType != LIST)
+    {
+        return error_response("key is not for a list");
+    }
+
+    List *list = (List *)fetched_node->value;
+
+    // add the values to the list
+    for (int i = 1; i < cmd->num_args; i++)
+    {
+        int ret = list_rinsert(list, cmd->args[i], LIST_TYPE_STRING);
+        if (ret)
+        {
+            return error_response("Failed to add value to list");
+        }
+        elem_added++;
+    }
+
+    return get_response(response_type, &elem_added);
+}
+
+/**
+ * @brief Executes an LPOP command and optionally logs the action to the AOF file.
+ *
+ * The LPOP command removes a value from the head of a list. Returns the value removed.
+ *
+ * @param cmd Command structure specifying the (key)
+ * @param aof_restore Flag indicating whether to log the LPOP operation to the AOF file.
+ *
+ * @return char* response if AOF restore is disabled, or NULL otherwise.
+ */
+char *lpop_command(Command *cmd, bool aof_restore)
+{
+    ValueType response_type = STRING;
+
+    char *global_table_key = cmd->args[0];
+
+    // fetch the list from the global table
+    HashNode *fetched_node = hget(global_table, global_table_key);
+    if (!fetched_node)
+    {
+        return error_response("key not in database");
+    }
+
+    // check if the value is a list
+    if (fetched_node->valueType != LIST)
+    {
+        return error_response("key is not for a list");
+    }
+
+    List *list = (List *)fetched_node->value;
+
+    // remove the value from the list
+    ListNode *removedNode = list_lremove(list);
+    if (!removedNode)
+    {
+        return error_response("Failed to remove value from list");
     }
 
     // ensure that only strings are stored in the list, if not, error occcued somehwere in db, serious error
@@ -1249,8 +1852,6 @@ char *lpop_command(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
-
         // strdup the value to avoid double free
         char *value = strdup(removedNode->data);
 
@@ -1282,11 +1883,6 @@ char *rpop_command(Command *cmd, bool aof_restore)
 
     ValueType response_type = STRING;
 
-    if (cmd->num_args < 1)
-    {
-        return error_response("rpop command requires at least 1 argument (key)");
-    }
-
     char *global_table_key = cmd->args[0];
 
     // fetch the list from the global table
@@ -1322,8 +1918,6 @@ char *rpop_command(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
-
         // strdup the value to avoid double free
         char *value = strdup(removedNode->data);
 
@@ -1354,12 +1948,7 @@ char *lrem_command(Command *cmd, bool aof_restore)
     errno = 0;
 
     ValueType response_type = INTEGER;
-    int elem_removed = 0;
-
-    if (cmd->num_args < 3)
-    {
-        return error_response("lrem command requires at least 3 arguments (key, count, value)");
-    }
+    int64_t elem_removed = 0;
 
     char *global_table_key = cmd->args[0];
     char *count_str = cmd->args[1];
@@ -1414,7 +2003,6 @@ char *lrem_command(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return get_response(response_type, &elem_removed);
     }
     else
@@ -1432,15 +2020,10 @@ char *lrem_command(Command *cmd, bool aof_restore)
  *
  * @return char* response
  */
-char *llen_cmd(Command *cmd)
+char *llen_cmd(Command *cmd, bool aof_restore)
 {
     ValueType response_type = INTEGER;
-    int len = 0;
-
-    if (cmd->num_args < 1)
-    {
-        return error_response("llen command requires at least 1 argument (key)");
-    }
+    int64_t len = 0;
 
     char *global_table_key = cmd->args[0];
 
@@ -1476,15 +2059,10 @@ char *llen_cmd(Command *cmd)
  *
  * @return char* response
  */
-char *lrange_cmd(Command *cmd)
+char *lrange_cmd(Command *cmd, bool aof_restore)
 {
     errno = 0;
 
-    if (cmd->num_args < 3)
-    {
-        return error_response("lrange command requires at least 3 arguments (key, start, stop)");
-    }
-
     char *global_table_key = cmd->args[0];
     char *start_str = cmd->args[1];
     char *stop_str = cmd->args[2];
@@ -1568,13 +2146,8 @@ char *lrange_cmd(Command *cmd)
 
     // get the values from the list
     int elems_to_fetch = stop - start + 1;
-    int num_elements = 0;
-    int inc_buffer = 5;
 
-    // buffer for the data
-    char *buffer = calloc(1 + 4 + MAX_MESSAGE_SIZE, sizeof(char));
-
-    // iterate through the list and write the values to the buffer, start and stop are inclusive
+    // iterate through the list and write the values to the response, start and stop are inclusive
     ListNode *current = list_iget(list, start);
     if (!current)
     {
@@ -1582,37 +2155,16 @@ char *lrange_cmd(Command *cmd)
         return empty_array_response();
     }
 
-    while (num_elements < elems_to_fetch)
-    {
-        // write the value to the buffer
-        int type = SER_STR;
-        int data_len = strlen(current->data);
-
-        // check if the buffer has enough space to write the value
-        if (inc_buffer + 5 + data_len > MAX_MESSAGE_SIZE)
-        {
-            fprintf(stderr, "Failed to reallocate memory for lrange response\n");
-            exit(EXIT_FAILURE);
-        }
-
-        // write the type and length of the response, 1 byte
-        memcpy(buffer + inc_buffer, &type, 1);
-        memcpy(buffer + inc_buffer + 1, &data_len, 4);
-
-        // write the value
-        memcpy(buffer + inc_buffer + 5, current->data, data_len);
+    ArrayResponse arr;
+    array_response_init(&arr);
 
-        inc_buffer += 5 + data_len;
-        num_elements++;
+    while (arr.num_elements < elems_to_fetch)
+    {
+        array_response_add(&arr, SER_STR, current->data, strlen(current->data));
         current = current->next;
     }
 
-    // write the type and length of array to buffer
-    int type = SER_ARR;
-    memcpy(buffer, &type, 1);
-    memcpy(buffer + 1, &num_elements, 4);
-
-    return buffer;
+    return array_response_finish(&arr);
 }
 
 /**
@@ -1629,11 +2181,6 @@ char *ltrim_cmd(Command *cmd, bool aof_restore)
 {
     errno = 0;
 
-    if (cmd->num_args < 3)
-    {
-        return error_response("ltrim command requires at least 3 arguments (key, start, stop)");
-    }
-
     char *global_table_key = cmd->args[0];
     char *start_str = cmd->args[1];
     char *stop_str = cmd->args[2];
@@ -1721,7 +2268,6 @@ char *ltrim_cmd(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return null_response();
     }
     else
@@ -1745,12 +2291,7 @@ char *lset_cmd(Command *cmd, bool aof_restore)
     errno = 0;
 
     ValueType response_type = INTEGER;
-    int elem_updated = 0;
-
-    if (cmd->num_args < 3)
-    {
-        return error_response("lset command requires at least 3 arguments (key, index, value)");
-    }
+    int64_t elem_updated = 0;
 
     char *global_table_key = cmd->args[0];
     char *index_str = cmd->args[1];
@@ -1809,7 +2350,6 @@ char *lset_cmd(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return get_response(response_type, &elem_updated);
     }
     else
@@ -1821,9 +2361,9 @@ char *lset_cmd(Command *cmd, bool aof_restore)
 /**
  * @brief Executes a ZADD command and optionally logs the action to the AOF file.
  *
- * The ZADD (key, score, name) command adds a value to a sorted set. If the key does not exist, a new sorted set is created. If the field already exists, it is updated instead. Returns an integer response indicating the number of elements added/updated.
+ * The ZADD (key, score, name [score, name ...]) command adds values to a sorted set. If the key does not exist, a new sorted set is created. If the field already exists, it is updated instead. Returns an integer response indicating the number of elements added/updated.
  *
- * @param cmd Command structure specifying the (key, score, name)
+ * @param cmd Command structure specifying the (key, score, name [score, name ...])
  * @param aof_restore Flag indicating whether to log the ZADD operation to the AOF file.
  *
  * @return char* response if AOF restore is disabled, or NULL otherwise.
@@ -1834,32 +2374,27 @@ char *zadd_command(Command *cmd, bool aof_restore)
     errno = 0;
 
     ValueType response_type = INTEGER;
-    int elem_added = 0;
-
-    if (cmd->num_args < 3)
-    {
-        return error_response("zadd command requires at least 3 arguments (key, score, name)");
-    }
+    int64_t elem_added = 0;
 
     char *zset_key = cmd->args[0];
-    char *score_str = cmd->args[1];
-
-    // convert the score to a float
-    // use strtol and duck typing to determine the type of the value
-    char *endptr;
-    float value = strtof(score_str, &endptr);
 
-    // check errors
-    if (errno)
+    if ((cmd->num_args - 1) % 2 != 0)
     {
-        perror("strtof failed");
-        exit(EXIT_FAILURE);
+        return error_response("zadd command requires key, score, name [score, name ...]");
     }
 
-    // Check if successfully converted to a float
-    if (!(*endptr == '\0') || (endptr == score_str))
+    // convert all the scores to doubles before the set is modified
+    for (int i = 1; i < cmd->num_args; i += 2)
     {
-        return error_response("Failed to convert score to float");
+        // use strtod and duck typing to determine the type of the value
+        char *endptr;
+        double score = strtod(cmd->args[i], &endptr);
+
+        // Check if successfully converted to a double, NaN can't be ordered
+        if (!(*endptr == '\0') || (endptr == cmd->args[i]) || isnan(score))
+        {
+            return error_response("Failed to convert score to float");
+        }
     }
 
     // fetch the zset from global table
@@ -1876,7 +2411,7 @@ char *zadd_command(Command *cmd, bool aof_restore)
         }
 
         // create a new hash node
-        HashNode *new_node = hinit(strdup(zset_key), ZSET, zset);
+        HashNode *new_node = hinit_key(cmd->args[0], cmd->arg_lens[0], ZSET, zset);
         if (!new_node)
         {
             fprintf(stderr, "Failed to create new hash node\n");
@@ -1902,17 +2437,19 @@ char *zadd_command(Command *cmd, bool aof_restore)
 
     ZSet *zset = (ZSet *)fetched_node->value;
 
-    // add the value to the ZSET
-    int ret = zset_add(zset, cmd->args[2], value);
-    if (ret < 0)
+    // add the values to the ZSET
+    for (int i = 1; i < cmd->num_args; i += 2)
     {
-        return error_response("Failed to add value to ZSET");
+        int ret = zset_add(zset, cmd->args[i + 1], strtod(cmd->args[i], NULL));
+        if (ret < 0)
+        {
+            return error_response("Failed to add value to ZSET");
+        }
+        elem_added++;
     }
-    elem_added++;
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return get_response(response_type, &elem_added);
     }
     else
@@ -1934,12 +2471,7 @@ char *zrem_command(Command *cmd, bool aof_restore)
     errno = 0;
 
     ValueType response_type = INTEGER;
-    int elem_removed = 0;
-
-    if (cmd->num_args < 2)
-    {
-        return error_response("zrem command requires at least 2 arguments (key, name)");
-    }
+    int64_t elem_removed = 0;
 
     char *zset_key = cmd->args[0];
     char *element_key = cmd->args[1];
@@ -1970,7 +2502,6 @@ char *zrem_command(Command *cmd, bool aof_restore)
 
     if (!aof_restore)
     {
-        handle_aof_write(cmd);
         return get_response(response_type, &elem_removed);
     }
     else
@@ -1982,23 +2513,17 @@ char *zrem_command(Command *cmd, bool aof_restore)
 /**
  * @brief Executes a ZSCORE command and returns the corresponding response string according to the liteDB protocol.
  *
- * ZSCORE: (key, name) - Returns the score of the element with the specified name from the sorted set specified by key. Returns a float . Returns a null response if the element does not exist.
+ * ZSCORE: (key, name) - Returns the score of the element with the specified name from the sorted set specified by key. Returns a float holding a double. Returns a null response if the element does not exist.
  *
  * @param cmd Command structure specifying the  (key, name)
  *
  * @return char* response
  */
-char *zscore_cmd(Command *cmd)
+char *zscore_cmd(Command *cmd, bool aof_restore)
 {
     errno = 0;
 
-    ValueType response_type = FLOAT;
-    float score;
-
-    if (cmd->num_args < 2)
-    {
-        return error_response("zscore command requires at least 2 arguments (key, name)");
-    }
+    double score;
 
     char *zset_key = cmd->args[0];
     char *element_key = cmd->args[1];
@@ -2021,100 +2546,43 @@ char *zscore_cmd(Command *cmd)
     ZSet *zset = (ZSet *)fetched_node->value;
 
     // search for the value in the ZSET
-    HashNode *ret_node = zset_search_by_key(zset, element_key);
-    if (!ret_node)
+    if (!zset_score(zset, element_key, &score))
     {
         fprintf(stderr, "Element not in zset\n");
         return null_response();
     }
 
-    // check if the value is a float
-    if (ret_node->valueType != FLOAT)
-    {
-        fprintf(stderr, "Value in zset is somehow not a float, catastrophic error\n");
-        exit(EXIT_FAILURE);
-    }
-
-    score = *(float *)ret_node->value;
-
-    return get_response(response_type, &score);
+    return double_response(score);
 }
 
 /**
- * @brief Generates an array response for a range of avl nodes in a sorted set.
- *
- * The function generates an array response containing a range keys and scores in the AVL tree. The range is determined by the start node and the limit. Elements are ordered by thier rank in the AVL tree.
+ * @brief Builds the array response of the members of a sorted set from a rank, with their scores
  *
- * @param tree AVL tree to iterate through
- * @param start Starting node in the AVL tree
- * @param limit Maximum number of elements to return
+ * @param zset sorted set to read
+ * @param rank rank of the first member, an empty array is returned when it is out of bounds
+ * @param limit maximum number of members to return
+ * @param reverse return the members before the first one instead, by descending rank
  *
  * @return char* response
  */
-char *avl_iterate_response(AVLNode *tree, AVLNode *start, long limit)
+char *zset_range_response(ZSet *zset, long rank, long limit, bool reverse)
 {
-    int num_elements = 0;
-    int inc_buffer = 5;
+    ArrayResponse arr;
+    array_response_init(&arr);
 
-    // buffer for the data
-    char *buffer = calloc(1 + 4 + MAX_MESSAGE_SIZE, sizeof(char));
+    ZSetIter iter;
+    zset_iter_at(zset, rank, &iter);
 
-    // iterate through the AVL tree and write the key and score to the buffer
-    AVLNode *current = start;
-    while (current != NULL && (num_elements / 2 < limit))
+    // write the key and score of every member to the response, in rank order
+    char *key;
+    double score;
+    while ((arr.num_elements / 2 < limit) && (reverse ? zset_iter_prev(&iter, &key, &score) : zset_iter_next(&iter, &key, &score)))
     {
-        // write the key to the buffer
-        int type = SER_STR;
-        int key_len = strlen((char *)current->scnd_index);
-
-        // check if the buffer has enough space to write the key
-        if (inc_buffer + 5 + key_len > MAX_MESSAGE_SIZE)
-        {
-            fprintf(stderr, "Failed to reallocate memory for zquery response\n");
-            exit(EXIT_FAILURE);
-        }
-
-        // write the type and length of the response, 1 byte
-        memcpy(buffer + inc_buffer, &type, 1);
-        memcpy(buffer + inc_buffer + 1, &key_len, 4);
-
-        // write the key
-        memcpy(buffer + inc_buffer + 5, current->scnd_index, key_len);
-
-        inc_buffer += 5 + key_len;
-        num_elements++;
-
-        // now write the score
-        type = SER_FLOAT;
-        int score_len = sizeof(float);
-
-        // check if the buffer has enough space to write the score
-        if (inc_buffer + 5 + score_len > MAX_MESSAGE_SIZE)
-        {
-            fprintf(stderr, "Failed to reallocate memory for zquery response\n");
-            exit(EXIT_FAILURE);
-        }
-
-        // write the type and length of the response, 1 byte
-        memcpy(buffer + inc_buffer, &type, 1);
-        memcpy(buffer + inc_buffer + 1, &score_len, 4);
-
-        // write the score
-        memcpy(buffer + inc_buffer + 5, &current->value, score_len);
-
-        inc_buffer += 5 + score_len;
-        num_elements++;
-
-        // go to next ranked node
-        current = avl_offset(current, 1);
+        array_response_add(&arr, SER_STR, key, strlen(key));
+        array_response_add(&arr, SER_FLOAT, &score, sizeof(double));
     }
 
-    // write the type and length of array to buffer
-    int type = SER_ARR;
-    memcpy(buffer, &type, 1);
-    memcpy(buffer + 1, &num_elements, 4);
-
-    return buffer;
+    return array_response_finish(&arr);
 }
 
 /**
@@ -2126,36 +2594,32 @@ char *avl_iterate_response(AVLNode *tree, AVLNode *start, long limit)
  *
  * @return char* response
  */
-char *zquery_cmd(Command *cmd)
+char *zquery_cmd(Command *cmd, bool aof_restore)
 {
     errno = 0;
 
-    if (cmd->num_args < 5)
-    {
-        return error_response("zquery command requires at least 5 arguments (key, score, name, offset, limit)");
-    }
-
     char *zset_key = cmd->args[0];
     char *score_str = cmd->args[1];
     char *element_key = cmd->args[2];
     char *offset_str = cmd->args[3];
     char *limit_str = cmd->args[4];
 
-    float score;
+    double score;
     int offset;
     int limit;
 
-    // convert the score to a float
-    // use strtol and duck typing to determine the type of the value
+    // convert the score to a double
+    // use strtod and duck typing to determine the type of the value
     char *endptr;
-    score = strtof(score_str, &endptr);
+    score = strtod(score_str, &endptr);
 
-    // check errors
-    if (errno)
+    // check errors, a score too large for a double is an infinity
+    if (errno && errno != ERANGE)
     {
-        perror("strtof failed");
+        perror("strtod failed");
         exit(EXIT_FAILURE);
     }
+    errno = 0;
 
     // Check if successfully converted to a float
     if (!(*endptr == '\0') || (endptr == score_str))
@@ -2210,555 +2674,2376 @@ char *zquery_cmd(Command *cmd)
 
     ZSet *zset = (ZSet *)fetched_node->value;
 
-    if ((isinf(score) == -1) && (strcmp(element_key, "\"\"") == 0))
+    if (isinf(score) && score < 0 && (strcmp(element_key, "\"\"") == 0))
     {
         // "" was passed as the key and -inf was passed as the score, perform a rank query
         printf("Performing rank query\n");
 
-        // find the element with smallest rank
-        AVLNode *origin_node = get_min_node(zset->avl_tree);
-
-        if (!origin_node)
+        if (zset_size(zset) == 0)
         {
             return error_response("No valid elements in zset");
         }
 
-        // offset the rank of the node in the AVL tree by the value specified by the offset parameter
-        AVLNode *offset_node = avl_offset(origin_node, offset);
-
-        return avl_iterate_response(zset->avl_tree, offset_node, limit);
+        // offset the rank of the element with the smallest rank by the value specified by the offset parameter
+        return zset_range_response(zset, offset, limit, false);
     }
     else if (strcmp(element_key, "\"\"") == 0)
     {
-        // ! potential problem dealing with equal scores here due to the fact that nodes with equal scores can be stored on the right and left based on AVL rotations
-        // "" was passed as the key, perform a range query with score without name
+        // "" was passed as the key, perform a range query with score without name, it starts at the first element (by name) with the score
         printf("Performing range query\n");
 
-        // find the element in the ZSET using AVL tree
-        AVLNode *origin_node = avl_search_float(zset->avl_tree, score);
+        long rank = zset_score_rank(zset, score);
 
-        if (!origin_node)
+        if (rank < 0)
         {
             return error_response("No valid elements in zset");
         }
 
-        // offset the rank of the node in the AVL tree by the value specified by the offset parameter
-        AVLNode *offset_node = avl_offset(origin_node, offset);
-
-        return avl_iterate_response(zset->avl_tree, offset_node, limit);
+        // offset the rank of the element by the value specified by the offset parameter
+        return zset_range_response(zset, rank + offset, limit, false);
     }
     else
     {
         // perform a query for the specific element
+        long rank = zset_rank(zset, element_key, score);
 
-        // find the element in the ZSET using AVL tree
-        AVLNode *origin_node = avl_search_pair(zset->avl_tree, element_key, score);
-
-        if (!origin_node)
+        if (rank < 0)
         {
             return error_response("Element not in zset");
         }
 
-        // offset the rank of the node in the AVL tree by the value specified by the offset parameter
-        AVLNode *offset_node = avl_offset(origin_node, offset);
-
-        return avl_iterate_response(zset->avl_tree, offset_node, limit);
+        // offset the rank of the element by the value specified by the offset parameter
+        return zset_range_response(zset, rank + offset, limit, false);
     }
 }
 
 /**
- * @brief Executes a command and returns the corresponding response string according to the liteDB protocol.
- *
- * The function executes a command and returns the corresponding response string according to the liteDB protocol. The function also handles logging the command to the AOF file if the aof_restore flag is set.
+ * @brief Finds the sorted set of a key for a read command
  *
- * @param cmd Command structure specifying the command to execute
- * @param aof_restore Flag indicating whether to log the command to the AOF file
+ * @param key key of the sorted set
+ * @param zset set to the sorted set, NULL if the key is not in the database
  *
- * @return char* response
+ * @return char* error response if the key holds another type, NULL otherwise
  */
-char *execute_command(Command *cmd, bool aof_restore)
+static char *zset_lookup(char *key, ZSet **zset)
 {
+    HashNode *fetched_node = hget(global_table, key);
+    *zset = NULL;
 
-    char *return_response;
-
-    if (!cmd->name)
+    if (!fetched_node)
     {
-        return_response = error_response("Command name was not specified");
+        return NULL;
     }
-    else if (strcmp(cmd->name, "PING") == 0)
+
+    // check if the value is a ZSET
+    if (fetched_node->valueType != ZSET)
     {
-        return_response = ping_command();
+        return error_response("key is not for a zset");
     }
-    else if (strcmp(cmd->name, "EXISTS") == 0)
+
+    *zset = (ZSet *)fetched_node->value;
+    return NULL;
+}
+
+/**
+ * @brief Parses the min or max of a score range, "(" in front of it excludes the score itself, and -inf or +inf leave the range open
+ *
+ * @param str the bound, null terminated
+ * @param len length of str
+ * @param bound the parsed score
+ * @param exclusive set to true if the bound starts with "("
+ *
+ * @return bool true if str is a valid bound
+ */
+static bool parse_score_bound(char *str, int len, double *bound, bool *exclusive)
+{
+    *exclusive = len > 0 && str[0] == '(';
+    if (*exclusive)
     {
-        return_response = exists_command(cmd);
+        str++;
+        len--;
     }
-    else if (strcmp(cmd->name, "DEL") == 0)
-    {
 
-        return_response = del_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "KEYS") == 0)
+    if (len == 0 || isspace((unsigned char)str[0]))
     {
-
-        return_response = keys_command();
+        return false;
     }
-    else if (strcmp(cmd->name, "FLUSHALL") == 0)
-    {
 
-        return_response = flushall_cmd(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "GET") == 0)
-    {
+    char *end;
+    *bound = strtod(str, &end);
 
-        return_response = get_command(cmd);
-    }
-    else if (strcmp(cmd->name, "SET") == 0)
-    {
+    return end == str + len && !isnan(*bound);
+}
 
-        return_response = set_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "HEXISTS") == 0)
+/**
+ * @brief Rank of a member of a sorted set for ZRANK and ZREVRANK
+ *
+ * @param cmd Command structure specifying the (key, name)
+ * @param reverse count the rank from the member with the highest score
+ *
+ * @return char* integer response, null response if the member is not in the sorted set
+ */
+static char *zrank_response(Command *cmd, bool reverse)
+{
+    ZSet *zset;
+    char *error = zset_lookup(cmd->args[0], &zset);
+    if (error)
     {
-        return_response = hexists_command(cmd);
+        return error;
     }
-    else if (strcmp(cmd->name, "HSET") == 0)
-    {
 
-        return_response = hset_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "HGET") == 0)
+    // the rank is found from the score, in O(log n)
+    double score;
+    if (!zset || !zset_score(zset, cmd->args[1], &score))
     {
-
-        return_response = hget_command(cmd);
+        return null_response();
     }
-    else if (strcmp(cmd->name, "HDEL") == 0)
-    {
 
-        return_response = hdel_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "HGETALL") == 0)
-    {
+    int64_t rank = zset_rank(zset, cmd->args[1], score);
 
-        return_response = hgetall_command(cmd);
-    }
-    else if (strcmp(cmd->name, "LEXISTS") == 0)
+    return int64_response(reverse ? zset_size(zset) - 1 - rank : rank);
+}
+
+/**
+ * @brief Executes a ZRANK command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * ZRANK: (key, name) - Returns the rank of the element with the specified name, its position by ascending score starting at 0. Returns a null response if the element does not exist.
+ *
+ * @param cmd Command structure specifying the (key, name)
+ *
+ * @return char* response
+ */
+char *zrank_cmd(Command *cmd, bool aof_restore)
+{
+    return zrank_response(cmd, false);
+}
+
+/**
+ * @brief Executes a ZREVRANK command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * ZREVRANK: (key, name) - Returns the rank of the element with the specified name by descending score, 0 for the element with the highest score. Returns a null response if the element does not exist.
+ *
+ * @param cmd Command structure specifying the (key, name)
+ *
+ * @return char* response
+ */
+char *zrevrank_cmd(Command *cmd, bool aof_restore)
+{
+    return zrank_response(cmd, true);
+}
+
+/**
+ * @brief Executes a ZCOUNT command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * ZCOUNT: (key, min, max) - Returns the number of elements with a score between min and max, both included unless prefixed by "(". Both bounds are found in O(log n), the elements between them are not visited.
+ *
+ * @param cmd Command structure specifying the (key, min, max)
+ *
+ * @return char* response
+ */
+char *zcount_cmd(Command *cmd, bool aof_restore)
+{
+    double min, max;
+    bool min_exclusive, max_exclusive;
+
+    if (!parse_score_bound(cmd->args[1], cmd->arg_lens[1], &min, &min_exclusive) || !parse_score_bound(cmd->args[2], cmd->arg_lens[2], &max, &max_exclusive))
     {
-        return_response = lexists_command(cmd);
+        return error_response("min or max is not a valid float");
     }
-    else if (strcmp(cmd->name, "LPUSH") == 0)
-    {
 
-        return_response = lpush_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "RPUSH") == 0)
+    ZSet *zset;
+    char *error = zset_lookup(cmd->args[0], &zset);
+    if (error)
     {
-
-        return_response = rpush_command(cmd, aof_restore);
+        return error;
     }
-    else if (strcmp(cmd->name, "LPOP") == 0)
-    {
 
-        return_response = lpop_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "RPOP") == 0)
+    int64_t count = 0;
+    if (zset)
     {
-
-        return_response = rpop_command(cmd, aof_restore);
+        // members up to max, minus the members below min
+        count = zset_lower_bound(zset, max, !max_exclusive) - zset_lower_bound(zset, min, min_exclusive);
     }
-    else if (strcmp(cmd->name, "LREM") == 0)
-    {
 
-        return_response = lrem_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "LLEN") == 0)
-    {
+    return int64_response(count > 0 ? count : 0);
+}
 
-        return_response = llen_cmd(cmd);
-    }
-    else if (strcmp(cmd->name, "LRANGE") == 0)
-    {
+/**
+ * @brief Executes a ZRANGEBYSCORE command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * ZRANGEBYSCORE: (key, min, max [LIMIT offset count]) - Returns the elements with a score between min and max, both included unless prefixed by "(", by ascending score. LIMIT skips the first offset elements and returns at most count of them, nothing if offset is negative and all of them if count is negative. Returns an array response of names and scores.
+ *
+ * @param cmd Command structure specifying the (key, min, max [LIMIT offset count])
+ *
+ * @return char* response
+ */
+char *zrangebyscore_cmd(Command *cmd, bool aof_restore)
+{
+    double min, max;
+    bool min_exclusive, max_exclusive;
 
-        return_response = lrange_cmd(cmd);
-    }
-    else if (strcmp(cmd->name, "LTRIM") == 0)
+    if (!parse_score_bound(cmd->args[1], cmd->arg_lens[1], &min, &min_exclusive) || !parse_score_bound(cmd->args[2], cmd->arg_lens[2], &max, &max_exclusive))
     {
-
-        return_response = ltrim_cmd(cmd, aof_restore);
+        return error_response("min or max is not a valid float");
     }
-    else if (strcmp(cmd->name, "LSET") == 0)
-    {
 
-        return_response = lset_cmd(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "ZADD") == 0)
-    {
+    int64_t offset = 0;
+    int64_t count = -1;
 
-        return_response = zadd_command(cmd, aof_restore);
-    }
-    else if (strcmp(cmd->name, "ZREM") == 0)
+    if (cmd->num_args != 3)
     {
+        if (cmd->num_args != 6 || strcasecmp(cmd->args[3], "LIMIT") != 0)
+        {
+            return error_response("zrangebyscore command requires key, min, max [LIMIT offset count]");
+        }
 
-        return_response = zrem_command(cmd, aof_restore);
+        if (!parse_int64(cmd->args[4], cmd->arg_lens[4], &offset, false) || !parse_int64(cmd->args[5], cmd->arg_lens[5], &count, false))
+        {
+            return error_response("offset or count is not a valid integer");
+        }
     }
-    else if (strcmp(cmd->name, "ZSCORE") == 0)
-    {
 
-        return_response = zscore_cmd(cmd);
-    }
-    else if (strcmp(cmd->name, "ZQUERY") == 0)
+    ZSet *zset;
+    char *error = zset_lookup(cmd->args[0], &zset);
+    if (error)
     {
-        return_response = zquery_cmd(cmd);
+        return error;
     }
-    else
+
+    // like Redis, a negative offset selects nothing
+    if (!zset || offset < 0)
     {
-        return_response = error_response("Unknown command");
+        return empty_array_response();
     }
 
-    // free the command
-    free(cmd->name);
+    // the first member in the range and the first one past it, both found in O(log n)
+    long start = zset_lower_bound(zset, min, min_exclusive);
+    long end = zset_lower_bound(zset, max, !max_exclusive);
 
-    // free all args
-    for (int i = 0; i < cmd->num_args; i++)
+    if (offset >= end - start)
     {
-        free(cmd->args[i]);
+        return empty_array_response();
     }
 
-    // free the command
-    free(cmd);
+    long limit = end - start - offset;
+    if (count >= 0 && count < limit)
+    {
+        limit = count;
+    }
 
-    return return_response;
+    return zset_range_response(zset, start + offset, limit, false);
 }
 
 /**
- * @brief Restores the database state from the AOF file.
+ * @brief Executes a ZREVRANGE command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * ZREVRANGE: (key, start, stop) - Returns the elements from rank start to rank stop, both included, by descending score. The ranks count from the element with the highest score, negative ranks count from the element with the lowest score (-1 is the lowest). Returns an array response of names and scores.
+ *
+ * @param cmd Command structure specifying the (key, start, stop)
  *
- * The function reads the AOF file line by line and executes the commands to restore the database state. The function is called when the server starts up.
+ * @return char* response
  */
-void aof_restore_db()
+char *zrevrange_cmd(Command *cmd, bool aof_restore)
 {
-    bool aof_restore = true;
+    int64_t start, stop;
 
-    // check if the AOF was initialized
-    if (!global_aof)
+    if (!parse_int64(cmd->args[1], cmd->arg_lens[1], &start, false) || !parse_int64(cmd->args[2], cmd->arg_lens[2], &stop, false))
     {
-        fprintf(stderr, "AOF not initialized\n");
-        exit(EXIT_FAILURE);
+        return error_response("start or stop is not a valid integer");
+    }
+
+    ZSet *zset;
+    char *error = zset_lookup(cmd->args[0], &zset);
+    if (error)
+    {
+        return error;
     }
 
-    // read the AOF file line by line
-    char *line;
-    while ((line = aof_read_line(global_aof)) != NULL)
+    if (!zset)
     {
-        // parse the command
-        Command *cmd = parse_cmd_string(line, strlen(line));
+        return empty_array_response();
+    }
 
-        // execute the command
-        execute_command(cmd, aof_restore);
+    // check bounds
+    int64_t size = zset_size(zset);
+    if (start < 0)
+    {
+        start = size + start;
+    }
+    if (stop < 0)
+    {
+        stop = size + stop;
+    }
+    if (start < 0)
+    {
+        start = 0;
+    }
+    if (stop >= size)
+    {
+        stop = size - 1;
+    }
 
-        // free the line from aof_read_line()
-        free(line);
+    if (start > stop || start >= size)
+    {
+        return empty_array_response();
     }
+
+    // reverse rank r is the member at rank size - 1 - r, walked backwards from there
+    return zset_range_response(zset, size - 1 - start, stop - start + 1, true);
 }
 
+// indices of the commands in the command table
+enum
+{
+    CMD_PING,
+    CMD_EXISTS,
+    CMD_DEL,
+    CMD_KEYS,
+    CMD_SLABSTATS,
+    CMD_FLUSHALL,
+    CMD_BGREWRITEAOF,
+    CMD_SAVE,
+    CMD_BGSAVE,
+    CMD_GET,
+    CMD_SET,
+    CMD_MGET,
+    CMD_MSET,
+    CMD_INCR,
+    CMD_DECR,
+    CMD_INCRBY,
+    CMD_INCRBYFLOAT,
+    CMD_HEXISTS,
+    CMD_HSET,
+    CMD_HGET,
+    CMD_HDEL,
+    CMD_HGETALL,
+    CMD_LEXISTS,
+    CMD_LPUSH,
+    CMD_RPUSH,
+    CMD_LPOP,
+    CMD_RPOP,
+    CMD_LREM,
+    CMD_LLEN,
+    CMD_LRANGE,
+    CMD_LTRIM,
+    CMD_LSET,
+    CMD_ZADD,
+    CMD_ZREM,
+    CMD_ZSCORE,
+    CMD_ZQUERY,
+    CMD_ZRANK,
+    CMD_ZREVRANK,
+    CMD_ZCOUNT,
+    CMD_ZRANGEBYSCORE,
+    CMD_ZREVRANGE,
+    NUM_COMMANDS
+};
+
+static CommandSpec command_table[NUM_COMMANDS] = {
+    [CMD_PING] = {"PING", ping_command, 0, -1, 0, ""},
+    [CMD_EXISTS] = {"EXISTS", exists_command, 1, -1, 0, "key [key ...]", 1},
+    [CMD_DEL] = {"DEL", del_command, 1, -1, CMD_WRITE | CMD_AOF, "key [key ...]", 1},
+    [CMD_KEYS] = {"KEYS", keys_command, 0, -1, CMD_ALL_SHARDS, ""},
+    [CMD_SLABSTATS] = {"SLABSTATS", slabstats_command, 0, 0, 0, ""},
+    [CMD_FLUSHALL] = {"FLUSHALL", flushall_cmd, 0, -1, CMD_WRITE | CMD_AOF | CMD_ALL_SHARDS, ""},
+    [CMD_BGREWRITEAOF] = {"BGREWRITEAOF", bgrewriteaof_command, 0, 0, 0, ""},
+    [CMD_SAVE] = {"SAVE", save_command, 0, 0, 0, ""},
+    [CMD_BGSAVE] = {"BGSAVE", bgsave_command, 0, 0, 0, ""},
+    [CMD_GET] = {"GET", get_command, 1, 1, 0, "key"},
+    [CMD_SET] = {"SET", set_command, 2, 2, CMD_WRITE | CMD_AOF, "key, value"},
+    [CMD_MGET] = {"MGET", mget_command, 1, -1, 0, "key [key ...]", 1},
+    [CMD_MSET] = {"MSET", mset_command, 2, -1, CMD_WRITE | CMD_AOF, "key, value [key, value ...]", 2},
+    [CMD_INCR] = {"INCR", incr_command, 1, 1, CMD_WRITE | CMD_AOF, "key"},
+    [CMD_DECR] = {"DECR", decr_command, 1, 1, CMD_WRITE | CMD_AOF, "key"},
+    [CMD_INCRBY] = {"INCRBY", incrby_command, 2, 2, CMD_WRITE | CMD_AOF, "key, increment"},
+    [CMD_INCRBYFLOAT] = {"INCRBYFLOAT", incrbyfloat_command, 2, 2, CMD_WRITE | CMD_AOF, "key, increment"},
+    [CMD_HEXISTS] = {"HEXISTS", hexists_command, 2, -1, 0, "key, field"},
+    [CMD_HSET] = {"HSET", hset_command, 3, -1, CMD_WRITE | CMD_AOF, "key, field, value [field, value ...]"},
+    [CMD_HGET] = {"HGET", hget_command, 2, -1, 0, "key, field"},
+    [CMD_HDEL] = {"HDEL", hdel_command, 2, -1, CMD_WRITE | CMD_AOF, "key, field"},
+    [CMD_HGETALL] = {"HGETALL", hgetall_command, 1, -1, 0, "key"},
+    [CMD_LEXISTS] = {"LEXISTS", lexists_command, 2, -1, 0, "key, value"},
+    [CMD_LPUSH] = {"LPUSH", lpush_command, 2, -1, CMD_WRITE | CMD_AOF, "key, value"},
+    [CMD_RPUSH] = {"RPUSH", rpush_command, 2, -1, CMD_WRITE | CMD_AOF, "key, value [value ...]"},
+    [CMD_LPOP] = {"LPOP", lpop_command, 1, -1, CMD_WRITE | CMD_AOF, "key"},
+    [CMD_RPOP] = {"RPOP", rpop_command, 1, -1, CMD_WRITE | CMD_AOF, "key"},
+    [CMD_LREM] = {"LREM", lrem_command, 3, -1, CMD_WRITE | CMD_AOF, "key, count, value"},
+    [CMD_LLEN] = {"LLEN", llen_cmd, 1, -1, 0, "key"},
+    [CMD_LRANGE] = {"LRANGE", lrange_cmd, 3, -1, 0, "key, start, stop"},
+    [CMD_LTRIM] = {"LTRIM", ltrim_cmd, 3, -1, CMD_WRITE | CMD_AOF, "key, start, stop"},
+    [CMD_LSET] = {"LSET", lset_cmd, 3, -1, CMD_WRITE | CMD_AOF, "key, index, value"},
+    [CMD_ZADD] = {"ZADD", zadd_command, 3, -1, CMD_WRITE | CMD_AOF, "key, score, name [score, name ...]"},
+    [CMD_ZREM] = {"ZREM", zrem_command, 2, -1, CMD_WRITE | CMD_AOF, "key, name"},
+    [CMD_ZSCORE] = {"ZSCORE", zscore_cmd, 2, -1, 0, "key, name"},
+    [CMD_ZQUERY] = {"ZQUERY", zquery_cmd, 5, -1, 0, "key, score, name, offset, limit"},
+    [CMD_ZRANK] = {"ZRANK", zrank_cmd, 2, 2, 0, "key, name"},
+    [CMD_ZREVRANK] = {"ZREVRANK", zrevrank_cmd, 2, 2, 0, "key, name"},
+    [CMD_ZCOUNT] = {"ZCOUNT", zcount_cmd, 3, 3, 0, "key, min, max"},
+    [CMD_ZRANGEBYSCORE] = {"ZRANGEBYSCORE", zrangebyscore_cmd, 3, 6, 0, "key, min, max [LIMIT offset count]"},
+    [CMD_ZREVRANGE] = {"ZREVRANGE", zrevrange_cmd, 3, 3, 0, "key, start, stop"},
+};
+
 /**
- * @brief Writes a response to a buffer following the liteDB protocol.
+ * @brief Looks up a command in the command table
  *
- * The function writes a response to a buffer following the liteDB protocol. The response is a byte string that follows the protocol. The function returns the number of bytes written to the buffer.
+ * The candidate entry is picked by switching on the length and the first characters of the name, so only one string comparison is needed whatever the number of commands.
  *
- * @param buffer Buffer to write the response to
- * @param response Response to write to the buffer
+ * @param name name of the command
+ * @param name_len length of the name
  *
- * @return int number of bytes written to the buffer
+ * @return CommandSpec* entry of the command, NULL if the command is unknown
  */
-int buffer_write_response(char *buffer, char *response)
+CommandSpec *lookup_command(char *name, int name_len)
 {
+    int index = -1;
 
-    // write type and size of message
-    memcpy(buffer, response, 1 + 4);
-
-    int type = 0;
-    memcpy(&type, buffer, 1);
-
-    int message_size = 0;
-    memcpy(&message_size, buffer + 1, 4);
-
-    // for the type and size of the message
-    int response_size = 1 + 4;
-
-    if (type == SER_ARR)
+    switch (name_len)
     {
-        for (int i = 0; i < message_size; i++)
+    case 3:
+        switch (name[0])
         {
-            int el_len = 0;
-            memcpy(&el_len, response + response_size + 1, 4);
-
-            // make sure the buffer has enough space to write the response
-            if (response_size + 5 + el_len > MAX_MESSAGE_SIZE)
-            {
-                fprintf(stderr, "Failed to reallocate memory for response\n");
-                exit(EXIT_FAILURE);
-            }
-
-            // write the response
-            memcpy(buffer + response_size, response + response_size, 5 + el_len);
-
-            response_size += 5 + el_len;
+        case 'D':
+            index = CMD_DEL;
+            break;
+        case 'G':
+            index = CMD_GET;
+            break;
+        case 'S':
+            index = CMD_SET;
+            break;
         }
-
-        return response_size;
-    }
-    else
-    {
-        // response without array
-        response_size += message_size;
-
-        // check if the buffer has enough space to write the response
-        if (response_size > MAX_MESSAGE_SIZE)
+        break;
+    case 4:
+        switch (name[0])
         {
-            fprintf(stderr, "Failed to reallocate memory for response\n");
-            exit(EXIT_FAILURE);
-        }
+        case 'P':
+            index = CMD_PING;
+            break;
+        case 'I':
+            index = CMD_INCR;
+            break;
+        case 'D':
+            index = CMD_DECR;
+            break;
+        case 'K':
+            index = CMD_KEYS;
+            break;
+        case 'M':
+            index = (name[1] == 'G') ? CMD_MGET : CMD_MSET;
+            break;
+        case 'H':
+            index = (name[1] == 'S') ? CMD_HSET : (name[1] == 'G') ? CMD_HGET : CMD_HDEL;
+            break;
+        case 'L':
+            index = (name[1] == 'P') ? CMD_LPOP : (name[1] == 'R') ? CMD_LREM : (name[1] == 'L') ? CMD_LLEN : CMD_LSET;
+            break;
+        case 'R':
+            index = CMD_RPOP;
+            break;
+        case 'S':
+            index = CMD_SAVE;
+            break;
+        case 'Z':
+            index = (name[1] == 'A') ? CMD_ZADD : CMD_ZREM;
+            break;
+        }
+        break;
+    case 5:
+        switch (name[0])
+        {
+        case 'L':
+            index = (name[1] == 'P') ? CMD_LPUSH : CMD_LTRIM;
+            break;
+        case 'R':
+            index = CMD_RPUSH;
+            break;
+        case 'Z':
+            index = CMD_ZRANK;
+            break;
+        }
+        break;
+    case 6:
+        switch (name[0])
+        {
+        case 'B':
+            index = CMD_BGSAVE;
+            break;
+        case 'E':
+            index = CMD_EXISTS;
+            break;
+        case 'I':
+            index = CMD_INCRBY;
+            break;
+        case 'L':
+            index = CMD_LRANGE;
+            break;
+        case 'Z':
+            index = (name[1] == 'S') ? CMD_ZSCORE : (name[1] == 'Q') ? CMD_ZQUERY : CMD_ZCOUNT;
+            break;
+        }
+        break;
+    case 7:
+        switch (name[0])
+        {
+        case 'H':
+            index = (name[1] == 'E') ? CMD_HEXISTS : CMD_HGETALL;
+            break;
+        case 'L':
+            index = CMD_LEXISTS;
+            break;
+        }
+        break;
+    case 8:
+        index = (name[0] == 'Z') ? CMD_ZREVRANK : CMD_FLUSHALL;
+        break;
+    case 9:
+        index = (name[0] == 'Z') ? CMD_ZREVRANGE : CMD_SLABSTATS;
+        break;
+    case 11:
+        index = CMD_INCRBYFLOAT;
+        break;
+    case 12:
+        index = CMD_BGREWRITEAOF;
+        break;
+    case 13:
+        index = CMD_ZRANGEBYSCORE;
+        break;
+    }
+
+    // the switch only narrows the name down to one candidate, confirm it
+    if (index < 0 || memcmp(command_table[index].name, name, name_len) != 0)
+    {
+        return NULL;
+    }
+
+    return &command_table[index];
+}
+
+/**
+ * @brief Executes a command and returns the corresponding response string according to the liteDB protocol.
+ *
+ * The command is looked up in the command table, which also checks the number of arguments for every command. Commands that modify the keyspace are logged to the AOF once they succeed, unless they are being restored from it.
+ *
+ * @param cmd Command structure specifying the command to execute
+ * @param aof_restore Flag indicating whether the command is restored from the AOF file, if so it is not logged again and no response is returned
+ *
+ * @return char* response
+ */
+char *execute_command(Command *cmd, bool aof_restore)
+{
+    if (!cmd->name)
+    {
+        return error_response("Command name was not specified");
+    }
+
+    CommandSpec *spec = lookup_command(cmd->name, cmd->name_len);
+    if (!spec)
+    {
+        return error_response("Unknown command");
+    }
+
+    if (cmd->num_args < spec->min_args || (spec->max_args >= 0 && cmd->num_args > spec->max_args))
+    {
+        // e.g. "set command requires 2 arguments (key, value)"
+        char err_msg[128];
+        int len = snprintf(err_msg, sizeof(err_msg), "%s command requires %s%d argument%s (%s)", spec->name, (spec->max_args < 0) ? "at least " : "", spec->min_args, (spec->min_args == 1) ? "" : "s", spec->usage);
+
+        for (int i = 0; i < cmd->name_len && i < len; i++)
+        {
+            err_msg[i] = tolower(err_msg[i]);
+        }
+
+        return error_response(err_msg);
+    }
+
+    if (spec->key_step > 1 && cmd->num_args % spec->key_step != 0)
+    {
+        // e.g. "mset command requires key, value [key, value ...]"
+        char err_msg[128];
+        snprintf(err_msg, sizeof(err_msg), "%s command requires %s", spec->name, spec->usage);
+
+        for (int i = 0; i < cmd->name_len; i++)
+        {
+            err_msg[i] = tolower(err_msg[i]);
+        }
+
+        return error_response(err_msg);
+    }
+
+    char *response = spec->handler(cmd, aof_restore);
+
+    // the handlers only produce an error response when they did not modify the keyspace
+    if (!aof_restore && (spec->flags & CMD_AOF) && response && response[0] != SER_ERR)
+    {
+        handle_aof_write(cmd);
+    }
+
+    return response;
+}
+
+/**
+ * @brief Copies a line of the AOF and parses it
+ *
+ * @param line line in the mapping of the AOF, without its newline
+ * @param len length of the line
+ * @param copy buffer the line is copied to, grown as needed
+ * @param cmd command to fill in, release it with cmd_release()
+ */
+static void restore_parse_line(const char *line, size_t len, RestoreLine *copy, Command *cmd)
+{
+    if (len + 1 > copy->capacity)
+    {
+        copy->capacity = len + 1 > MAX_MESSAGE_SIZE ? len + 1 : MAX_MESSAGE_SIZE;
+        free(copy->data);
+        copy->data = malloc(copy->capacity);
+        if (!copy->data)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(copy->data, line, len);
+    parse_cmd(copy->data, len, cmd);
+}
+
+/**
+ * @brief Replays one line of the AOF
+ *
+ * @param line line in the mapping of the AOF, without its newline
+ * @param len length of the line
+ * @param copy buffer the line is copied to so that it can be parsed in place, grown as needed
+ * @param route replay the command against the shard(s) that own it, otherwise against global_table
+ */
+static void restore_replay_line(const char *line, size_t len, RestoreLine *copy, bool route)
+{
+    Command cmd;
+    restore_parse_line(line, len, copy, &cmd);
+
+    int shard = (route && num_loops > 1 && event_loops) ? command_shard(&cmd) : -2;
+
+    if (shard == -1)
+    {
+        // commands with keys on several shards only touch the keys of the shard they run on
+        for (int i = 0; i < num_loops; i++)
+        {
+            global_table = event_loops[i].table;
+            response_free(execute_command(&cmd, true));
+        }
+    }
+    else
+    {
+        if (shard >= 0)
+        {
+            global_table = event_loops[shard].table;
+        }
+
+        // execute the command, some commands respond even when restored
+        response_free(execute_command(&cmd, true));
+    }
+
+    response_arena_reset();
+    cmd_release(&cmd);
+}
+
+/**
+ * @brief Returns the end of the line starting at a position of the mapped AOF
+ *
+ * @return size_t position of its newline, or the end of the file for a last line without one
+ */
+static size_t restore_line_end(const char *data, size_t pos, size_t end)
+{
+    const char *newline = memchr(data + pos, '\n', end - pos);
+
+    return newline ? (size_t)(newline - data) : end;
+}
+
+/**
+ * @brief Replays the commands of the mapped AOF in order on the current thread, switching between the shards they belong to
+ *
+ * @return long number of lines replayed
+ */
+static long restore_serial(const char *data, size_t start, size_t end)
+{
+    RestoreLine copy = {0};
+    long num_lines = 0;
+
+    for (size_t pos = start; pos < end;)
+    {
+        size_t line_end = restore_line_end(data, pos, end);
+
+        if (line_end > pos)
+        {
+            restore_replay_line(data + pos, line_end - pos, &copy, true);
+            num_lines++;
+        }
+
+        pos = line_end + 1;
+    }
+
+    free(copy.data);
+
+    // event loop 0 runs on the main thread
+    if (event_loops)
+    {
+        global_table = event_loops[0].table;
+    }
+
+    return num_lines;
+}
+
+// adds the position of a line to the lines a shard replays
+static void restore_add_line(RestoreLines *lines, size_t pos)
+{
+    if (lines->size == lines->capacity)
+    {
+        lines->capacity = lines->capacity ? lines->capacity * 2 : 1024;
+        lines->positions = realloc(lines->positions, lines->capacity * sizeof(size_t));
+        if (!lines->positions)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    lines->positions[lines->size++] = pos;
+}
+
+/**
+ * @brief Splits a chunk of the mapped AOF into lines and routes each one to the shard(s) it is replayed on
+ *
+ * @param arg RestoreWorker of the chunk
+ */
+static void *restore_route_chunk(void *arg)
+{
+    RestoreWorker *worker = (RestoreWorker *)arg;
+    RestoreLine copy = {0};
+
+    for (size_t pos = worker->start; pos < worker->end;)
+    {
+        size_t line_end = restore_line_end(worker->data, pos, worker->end);
+
+        if (line_end > pos)
+        {
+            Command cmd;
+            restore_parse_line(worker->data + pos, line_end - pos, &copy, &cmd);
+
+            // commands with keys on several shards are replayed on each of them, and only touch the keys of the shard they run on
+            int shard = command_shard(&cmd);
+            for (int i = 0; i < num_loops; i++)
+            {
+                if (shard < 0 || shard == i)
+                {
+                    restore_add_line(&worker->lines[i], pos);
+                }
+            }
+
+            cmd_release(&cmd);
+            worker->num_lines++;
+        }
+
+        pos = line_end + 1;
+    }
+
+    free(copy.data);
+
+    return NULL;
+}
+
+/**
+ * @brief Replays the lines routed to the shard of a worker, chunk after chunk so that they are applied in the order of the file
+ *
+ * @param arg RestoreWorker whose id is the shard
+ */
+static void *restore_apply_shard(void *arg)
+{
+    RestoreWorker *worker = (RestoreWorker *)arg;
+    RestoreWorker *workers = worker - worker->id;
+    RestoreLine copy = {0};
+
+    global_table = event_loops[worker->id].table;
+
+    for (int c = 0; c < num_loops; c++)
+    {
+        RestoreLines *lines = &workers[c].lines[worker->id];
+
+        for (long i = 0; i < lines->size; i++)
+        {
+            size_t pos = lines->positions[i];
+            restore_replay_line(worker->data + pos, restore_line_end(worker->data, pos, workers[c].end) - pos, &copy, false);
+        }
+    }
+
+    free(copy.data);
+
+    // the response arena of the main thread is kept, it goes on serving event loop 0. The nodes allocated by the other threads stay valid once they exit, only the unused rest of their current slabs is not handed out anymore
+    if (worker->id != 0)
+    {
+        arena_free(&response_arena);
+    }
+
+    return NULL;
+}
+
+// runs a restore step on one thread per shard, the main thread takes the first one
+static void restore_run_workers(RestoreWorker *workers, void *(*step)(void *))
+{
+    pthread_t threads[MAX_LOOPS];
+
+    for (int i = 1; i < num_loops; i++)
+    {
+        if (pthread_create(&threads[i], NULL, step, &workers[i]))
+        {
+            fprintf(stderr, "Failed to create AOF restore thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    step(&workers[0]);
+
+    for (int i = 1; i < num_loops; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/**
+ * @brief Replays the commands of the mapped AOF on every shard in parallel
+ *
+ * The file is split into one chunk per shard at line boundaries. The chunks are parsed in parallel, each line being routed to the shard(s) that own its keys, then every shard replays its lines on a thread of its own in the order of the file. The shards are independent, so this gives the same keyspace as replaying the file from start to end.
+ *
+ * @return long number of lines replayed
+ */
+static long restore_parallel(const char *data, size_t start, size_t end)
+{
+    RestoreWorker *workers = calloc(num_loops, sizeof(RestoreWorker));
+    if (!workers)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t chunk_start = start;
+    for (int i = 0; i < num_loops; i++)
+    {
+        workers[i].id = i;
+        workers[i].data = data;
+        workers[i].start = chunk_start;
+
+        // every chunk but the last ends after the first newline past its share of the file
+        size_t chunk_end = (i == num_loops - 1) ? end : start + (end - start) / num_loops * (i + 1);
+        if (chunk_end < chunk_start)
+        {
+            chunk_end = chunk_start;
+        }
+        if (chunk_end < end && chunk_end > chunk_start)
+        {
+            chunk_end = restore_line_end(data, chunk_end - 1, end);
+            chunk_end = (chunk_end < end) ? chunk_end + 1 : end;
+        }
+
+        workers[i].end = chunk_end;
+        chunk_start = chunk_end;
+    }
+
+    restore_run_workers(workers, restore_route_chunk);
+    restore_run_workers(workers, restore_apply_shard);
+
+    long num_lines = 0;
+    for (int i = 0; i < num_loops; i++)
+    {
+        num_lines += workers[i].num_lines;
+
+        for (int j = 0; j < num_loops; j++)
+        {
+            free(workers[i].lines[j].positions);
+        }
+    }
+    free(workers);
+
+    // event loop 0 runs on the main thread
+    global_table = event_loops[0].table;
+
+    return num_lines;
+}
+
+/**
+ * @brief Restores the database state from the AOF file.
+ *
+ * The function loads the snapshot the AOF starts with if it was rewritten, then maps the rest of the file and executes its commands to restore the database state, on one thread per shard when the keyspace is sharded. The function is called when the server starts up.
+ *
+ * @return long number of command lines replayed after the snapshot
+ */
+long aof_restore_db()
+{
+    // check if the AOF was initialized
+    if (!global_aof)
+    {
+        fprintf(stderr, "AOF not initialized\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a rewritten AOF starts with a binary snapshot of the keyspace, the commands logged after it follow
+    int version = snapshot_detect(global_aof->file);
+    if (version)
+    {
+        HashTable *tables[MAX_LOOPS];
+        int num_tables = event_loops ? num_loops : 1;
+
+        for (int i = 0; i < num_tables; i++)
+        {
+            tables[i] = event_loops ? event_loops[i].table : global_table;
+        }
+
+        if (snapshot_load(global_aof->file, version, tables, num_tables, shard_for_key) < 0)
+        {
+            fprintf(stderr, "The snapshot at the start of the AOF is truncated or corrupt\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the commands are replayed from a mapping of the rest of the file
+    long offset = ftell(global_aof->file);
+    struct stat st;
+    if (offset < 0 || fstat(fileno(global_aof->file), &st) < 0)
+    {
+        perror("Error reading the AOF");
+        exit(EXIT_FAILURE);
+    }
+
+    if (st.st_size <= offset)
+    {
+        return 0;
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(global_aof->file), 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Error mapping the AOF");
+        exit(EXIT_FAILURE);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    // the shards are replayed in parallel when there are cores to run them on
+    bool parallel = num_loops > 1 && event_loops && sysconf(_SC_NPROCESSORS_ONLN) > 1;
+
+    long num_lines = parallel ? restore_parallel(data, offset, st.st_size) : restore_serial(data, offset, st.st_size);
+
+    munmap(data, st.st_size);
+
+    return num_lines;
+}
+
+// size of the buffers a rewritten command is built in, large enough for the longest item after a full prefix
+#define REWRITE_LINE_SIZE (3 * MAX_MESSAGE_SIZE)
+
+/**
+ * @brief Appends an item (e.g. " field value") to a rewritten bulk command. When the command would not fit in a request anymore it is written out, and a new one is started with the same prefix (e.g. "HSET key")
+ *
+ * @param file file the commands are written to
+ * @param line command being built
+ * @param len length of the command, updated
+ * @param prefix_len length of the prefix of the command
+ * @param item item to append
+ * @param item_len length of the item
+ */
+static void rewrite_append_item(FILE *file, char *line, int *len, int prefix_len, char *item, int item_len)
+{
+    if (*len > prefix_len && *len + item_len > MAX_MESSAGE_SIZE - 2)
+    {
+        line[(*len)++] = '\n';
+        fwrite(line, 1, *len, file);
+        *len = prefix_len;
+    }
+
+    memcpy(line + *len, item, item_len);
+    *len += item_len;
+}
+
+/**
+ * @brief Writes out a rewritten bulk command, unless no item was appended to it
+ *
+ * @param file file the commands are written to
+ * @param line command being built
+ * @param len length of the command
+ * @param prefix_len length of the prefix of the command
+ */
+static void rewrite_finish_line(FILE *file, char *line, int len, int prefix_len)
+{
+    if (len > prefix_len)
+    {
+        line[len++] = '\n';
+        fwrite(line, 1, len, file);
+    }
+}
+
+/**
+ * @brief Writes the commands rebuilding a shard of the keyspace, one SET (or INCRBYFLOAT for floats) per number or string, and one HSET, RPUSH or ZADD per hash, list or sorted set, split when it would exceed the request size
+ *
+ * @param file file the commands are written to
+ * @param table shard to write
+ *
+ * @return bool true if everything was written
+ */
+bool aof_rewrite_table(FILE *file, HashTable *table)
+{
+    char *line = malloc(REWRITE_LINE_SIZE);
+    char *item = malloc(REWRITE_LINE_SIZE);
+    if (!line || !item)
+    {
+        fprintf(stderr, "Failed to allocate memory for the AOF rewrite\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int pos = 0;
+    HashNode *node;
+
+    while ((node = hnext(table, &pos)) != NULL)
+    {
+        char number[32];
+        int len = 0;
+        int prefix_len = 0;
+
+        switch (node->valueType)
+        {
+        case STRING:
+            fprintf(file, "SET %s %s\n", node->key, (char *)node->value);
+            break;
+
+        case INTEGER:
+            format_number(node, number, sizeof(number));
+            fprintf(file, "SET %s %s\n", node->key, number);
+            break;
+
+        case FLOAT:
+            // SET would store the number as a string, INCRBYFLOAT on a missing key stores it as a float
+            format_number(node, number, sizeof(number));
+            fprintf(file, "INCRBYFLOAT %s %s\n", node->key, number);
+            break;
+
+        case HASHTABLE:
+        {
+            len = prefix_len = snprintf(line, REWRITE_LINE_SIZE, "HSET %s", node->key);
+
+            int field_pos = 0;
+            char *field, *value;
+            uint32_t field_len, value_len;
+            while (hmap_next((HashMap *)node->value, &field_pos, &field, &field_len, &value, &value_len))
+            {
+                int item_len = snprintf(item, REWRITE_LINE_SIZE, " %s %s", field, value);
+                rewrite_append_item(file, line, &len, prefix_len, item, item_len);
+            }
+            break;
+        }
+
+        case LIST:
+        {
+            len = prefix_len = snprintf(line, REWRITE_LINE_SIZE, "RPUSH %s", node->key);
+
+            for (ListNode *elem = ((List *)node->value)->head; elem; elem = elem->next)
+            {
+                int item_len = snprintf(item, REWRITE_LINE_SIZE, " %s", (char *)elem->data);
+                rewrite_append_item(file, line, &len, prefix_len, item, item_len);
+            }
+            break;
+        }
+
+        case ZSET:
+        {
+            len = prefix_len = snprintf(line, REWRITE_LINE_SIZE, "ZADD %s", node->key);
+
+            ZSetIter iter;
+            zset_iter_at((ZSet *)node->value, 0, &iter);
+
+            char *member;
+            double score;
+            while (zset_iter_next(&iter, &member, &score))
+            {
+                // scores are doubles, 17 digits are enough to read back the same double
+                int item_len = snprintf(item, REWRITE_LINE_SIZE, " %.17g %s", score, member);
+                rewrite_append_item(file, line, &len, prefix_len, item, item_len);
+            }
+            break;
+        }
+        }
+
+        rewrite_finish_line(file, line, len, prefix_len);
+    }
+
+    free(line);
+    free(item);
+
+    return !ferror(file);
+}
+
+/**
+ * @brief Writes the base of a rewritten AOF, holding every shard of the keyspace
+ *
+ * @param path file to write
+ * @param snapshot write a binary snapshot, otherwise the commands rebuilding the keyspace
+ *
+ * @return bool true if the file was written and synced
+ */
+bool aof_rewrite_write(char *path, bool snapshot)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER_SIZE);
+
+    int num_tables = event_loops ? num_loops : 1;
+    uint64_t num_entries = 0;
+
+    for (int i = 0; i < num_tables; i++)
+    {
+        num_entries += (event_loops ? event_loops[i].table : global_table)->size;
+    }
+
+    bool ok = !snapshot || snapshot_write_header(file, num_entries);
+
+    for (int i = 0; i < num_tables && ok; i++)
+    {
+        HashTable *table = event_loops ? event_loops[i].table : global_table;
+        ok = snapshot ? snapshot_write_table(file, table) : aof_rewrite_table(file, table);
+    }
+
+    ok = ok && (!snapshot || snapshot_write_end(file));
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    return ok;
+}
+
+/**
+ * @brief Body of the child process forked by aof_rewrite_background(), writes the base of the rewritten AOF and exits
+ *
+ * The child has a copy-on-write copy of the memory of the server at the time of the fork, and only the thread that forked it.
+ *
+ * @param path file to write the base to
+ * @param snapshot write a binary snapshot, otherwise commands
+ */
+void aof_rewrite_child(char *path, bool snapshot)
+{
+    _exit(aof_rewrite_write(path, snapshot) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @brief Starts rewriting the AOF in a child process
+ *
+ * The other event loops are paused while the child is forked, so every shard is in a consistent state and the snapshot holds exactly the commands appended so far. The commands appended while the child runs are kept in the rewrite buffer of the AOF, the AOF thread appends them to the snapshot and renames it over the AOF once the child exits.
+ *
+ * @param snapshot start the rewritten AOF with a binary snapshot instead of commands
+ *
+ * @return bool true if the rewrite was started, false if one is already running or the child could not be forked
+ */
+bool aof_rewrite_background(bool snapshot)
+{
+    if (!global_aof || global_aof->fd < 0 || !aof_rewrite_begin(global_aof))
+    {
+        return false;
+    }
+
+    loops_pause();
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        aof_rewrite_child(AOF_REWRITE_FILE, snapshot);
+    }
+
+    if (pid < 0)
+    {
+        perror("fork failed");
+        loops_resume();
+        aof_rewrite_abort(global_aof);
+        return false;
+    }
+
+    aof_rewrite_started(global_aof, pid, AOF_REWRITE_FILE);
+
+    loops_resume();
+
+    return true;
+}
+
+/**
+ * @brief Rewrites the AOF as a binary snapshot of the keyspace, without forking
+ *
+ * Every event loop waits until the snapshot is written and replaces the AOF, the commands logged later are appended after it.
+ *
+ * @return bool true if the snapshot replaced the AOF, false if a rewrite is already running or writing the snapshot failed
+ */
+bool aof_save()
+{
+    if (!global_aof || global_aof->fd < 0 || !aof_rewrite_begin(global_aof))
+    {
+        return false;
+    }
+
+    loops_pause();
+
+    aof_rewrite_started(global_aof, 0, AOF_REWRITE_FILE);
+    bool saved = aof_rewrite_finish(global_aof, aof_rewrite_write(AOF_REWRITE_FILE, true));
+
+    loops_resume();
+
+    return saved;
+}
+
+/**
+ * @brief Writes a response to a buffer following the liteDB protocol.
+ *
+ * The function appends a response to the chunked write buffer of a connection. The response is a byte string that follows the protocol, there is no limit on the size of array responses, they spill over as many chunks as needed. The size of the response is kept in front of it by response_alloc(), so array responses are copied without walking their elements. The function returns the number of bytes written to the buffer.
+ *
+ * @param buffer Buffer to write the response to
+ * @param response Response to write to the buffer
+ *
+ * @return int number of bytes written to the buffer
+ */
+int buffer_write_response(Buffer *buffer, char *response)
+{
+    int size = response_size(response);
+
+    buffer_append(buffer, response, size);
+
+    return size;
+}
+
+/**
+ * @brief Removes a processed request from the front of the read buffer of a connection
+ *
+ * @param conn Connection structure to handle
+ * @param message_size size of the request message, excluding the 4 byte length prefix
+ */
+void conn_consume_request(Conn *conn, int message_size)
+{
+    int remaining_size = conn->current_read_size - (4 + message_size);
+
+    // using memmove instead of memcpy to handle overlapping memory regions
+    if (remaining_size)
+    {
+        memmove(conn->read_chunk->data, conn->read_chunk->data + 4 + message_size, remaining_size);
+    }
+
+    conn->current_read_size = remaining_size;
+}
+
+/**
+ * @brief Writes a response to the write buffer of a connection and tries to flush it
+ *
+ * @param conn Connection structure to handle
+ * @param response Response to send, freed by this function
+ */
+void conn_write_response(Conn *conn, char *response)
+{
+    // write response to the write buffer
+    buffer_write_response(&conn->write_buffer, response);
+
+    // free the response, it was detached from the arena of the loop that produced it
+    response_free(response);
+
+    // the request has been processed, move to the response state
+    conn->state = STATE_RESP;
+    state_resp(conn);
+}
+
+/**
+ * @brief Attempts to process a single request from a connection.
+ *
+ * The function attempts to process a single request from a connection. The function checks if the read buffer of the connection has enough data to process a request. If the read buffer has enough data, the function processes the request and writes the response to the write buffer. The function returns true if the request was fully processed and sent to the connection, and false otherwise.
+ *
+ * @param conn Connection structure to handle
+ */
+bool try_process_single_request(Conn *conn)
+{
+    // check if the read buffer has enough data to process a request
+    if (conn->current_read_size < 4)
+    {
+        // not enough data to process a request
+        return false;
+    }
+
+    // copy the first 4 bytes of the read buffer, assume the message size is in little endian (this machine is little endian)
+    int message_size = 0;
+    memcpy(&message_size, conn->read_chunk->data, 4);
+
+    if (message_size > MAX_MESSAGE_SIZE)
+    {
+        fprintf(stderr, "Message size too large\n");
+        conn->state = STATE_DONE;
+        return false;
+    }
+
+    // check if the read buffer has enough data to process a request
+    if (conn->current_read_size < 4 + message_size)
+    {
+        // not enough data to process a request
+        return false;
+    }
+
+    // print the message, account for the fact that the message is not null terminated due to pipe-lining
+    printf("Client %d says: %.*s\n", conn->fd, message_size, conn->read_chunk->data + 4);
+
+    // parse the message in place, the args of the command point into the read buffer. Parsing overwrites the first byte after the message, which may belong to the next pipelined request, so it is restored once the command is done
+    char *message = conn->read_chunk->data + 4;
+    char next_byte = message[message_size];
+
+    Command cmd;
+    parse_cmd(message, message_size, &cmd);
+
+    // writes touching several shards are executed right here with the other loops paused, so that they are logged to the AOF in the order they took effect
+    int shard = command_shard(&cmd);
+    CommandSpec *spec = (shard < 0) ? lookup_command(cmd.name, cmd.name_len) : NULL;
+    bool all_shards_write = spec && (spec->flags & CMD_WRITE);
+
+    // forward the request if its key is owned by another event loop, reads touching every shard visit the loops in turn
+    if (current_loop && shard != current_loop->id && !all_shards_write)
+    {
+        LoopMsg *msg = calloc(1, sizeof(LoopMsg));
+        if (!msg)
+        {
+            fprintf(stderr, "Failed to allocate memory for loop message\n");
+            exit(EXIT_FAILURE);
+        }
+
+        msg->type = LOOP_MSG_REQUEST;
+        msg->conn = conn;
+        msg->origin = current_loop->id;
+
+        // the request was tokenized in place, so the forwarded copy is rebuilt from the parsed command
+        msg->request = malloc(message_size + 1);
+        if (!msg->request)
+        {
+            fprintf(stderr, "Failed to allocate memory for loop message\n");
+            exit(EXIT_FAILURE);
+        }
+        msg->request_size = serialize_cmd(&cmd, msg->request);
+        msg->request[msg->request_size] = '\0';
+        cmd_release(&cmd);
+
+        // commands touching every shard visit the loops in order, starting with the first one
+        msg->next_shard = (shard < 0) ? 0 : shard;
+
+        message[message_size] = next_byte;
+        conn_consume_request(conn, message_size);
+
+        // flush the replies accumulated so far, they should not be held back while waiting
+        state_resp(conn);
+        if (conn->state == STATE_DONE)
+        {
+            free(msg->request);
+            free(msg);
+            return false;
+        }
+
+        // stop processing pipelined requests until the response arrives, so responses stay in order
+        conn->state = STATE_WAIT;
+        loop_send(msg->next_shard, msg);
+
+        return false;
+    }
+
+    // aof_restore is false, since the command is not being restored from the AOF file
+    bool aof_restore = false;
+
+    // execute the command, response is a null terminated byte string following the protocol
+    char *response = (current_loop && all_shards_write) ? execute_on_all_shards(&cmd) : execute_command(&cmd, aof_restore);
+    cmd_release(&cmd);
+
+    message[message_size] = next_byte;
+
+    // remove the request from the read buffer
+    conn_consume_request(conn, message_size);
+
+    // queue the response, it is flushed together with the other pipelined responses once the read side is drained
+    buffer_write_response(&conn->write_buffer, response);
+    response_arena_reset();
+
+    // continue the outer loop to process pipelined requests, unless too many responses are pending
+    return (conn->write_buffer.size < MAX_PENDING_WRITE_SIZE);
+}
+
+/**
+ * @brief Attempts to fill the read buffer of a connection.
+ *
+ * The function attempts to fill the read buffer of a connection. The function reads from the socket and fills the read buffer of the connection. The function returns false to indicate to that the attempt to read any characters into the buffer was unsuccessful or that the connection is waiting for a response, and true otherwise.
+ *
+ * @param conn Connection structure to handle
+ *
+ * @return bool indicating if this function should be called again in the while loop of state_req()
+ */
+bool try_fill_read_buffer(Conn *conn)
+{
+    // stop reading until the pending responses are flushed
+    if (conn->write_buffer.size >= MAX_PENDING_WRITE_SIZE)
+    {
+        return false;
+    }
+
+    // check if the read buffer overflowed
+    if (conn->current_read_size > READ_BUFFER_SIZE)
+    {
+        fprintf(stderr, "Read buffer overflow\n");
+        return false;
+    }
+
+    // the read buffer is only taken from the pool once there is input
+    if (!conn->read_chunk)
+    {
+        conn->read_chunk = buffer_chunk_acquire();
+    }
+
+    // read from the socket
+    int read_size = 0;
+
+    // attempt to read from the socket until we have read some characters or a signal has not interrupted the read
+    do
+    {
+        int max_possible_read = READ_BUFFER_SIZE - conn->current_read_size;
+
+        read_size = read(conn->fd, conn->read_chunk->data + conn->current_read_size, max_possible_read);
+    } while (read_size < 0 && errno == EINTR);
+
+    if ((read_size < 0) && (errno == EAGAIN))
+    {
+        //  socket has been drained, wait for the next epoll event
+        return false;
+    }
+
+    if (read_size < 0)
+    {
+        // an error that is not EINTR or EAGAIN occured, exit the connection
+        perror("read failed");
+        conn->state = STATE_DONE;
+        return false;
+    }
+
+    if (read_size == 0)
+    {
+        // if read_size is 0 then EOF reached
+
+        // if the current_read_size is greater than 0, then the EOF was reached before reading the full message
+        if (conn->current_read_size > 0)
+        {
+            fprintf(stderr, "EOF reached before reading full message\n");
+        }
+        else
+        {
+            // EOF reached
+            printf("EOF reached\n");
+        }
+
+        conn->state = STATE_DONE;
+        return false;
+    }
+
+    conn->current_read_size += read_size;
+    if (conn->current_read_size > READ_BUFFER_SIZE)
+    {
+        fprintf(stderr, "Read buffer overflow\n");
+        return false;
+    }
+
+    // the loop here is to handle that clients can send multiple requests in one go (pipe-lining)
+    while (try_process_single_request(conn))
+    {
+    };
+
+    return (conn->state == STATE_REQ) && (conn->write_buffer.size < MAX_PENDING_WRITE_SIZE);
+}
+
+/**
+ * @brief Attempts to flush the write buffer of a connection.
+ *
+ * The function attempts to flush the write buffer of a connection. The function writes to the socket and flushes the write buffer of the connection. The function returns false to indicate that the attempt to write any characters into the buffer was unsuccessful or that the connection is waiting for a request, and true otherwise.
+ *
+ * @param conn Connection structure to handle
+ *
+ * @return bool indicating if this function should be called again in the while loop of state_resp()
+ */
+bool try_flush_write_buffer(Conn *conn)
+{
+    // with appendfsync always, replies are only released once the commands logged so far are durable
+    if (current_loop && global_aof && aof_needs_commit(global_aof, current_loop->aof_offset))
+    {
+        conn_defer_reply(conn);
+        return false;
+    }
+
+    // write as many pending chunks as possible in one system call
+    struct iovec iov[MAX_WRITE_IOV];
+    int iov_count = buffer_iovec(&conn->write_buffer, iov, MAX_WRITE_IOV);
+
+    ssize_t write_size = 0;
+
+    // attempt to write to the socket until we have written some characters or a signal has not interrupted the write
+    do
+    {
+        write_size = writev(conn->fd, iov, iov_count);
+    } while (write_size < 0 && errno == EINTR);
+
+    if (write_size < 0)
+    {
+        if (errno == EAGAIN)
+        {
+            // socket send buffer is full, wait for the next epoll event
+            return false;
+        }
+        // an error that is not EINTR or EAGAIN occured, exit the connection
+        perror("write failed");
+        conn->state = STATE_DONE;
+        return false;
+    }
+
+    // drop the written bytes, fully written chunks go back to the pool
+    buffer_consume(&conn->write_buffer, write_size);
+
+    if (conn->write_buffer.size == 0)
+    {
+        // the responses have been fully written, move to the request state. A connection waiting on another event loop keeps waiting
+        if (conn->state == STATE_RESP)
+        {
+            conn->state = STATE_REQ;
+        }
+
+        // exit the outer write loop
+        return false;
+    }
+
+    // data still in the write buffer, try to write again in the outer loop
+    return true;
+}
+
+/**
+ * @brief Handles the request state of a connection.
+ *
+ * The function handles the request state of a connection. Calls try_fill_read_buffer() repeatedly until the socket is drained, then flushes the responses of all the processed requests at once, so pipelined requests cost a single write system call.
+ *
+ * @param conn Connection structure to handle
+ */
+void state_req(Conn *conn)
+{
+    while (1)
+    {
+        while (try_fill_read_buffer(conn))
+        {
+        };
+
+        if (conn->state != STATE_REQ || conn->write_buffer.size == 0)
+        {
+            return;
+        }
+
+        // reading stopped early if too many responses were pending, the socket may not be drained yet
+        bool backpressure = conn->write_buffer.size >= MAX_PENDING_WRITE_SIZE;
+
+        conn->state = STATE_RESP;
+        state_resp(conn);
+
+        if (!backpressure || conn->state != STATE_REQ)
+        {
+            return;
+        }
+
+        // process the requests left in the read buffer before reading again
+        while (try_process_single_request(conn))
+        {
+        };
+    }
+}
+
+/**
+ * @brief Handles the response state of a connection.
+ *
+ * The function handles the response state of a connection. Calls try_flush_write_buffer() repeatedly.
+ *
+ * @param conn Connection structure to handle
+ */
+void state_resp(Conn *conn)
+{
+    while (try_flush_write_buffer(conn))
+    {
+    };
+}
+
+/**
+ * @brief Handles the state of a connection after IO was performed on it by an event loop
+ *
+ * Closes the connection if it is done, otherwise switches its epoll interest if the connection moved between reading and writing.
+ *
+ * @param epoll_fd epoll instance of the event loop owning the connection
+ * @param conn Connection structure to handle
+ * @param prev_state state of the connection before the IO
+ */
+void conn_after_io(int epoll_fd, Conn *conn, enum Conn_State prev_state)
+{
+    if (conn->state == STATE_DONE && conn->reply_deferred)
+    {
+        // still linked in the deferred replies of the loop, closed by loop_release_replies()
+        return;
+    }
+
+    if (conn->state == STATE_DONE)
+    {
+        // close the connection, closing the fd also removes it from the epoll instance
+        fd2conn[conn->fd] = NULL;
+        close(conn->fd);
+        conn_free(conn);
+        return;
+    }
+
+    if (conn->state != prev_state)
+    {
+        // only touch the epoll interest when the connection switched between reading and writing
+        conn_update_events(epoll_fd, conn, EPOLL_CTL_MOD);
+    }
+
+    conn_release_idle_buffers(conn);
+}
+
+/**
+ * @brief Holds back the responses of a connection until the AOF is committed at the end of the event loop iteration
+ *
+ * @param conn Connection structure to handle
+ */
+void conn_defer_reply(Conn *conn)
+{
+    if (conn->reply_deferred)
+    {
+        return;
+    }
+
+    conn->reply_deferred = true;
+    conn->next_deferred = current_loop->deferred_replies;
+    current_loop->deferred_replies = conn;
+}
+
+/**
+ * @brief Hands the commands logged during an event loop iteration to the AOF thread and releases the replies that waited for them
+ *
+ * With appendfsync always, the replies of the iteration are held back until the AOF thread has committed its commands, it wakes the loop up once they are durable. Commits of all the loops are grouped into one write and fdatasync. With the other policies the AOF thread drains the rings on its own and replies are sent right away.
+ *
+ * @param loop event loop at the end of its iteration
+ */
+void loop_release_replies(EventLoop *loop)
+{
+    if (!global_aof)
+    {
+        return;
+    }
+
+    if (global_aof->fsync_policy != AOF_FSYNC_ALWAYS)
+    {
+        // the AOF thread drains the rings on its own
+        return;
+    }
+
+    // the AOF thread commits the records appended in this iteration
+    if (loop->aof_offset > atomic_load(&global_aof->written))
+    {
+        aof_notify(global_aof);
+    }
+
+    // resuming a connection may process more of its pipelined requests, whose replies are deferred again
+    while (loop->deferred_replies)
+    {
+        if (aof_needs_commit(global_aof, loop->aof_offset))
+        {
+            // the AOF thread wakes the loop up once the records are durable, the check is repeated in case it synced them in between
+            atomic_store(&loop->aof_wait, loop->aof_offset);
+            if (aof_needs_commit(global_aof, loop->aof_offset))
+            {
+                return;
+            }
+        }
+
+        atomic_store(&loop->aof_wait, 0);
+
+        Conn *conn = loop->deferred_replies;
+        loop->deferred_replies = NULL;
+
+        while (conn)
+        {
+            Conn *next = conn->next_deferred;
+            conn->next_deferred = NULL;
+            conn->reply_deferred = false;
+
+            enum Conn_State prev_state = conn->state;
+
+            if (conn->state == STATE_RESP)
+            {
+                connection_io(conn);
+            }
+            else if (conn->state == STATE_WAIT)
+            {
+                // flush the replies that came before the forwarded request
+                state_resp(conn);
+            }
+
+            conn_after_io(loop->epoll_fd, conn, prev_state);
+
+            conn = next;
+        }
+
+        if (loop->aof_offset > atomic_load(&global_aof->written))
+        {
+            aof_notify(global_aof);
+        }
+    }
+}
+
+/**
+ * @brief Called by the AOF thread once the file was synced, wakes up the event loops whose replies waited for it
+ *
+ * @param aof the AOF
+ * @param synced sequence number up to which the records are durable
+ */
+void aof_synced(AOF *aof, long synced)
+{
+    for (int i = 0; event_loops && i < num_loops; i++)
+    {
+        long wait = atomic_load(&event_loops[i].aof_wait);
+
+        if (wait && wait <= synced)
+        {
+            loop_wake(&event_loops[i]);
+        }
+    }
+}
+
+/**
+ * @brief Returns the read buffer of a connection to the pool when it holds no unprocessed input
+ *
+ * The write buffer releases its chunks as they are flushed, so an idle connection holds no buffer memory.
+ *
+ * @param conn Connection structure to handle
+ */
+void conn_release_idle_buffers(Conn *conn)
+{
+    if (conn->read_chunk && conn->current_read_size == 0)
+    {
+        buffer_chunk_release(conn->read_chunk);
+        conn->read_chunk = NULL;
+    }
+}
+
+/**
+ * @brief Frees a connection and its buffers, does not close the socket
+ *
+ * @param conn Connection structure to free
+ */
+void conn_free(Conn *conn)
+{
+    if (conn->read_chunk)
+    {
+        buffer_chunk_release(conn->read_chunk);
+    }
+
+    buffer_free(&conn->write_buffer);
+    free(conn);
+}
+
+/**
+ * @brief Returns the shard (event loop) that owns a key
+ *
+ * The high 32 bits of the hash are used, since each shard's hash table already indexes its slots with the low bits of the same hash.
+ *
+ * @param key key to look up
+ *
+ * @return int index of the owning event loop
+ */
+int shard_for_key(char *key)
+{
+    uint64_t high = hash(key) >> 32;
+
+    return (int)((high * (uint64_t)num_loops) >> 32);
+}
+
+/**
+ * @brief Returns the shard a command has to be executed on
+ *
+ * @param cmd parsed command
+ *
+ * @return int index of the owning event loop, the current loop for commands without a key, or -1 for commands that touch every shard
+ */
+int command_shard(Command *cmd)
+{
+    int local = current_loop ? current_loop->id : 0;
+
+    if (num_loops == 1 || !cmd->name)
+    {
+        return local;
+    }
+
+    CommandSpec *spec = lookup_command(cmd->name, cmd->name_len);
+    if (spec && (spec->flags & CMD_ALL_SHARDS))
+    {
+        return -1;
+    }
+
+    if (cmd->num_args == 0)
+    {
+        return local;
+    }
+
+    int shard = shard_for_key(cmd->args[0]);
+
+    // commands with several keys run on every shard unless all their keys belong to the same one
+    if (spec && spec->key_step > 0)
+    {
+        for (int i = spec->key_step; i < cmd->num_args; i += spec->key_step)
+        {
+            if (shard_for_key(cmd->args[i]) != shard)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return shard;
+}
+
+/**
+ * @brief Checks whether a key belongs to the shard commands are currently executed against
+ *
+ * Commands with several keys spread over several shards are executed by every shard, each only handling the keys it owns.
+ *
+ * @param key key to check
+ *
+ * @return bool true if the key belongs to the shard of global_table
+ */
+bool key_in_shard(char *key)
+{
+    if (num_loops == 1 || !event_loops)
+    {
+        return true;
+    }
+
+    return event_loops[shard_for_key(key)].table == global_table;
+}
+
+/**
+ * @brief Pushes a message onto the inbox of an event loop and wakes the loop up
+ *
+ * @param loop_id index of the destination event loop
+ * @param msg message to send, ownership passes to the destination loop
+ */
+void loop_send(int loop_id, LoopMsg *msg)
+{
+    EventLoop *loop = &event_loops[loop_id];
 
-        // write the response
-        memcpy(buffer + 5, response + 5, message_size);
+    queue_push(&loop->inbox, &msg->node);
+
+    loop_wake(loop);
+}
 
-        return response_size;
+/**
+ * @brief Wakes up an event loop waiting in epoll_wait()
+ *
+ * @param loop event loop to wake up
+ */
+void loop_wake(EventLoop *loop)
+{
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("eventfd write failed");
+        exit(EXIT_FAILURE);
     }
 }
 
 /**
- * @brief Attempts to process a single request from a connection.
+ * @brief Merges two array responses into a single array response
  *
- * The function attempts to process a single request from a connection. The function checks if the read buffer of the connection has enough data to process a request. If the read buffer has enough data, the function processes the request and writes the response to the write buffer. The function returns true if the request was fully processed and sent to the connection, and false otherwise.
+ * @param first array response, freed by this function
+ * @param second array response, freed by this function
  *
- * @param conn Connection structure to handle
+ * @return char* array response containing the elements of both arrays
  */
-bool try_process_single_request(Conn *conn)
+char *merge_array_responses(char *first, char *second)
 {
-    // check if the read buffer has enough data to process a request
-    if (conn->current_read_size < 4)
-    {
-        // not enough data to process a request
-        return false;
-    }
+    int first_len = 0;
+    int second_len = 0;
+    memcpy(&first_len, first + 1, 4);
+    memcpy(&second_len, second + 1, 4);
+
+    // size of the elements of each array, without the type and length of the array
+    int first_size = response_size(first) - 5;
+    int second_size = response_size(second) - 5;
+
+    char *merged = response_alloc(5 + first_size + second_size);
+
+    int merged_len = first_len + second_len;
+    merged[0] = SER_ARR;
+    memcpy(merged + 1, &merged_len, 4);
+    memcpy(merged + 5, first + 5, first_size);
+    memcpy(merged + 5 + first_size, second + 5, second_size);
+
+    response_free(first);
+    response_free(second);
+    return merged;
+}
 
-    // copy the first 4 bytes of the read buffer, assume the message size is in little endian (this machine is little endian)
-    int message_size = 0;
-    memcpy(&message_size, conn->read_buffer, 4);
+/**
+ * @brief Reads the element of an array response at the given offset
+ *
+ * @param response array response
+ * @param offset offset of the element in the response, advanced past the element
+ * @param element_len size of the element including its type and length
+ *
+ * @return char* the element
+ */
+static char *array_response_next(char *response, int *offset, int *element_len)
+{
+    char *element = response + *offset;
 
-    if (message_size > MAX_MESSAGE_SIZE)
+    int value_len = 0;
+    memcpy(&value_len, element + 1, 4);
+
+    *element_len = 5 + value_len;
+    *offset += *element_len;
+
+    return element;
+}
+
+/**
+ * @brief Merges the partial responses of a command with several keys, executed by two shards
+ *
+ * Every shard only executes the command on the keys it owns. Counts are summed, and arrays holding one element per key take every element from the shard owning the key.
+ *
+ * @param cmd the command
+ * @param spec entry of the command in the command table
+ * @param prev response merged so far from the shards before the current one, freed by this function
+ * @param next response of the current shard, freed by this function
+ *
+ * @return char* merged response
+ */
+char *merge_multi_key_responses(Command *cmd, CommandSpec *spec, char *prev, char *next)
+{
+    if (prev[0] == SER_INT && next[0] == SER_INT)
     {
-        fprintf(stderr, "Message size too large\n");
-        conn->state = STATE_DONE;
-        return false;
+        int64_t sum = *(int64_t *)(prev + 5) + *(int64_t *)(next + 5);
+        response_free(prev);
+        response_free(next);
+
+        return get_response(INTEGER, &sum);
     }
 
-    // check if the read buffer has enough data to process a request
-    if (conn->current_read_size < 4 + message_size)
+    if (prev[0] != SER_ARR || next[0] != SER_ARR)
     {
-        // not enough data to process a request
-        return false;
+        // nothing to merge, e.g. the nil response of MSET or an error
+        response_free(prev);
+        return next;
     }
 
-    // print the message, account for the fact that the message is not null terminated due to pipe-lining
-    printf("Client %d says: %.*s\n", conn->fd, message_size, conn->read_buffer + 4);
+    ArrayResponse arr;
+    array_response_init(&arr);
 
-    // parse the message to extract the command
-    Command *cmd = parse_cmd_string(conn->read_buffer + 4, message_size);
+    int prev_offset = 5;
+    int next_offset = 5;
 
-    // aof_restore is false, since the command is not being restored from the AOF file
-    bool aof_restore = false;
+    for (int i = 0; i < cmd->num_args; i += spec->key_step)
+    {
+        int prev_len, next_len;
+        char *prev_element = array_response_next(prev, &prev_offset, &prev_len);
+        char *next_element = array_response_next(next, &next_offset, &next_len);
 
-    // execute the command, response is a null terminated byte string following the protocol
-    char *response = execute_command(cmd, aof_restore);
+        char *element = key_in_shard(cmd->args[i]) ? next_element : prev_element;
+        int element_len = (element == next_element) ? next_len : prev_len;
 
-    // write response to the write buffer
-    int response_size = buffer_write_response(conn->write_buffer, response);
+        array_response_add(&arr, element[0], element + 5, element_len - 5);
+    }
 
-    // free the response
-    free(response);
+    response_free(prev);
+    response_free(next);
 
-    conn->need_write_size = response_size;
+    return array_response_finish(&arr);
+}
 
-    // remove the request from the read buffer
-    int remaining_size = conn->current_read_size - (4 + message_size);
+/**
+ * @brief Merges the response of a shard into the response of the shards that executed a command before it
+ *
+ * @param cmd the command
+ * @param prev response merged so far, may be NULL, freed by this function
+ * @param next response of the current shard, may be NULL, freed by this function
+ *
+ * @return char* merged response
+ */
+char *merge_shard_responses(Command *cmd, char *prev, char *next)
+{
+    if (!next)
+    {
+        // e.g. FLUSHALL executed by a shard that does not log it
+        return prev;
+    }
 
-    // using memmove instead of memcpy to handle overlapping memory regions
-    if (remaining_size)
+    if (!prev)
     {
-        memmove(conn->read_buffer, conn->read_buffer + 4 + message_size, remaining_size);
+        return next;
     }
 
-    conn->current_read_size = remaining_size;
+    CommandSpec *spec = lookup_command(cmd->name, cmd->name_len);
 
-    // the request has been processed, move to the response state
-    conn->state = STATE_RESP;
-    state_resp(conn);
+    if (spec && spec->key_step > 0)
+    {
+        // every shard answered for its own keys only
+        return merge_multi_key_responses(cmd, spec, prev, next);
+    }
+
+    if (prev[0] == SER_ARR && next[0] == SER_ARR)
+    {
+        return merge_array_responses(prev, next);
+    }
 
-    // continue the outer loop to process pipelined requests
-    return (conn->state == STATE_REQ);
+    response_free(prev);
+    return next;
 }
 
 /**
- * @brief Attempts to fill the read buffer of a connection.
+ * @brief Executes a write command touching several shards against all of them, while the other event loops are paused
  *
- * The function attempts to fill the read buffer of a connection. The function reads from the socket and fills the read buffer of the connection. The function returns false to indicate to that the attempt to read any characters into the buffer was unsuccessful or that the connection is waiting for a response, and true otherwise.
+ * No other loop modifies its shard or appends to the AOF while the command runs, so its single AOF record, logged by the last shard, lands exactly where the command took effect on every shard. Replaying the AOF then applies it in the same order relative to the other writes as the running server did.
  *
- * @param conn Connection structure to handle
+ * @param cmd the command
  *
- * @return bool indicating if this function should be called again in the while loop of state_req()
+ * @return char* merged response of the shards
  */
-bool try_fill_read_buffer(Conn *conn)
+char *execute_on_all_shards(Command *cmd)
 {
-    // check if the read buffer overflowed
-    if (conn->current_read_size > sizeof(conn->read_buffer))
+    HashTable *own_table = global_table;
+    char *response = NULL;
+
+    loops_pause();
+
+    for (int i = 0; i < num_loops; i++)
     {
-        fprintf(stderr, "Read buffer overflow\n");
-        return false;
+        global_table = event_loops[i].table;
+
+        // only the last shard logs the command to the AOF
+        bool aof_restore = (i != num_loops - 1);
+        response = merge_shard_responses(cmd, response, execute_command(cmd, aof_restore));
     }
 
-    // read from the socket
-    int read_size = 0;
+    loops_resume();
 
-    // attempt to read from the socket until we have read some characters or a signal has not interrupted the read
-    do
+    global_table = own_table;
+
+    return response;
+}
+
+/**
+ * @brief Executes a request forwarded by another event loop against the shard of this loop
+ *
+ * Reads touching every shard are passed on to the next loop, their responses are merged along the way. The final response is sent back to the loop owning the connection.
+ *
+ * @param loop event loop executing the request
+ * @param msg forwarded request
+ */
+void loop_execute_request(EventLoop *loop, LoopMsg *msg)
+{
+    // parse a copy of the request, since requests touching every shard are passed on unchanged
+    char request[MAX_MESSAGE_SIZE + 1];
+    memcpy(request, msg->request, msg->request_size);
+
+    Command cmd;
+    parse_cmd(request, msg->request_size, &cmd);
+    bool broadcast = command_shard(&cmd) < 0;
+
+    // writes touching several shards never get here, see execute_on_all_shards(), so the command is logged if it is a write
+    bool aof_restore = false;
+
+    char *response = execute_command(&cmd, aof_restore);
+
+    // the reply may depend on commands logged by this loop
+    if (loop->aof_offset > msg->aof_offset)
     {
-        int max_possible_read = sizeof(conn->read_buffer) - conn->current_read_size;
+        msg->aof_offset = loop->aof_offset;
+    }
 
-        read_size = read(conn->fd, conn->read_buffer + conn->current_read_size, max_possible_read);
-    } while (read_size < 0 && errno == EINTR);
+    if (response)
+    {
+        msg->response = merge_shard_responses(&cmd, msg->response, response);
 
-    if ((read_size < 0) && (errno = EAGAIN))
+        // the response is passed on to other event loops, so it can't stay in the arena of this one
+        msg->response = response_detach(msg->response);
+    }
+
+    cmd_release(&cmd);
+    response_arena_reset();
+
+    if (broadcast && msg->next_shard < num_loops - 1)
     {
-        //  read buffer is full, wait for the next poll event
-        return false;
+        msg->next_shard++;
+        loop_send(msg->next_shard, msg);
+        return;
     }
 
-    if (read_size < 0)
+    free(msg->request);
+    msg->request = NULL;
+
+    msg->type = LOOP_MSG_RESPONSE;
+    loop_send(msg->origin, msg);
+}
+
+/**
+ * @brief Processes all messages in the inbox of an event loop
+ *
+ * Requests are executed against the shard of the loop, responses are written to the waiting connections, which then resume processing their pipelined requests.
+ *
+ * @param loop event loop whose inbox should be processed
+ */
+void loop_process_inbox(EventLoop *loop)
+{
+    // reset the eventfd counter before draining, so a push racing with the drain wakes the loop again
+    uint64_t count;
+    if (read(loop->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
     {
-        // an error that is not EINTR or EAGAIN occured
-        perror("read failed");
-        return false;
+        perror("eventfd read failed");
+        exit(EXIT_FAILURE);
     }
 
-    if (read_size == 0)
+    QueueNode *node;
+    while ((node = queue_pop(&loop->inbox)) != NULL)
     {
-        // if read_size is 0 then EOF reached
+        LoopMsg *msg = (LoopMsg *)node;
 
-        // if the current_read_size is greater than 0, then the EOF was reached before reading the full message
-        if (conn->current_read_size > 0)
+        if (msg->type == LOOP_MSG_REQUEST)
         {
-            fprintf(stderr, "EOF reached before reading full message\n");
+            loop_execute_request(loop, msg);
+            continue;
         }
-        else
+
+        if (msg->type == LOOP_MSG_PAUSE)
         {
-            // EOF reached
-            printf("EOF reached\n");
+            free(msg);
+            loop_pause_wait();
+            continue;
         }
 
-        conn->state = STATE_DONE;
-        return false;
-    }
+        Conn *conn = msg->conn;
+        char *response = msg->response;
 
-    conn->current_read_size += read_size;
-    if (conn->current_read_size > sizeof(conn->read_buffer))
-    {
-        fprintf(stderr, "Read buffer overflow\n");
-        return false;
-    }
+        // the reply depends on the commands logged by the loops that executed the request
+        if (msg->aof_offset > loop->aof_offset)
+        {
+            loop->aof_offset = msg->aof_offset;
+        }
+        free(msg);
 
-    // the loop here is to handle that clients can send multiple requests in one go (pipe-lining)
-    while (try_process_single_request(conn))
-    {
-    };
+        enum Conn_State prev_state = conn->state;
+
+        conn_write_response(conn, response);
 
-    return (conn->state == STATE_REQ);
+        // the response was flushed, resume the pipelined requests and the input that arrived while waiting
+        conn_resume_requests(conn);
+
+        conn_after_io(loop->epoll_fd, conn, prev_state);
+    }
 }
 
+// number of event loops waiting in loop_pause_wait(), and whether they may continue
+static _Atomic int paused_loops = 0;
+static _Atomic int loops_resumed = 0;
+
+// event loop pausing the others, -1 if none
+static _Atomic int pausing_loop = -1;
+
 /**
- * @brief Attempts to flush the write buffer of a connection.
- *
- * The function attempts to flush the write buffer of a connection. The function writes to the socket and flushes the write buffer of the connection. The function returns false to indicate that the attempt to write any characters into the buffer was unsuccessful or that the connection is waiting for a request, and true otherwise.
- *
- * @param conn Connection structure to handle
+ * @brief Stops every other event loop between two messages, returns once they all wait in loop_pause_wait()
  *
- * @return bool indicating if this function should be called again in the while loop of state_resp()
+ * While they are paused, their shards are not modified and nothing is appended to the AOF. Only one loop pauses the others at a time, a loop that wants to pause them while another one does waits as a paused loop until its turn. The caller must call loops_resume() before handling any other request.
  */
-bool try_flush_write_buffer(Conn *conn)
+void loops_pause()
 {
+    if (!event_loops || !current_loop || num_loops == 1)
+    {
+        return;
+    }
 
-    int write_size = 0;
-
-    // attempt to write to the socket until we have written some characters or a signal has not interrupted the write
-    do
+    int none = -1;
+    while (!atomic_compare_exchange_weak(&pausing_loop, &none, current_loop->id))
     {
-        int max_possible_write = conn->need_write_size - conn->current_write_size;
+        none = -1;
 
-        write_size = write(conn->fd, conn->write_buffer + conn->current_write_size, max_possible_write);
-    } while (write_size < 0 && errno == EINTR);
+        // the loop pausing the others may be waiting for this one, its pause message is then a no-op once it is processed
+        loop_pause_wait();
+    }
 
-    if (write_size < 0)
+    atomic_store(&loops_resumed, 0);
+
+    for (int i = 0; i < num_loops; i++)
     {
-        if (errno == EAGAIN)
+        if (i == current_loop->id)
         {
-            // write buffer is full, wait for the next poll event
-            return false;
+            continue;
         }
-        // an error that is not EINTR or EAGAIN occured, exit the connection
-        perror("write failed");
-        conn->state = STATE_DONE;
-        return false;
+
+        LoopMsg *msg = calloc(1, sizeof(LoopMsg));
+        if (!msg)
+        {
+            fprintf(stderr, "Failed to allocate memory for loop message\n");
+            exit(EXIT_FAILURE);
+        }
+
+        msg->type = LOOP_MSG_PAUSE;
+        loop_send(i, msg);
     }
 
-    conn->current_write_size += write_size;
+    while (atomic_load(&paused_loops) < num_loops - 1)
+    {
+        sched_yield();
+    }
+}
 
-    if (conn->current_write_size > conn->need_write_size)
+/**
+ * @brief Lets the event loops paused by loops_pause() continue, returns once they all left loop_pause_wait()
+ */
+void loops_resume()
+{
+    if (!event_loops || !current_loop || num_loops == 1)
     {
-        fprintf(stderr, "Write buffer overflow\n");
-        conn->state = STATE_DONE;
-        return false;
-    };
+        return;
+    }
+
+    atomic_store(&loops_resumed, 1);
 
-    if (conn->current_write_size == conn->need_write_size)
+    while (atomic_load(&paused_loops) > 0)
     {
-        // the response has been fully written, move to the request state
-        conn->state = STATE_REQ;
-        conn->current_write_size = 0;
-        conn->need_write_size = 0;
+        sched_yield();
+    }
 
-        // exit the outer write loop
-        return false;
+    atomic_store(&pausing_loop, -1);
+}
+
+/**
+ * @brief Waits in an event loop that received a pause message, until loops_resume() is called
+ */
+void loop_pause_wait()
+{
+    atomic_fetch_add(&paused_loops, 1);
+
+    while (!atomic_load(&loops_resumed))
+    {
+        sched_yield();
     }
 
-    // data still in the write buffer, try to write again in the outer loop
-    return true;
+    atomic_fetch_sub(&paused_loops, 1);
+}
+
+// microseconds since the idle rehash started
+static long rehash_idle_elapsed_us(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
 }
 
 /**
- * @brief Handles the request state of a connection.
+ * @brief Moves a hash table that is being resized along, for a bounded amount of time
  *
- * The function handles the request state of a connection. Calls try_fill_read_buffer() repeatedly.
+ * Called by an event loop when it has no ready events, so that the rehashing of its shard does not only progress with the inserts.
  *
- * @param conn Connection structure to handle
+ * @param table hash table to rehash
+ *
+ * @return bool true if the table is still being rehashed
  */
-void state_req(Conn *conn)
+bool rehash_idle(HashTable *table)
 {
-    while (try_fill_read_buffer(conn))
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (hrehash_step(table, REHASH_IDLE_BATCH_GROUPS))
     {
-    };
+        if (rehash_idle_elapsed_us(&start) >= REHASH_IDLE_BUDGET_US)
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /**
- * @brief Handles the response state of a connection.
+ * @brief Remembers a hash of the current shard whose table is being shrunk, so that the event loop owning the shard moves it along while idle
  *
- * The function handles the response state of a connection. Calls try_flush_write_buffer() repeatedly.
+ * @param key key of the hash
+ */
+void loop_track_rehash(char *key)
+{
+    for (int i = 0; event_loops && i < num_loops; i++)
+    {
+        EventLoop *loop = &event_loops[i];
+        if (loop->table != global_table)
+        {
+            continue;
+        }
+
+        if (loop->num_rehash_keys == LOOP_MAX_REHASH_KEYS)
+        {
+            return;
+        }
+
+        for (int j = 0; j < loop->num_rehash_keys; j++)
+        {
+            if (!strcmp(loop->rehash_keys[j], key))
+            {
+                return;
+            }
+        }
+
+        loop->rehash_keys[loop->num_rehash_keys] = strdup(key);
+        if (!loop->rehash_keys[loop->num_rehash_keys])
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        loop->num_rehash_keys++;
+
+        return;
+    }
+}
+
+/**
+ * @brief Moves the shard of an event loop and its shrinking hashes along while they are being resized, for a bounded amount of time
  *
- * @param conn Connection structure to handle
+ * Called by an event loop when it has no ready events. Hashes that were deleted or replaced meanwhile are simply forgotten.
+ *
+ * @param loop event loop with no ready events
+ *
+ * @return bool true if the shard or one of its hashes is still being rehashed
  */
-void state_resp(Conn *conn)
+bool loop_rehash_idle(EventLoop *loop)
 {
-    while (try_flush_write_buffer(conn))
+    if (rehash_idle(loop->table))
     {
-    };
+        return true;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (loop->num_rehash_keys > 0)
+    {
+        char *key = loop->rehash_keys[loop->num_rehash_keys - 1];
+
+        HashNode *node = hget(loop->table, key);
+        HashMap *map = (node && node->valueType == HASHTABLE) ? (HashMap *)node->value : NULL;
+
+        while (map && hmap_rehash_step(map, REHASH_IDLE_BATCH_GROUPS))
+        {
+            if (rehash_idle_elapsed_us(&start) >= REHASH_IDLE_BUDGET_US)
+            {
+                return true;
+            }
+        }
+
+        free(key);
+        loop->num_rehash_keys--;
+    }
+
+    return false;
 }
@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -11,112 +13,364 @@
 #include <netinet/in.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <sys/random.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// Zset includes AVLTree and HashTable header
-#include "../ZSet/ZSet.h"
-#include "../list/list.h"
+// snapshot includes the ZSet (which includes AVLTree, skipList and HashTable) and list headers
+#include "../snapshot/snapshot.h"
 #include "../aof/aof.h"
+#include "../queue/queue.h"
+#include "../buffer/buffer.h"
+#include "../arena/arena.h"
 
 // protcol header
 #include "../protocol.h"
 
 // persistent storage
 #define AOF_FILE "AOF.aof"
-#define FLUSH_INTERVAL_SEC 5
+// file the snapshot of a rewrite is written to, renamed over AOF_FILE once complete
+#define AOF_REWRITE_FILE "AOF.aof.rewrite"
+#define FLUSH_INTERVAL_SEC 1
 
 // should be multiple of two
 #define INIT_TABLE_SIZE 1024
 
+// size of the read buffer of a connection, large enough for one full request
+#define READ_BUFFER_SIZE (4 + MAX_MESSAGE_SIZE + 1)
+
+// once this many response bytes are pending, a connection stops reading requests until they are flushed
+#define MAX_PENDING_WRITE_SIZE (64 * BUFFER_CHUNK_SIZE)
+
+// maximum number of chunks passed to a single writev() call
+#define MAX_WRITE_IOV 64
+
+// maximum number of ready events returned by a single epoll_wait() call
+#define MAX_EVENTS 256
+
+// maximum number of event loops (--threads), each loop owns one shard of the keyspace
+#define MAX_LOOPS 64
+
+// time an idle event loop spends moving its shard along while it is being resized, in microseconds
+#define REHASH_IDLE_BUDGET_US 1000
+
+// number of groups moved between two checks of the idle rehash budget
+#define REHASH_IDLE_BATCH_GROUPS 64
+
+// maximum number of shrinking hashes an idle event loop moves along, the others only move along with their own updates
+#define LOOP_MAX_REHASH_KEYS 64
+
 // variables/structs for the event loop
 enum Conn_State
 {
     STATE_REQ,
     STATE_RESP,
+    // the request was forwarded to the event loop owning its key, waiting for the response
+    STATE_WAIT,
     STATE_DONE
 };
 
-typedef struct
+typedef struct Conn
 {
     int fd;
     enum Conn_State state;
 
-    // read buffer
-    char read_buffer[4 + MAX_MESSAGE_SIZE + 1];
+    // read buffer, a pooled chunk that is only held while the connection has unprocessed input
+    BufferChunk *read_chunk;
     int current_read_size;
 
-    // write buffer
-    char write_buffer[4 + MAX_MESSAGE_SIZE + 1];
-    int need_write_size;
-    int current_write_size;
+    // write buffer, chain of pooled chunks holding the responses that were not flushed yet
+    Buffer write_buffer;
+
+    // with appendfsync always, the responses wait until the commands of the loop iteration are durable, see loop_release_replies()
+    bool reply_deferred;
+    struct Conn *next_deferred;
 } Conn;
 
+// responses are allocated from a per-thread arena, with their size in the bytes before them
+#define RESPONSE_HEADER_SIZE 8
+
+// growable array response, elements are appended as they are produced
+typedef struct
+{
+    char *data;
+    int size;
+    int capacity;
+    int num_elements;
+} ArrayResponse;
+
+// number of arguments a parsed command holds without allocating, commands with more arguments grow their argv on the heap
+#define CMD_INLINE_ARGS 16
+
+// a parsed request, the name and args point into the request buffer and are null terminated in place, their lengths are kept so that args may contain any byte
 typedef struct
 {
     char *name;
-    char *args[MAX_ARGS];
+    int name_len;
+    // point to inline_args and inline_arg_lens, or to heap arrays once there are more than CMD_INLINE_ARGS arguments. The command must not be copied, and is released with cmd_release()
+    char **args;
+    int *arg_lens;
     int num_args;
+    int args_capacity;
 
+    char *inline_args[CMD_INLINE_ARGS];
+    int inline_arg_lens[CMD_INLINE_ARGS];
 } Command;
 
+// flags of a command in the command table
+#define CMD_WRITE 0x1      // modifies the keyspace, commands without it only read
+#define CMD_AOF 0x2        // logged to the AOF when it succeeds
+#define CMD_ALL_SHARDS 0x4 // touches every shard of the keyspace instead of the shard owning its key
+
+// every handler gets the parsed command and whether it is replayed from the AOF, in which case no response is needed
+typedef char *(*CommandHandler)(Command *cmd, bool aof_restore);
+
+typedef struct
+{
+    char *name;
+    CommandHandler handler;
+    // number of arguments, max_args is -1 when there is no upper bound
+    int min_args;
+    int max_args;
+    int flags;
+    // argument names used in the arity error
+    char *usage;
+    // for commands taking several keys, the number of arguments per key (e.g. 2 for key value pairs), 0 for commands whose only key is the first argument
+    int key_step;
+} CommandSpec;
+
+// messages exchanged between event loops through their inbox queues
+typedef enum
+{
+    LOOP_MSG_REQUEST,
+    LOOP_MSG_RESPONSE,
+    // stop until loops_resume() is called, see loops_pause()
+    LOOP_MSG_PAUSE
+} LoopMsgType;
+
+typedef struct
+{
+    // must be the first member, the inbox queue links messages through it
+    QueueNode node;
+
+    LoopMsgType type;
+
+    // connection and event loop the request came from, the response is sent back to it
+    Conn *conn;
+    int origin;
+
+    // copy of the raw request, parsed by the loop that executes it
+    char *request;
+    int request_size;
+
+    // for commands that touch every shard, the shard that executes the request next
+    int next_shard;
+
+    char *response;
+
+    // AOF sequence number of the commands the response depends on, the reply is released once they are durable
+    long aof_offset;
+} LoopMsg;
+
+typedef struct
+{
+    int id;
+    int epoll_fd;
+
+    // listening socket accepted on by this loop, shared by all loops unless --reuseport is used
+    int listen_fd;
+
+    // eventfd used to wake the loop up when a message is pushed to its inbox
+    int wake_fd;
+
+    // shard of the keyspace owned by this loop, only ever touched by the loop's thread
+    HashTable *table;
+
+    Queue inbox;
+    pthread_t thread;
+
+    // AOF sequence number of the last command logged by this loop or answered through it
+    long aof_offset;
+
+    // connections whose responses wait for the AOF to be committed
+    Conn *deferred_replies;
+
+    // sequence number of the AOF record the deferred replies wait for, read by the AOF thread to wake the loop up once it is durable
+    _Atomic long aof_wait;
+
+    // keys of the hashes of the shard whose tables are being shrunk, the keys are kept since the hashes may be deleted meanwhile
+    char *rehash_keys[LOOP_MAX_REHASH_KEYS];
+    int num_rehash_keys;
+} EventLoop;
+
+// buffer a line of the AOF is copied to while it is replayed, so that it can be parsed in place
+typedef struct
+{
+    char *data;
+    size_t capacity;
+} RestoreLine;
+
+// positions in the mapped AOF of the lines a shard replays, in the order of the file
+typedef struct
+{
+    size_t *positions;
+    long size;
+    long capacity;
+} RestoreLines;
+
+// a thread restoring the AOF, it routes the lines of one chunk of the file, then replays the lines of one shard
+typedef struct
+{
+    int id;
+    const char *data;
+
+    // chunk of the mapped AOF, starting at a line and ending after a newline (or at the end of the file)
+    size_t start;
+    size_t end;
+
+    // lines of the chunk for every shard, and number of lines in the chunk
+    RestoreLines lines[MAX_LOOPS];
+    long num_lines;
+} RestoreWorker;
+
 // server functions
 void set_fd_nonblocking(int fd);
-int accept_new_connection(Conn *fd2conn[], int server_socket);
+int accept_new_connection(Conn *fd2conn[], int server_socket, int epoll_fd);
+void conn_update_events(int epoll_fd, Conn *conn, int op);
 void connection_io(Conn *conn);
+void conn_resume_requests(Conn *conn);
 bool try_process_single_request(Conn *conn);
+void conn_consume_request(Conn *conn, int message_size);
+int buffer_write_response(Buffer *buffer, char *response);
+void conn_write_response(Conn *conn, char *response);
+void conn_release_idle_buffers(Conn *conn);
+void conn_free(Conn *conn);
 bool try_fill_read_buffer(Conn *conn);
 bool try_flush_write_buffer(Conn *conn);
 void state_req(Conn *conn);
 void state_resp(Conn *conn);
+void conn_after_io(int epoll_fd, Conn *conn, enum Conn_State prev_state);
+void conn_defer_reply(Conn *conn);
+void loop_release_replies(EventLoop *loop);
+void aof_synced(AOF *aof, long synced);
+
+int shard_for_key(char *key);
+bool key_in_shard(char *key);
+int command_shard(Command *cmd);
+void loop_send(int loop_id, LoopMsg *msg);
+void loop_wake(EventLoop *loop);
+char *merge_array_responses(char *first, char *second);
+char *merge_multi_key_responses(Command *cmd, CommandSpec *spec, char *prev, char *next);
+char *merge_shard_responses(Command *cmd, char *prev, char *next);
+char *execute_on_all_shards(Command *cmd);
+void loop_process_inbox(EventLoop *loop);
+void loops_pause();
+void loops_resume();
+void loop_pause_wait();
+bool rehash_idle(HashTable *table);
+void loop_track_rehash(char *key);
+bool loop_rehash_idle(EventLoop *loop);
 
+char *response_alloc(int size);
+int response_size(char *response);
+char *response_detach(char *response);
+void response_free(char *response);
+void response_arena_reset();
+char *value_response(SerialType ser_type, const void *value, int value_len);
 char *get_response(ValueType type, void *value);
+char *int64_response(int64_t value);
+char *double_response(double value);
 char *null_response();
 char *error_response(char *err_msg);
-char *avl_iterate_response(AVLNode *tree, AVLNode *start, long limit);
+void array_response_init(ArrayResponse *arr);
+void array_response_add(ArrayResponse *arr, SerialType type, void *value, int value_len);
+char *array_response_finish(ArrayResponse *arr);
+char *zset_range_response(ZSet *zset, long rank, long limit, bool reverse);
 
-Command *parse_cmd_string(char *cmd_string, int size);
+void parse_cmd(char *cmd_string, int size, Command *cmd);
+void cmd_grow_args(Command *cmd);
+void cmd_release(Command *cmd);
+CommandSpec *lookup_command(char *name, int name_len);
+int serialize_cmd(Command *cmd, char *out);
 char *execute_command(Command *cmd, bool aof_restore);
 
 void global_table_del(char *key, char *value, ValueType type);
-char *exists_command(Command *cmd);
+char *ping_command(Command *cmd, bool aof_restore);
+char *exists_command(Command *cmd, bool aof_restore);
 char *del_command(Command *cmd, bool aof_restore);
-char *keys_command();
+char *keys_command(Command *cmd, bool aof_restore);
+char *slabstats_command(Command *cmd, bool aof_restore);
+char *mget_command(Command *cmd, bool aof_restore);
+char *mset_command(Command *cmd, bool aof_restore);
 char *flushall_cmd(Command *cmd, bool aof_restore);
+char *bgrewriteaof_command(Command *cmd, bool aof_restore);
+char *save_command(Command *cmd, bool aof_restore);
+char *bgsave_command(Command *cmd, bool aof_restore);
 
-char *get_command(Command *cmd);
+uint32_t string_value_len(HashNode *node);
+char *get_command(Command *cmd, bool aof_restore);
 char *set_command(Command *cmd, bool aof_restore);
+bool parse_int64(const char *str, int len, int64_t *out, bool canonical);
+bool parse_double(const char *str, int len, double *out);
+int format_number(HashNode *node, char *buffer, int size);
+char *incr_by(Command *cmd, int64_t increment, bool aof_restore);
+char *incr_command(Command *cmd, bool aof_restore);
+char *decr_command(Command *cmd, bool aof_restore);
+char *incrby_command(Command *cmd, bool aof_restore);
+char *incrbyfloat_command(Command *cmd, bool aof_restore);
 
-char *hexists_command(Command *cmd);
+char *hexists_command(Command *cmd, bool aof_restore);
 char *hset_command(Command *cmd, bool aof_restore);
-char *hget_command(Command *cmd);
+char *hget_command(Command *cmd, bool aof_restore);
 char *hdel_command(Command *cmd, bool aof_restore);
-char *hgetall_command(Command *cmd);
+char *hgetall_command(Command *cmd, bool aof_restore);
 
-char *lexists_command(Command *cmd);
+char *lexists_command(Command *cmd, bool aof_restore);
 char *lpush_command(Command *cmd, bool aof_restore);
 char *rpush_command(Command *cmd, bool aof_restore);
 char *lpop_command(Command *cmd, bool aof_restore);
 char *rpop_command(Command *cmd, bool aof_restore);
 char *lrem_command(Command *cmd, bool aof_restore);
-char *llen_cmd(Command *cmd);
-char *lrange_cmd(Command *cmd);
+char *llen_cmd(Command *cmd, bool aof_restore);
+char *lrange_cmd(Command *cmd, bool aof_restore);
 char *ltrim_cmd(Command *cmd, bool aof_restore);
 char *lset_cmd(Command *cmd, bool aof_restore);
 
 char *zadd_command(Command *cmd, bool aof_restore);
 char *zrem_command(Command *cmd, bool aof_restore);
-char *zscore_cmd(Command *cmd);
-char *zquery_cmd(Command *cmd);
+char *zscore_cmd(Command *cmd, bool aof_restore);
+char *zquery_cmd(Command *cmd, bool aof_restore);
+char *zrank_cmd(Command *cmd, bool aof_restore);
+char *zrevrank_cmd(Command *cmd, bool aof_restore);
+char *zcount_cmd(Command *cmd, bool aof_restore);
+char *zrangebyscore_cmd(Command *cmd, bool aof_restore);
+char *zrevrange_cmd(Command *cmd, bool aof_restore);
 
-void aof_restore_db();
+long aof_restore_db();
 void handle_aof_write(Command *cmd);
+bool aof_rewrite_table(FILE *file, HashTable *table);
+bool aof_rewrite_write(char *path, bool snapshot);
+void aof_rewrite_child(char *path, bool snapshot);
+bool aof_rewrite_background(bool snapshot);
+bool aof_save();
 
 // Global variables (usually avoid, but okay here since no function depends on a specific state of the global table or aof, behaves)
-extern HashTable *global_table;
+// global_table is the shard owned by the event loop running on the current thread
+extern __thread HashTable *global_table;
+extern __thread EventLoop *current_loop;
+extern EventLoop *event_loops;
+extern int num_loops;
 extern AOF *global_aof;
+extern bool aof_use_snapshot;
 extern pthread_t aof_thread;
 extern int server_socket;
 extern Conn *fd2conn[MAX_CLIENTS];
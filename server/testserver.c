@@ -37,9 +37,9 @@ bool test_get_response()
         return false;
     }
 
-    // test int
+    // test int, integers are always 64 bit
     type = INTEGER;
-    int i = 123;
+    int64_t i = 5000000000;
     value = &i;
 
     response = get_response(type, value);
@@ -53,21 +53,21 @@ bool test_get_response()
     }
 
     memcpy(&len, response + 1, 4);
-    if (len != 4)
+    if (len != sizeof(int64_t))
     {
-        fprintf(stderr, "integer response length should be 4\n");
+        fprintf(stderr, "integer response length should be 8\n");
         return false;
     }
 
-    if (i != *(int *)(response + 5))
+    if (i != *(int64_t *)(response + 5))
     {
-        fprintf(stderr, "integer response value should be %d\n", i);
+        fprintf(stderr, "integer response value should be %" PRId64 "\n", i);
         return false;
     }
 
-    // test float
+    // test float, floats are always doubles
     type = FLOAT;
-    float f = 123.456;
+    double f = 123.456;
     value = &f;
 
     response = get_response(type, value);
@@ -81,13 +81,13 @@ bool test_get_response()
     }
 
     memcpy(&len, response + 1, 4);
-    if (len != 4)
+    if (len != sizeof(double))
     {
-        fprintf(stderr, "float response length should be 4\n");
+        fprintf(stderr, "float response length should be 8\n");
         return false;
     }
 
-    if (f != *(float *)(response + 5))
+    if (f != *(double *)(response + 5))
     {
         fprintf(stderr, "float response value should be %f\n", f);
         return false;
@@ -151,22 +151,21 @@ bool test_error_response()
     return true;
 }
 
-bool test_avl_iterate_response()
+bool test_zset_range_response()
 {
+    ZSet *zset = zset_init();
+    zset_add(zset, "1", 1);
+    zset_add(zset, "2", 2);
+    zset_add(zset, "3", 3);
 
-    // create AVL tree
-    AVLNode *root = avl_init("1", 1);
-    avl_insert(root, "2", 2);
-    avl_insert(root, "3", 3);
-
-    AVLNode *start = avl_search_float(root, 1);
-    if (start == NULL)
+    long rank = zset_score_rank(zset, 1);
+    if (rank != 0)
     {
-        fprintf(stderr, "node with key 1 not found\n");
+        fprintf(stderr, "member with score 1 not found\n");
         return false;
     }
 
-    char *response = avl_iterate_response(root, start, 2);
+    char *response = zset_range_response(zset, rank, 2, false);
 
     // check first byte
     if (response[0] != SER_ARR)
@@ -189,32 +188,274 @@ bool test_avl_iterate_response()
         return false;
     }
 
+    // a rank past the last member gives an empty array
+    response = zset_range_response(zset, 3, 2, false);
+    if (response[0] != SER_ARR || *(int *)(response + 1) != 0)
+    {
+        fprintf(stderr, "response past the last member should be empty\n");
+        return false;
+    }
+
+    // a reverse range walks down from the rank, the scores are doubles
+    response = zset_range_response(zset, 2, 5, true);
+    if (response[0] != SER_ARR || *(int *)(response + 1) != 3 * 2 || response[5] != SER_STR || response[5 + 5] != '3' || response[11] != SER_FLOAT || *(int *)(response + 12) != sizeof(double) || *(double *)(response + 16) != 3)
+    {
+        fprintf(stderr, "reverse range should start at the member with score 3\n");
+        return false;
+    }
+
+    response_arena_reset();
+    zset_free_contents(zset);
+    free(zset);
+
+    return true;
+}
+
+bool test_response_arena()
+{
+    // array responses carry the size of their elements, not the capacity they grew to
+    ArrayResponse arr;
+    array_response_init(&arr);
+    for (int i = 0; i < 1000; i++)
+    {
+        array_response_add(&arr, SER_INT, &i, sizeof(int));
+    }
+    char *response = array_response_finish(&arr);
+
+    if (response_size(response) != 5 + 1000 * (5 + sizeof(int)) || *(int *)(response + 5 + 999 * 9 + 5) != 999)
+    {
+        fprintf(stderr, "array response should keep its size while growing\n");
+        return false;
+    }
+
+    // the response is written to the buffer without walking its elements
+    Buffer buffer = {0};
+    int written = buffer_write_response(&buffer, response);
+    buffer_write_response(&buffer, null_response());
+    if (written != response_size(response) || buffer.size != written + 5)
+    {
+        fprintf(stderr, "buffer_write_response should write the size of the response\n");
+        return false;
+    }
+    buffer_free(&buffer);
+
+    // detached responses outlive the arena
+    char *detached = response_detach(error_response("err"));
+    response_arena_reset();
+
+    char expected[] = {SER_ERR, 3, 0, 0, 0, 'e', 'r', 'r'};
+    if (response_size(detached) != sizeof(expected) || memcmp(detached, expected, sizeof(expected)) != 0)
+    {
+        fprintf(stderr, "detached response should be a copy of the response\n");
+        return false;
+    }
+
+    // merging the detached response of another shard with one from the arena
+    int one = 1;
+    array_response_init(&arr);
+    array_response_add(&arr, SER_STR, "a", 1);
+    char *first = response_detach(array_response_finish(&arr));
+
+    array_response_init(&arr);
+    array_response_add(&arr, SER_INT, &one, sizeof(int));
+    char *merged = merge_array_responses(first, array_response_finish(&arr));
+
+    char expected_merged[] = {SER_ARR, 2, 0, 0, 0, SER_STR, 1, 0, 0, 0, 'a', SER_INT, 4, 0, 0, 0, 1, 0, 0, 0};
+    if (response_size(merged) != sizeof(expected_merged) || memcmp(merged, expected_merged, sizeof(expected_merged)) != 0)
+    {
+        fprintf(stderr, "merged array responses should hold the elements of both arrays\n");
+        return false;
+    }
+
+    response_free(detached);
+    response_arena_reset();
+
+    return true;
+}
+
+// appends a record to the AOF from another thread, which gets a ring of its own
+void *aof_write_thread(void *aof)
+{
+    aof_write((AOF *)aof, "SET b 2\n");
+    return NULL;
+}
+
+bool test_aof_commit()
+{
+    char path[] = "/tmp/testserver_aof_XXXXXX";
+    close(mkstemp(path));
+
+    AOF *aof = aof_init(path, FLUSH_INTERVAL_SEC, "a");
+    aof->fsync_policy = AOF_FSYNC_ALWAYS;
+
+    // records are appended to the ring of each thread, they are only written by a drain
+    long first = aof_write(aof, "SET a 1\n");
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, aof_write_thread, aof);
+    pthread_join(thread, NULL);
+
+    long last = aof_write(aof, "SET c 3\n");
+    if (last != 3 || aof->num_rings != 2 || aof->written != 0 || !aof_needs_commit(aof, first))
+    {
+        fprintf(stderr, "appended records should wait for a commit\n");
+        return false;
+    }
+
+    // a commit writes and syncs everything that was appended, so the later records are committed with the first
+    if (aof_commit(aof) != last || aof_needs_commit(aof, last))
+    {
+        fprintf(stderr, "a commit should group all the appended records\n");
+        return false;
+    }
+
+    // replies never wait without the always policy
+    aof->fsync_policy = AOF_FSYNC_NO;
+    if (aof_needs_commit(aof, aof_write(aof, "DEL a\n")))
+    {
+        fprintf(stderr, "appendfsync no should not hold replies back\n");
+        return false;
+    }
+
+    // records larger than the space left at the end of the ring start over at its beginning
+    char big[4096];
+    memset(big, 'x', sizeof(big) - 2);
+    big[sizeof(big) - 2] = '\n';
+    big[sizeof(big) - 1] = '\0';
+
+    for (int i = 0; i < 2 * AOF_RING_SIZE / (int)sizeof(big); i++)
+    {
+        aof_write(aof, big);
+
+        // a full ring waits for the AOF thread, which the test drains for
+        if (i % 256 == 255)
+        {
+            aof_drain(aof);
+        }
+    }
+
+    // closing writes the remaining records
+    aof_close(aof);
+
+    char contents[64] = {0};
+    FILE *file = fopen(path, "r");
+    fread(contents, 1, sizeof(contents) - 1, file);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    unlink(path);
+
+    if (strncmp(contents, "SET a 1\nSET b 2\nSET c 3\nDEL a\nxxx", 33) != 0 || size != 30 + 2L * AOF_RING_SIZE / sizeof(big) * (sizeof(big) - 1))
+    {
+        fprintf(stderr, "the AOF should hold the records in the order they were appended\n");
+        return false;
+    }
+
     return true;
 }
 
-bool test_parse_cmd_string()
+// parses a command from a string literal, the command points into a heap copy of the string since the parser works in place
+Command *parse_test_cmd(char *cmd_string)
+{
+    Command *cmd = malloc(sizeof(Command));
+    parse_cmd(strdup(cmd_string), strlen(cmd_string), cmd);
+
+    return cmd;
+}
+
+bool test_parse_cmd()
 {
-    char *cmd_string = "SET key";
-    Command *cmd = parse_cmd_string(cmd_string, strlen(cmd_string));
+    char cmd_string[] = "SET  key val\0ue ";
+    int size = sizeof(cmd_string) - 1;
+
+    Command cmd;
+    parse_cmd(cmd_string, size, &cmd);
 
-    if (strcmp(cmd->name, "SET") != 0)
+    if (strcmp(cmd.name, "SET") != 0 || cmd.name_len != 3)
     {
         fprintf(stderr, "command name should be 'SET'\n");
         return false;
     }
 
-    if (cmd->num_args != 1)
+    if (cmd.num_args != 2)
     {
-        fprintf(stderr, "number of arguments should be 1\n");
+        fprintf(stderr, "number of arguments should be 2\n");
         return false;
     }
 
-    if (strcmp(cmd->args[0], "key") != 0)
+    if (strcmp(cmd.args[0], "key") != 0 || cmd.arg_lens[0] != 3)
     {
         fprintf(stderr, "first argument should be 'key'\n");
         return false;
     }
 
+    // arguments are length delimited, so they may contain null bytes
+    if (cmd.arg_lens[1] != 6 || memcmp(cmd.args[1], "val\0ue", 6) != 0)
+    {
+        fprintf(stderr, "second argument should be 'val\\0ue'\n");
+        return false;
+    }
+
+    // the command is written back with single spaces
+    char out[sizeof(cmd_string)];
+    if (serialize_cmd(&cmd, out) != 14 || memcmp(out, "SET key val\0ue", 14) != 0)
+    {
+        fprintf(stderr, "serialized command should be 'SET key val\\0ue'\n");
+        return false;
+    }
+
+    // commands with more than CMD_INLINE_ARGS arguments move their argv to the heap
+    char many[1024] = "DEL";
+    for (int i = 0; i < 100; i++)
+    {
+        sprintf(many + strlen(many), " k%d", i);
+    }
+
+    parse_cmd(many, strlen(many), &cmd);
+    if (cmd.num_args != 100 || cmd.args == cmd.inline_args || strcmp(cmd.args[99], "k99") != 0 || cmd.arg_lens[99] != 3)
+    {
+        fprintf(stderr, "command with 100 arguments should parse\n");
+        return false;
+    }
+
+    cmd_release(&cmd);
+
+    return true;
+}
+
+bool test_command_table()
+{
+    char *names[] = {"PING", "EXISTS", "DEL", "KEYS", "SLABSTATS", "FLUSHALL", "GET", "SET", "MGET", "MSET", "INCR", "DECR", "INCRBY", "INCRBYFLOAT", "HEXISTS", "HSET", "HGET", "HDEL", "HGETALL", "LEXISTS", "LPUSH", "RPUSH", "LPOP", "RPOP", "LREM", "LLEN", "LRANGE", "LTRIM", "LSET", "ZADD", "ZREM", "ZSCORE", "ZQUERY", "ZRANK", "ZREVRANK", "ZCOUNT", "ZRANGEBYSCORE", "ZREVRANGE"};
+
+    // every command is found under its own name
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        CommandSpec *spec = lookup_command(names[i], strlen(names[i]));
+        if (!spec || strcmp(spec->name, names[i]) != 0)
+        {
+            fprintf(stderr, "command %s not found in command table\n", names[i]);
+            return false;
+        }
+    }
+
+    if (lookup_command("GOT", 3) || lookup_command("HSETX", 5) || lookup_command("get", 3))
+    {
+        fprintf(stderr, "unknown commands should not be found\n");
+        return false;
+    }
+
+    // the arity is checked before the handler runs
+    Command *cmd = parse_test_cmd("SET key");
+    char *response = execute_command(cmd, true);
+    char *err_msg = "set command requires 2 arguments (key, value)";
+
+    if (response[0] != SER_ERR || *(int *)(response + 1) != strlen(err_msg) || memcmp(response + 5, err_msg, strlen(err_msg)) != 0)
+    {
+        fprintf(stderr, "SET with one argument should fail with '%s'\n", err_msg);
+        return false;
+    }
+
+    response_free(response);
     return true;
 }
 
@@ -237,7 +478,7 @@ bool test_string_commands()
     // set this to true, don't want to write to aof file in a tests
     bool aof_restore = true;
 
-    Command *cmd = parse_cmd_string(cmdString, 13);
+    Command *cmd = parse_test_cmd(cmdString);
     set_command(cmd, aof_restore);
 
     // check if global table has the key
@@ -256,7 +497,7 @@ bool test_string_commands()
 
     // test del command
     cmdString = "DEL key";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     del_command(cmd, aof_restore);
 
     // check if key was deleted
@@ -267,18 +508,231 @@ bool test_string_commands()
         return false;
     }
 
+    // GET and MGET send the stored length of a value, so values may hold any byte
+    char binary[] = "SET bin a\0b";
+    Command bin_cmd;
+    parse_cmd(binary, sizeof(binary) - 1, &bin_cmd);
+    set_command(&bin_cmd, aof_restore);
+
+    char *response = get_command(parse_test_cmd("GET bin"), aof_restore);
+    if (response[0] != SER_STR || *(int *)(response + 1) != 3 || memcmp(response + 5, "a\0b", 3) != 0)
+    {
+        fprintf(stderr, "GET should return the value with its null byte\n");
+        return false;
+    }
+    response_free(response);
+
+    response = mget_command(parse_test_cmd("MGET bin"), aof_restore);
+    if (response[0] != SER_ARR || *(int *)(response + 1) != 1 || response[5] != SER_STR || *(int *)(response + 6) != 3 || memcmp(response + 10, "a\0b", 3) != 0)
+    {
+        fprintf(stderr, "MGET should return the value with its null byte\n");
+        return false;
+    }
+    response_free(response);
+
     // reset global table
     test_reset();
 
     return true;
 }
 
+bool test_counter_commands()
+{
+    test_init();
+
+    // the handlers don't write to the aof, only execute_command does
+    bool aof_restore = false;
+
+    // integers are detected by SET and stored natively, GET still returns them as strings
+    set_command(parse_test_cmd("SET counter 41"), aof_restore);
+    set_command(parse_test_cmd("SET padded 007"), aof_restore);
+
+    HashNode *fetched_node = hget(global_table, "counter");
+    if (!fetched_node || fetched_node->valueType != INTEGER || fetched_node->intValue != 41)
+    {
+        fprintf(stderr, "integer value should be stored as INTEGER\n");
+        return false;
+    }
+
+    fetched_node = hget(global_table, "padded");
+    if (!fetched_node || fetched_node->valueType != STRING)
+    {
+        fprintf(stderr, "integer with leading zeros should be stored as STRING\n");
+        return false;
+    }
+
+    char *response = get_command(parse_test_cmd("GET counter"), aof_restore);
+    if (response[0] != SER_STR || *(int *)(response + 1) != 2 || memcmp(response + 5, "41", 2) != 0)
+    {
+        fprintf(stderr, "GET of an integer should return '41'\n");
+        return false;
+    }
+
+    response = incr_command(parse_test_cmd("INCR counter"), aof_restore);
+    if (response[0] != SER_INT || *(int *)(response + 1) != 8 || *(int64_t *)(response + 5) != 42)
+    {
+        fprintf(stderr, "INCR should return 42\n");
+        return false;
+    }
+
+    response = incrby_command(parse_test_cmd("INCRBY counter -50"), aof_restore);
+    if (*(int64_t *)(response + 5) != -8)
+    {
+        fprintf(stderr, "INCRBY should return -8\n");
+        return false;
+    }
+
+    // missing keys start at 0
+    response = decr_command(parse_test_cmd("DECR missing"), aof_restore);
+    if (*(int64_t *)(response + 5) != -1)
+    {
+        fprintf(stderr, "DECR of a missing key should return -1\n");
+        return false;
+    }
+
+    response = incr_command(parse_test_cmd("INCR padded"), aof_restore);
+    if (response[0] != SER_ERR)
+    {
+        fprintf(stderr, "INCR of a string should fail\n");
+        return false;
+    }
+
+    set_command(parse_test_cmd("SET max 9223372036854775807"), aof_restore);
+    response = incr_command(parse_test_cmd("INCR max"), aof_restore);
+    if (response[0] != SER_ERR || hget(global_table, "max")->intValue != INT64_MAX)
+    {
+        fprintf(stderr, "INCR past INT64_MAX should fail\n");
+        return false;
+    }
+
+    response = incrbyfloat_command(parse_test_cmd("INCRBYFLOAT counter 0.5"), aof_restore);
+    if (response[0] != SER_FLOAT || *(int *)(response + 1) != 8 || *(double *)(response + 5) != -7.5)
+    {
+        fprintf(stderr, "INCRBYFLOAT should return -7.5\n");
+        return false;
+    }
+
+    response = get_command(parse_test_cmd("GET counter"), aof_restore);
+    if (*(int *)(response + 1) != 4 || memcmp(response + 5, "-7.5", 4) != 0)
+    {
+        fprintf(stderr, "GET of a float should return '-7.5'\n");
+        return false;
+    }
+
+    // strings holding a number are converted
+    response = incrbyfloat_command(parse_test_cmd("INCRBYFLOAT padded 1"), aof_restore);
+    if (response[0] != SER_FLOAT || *(double *)(response + 5) != 8)
+    {
+        fprintf(stderr, "INCRBYFLOAT of '007' should return 8\n");
+        return false;
+    }
+
+    response = incrbyfloat_command(parse_test_cmd("INCRBYFLOAT padded abc"), aof_restore);
+    if (response[0] != SER_ERR)
+    {
+        fprintf(stderr, "INCRBYFLOAT with an invalid increment should fail\n");
+        return false;
+    }
+
+    test_reset();
+
+    return true;
+}
+
+bool test_multi_key_commands()
+{
+    test_init();
+
+    bool aof_restore = false;
+
+    // execute_command logs to the aof unless the command is restored, MSET responds either way
+    char *response = execute_command(parse_test_cmd("MSET a 1 b two c 3"), true);
+    if (response[0] != SER_NIL || hget(global_table, "a")->valueType != INTEGER || strcmp(hget(global_table, "b")->value, "two") != 0)
+    {
+        fprintf(stderr, "MSET should set every key\n");
+        return false;
+    }
+
+    response = execute_command(parse_test_cmd("MSET a 1 b"), true);
+    if (response[0] != SER_ERR)
+    {
+        fprintf(stderr, "MSET with an odd number of arguments should fail\n");
+        return false;
+    }
+
+    // one element per key, in the order of the keys
+    response = mget_command(parse_test_cmd("MGET b missing a"), aof_restore);
+    char expected[] = {SER_ARR, 3, 0, 0, 0, SER_STR, 3, 0, 0, 0, 't', 'w', 'o', SER_NIL, 0, 0, 0, 0, SER_STR, 1, 0, 0, 0, '1'};
+    if (memcmp(response, expected, sizeof(expected)) != 0)
+    {
+        fprintf(stderr, "MGET should return [two, nil, 1]\n");
+        return false;
+    }
+
+    response = exists_command(parse_test_cmd("EXISTS a missing c a"), aof_restore);
+    if (*(int64_t *)(response + 5) != 3)
+    {
+        fprintf(stderr, "EXISTS should count 3 keys\n");
+        return false;
+    }
+
+    response = del_command(parse_test_cmd("DEL a missing c"), aof_restore);
+    if (*(int64_t *)(response + 5) != 2 || hget(global_table, "a") || hget(global_table, "c") || !hget(global_table, "b"))
+    {
+        fprintf(stderr, "DEL should remove 2 keys\n");
+        return false;
+    }
+
+    // partial responses of two shards are merged per key
+    Command *cmd = parse_test_cmd("MGET x y");
+    CommandSpec *spec = lookup_command("MGET", 4);
+    char *merged = merge_multi_key_responses(cmd, spec, mget_command(parse_test_cmd("MGET b missing"), aof_restore), mget_command(parse_test_cmd("MGET missing b"), aof_restore));
+    char expected_merged[] = {SER_ARR, 2, 0, 0, 0, SER_NIL, 0, 0, 0, 0, SER_STR, 3, 0, 0, 0, 't', 'w', 'o'};
+    if (memcmp(merged, expected_merged, sizeof(expected_merged)) != 0)
+    {
+        fprintf(stderr, "merged MGET responses should take every key from the current shard\n");
+        return false;
+    }
+
+    int64_t large = 3000000000;
+    merged = merge_multi_key_responses(cmd, lookup_command("DEL", 3), get_response(INTEGER, &large), get_response(INTEGER, &large));
+    if (merged[0] != SER_INT || *(int64_t *)(merged + 5) != 6000000000)
+    {
+        fprintf(stderr, "merged DEL responses should be summed\n");
+        return false;
+    }
+
+    test_reset();
+
+    return true;
+}
+
+bool test_slabstats_command()
+{
+    test_init();
+
+    set_command(parse_test_cmd("SET key value"), true);
+
+    // the nodes come from the slabs, at least one size class is reported
+    char *response = slabstats_command(NULL, true);
+    if (response[0] != SER_ARR || *(int *)(response + 1) < 1 || response[5] != SER_STR || memcmp(response + 10, "size ", 5) != 0)
+    {
+        fprintf(stderr, "SLABSTATS should report the occupancy of the slabs\n");
+        return false;
+    }
+
+    response_free(response);
+    test_reset();
+
+    return true;
+}
+
 bool test_exists_command()
 {
     // test exists on key that does not exist
     char *cmdStringExists = "EXISTS key";
-    Command *cmdExists = parse_cmd_string(cmdStringExists, strlen(cmdStringExists));
-    char *existsResponse = exists_command(cmdExists);
+    Command *cmdExists = parse_test_cmd(cmdStringExists);
+    char *existsResponse = exists_command(cmdExists, true);
 
     if (existsResponse[0] != SER_INT)
     {
@@ -294,11 +748,11 @@ bool test_exists_command()
 
     // insert a key
     char *cmdStringSet = "SET key value";
-    Command *cmdSet = parse_cmd_string(cmdStringSet, strlen(cmdStringSet));
+    Command *cmdSet = parse_test_cmd(cmdStringSet);
     set_command(cmdSet, true);
 
     // test exists on key that exists
-    existsResponse = exists_command(cmdExists);
+    existsResponse = exists_command(cmdExists, true);
 
     if (existsResponse[0] != SER_INT)
     {
@@ -325,23 +779,23 @@ bool test_meta_commands()
 
     // insert a string,hashtable, list, sorted set
     char *cmdString = "SET key value";
-    Command *cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    Command *cmd = parse_test_cmd(cmdString);
     set_command(cmd, aof_restore);
 
     cmdString = "HSET hash key value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     hset_command(cmd, aof_restore);
 
     cmdString = "LPUSH list value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpush_command(cmd, aof_restore);
 
     cmdString = "ZADD sortedset 1 value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     zadd_command(cmd, aof_restore);
 
     // test keys command
-    char *response = keys_command();
+    char *response = keys_command(NULL, true);
     if (response[0] != SER_ARR)
     {
         fprintf(stderr, "response type should be array\n");
@@ -357,7 +811,7 @@ bool test_meta_commands()
     // test del command
     cmdString = "DEL key";
 
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     del_command(cmd, aof_restore);
 
     // check if key was deleted
@@ -370,7 +824,7 @@ bool test_meta_commands()
 
     // test flushall command
     cmdString = "FLUSHALL";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     flushall_cmd(cmd, aof_restore);
 
     // check if all keys were deleted
@@ -404,7 +858,7 @@ bool test_hashtable_commands()
 
     // test hset command
     char *cmdString = "HSET hash key value";
-    Command *cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    Command *cmd = parse_test_cmd(cmdString);
     hset_command(cmd, aof_restore);
 
     // check if global table has the hash
@@ -416,14 +870,14 @@ bool test_hashtable_commands()
     }
 
     // check if hash has the key
-    HashNode *hash_node = hget(fetched_node->value, "key");
-    if (!hash_node)
+    char *value;
+    if (!hmap_get(fetched_node->value, "key", &value, NULL))
     {
         fprintf(stderr, "key not found in hash, was not set\n");
         return false;
     }
 
-    if (strcmp(hash_node->value, "value") != 0)
+    if (strcmp(value, "value") != 0)
     {
         fprintf(stderr, "incorrect value set\n");
         return false;
@@ -431,15 +885,15 @@ bool test_hashtable_commands()
 
     // test hexists command
     cmdString = "HEXISTS hash key";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
-    char *response = hexists_command(cmd);
+    cmd = parse_test_cmd(cmdString);
+    char *response = hexists_command(cmd, true);
 
     if (response[0] != SER_INT)
     {
         fprintf(stderr, "hexists failed, response type should be integer\n");
     }
 
-    if (*(int *)(response + 5) != 1)
+    if (*(int64_t *)(response + 5) != 1)
     {
         fprintf(stderr, "hexists failed, response value should be 1\n");
         return false;
@@ -447,8 +901,8 @@ bool test_hashtable_commands()
 
     // test get command
     cmdString = "HGET hash key";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
-    response = hget_command(cmd);
+    cmd = parse_test_cmd(cmdString);
+    response = hget_command(cmd, true);
 
     if (response[0] != SER_STR)
     {
@@ -462,7 +916,8 @@ bool test_hashtable_commands()
         return false;
     }
 
-    if (strcmp("value", response + 5) != 0)
+    // the string of a response is not null terminated
+    if (memcmp("value", response + 5, strlen("value")) != 0)
     {
         fprintf(stderr, "response value should be 'value'\n");
         return false;
@@ -470,59 +925,136 @@ bool test_hashtable_commands()
 
     // test hdel command
     cmdString = "HDEL hash key";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     hdel_command(cmd, aof_restore);
 
     // check if key was deleted
-    hash_node = hget(fetched_node->value, "key");
-    if (hash_node)
+    if (hmap_get(fetched_node->value, "key", &value, NULL))
     {
         fprintf(stderr, "key was not deleted\n");
         return false;
     }
 
+    // values are sent with the lengths kept by the hash, so they may hold any byte
+    char binary[] = "HSET binhash field v\0lue";
+    Command bin_cmd;
+    parse_cmd(binary, sizeof(binary) - 1, &bin_cmd);
+    response_free(hset_command(&bin_cmd, aof_restore));
+
+    response = hget_command(parse_test_cmd("HGET binhash field"), true);
+    if (response[0] != SER_STR || *(int *)(response + 1) != 5 || memcmp(response + 5, "v\0lue", 5) != 0)
+    {
+        fprintf(stderr, "HGET should return the value with its null byte\n");
+        return false;
+    }
+
+    response = hgetall_command(parse_test_cmd("HGETALL binhash"), true);
+    if (response[0] != SER_ARR || *(int *)(response + 1) != 2 || *(int *)(response + 6) != 5 || memcmp(response + 10, "field", 5) != 0 || *(int *)(response + 16) != 5 || memcmp(response + 20, "v\0lue", 5) != 0)
+    {
+        fprintf(stderr, "HGETALL should return the values with their null bytes\n");
+        return false;
+    }
+
     return true;
 }
 
-bool test_list_commands()
+bool test_hash_shrink_idle()
 {
     // set this to true, don't want to write to aof file in a tests
     bool aof_restore = true;
 
-    test_init();
+    EventLoop loop = {0};
+    loop.table = hcreate(INIT_TABLE_SIZE);
+    event_loops = &loop;
+    global_table = loop.table;
 
-    // test lpush command
-    char *cmdString = "LPUSH list value";
-    Command *cmd = parse_cmd_string(cmdString, strlen(cmdString));
-    lpush_command(cmd, aof_restore);
+    char request[64];
+    for (int i = 0; i < 4096; i++)
+    {
+        sprintf(request, "HSET hash f%d v%d", i, i);
+        response_free(execute_command(parse_test_cmd(request), aof_restore));
+    }
 
-    // check if global table has the list
-    HashNode *fetched_node = hget(global_table, "list");
-    if (!fetched_node)
+    // deleting most fields starts shrinking the table of the hash, which the loop owning the shard moves along while idle
+    for (int i = 0; i < 3896; i++)
     {
-        fprintf(stderr, "list not found in global table, was not set\n");
-        return false;
+        sprintf(request, "HDEL hash f%d", i);
+        response_free(execute_command(parse_test_cmd(request), aof_restore));
     }
 
-    // check if list has size 1
-    if (((List *)fetched_node->value)->size != 1)
+    HashMap *map = hget(loop.table, "hash")->value;
+    if (loop.num_rehash_keys != 1 || !map->table->old_groups)
     {
-        fprintf(stderr, "list size should be 1\n");
+        fprintf(stderr, "hash shrink, the shrinking hash should be tracked by its loop\n");
         return false;
     }
 
-    // check if list has the value
-    ListNode *list_node = list_iget(fetched_node->value, 0);
-    if (strcmp(list_node->data, "value") != 0)
+    while (loop_rehash_idle(&loop))
     {
-        printf("%s\n", (char *)list_node->data);
-        fprintf(stderr, "value not found in list, was not set\n");
-        return false;
+    }
+
+    char *value;
+    if (loop.num_rehash_keys != 0 || map->table->old_groups || hmap_size(map) != 200 || !hmap_get(map, "f4095", &value, NULL) || strcmp(value, "v4095") != 0)
+    {
+        fprintf(stderr, "hash shrink, the idle loop should finish shrinking the hash\n");
+        return false;
+    }
+
+    // a hash deleted while it shrinks is forgotten
+    response_free(execute_command(parse_test_cmd("HDEL hash f4000"), aof_restore));
+    loop_track_rehash("hash");
+    response_free(execute_command(parse_test_cmd("DEL hash"), aof_restore));
+    if (loop_rehash_idle(&loop) || loop.num_rehash_keys != 0)
+    {
+        fprintf(stderr, "hash shrink, a deleted hash should be forgotten\n");
+        return false;
+    }
+
+    event_loops = NULL;
+    test_reset();
+
+    return true;
+}
+
+bool test_list_commands()
+{
+    // set this to true, don't want to write to aof file in a tests
+    bool aof_restore = true;
+
+    test_init();
+
+    // test lpush command
+    char *cmdString = "LPUSH list value";
+    Command *cmd = parse_test_cmd(cmdString);
+    lpush_command(cmd, aof_restore);
+
+    // check if global table has the list
+    HashNode *fetched_node = hget(global_table, "list");
+    if (!fetched_node)
+    {
+        fprintf(stderr, "list not found in global table, was not set\n");
+        return false;
+    }
+
+    // check if list has size 1
+    if (((List *)fetched_node->value)->size != 1)
+    {
+        fprintf(stderr, "list size should be 1\n");
+        return false;
+    }
+
+    // check if list has the value
+    ListNode *list_node = list_iget(fetched_node->value, 0);
+    if (strcmp(list_node->data, "value") != 0)
+    {
+        printf("%s\n", (char *)list_node->data);
+        fprintf(stderr, "value not found in list, was not set\n");
+        return false;
     }
 
     // test rpush command
     cmdString = "RPUSH list value2";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     rpush_command(cmd, aof_restore);
 
     list_node = list_iget(fetched_node->value, 1);
@@ -535,7 +1067,7 @@ bool test_list_commands()
 
     // test lpop command
     cmdString = "LPOP list";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpop_command(cmd, aof_restore);
 
     // check if list has size 1
@@ -547,7 +1079,7 @@ bool test_list_commands()
 
     // test rpop command
     cmdString = "RPOP list";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     rpop_command(cmd, aof_restore);
 
     // check if list has size 0
@@ -559,8 +1091,8 @@ bool test_list_commands()
 
     // test llen command
     cmdString = "LLEN list";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
-    char *response = llen_cmd(cmd);
+    cmd = parse_test_cmd(cmdString);
+    char *response = llen_cmd(cmd, true);
 
     if (response[0] != SER_INT)
     {
@@ -568,7 +1100,7 @@ bool test_list_commands()
         return false;
     }
 
-    if (*(int *)(response + 5) != 0)
+    if (*(int64_t *)(response + 5) != 0)
     {
         printf("%d\n", *(int *)(response + 1));
         fprintf(stderr, "response value should be 0\n");
@@ -577,11 +1109,11 @@ bool test_list_commands()
 
     // test lset
     cmdString = "LPUSH list value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpush_command(cmd, aof_restore);
 
     cmdString = "LSET list 0 newvalue";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lset_cmd(cmd, aof_restore);
 
     list_node = list_iget(fetched_node->value, 0);
@@ -593,29 +1125,29 @@ bool test_list_commands()
 
     // remove all elements
     cmdString = "LPOP list";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpop_command(cmd, aof_restore);
 
     // test ltrim
     cmdString = "LPUSH list value2";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpush_command(cmd, aof_restore);
 
     cmdString = "LPUSH list value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     lpush_command(cmd, aof_restore);
 
     cmdString = "RPUSH list value3";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     rpush_command(cmd, aof_restore);
 
     cmdString = "RPUSH list value4";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     rpush_command(cmd, aof_restore);
 
     // trim from 1 to 2
     cmdString = "LTRIM list 1 2";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     ltrim_cmd(cmd, aof_restore);
 
     // check if list has size 1
@@ -658,7 +1190,7 @@ bool test_zset_commands()
 
     // test zadd command
     char *cmdString = "ZADD sortedset 1 value";
-    Command *cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    Command *cmd = parse_test_cmd(cmdString);
     zadd_command(cmd, aof_restore);
 
     // check if global table has the sorted set
@@ -670,8 +1202,8 @@ bool test_zset_commands()
     }
 
     // check if sorted set has the value
-    HashNode *hash_node = zset_search_by_key(fetched_node->value, "value");
-    if (!hash_node)
+    double score;
+    if (!zset_score(fetched_node->value, "value", &score))
     {
         fprintf(stderr, "zset, value not found in sorted set, was not set\n");
         return false;
@@ -679,8 +1211,8 @@ bool test_zset_commands()
 
     // test zscore
     cmdString = "ZSCORE sortedset value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
-    char *response = zscore_cmd(cmd);
+    cmd = parse_test_cmd(cmdString);
+    char *response = zscore_cmd(cmd, true);
 
     if (response[0] != SER_FLOAT)
     {
@@ -688,20 +1220,19 @@ bool test_zset_commands()
         return false;
     }
 
-    if (*(float *)(response + 5) != 1)
+    if (*(int *)(response + 1) != sizeof(double) || *(double *)(response + 5) != 1)
     {
-        fprintf(stderr, "zset, response value should be 1\n");
+        fprintf(stderr, "zset, response value should be the double 1\n");
         return false;
     }
 
     // test zrem
     cmdString = "ZREM sortedset value";
-    cmd = parse_cmd_string(cmdString, strlen(cmdString));
+    cmd = parse_test_cmd(cmdString);
     zrem_command(cmd, aof_restore);
 
     // check if key was deleted
-    hash_node = zset_search_by_key(fetched_node->value, "value");
-    if (hash_node)
+    if (zset_score(fetched_node->value, "value", &score))
     {
         fprintf(stderr, "value was not deleted\n");
         return false;
@@ -713,19 +1244,669 @@ bool test_zset_commands()
     return true;
 }
 
+// reads the names of an array response of names and scores into a string, e.g. "a b c"
+void zset_response_names(char *response, char *out)
+{
+    int num_elements = *(int *)(response + 1);
+    int offset = 5;
+
+    out[0] = '\0';
+    for (int i = 0; i < num_elements; i++)
+    {
+        int len = *(int *)(response + offset + 1);
+
+        // every other element is a score
+        if (i % 2 == 0)
+        {
+            if (out[0])
+            {
+                strcat(out, " ");
+            }
+            strncat(out, response + offset + 5, len);
+        }
+
+        offset += 5 + len;
+    }
+}
+
+// checks the integer response of a command
+bool check_int_response(char *response, int64_t expected)
+{
+    return response[0] == SER_INT && *(int *)(response + 1) == sizeof(int64_t) && *(int64_t *)(response + 5) == expected;
+}
+
+bool test_zset_range_commands()
+{
+    test_init();
+
+    // a and b share a score, the large scores only differ past the precision of a float
+    zadd_command(parse_test_cmd("ZADD board 1 a 1 b 2.5 c -3 d 16777216 e 16777217 f"), true);
+
+    char names[128];
+    struct
+    {
+        char *command;
+        char *expected;
+    } ranges[] = {
+        {"ZRANGEBYSCORE board 1 2.5", "a b c"},
+        {"ZRANGEBYSCORE board (1 +inf", "c e f"},
+        {"ZRANGEBYSCORE board -inf (1", "d"},
+        {"ZRANGEBYSCORE board (16777216 16777217", "f"},
+        {"ZRANGEBYSCORE board -inf +inf LIMIT 1 3", "a b c"},
+        {"ZRANGEBYSCORE board -inf +inf limit 4 -1", "e f"},
+        {"ZRANGEBYSCORE board 3 2", ""},
+        {"ZRANGEBYSCORE board 1 1 LIMIT 5 1", ""},
+        {"ZRANGEBYSCORE board -inf +inf LIMIT -1 2", ""},
+        {"ZRANGEBYSCORE board (1 +inf LIMIT 0 -5", "c e f"},
+        {"ZRANGEBYSCORE missing 1 2", ""},
+        {"ZREVRANGE board 0 2", "f e c"},
+        {"ZREVRANGE board -2 -1", "a d"},
+        {"ZREVRANGE board 4 100", "a d"},
+        {"ZREVRANGE board 3 1", ""},
+    };
+
+    for (int i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+    {
+        Command *cmd = parse_test_cmd(ranges[i].command);
+        char *response = lookup_command(cmd->name, cmd->name_len)->handler(cmd, true);
+
+        zset_response_names(response, names);
+        if (response[0] != SER_ARR || strcmp(names, ranges[i].expected) != 0)
+        {
+            fprintf(stderr, "%s should return '%s', not '%s'\n", ranges[i].command, ranges[i].expected, names);
+            return false;
+        }
+    }
+
+    if (!check_int_response(zrank_cmd(parse_test_cmd("ZRANK board d"), true), 0) || !check_int_response(zrank_cmd(parse_test_cmd("ZRANK board f"), true), 5) || !check_int_response(zrevrank_cmd(parse_test_cmd("ZREVRANK board f"), true), 0) || !check_int_response(zrevrank_cmd(parse_test_cmd("ZREVRANK board b"), true), 3))
+    {
+        fprintf(stderr, "zset, ranks are wrong\n");
+        return false;
+    }
+
+    if (zrank_cmd(parse_test_cmd("ZRANK board missing"), true)[0] != SER_NIL || zrevrank_cmd(parse_test_cmd("ZREVRANK missing a"), true)[0] != SER_NIL)
+    {
+        fprintf(stderr, "zset, rank of a missing member should be null\n");
+        return false;
+    }
+
+    if (!check_int_response(zcount_cmd(parse_test_cmd("ZCOUNT board 1 2.5"), true), 3) || !check_int_response(zcount_cmd(parse_test_cmd("ZCOUNT board (1 (16777217"), true), 2) || !check_int_response(zcount_cmd(parse_test_cmd("ZCOUNT board -inf +inf"), true), 6) || !check_int_response(zcount_cmd(parse_test_cmd("ZCOUNT board 5 1"), true), 0) || !check_int_response(zcount_cmd(parse_test_cmd("ZCOUNT missing 1 2"), true), 0))
+    {
+        fprintf(stderr, "zset, counts are wrong\n");
+        return false;
+    }
+
+    if (zcount_cmd(parse_test_cmd("ZCOUNT board ( 2"), true)[0] != SER_ERR || zrangebyscore_cmd(parse_test_cmd("ZRANGEBYSCORE board 1 2 LIMIT 1"), true)[0] != SER_ERR || zrevrange_cmd(parse_test_cmd("ZREVRANGE board a 1"), true)[0] != SER_ERR || zadd_command(parse_test_cmd("ZADD board nan g"), true)[0] != SER_ERR)
+    {
+        fprintf(stderr, "zset, invalid arguments should be rejected\n");
+        return false;
+    }
+
+    response_arena_reset();
+    test_reset();
+
+    return true;
+}
+
+bool test_aof_rewrite()
+{
+    // set this to true, don't want to write to aof file in a tests
+    bool aof_restore = true;
+
+    test_init();
+
+    // many commands updating the same keys, and bulk commands setting several values at once
+    for (int i = 0; i < 1000; i++)
+    {
+        response_free(execute_command(parse_test_cmd("INCR counter"), aof_restore));
+    }
+
+    char *commands[] = {"SET name liteDB", "INCRBYFLOAT pi 3.25", "HSET user name ada lang c", "HSET user lang c99", "RPUSH list a b c", "LPOP list", "ZADD board 1.5 x 2 y 0.1 z", "ZREM board y"};
+    for (int i = 0; i < (int)(sizeof(commands) / sizeof(commands[0])); i++)
+    {
+        response_free(execute_command(parse_test_cmd(commands[i]), aof_restore));
+    }
+
+    // a list too long for a single request is split over several RPUSH
+    char cmd_string[64];
+    for (int i = 0; i < 2000; i++)
+    {
+        sprintf(cmd_string, "RPUSH biglist item%d", i);
+        response_free(execute_command(parse_test_cmd(cmd_string), aof_restore));
+    }
+
+    char path[] = "/tmp/testserver_rewrite_XXXXXX";
+    close(mkstemp(path));
+
+    FILE *file = fopen(path, "w");
+    if (!aof_rewrite_table(file, global_table))
+    {
+        fprintf(stderr, "rewrite, failed to write the keyspace\n");
+        return false;
+    }
+    fclose(file);
+
+    // replay the rewritten commands into an empty keyspace
+    HashTable *original = global_table;
+    global_table = hcreate(INIT_TABLE_SIZE);
+
+    file = fopen(path, "r");
+    char line[MAX_MESSAGE_SIZE];
+    int num_lines = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        int len = strlen(line);
+        if (line[len - 1] != '\n')
+        {
+            fprintf(stderr, "rewrite, commands should fit in a request\n");
+            return false;
+        }
+
+        line[--len] = '\0';
+        num_lines++;
+
+        Command cmd;
+        parse_cmd(line, len, &cmd);
+        response_free(execute_command(&cmd, aof_restore));
+        cmd_release(&cmd);
+    }
+
+    fclose(file);
+    unlink(path);
+
+    // one command per key, except the long list
+    if (num_lines < 8 || num_lines > 20)
+    {
+        fprintf(stderr, "rewrite, expected one command per key, got %d\n", num_lines);
+        return false;
+    }
+
+    HashNode *node = hget(global_table, "counter");
+    if (!node || node->valueType != INTEGER || node->intValue != 1000)
+    {
+        fprintf(stderr, "rewrite, counter should be restored as an integer\n");
+        return false;
+    }
+
+    node = hget(global_table, "pi");
+    if (!node || node->valueType != FLOAT || node->floatValue != 3.25 || !hget(global_table, "name"))
+    {
+        fprintf(stderr, "rewrite, strings and floats should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "user");
+    char *field;
+    if (!node || !hmap_get(node->value, "lang", &field, NULL) || strcmp(field, "c99") != 0 || !hmap_get(node->value, "name", &field, NULL))
+    {
+        fprintf(stderr, "rewrite, hash should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "list");
+    if (!node || ((List *)node->value)->size != 2 || strcmp(list_iget(node->value, 0)->data, "b") != 0)
+    {
+        fprintf(stderr, "rewrite, list should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "biglist");
+    if (!node || ((List *)node->value)->size != 2000 || strcmp(list_iget(node->value, 1999)->data, "item1999") != 0)
+    {
+        fprintf(stderr, "rewrite, long list should be restored in order\n");
+        return false;
+    }
+
+    node = hget(global_table, "board");
+    double score;
+    if (!node || !zset_score(node->value, "x", &score) || score != 1.5 || zset_score(node->value, "y", &score) || !zset_score(node->value, "z", &score) || score != 0.1)
+    {
+        fprintf(stderr, "rewrite, sorted set should be restored\n");
+        return false;
+    }
+
+    hfree_table(original);
+    test_reset();
+
+    // the records appended while the child writes the snapshot are appended to it before it replaces the AOF
+    char aof_path[] = "/tmp/testserver_aof_XXXXXX";
+    close(mkstemp(aof_path));
+
+    char rewrite_path[AOF_PATH_SIZE];
+    snprintf(rewrite_path, sizeof(rewrite_path), "%s.rewrite", aof_path);
+
+    AOF *aof = aof_init(aof_path, FLUSH_INTERVAL_SEC, "a");
+    aof_write(aof, "INCR counter\n");
+    aof_write(aof, "INCR counter\n");
+
+    if (!aof_rewrite_begin(aof) || aof_rewrite_begin(aof))
+    {
+        fprintf(stderr, "rewrite, only one rewrite should run at a time\n");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        FILE *snapshot = fopen(rewrite_path, "w");
+        fputs("SET counter 2\n", snapshot);
+        fclose(snapshot);
+        _exit(EXIT_SUCCESS);
+    }
+
+    aof_rewrite_started(aof, pid, rewrite_path);
+
+    aof_write(aof, "INCR counter\n");
+    aof_drain(aof);
+    aof_write(aof, "SET other 1\n");
+
+    int result;
+    while ((result = aof_rewrite_poll(aof)) == 0)
+    {
+        usleep(1000);
+    }
+
+    char *expected = "SET counter 2\nINCR counter\nSET other 1\n";
+    if (result != 1 || aof->written != 4 || aof->size != (long)strlen(expected) || aof->base_size != aof->size || aof->rewriting)
+    {
+        fprintf(stderr, "rewrite, rewritten file should replace the AOF\n");
+        return false;
+    }
+
+    // the automatic rewrite waits for the file to grow by the percentage
+    aof->rewrite_min_size = 0;
+    aof_write(aof, "DEL other\n");
+    aof_drain(aof);
+    if (aof_rewrite_due(aof))
+    {
+        fprintf(stderr, "rewrite, should not be due before the file grew enough\n");
+        return false;
+    }
+
+    aof->rewrite_percentage = 20;
+    if (!aof_rewrite_due(aof))
+    {
+        fprintf(stderr, "rewrite, should be due once the file grew enough\n");
+        return false;
+    }
+
+    // a failed rewrite is not retried before the delay, the file is still as large as before
+    if (!aof_rewrite_begin(aof))
+    {
+        return false;
+    }
+    aof_rewrite_started(aof, 0, rewrite_path);
+    if (aof_rewrite_finish(aof, false) || aof_rewrite_due(aof))
+    {
+        fprintf(stderr, "rewrite, should not be due right after a failed rewrite\n");
+        return false;
+    }
+
+    aof->rewrite_failed_at -= AOF_REWRITE_RETRY_DELAY_SEC;
+    if (!aof_rewrite_due(aof))
+    {
+        fprintf(stderr, "rewrite, should be due again once the retry delay passed\n");
+        return false;
+    }
+
+    // later records are appended to the new file
+    aof_close(aof);
+
+    char content[256] = {0};
+    file = fopen(aof_path, "r");
+    int len = fread(content, 1, sizeof(content) - 1, file);
+    fclose(file);
+    unlink(aof_path);
+
+    if (len != (int)strlen(expected) + 10 || memcmp(content, expected, strlen(expected)) != 0 || strcmp(content + strlen(expected), "DEL other\n") != 0)
+    {
+        fprintf(stderr, "rewrite, unexpected AOF content '%s'\n", content);
+        return false;
+    }
+
+    return true;
+}
+
+bool test_aof_snapshot()
+{
+    // set this to true, don't want to write to aof file in a tests
+    bool aof_restore = true;
+
+    test_init();
+
+    char *commands[] = {"SET name liteDB", "INCRBY counter 41", "INCRBYFLOAT pi 3.25", "HSET user name ada lang c", "RPUSH list a b c", "ZADD board 16777217 z 1.5 x 2 y"};
+    for (int i = 0; i < (int)(sizeof(commands) / sizeof(commands[0])); i++)
+    {
+        response_free(execute_command(parse_test_cmd(commands[i]), aof_restore));
+    }
+
+    // a rewritten AOF is a snapshot followed by the commands logged after it
+    char path[] = "/tmp/testserver_snapshot_XXXXXX";
+    close(mkstemp(path));
+
+    if (!aof_rewrite_write(path, true))
+    {
+        fprintf(stderr, "snapshot, failed to write the keyspace\n");
+        return false;
+    }
+
+    FILE *file = fopen(path, "a");
+    fputs("INCR counter\nZREM board y\nSET tail 1\n", file);
+    fclose(file);
+
+    HashTable *original = global_table;
+    global_table = hcreate(INIT_TABLE_SIZE);
+
+    global_aof = aof_init(path, FLUSH_INTERVAL_SEC, "r");
+    aof_restore_db();
+    aof_close(global_aof);
+    global_aof = NULL;
+    unlink(path);
+
+    HashNode *node = hget(global_table, "counter");
+    if (!node || node->valueType != INTEGER || node->intValue != 42 || !hget(global_table, "tail"))
+    {
+        fprintf(stderr, "snapshot, the commands after it should be replayed\n");
+        return false;
+    }
+
+    node = hget(global_table, "pi");
+    HashNode *name = hget(global_table, "name");
+    if (!node || node->valueType != FLOAT || node->floatValue != 3.25 || !name || strcmp(name->value, "liteDB") != 0)
+    {
+        fprintf(stderr, "snapshot, strings and numbers should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "user");
+    char *lang;
+    if (!node || hmap_size(node->value) != 2 || !hmap_get(node->value, "lang", &lang, NULL) || strcmp(lang, "c") != 0)
+    {
+        fprintf(stderr, "snapshot, hash should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "list");
+    if (!node || ((List *)node->value)->size != 3 || strcmp(list_iget(node->value, 2)->data, "c") != 0)
+    {
+        fprintf(stderr, "snapshot, list should be restored\n");
+        return false;
+    }
+
+    node = hget(global_table, "board");
+    ZSet *zset = node ? node->value : NULL;
+    double score;
+    if (!zset || zset_score(zset, "y", &score) || zset_size(zset) != 2 || zset_rank(zset, "x", 1.5) != 0 || !zset_score(zset, "z", &score) || score != 16777217)
+    {
+        fprintf(stderr, "snapshot, sorted set should be restored\n");
+        return false;
+    }
+
+    hfree_table(original);
+    test_reset();
+
+    return true;
+}
+
+bool test_aof_restore_sharded()
+{
+    // a keyspace of 4 shards, as with --threads 4
+    EventLoop loops[4] = {0};
+    for (int i = 0; i < 4; i++)
+    {
+        loops[i].id = i;
+        loops[i].table = hcreate(INIT_TABLE_SIZE);
+    }
+    event_loops = loops;
+    num_loops = 4;
+    global_table = loops[0].table;
+
+    char path[] = "/tmp/testserver_restore_XXXXXX";
+    close(mkstemp(path));
+
+    // keys of several shards set and deleted by single commands, an empty line, and a last line without its newline
+    FILE *file = fopen(path, "w");
+    for (int i = 0; i < 100; i++)
+    {
+        fprintf(file, "SET key%d %d\nINCR counter%d\n", i, i, i % 10);
+    }
+    fputs("MSET new1 one new2 two new3 three\n\nDEL key4 key5 key6\nRPUSH list a b\nRPUSH list c", file);
+    fclose(file);
+
+    global_aof = aof_init(path, FLUSH_INTERVAL_SEC, "r");
+    long num_lines = aof_restore_db();
+    aof_close(global_aof);
+    global_aof = NULL;
+    unlink(path);
+
+    bool ok = num_lines == 204;
+    if (!ok)
+    {
+        fprintf(stderr, "restore, every line but the empty one should be replayed, %ld were\n", num_lines);
+    }
+
+    // every key is restored into the shard that owns it
+    char key[32];
+    for (int i = 0; ok && i < 100; i++)
+    {
+        sprintf(key, "key%d", i);
+        HashNode *node = hget(loops[shard_for_key(key)].table, key);
+
+        if (i >= 4 && i <= 6)
+        {
+            ok = node == NULL;
+        }
+        else
+        {
+            ok = node && node->valueType == INTEGER && node->intValue == i;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "restore, %s should be restored in its shard\n", key);
+        }
+    }
+
+    HashNode *new3 = hget(loops[shard_for_key("new3")].table, "new3");
+    if (ok && (!new3 || strcmp(new3->value, "three") != 0 || !hget(loops[shard_for_key("new1")].table, "new1")))
+    {
+        fprintf(stderr, "restore, keys of several shards set by one command should be restored\n");
+        ok = false;
+    }
+
+    HashNode *counter = hget(loops[shard_for_key("counter7")].table, "counter7");
+    HashNode *list = hget(loops[shard_for_key("list")].table, "list");
+    if (ok && (!counter || counter->intValue != 10 || !list || ((List *)list->value)->size != 3))
+    {
+        fprintf(stderr, "restore, the commands of a key should be replayed in order\n");
+        ok = false;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        hfree_table(loops[i].table);
+    }
+    event_loops = NULL;
+    num_loops = 1;
+
+    return ok;
+}
+
+// number of shard threads done writing, and whether they should stop processing their inbox
+static _Atomic int shard_writers_done = 0;
+static _Atomic int shard_threads_stop = 0;
+
+// runs the event loop of a shard, it sets a key of its shard over and over and processes its inbox between two writes, like a loop between two requests
+void *test_shard_thread(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+    current_loop = loop;
+    global_table = loop->table;
+
+    // the first key owned by the shard
+    char key[32];
+    int k = 0;
+    do
+    {
+        sprintf(key, "key%d", k++);
+    } while (shard_for_key(key) != loop->id);
+
+    char request[64];
+    for (int i = 1; i <= 2000; i++)
+    {
+        sprintf(request, "SET %s %d", key, i);
+        Command *cmd = parse_test_cmd(request);
+        response_free(execute_command(cmd, false));
+        response_arena_reset();
+
+        loop_process_inbox(loop);
+    }
+
+    atomic_fetch_add(&shard_writers_done, 1);
+
+    while (!atomic_load(&shard_threads_stop))
+    {
+        loop_process_inbox(loop);
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+bool test_all_shards_write_order()
+{
+    // 4 event loops, this thread runs the first one
+    EventLoop loops[4] = {0};
+    for (int i = 0; i < 4; i++)
+    {
+        loops[i].id = i;
+        loops[i].table = hcreate(INIT_TABLE_SIZE);
+        loops[i].wake_fd = eventfd(0, EFD_NONBLOCK);
+        queue_init(&loops[i].inbox);
+    }
+    event_loops = loops;
+    num_loops = 4;
+    current_loop = &loops[0];
+    global_table = loops[0].table;
+
+    char path[] = "/tmp/testserver_order_XXXXXX";
+    close(mkstemp(path));
+    global_aof = aof_init(path, FLUSH_INTERVAL_SEC, "a");
+
+    for (int i = 1; i < 4; i++)
+    {
+        pthread_create(&loops[i].thread, NULL, test_shard_thread, &loops[i]);
+    }
+
+    // FLUSHALL, and MSET and DEL with keys on several shards interleave with the writes of the other shards
+    char *commands[] = {"FLUSHALL", "MSET key0 0 key1 0 key2 0 key3 0 key4 0 key5 0", "DEL key0 key1 key2 key3 key4 key5 key6 key7 key8 key9"};
+    for (int i = 0; atomic_load(&shard_writers_done) < 3; i++)
+    {
+        Command *cmd = parse_test_cmd(commands[i % 3]);
+        response_free(execute_on_all_shards(cmd));
+        response_arena_reset();
+
+        if (i % 256 == 255)
+        {
+            aof_drain(global_aof);
+        }
+    }
+
+    atomic_store(&shard_threads_stop, 1);
+    for (int i = 1; i < 4; i++)
+    {
+        pthread_join(loops[i].thread, NULL);
+    }
+
+    current_loop = NULL;
+    aof_close(global_aof);
+
+    // replaying the AOF into empty shards gives the keyspace the server had
+    HashTable *live[4];
+    for (int i = 0; i < 4; i++)
+    {
+        live[i] = loops[i].table;
+        loops[i].table = hcreate(INIT_TABLE_SIZE);
+    }
+
+    global_aof = aof_init(path, FLUSH_INTERVAL_SEC, "r");
+    aof_restore_db();
+    aof_close(global_aof);
+    global_aof = NULL;
+    unlink(path);
+
+    bool ok = true;
+    char key[32];
+    for (int i = 0; ok && i < 100; i++)
+    {
+        sprintf(key, "key%d", i);
+        int shard = shard_for_key(key);
+        HashNode *expected = hget(live[shard], key);
+        HashNode *restored = hget(loops[shard].table, key);
+
+        ok = (!expected && !restored) || (expected && restored && expected->intValue == restored->intValue);
+        if (!ok)
+        {
+            fprintf(stderr, "write order, %s should be restored as it was before the restart\n", key);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        hfree_table(live[i]);
+        hfree_table(loops[i].table);
+        close(loops[i].wake_fd);
+    }
+    event_loops = NULL;
+    num_loops = 1;
+
+    return ok;
+}
+
 int main()
 {
 
     assert(test_get_response());
     assert(test_null_response());
     assert(test_error_response());
-    assert(test_avl_iterate_response());
-    assert(test_parse_cmd_string());
+    assert(test_zset_range_response());
+    assert(test_response_arena());
+    assert(test_aof_commit());
+    assert(test_parse_cmd());
+    assert(test_command_table());
     assert(test_string_commands());
+    assert(test_counter_commands());
+    assert(test_multi_key_commands());
+    assert(test_slabstats_command());
     assert(test_hashtable_commands());
+
+    // hashes behave the same once they are hash tables
+    hmap_max_compact_fields = 0;
+    assert(test_hashtable_commands());
+    hmap_max_compact_fields = HMAP_MAX_COMPACT_FIELDS;
+    assert(test_hash_shrink_idle());
     assert(test_list_commands());
     assert(test_zset_commands());
+
+    // the sorted set commands behave the same with every engine
+    zset_default_engine = ZSET_ENGINE_SKIPLIST;
+    assert(test_zset_commands());
+    zset_default_engine = ZSET_ENGINE_AVL;
+    assert(test_zset_range_commands());
+
+    // and once the sorted sets are too large to be compact
+    zset_max_compact_entries = 0;
+    assert(test_zset_range_commands());
+    zset_default_engine = ZSET_ENGINE_SKIPLIST;
+    assert(test_zset_range_commands());
+    zset_default_engine = ZSET_ENGINE_AVL;
+    zset_max_compact_entries = ZSET_MAX_COMPACT_ENTRIES;
     assert(test_meta_commands());
+    assert(test_aof_rewrite());
+    assert(test_aof_snapshot());
+    assert(test_aof_restore_sharded());
+    assert(test_all_shards_write_order());
 
     printf("All tests passed\n");
     return 0;
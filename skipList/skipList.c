@@ -0,0 +1,428 @@
+// * This file contains a skip list with ranks, the ordered index of a sorted set. Nodes are ordered by (score, member), every link knows how many nodes it skips so a rank is found on the way down like a key, and level 0 is a plain linked list so a range is read by following one pointer per member. The member is stored in the allocation of its node.
+
+#include "skipList.h"
+
+// state of the generator of node levels, one per thread since every event loop updates its own sorted sets
+static __thread uint64_t skiplist_random_state = 0;
+
+/**
+ * @brief Draws the level of a new node, level n + 1 is reached with a probability of 1 / SKIPLIST_BRANCHING^n
+ *
+ * @return int level between 1 and SKIPLIST_MAX_LEVEL
+ */
+static int skiplist_random_level()
+{
+    if (skiplist_random_state == 0)
+    {
+        skiplist_random_state = 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)&skiplist_random_state;
+    }
+
+    // xorshift64
+    uint64_t x = skiplist_random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    skiplist_random_state = x;
+
+    // every level uses 2 bits of the draw
+    int level = 1;
+    while (level < SKIPLIST_MAX_LEVEL && (x & (SKIPLIST_BRANCHING - 1)) == 0)
+    {
+        level++;
+        x >>= 2;
+    }
+
+    return level;
+}
+
+/**
+ * @brief Allocates a node with its member, the links are left to the caller
+ *
+ * @param level number of levels of the node
+ * @param member member of the node, copied. NULL for the header
+ * @param score score of the node
+ *
+ * @return SkipListNode* the new node
+ */
+static SkipListNode *skiplist_node_create(int level, const char *member, double score)
+{
+    size_t member_len = member ? strlen(member) + 1 : 0;
+
+    SkipListNode *node = slab_alloc(sizeof(SkipListNode) + level * sizeof(SkipListLevel) + member_len);
+    if (node == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    node->score = score;
+    node->level = level;
+    node->backward = NULL;
+    node->member = NULL;
+
+    if (member)
+    {
+        node->member = (char *)&node->levels[level];
+        memcpy(node->member, member, member_len);
+    }
+
+    return node;
+}
+
+/**
+ * @brief Compares a (score, member) pair with a node
+ *
+ * @return int negative if the pair comes before the node, 0 if it is the pair of the node, positive if it comes after it
+ */
+static int skiplist_compare(const char *member, double score, SkipListNode *node)
+{
+    if (score < node->score)
+    {
+        return -1;
+    }
+
+    if (score > node->score)
+    {
+        return 1;
+    }
+
+    return strcmp(member, node->member);
+}
+
+/**
+ * @brief Creates an empty skip list
+ *
+ * @return SkipList* the new skip list
+ */
+SkipList *skiplist_create()
+{
+    SkipList *list = calloc(1, sizeof(SkipList));
+    if (list == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    list->header = skiplist_node_create(SKIPLIST_MAX_LEVEL, NULL, 0);
+    for (int i = 0; i < SKIPLIST_MAX_LEVEL; i++)
+    {
+        list->header->levels[i].forward = NULL;
+        list->header->levels[i].span = 0;
+    }
+
+    list->level = 1;
+
+    return list;
+}
+
+/**
+ * @brief Inserts a member, which must not be in the list already
+ *
+ * @param list skip list to insert into
+ * @param member member to insert, copied into the node
+ * @param score score of the member
+ *
+ * @return SkipListNode* the new node
+ */
+SkipListNode *skiplist_insert(SkipList *list, const char *member, double score)
+{
+    // last node before the new one on every level, and its rank
+    SkipListNode *update[SKIPLIST_MAX_LEVEL];
+    long rank[SKIPLIST_MAX_LEVEL];
+
+    SkipListNode *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--)
+    {
+        rank[i] = (i == list->level - 1) ? 0 : rank[i + 1];
+
+        while (node->levels[i].forward && skiplist_compare(member, score, node->levels[i].forward) > 0)
+        {
+            rank[i] += node->levels[i].span;
+            node = node->levels[i].forward;
+        }
+
+        update[i] = node;
+    }
+
+    int level = skiplist_random_level();
+    if (level > list->level)
+    {
+        // the new levels start at the header, whose links span the whole list
+        for (int i = list->level; i < level; i++)
+        {
+            rank[i] = 0;
+            update[i] = list->header;
+            update[i]->levels[i].span = list->length;
+        }
+
+        list->level = level;
+    }
+
+    node = skiplist_node_create(level, member, score);
+
+    for (int i = 0; i < level; i++)
+    {
+        node->levels[i].forward = update[i]->levels[i].forward;
+        update[i]->levels[i].forward = node;
+
+        // the link before the node is split in two around it
+        node->levels[i].span = update[i]->levels[i].span - (rank[0] - rank[i]);
+        update[i]->levels[i].span = (rank[0] - rank[i]) + 1;
+    }
+
+    // the links above the node skip over one more node
+    for (int i = level; i < list->level; i++)
+    {
+        update[i]->levels[i].span++;
+    }
+
+    node->backward = (update[0] == list->header) ? NULL : update[0];
+    if (node->levels[0].forward)
+    {
+        node->levels[0].forward->backward = node;
+    }
+    else
+    {
+        list->tail = node;
+    }
+
+    list->length++;
+
+    return node;
+}
+
+/**
+ * @brief Deletes a member
+ *
+ * @param list skip list to delete from
+ * @param member member to delete
+ * @param score score of the member
+ *
+ * @return bool true if the member was found and deleted
+ */
+bool skiplist_delete(SkipList *list, const char *member, double score)
+{
+    SkipListNode *update[SKIPLIST_MAX_LEVEL];
+
+    SkipListNode *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--)
+    {
+        while (node->levels[i].forward && skiplist_compare(member, score, node->levels[i].forward) > 0)
+        {
+            node = node->levels[i].forward;
+        }
+
+        update[i] = node;
+    }
+
+    node = node->levels[0].forward;
+    if (!node || skiplist_compare(member, score, node) != 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < list->level; i++)
+    {
+        if (update[i]->levels[i].forward == node)
+        {
+            update[i]->levels[i].span += node->levels[i].span - 1;
+            update[i]->levels[i].forward = node->levels[i].forward;
+        }
+        else
+        {
+            update[i]->levels[i].span--;
+        }
+    }
+
+    if (node->levels[0].forward)
+    {
+        node->levels[0].forward->backward = node->backward;
+    }
+    else
+    {
+        list->tail = node->backward;
+    }
+
+    // drop the levels that no node reaches anymore
+    while (list->level > 1 && list->header->levels[list->level - 1].forward == NULL)
+    {
+        list->header->levels[list->level - 1].span = 0;
+        list->level--;
+    }
+
+    list->length--;
+    slab_free(node);
+
+    return true;
+}
+
+/**
+ * @brief Returns the rank of a member, its position in the list starting at 0
+ *
+ * @param list skip list to search
+ * @param member member to search for
+ * @param score score of the member
+ *
+ * @return long rank of the member, -1 if it is not in the list
+ */
+long skiplist_rank(SkipList *list, const char *member, double score)
+{
+    // rank of the current node, counting the header as 0 and the first node as 1
+    long rank = 0;
+
+    SkipListNode *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--)
+    {
+        while (node->levels[i].forward && skiplist_compare(member, score, node->levels[i].forward) >= 0)
+        {
+            rank += node->levels[i].span;
+            node = node->levels[i].forward;
+        }
+
+        if (node != list->header && skiplist_compare(member, score, node) == 0)
+        {
+            return rank - 1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the first node whose score is at least a value
+ *
+ * @param list skip list to search
+ * @param score smallest score of the node
+ * @param exclusive skip the nodes with the score too, to find the first node with a greater score
+ * @param rank set to the rank of the node, the number of nodes before it, may be NULL
+ *
+ * @return SkipListNode* the first node with a score greater than or equal to (greater than, when exclusive) score, NULL if there is none
+ */
+SkipListNode *skiplist_lower_bound(SkipList *list, double score, bool exclusive, long *rank)
+{
+    long traversed = 0;
+
+    SkipListNode *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--)
+    {
+        while (node->levels[i].forward && (node->levels[i].forward->score < score || (exclusive && node->levels[i].forward->score == score)))
+        {
+            traversed += node->levels[i].span;
+            node = node->levels[i].forward;
+        }
+    }
+
+    if (rank)
+    {
+        *rank = traversed;
+    }
+
+    return node->levels[0].forward;
+}
+
+/**
+ * @brief Returns the node at a rank
+ *
+ * @param list skip list to search
+ * @param rank position of the node, starting at 0
+ *
+ * @return SkipListNode* the node, NULL if the rank is out of bounds
+ */
+SkipListNode *skiplist_at_rank(SkipList *list, long rank)
+{
+    if (rank < 0 || rank >= list->length)
+    {
+        return NULL;
+    }
+
+    // the header is at position 0, the node at rank r at position r + 1
+    long traversed = 0;
+
+    SkipListNode *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--)
+    {
+        while (node->levels[i].forward && traversed + node->levels[i].span <= rank + 1)
+        {
+            traversed += node->levels[i].span;
+            node = node->levels[i].forward;
+        }
+
+        if (traversed == rank + 1)
+        {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Fills an empty skip list from members sorted by (score, member), every node is appended without searching
+ *
+ * @param list the empty skip list
+ * @param members the members, distinct
+ * @param scores the scores of the members, in ascending order
+ * @param count number of members
+ */
+void skiplist_build_sorted(SkipList *list, char **members, double *scores, int count)
+{
+    // last node on every level, and its position (the header is at position 0)
+    SkipListNode *last[SKIPLIST_MAX_LEVEL];
+    long position[SKIPLIST_MAX_LEVEL];
+
+    for (int i = 0; i < SKIPLIST_MAX_LEVEL; i++)
+    {
+        last[i] = list->header;
+        position[i] = 0;
+    }
+
+    for (int n = 0; n < count; n++)
+    {
+        int level = skiplist_random_level();
+        SkipListNode *node = skiplist_node_create(level, members[n], scores[n]);
+
+        for (int i = 0; i < level; i++)
+        {
+            last[i]->levels[i].forward = node;
+            last[i]->levels[i].span = (n + 1) - position[i];
+            last[i] = node;
+            position[i] = n + 1;
+        }
+
+        node->backward = list->tail;
+        list->tail = node;
+
+        if (level > list->level)
+        {
+            list->level = level;
+        }
+    }
+
+    // the last node of every level links to the end of the list
+    for (int i = 0; i < SKIPLIST_MAX_LEVEL; i++)
+    {
+        last[i]->levels[i].forward = NULL;
+        last[i]->levels[i].span = (i < list->level) ? count - position[i] : 0;
+    }
+
+    list->length = count;
+}
+
+/**
+ * @brief Frees a skip list and its nodes
+ *
+ * @param list skip list to free
+ */
+void skiplist_free(SkipList *list)
+{
+    SkipListNode *node = list->header;
+
+    while (node)
+    {
+        SkipListNode *next = node->levels[0].forward;
+        slab_free(node);
+        node = next;
+    }
+
+    free(list);
+}
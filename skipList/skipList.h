@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../slab/slab.h"
+
+// maximum number of levels of a node, enough for 4^32 nodes
+#define SKIPLIST_MAX_LEVEL 32
+
+// a node is promoted to the next level with a probability of 1 / SKIPLIST_BRANCHING
+#define SKIPLIST_BRANCHING 4
+
+typedef struct SkipListNode SkipListNode;
+
+// link of a node on one level, span is the number of nodes on level 0 that the link skips over (1 for the next node)
+typedef struct
+{
+    SkipListNode *forward;
+    long span;
+} SkipListLevel;
+
+// nodes are ordered by score, and nodes with equal scores by member
+struct SkipListNode
+{
+    double score;
+    int level;
+
+    // previous node on level 0, NULL for the first node
+    SkipListNode *backward;
+
+    // points into the same allocation, after the levels
+    char *member;
+
+    SkipListLevel levels[];
+};
+
+typedef struct
+{
+    // header node, holds no member and has every level
+    SkipListNode *header;
+    SkipListNode *tail;
+
+    long length;
+    int level;
+} SkipList;
+
+SkipList *skiplist_create();
+SkipListNode *skiplist_insert(SkipList *list, const char *member, double score);
+bool skiplist_delete(SkipList *list, const char *member, double score);
+long skiplist_rank(SkipList *list, const char *member, double score);
+SkipListNode *skiplist_lower_bound(SkipList *list, double score, bool exclusive, long *rank);
+SkipListNode *skiplist_at_rank(SkipList *list, long rank);
+void skiplist_build_sorted(SkipList *list, char **members, double *scores, int count);
+void skiplist_free(SkipList *list);
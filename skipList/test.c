@@ -0,0 +1,172 @@
+// test the skip list
+#include "skipList.h"
+
+// checks the links, spans and backward pointers of the whole list
+bool check_list(SkipList *list)
+{
+    SkipListNode *prev = NULL;
+    long count = 0;
+
+    for (SkipListNode *node = list->header->levels[0].forward; node; node = node->levels[0].forward)
+    {
+        if (node->backward != prev || (prev && (prev->score > node->score || (prev->score == node->score && strcmp(prev->member, node->member) >= 0))))
+        {
+            return false;
+        }
+
+        prev = node;
+        count++;
+    }
+
+    if (count != list->length || list->tail != prev)
+    {
+        return false;
+    }
+
+    // every link skips as many nodes as it spans
+    for (int i = 0; i < list->level; i++)
+    {
+        long position = 0;
+        for (SkipListNode *node = list->header; node->levels[i].forward; node = node->levels[i].forward)
+        {
+            position += node->levels[i].span;
+            if (skiplist_at_rank(list, position - 1) != node->levels[i].forward)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    SkipList *list = skiplist_create();
+    char member[16];
+
+    // Test 1: insert members in a scrambled order, half of them sharing a score
+    for (int i = 0; i < 1000; i++)
+    {
+        int n = (i * 7919) % 1000;
+        sprintf(member, "m%04d", n);
+        skiplist_insert(list, member, n < 500 ? 0 : n);
+    }
+
+    if (list->length != 1000 || !check_list(list))
+    {
+        fprintf(stderr, "Test 1 (Insert) failed\n");
+        return 1;
+    }
+
+    // Test 2: ranks, equal scores are ordered by member
+    for (int n = 0; n < 1000; n++)
+    {
+        sprintf(member, "m%04d", n);
+        SkipListNode *node = skiplist_at_rank(list, n);
+
+        if (skiplist_rank(list, member, n < 500 ? 0 : n) != n || !node || strcmp(node->member, member) != 0)
+        {
+            fprintf(stderr, "Test 2 (Rank of %s) failed\n", member);
+            return 1;
+        }
+    }
+
+    if (skiplist_rank(list, "m0001", 1) != -1 || skiplist_rank(list, "missing", 0) != -1 || skiplist_at_rank(list, 1000) || skiplist_at_rank(list, -1))
+    {
+        fprintf(stderr, "Test 2 (Missing members) failed\n");
+        return 1;
+    }
+
+    // Test 3: lower bound of a score
+    long rank;
+    SkipListNode *node = skiplist_lower_bound(list, 0, false, &rank);
+    if (!node || rank != 0 || strcmp(node->member, "m0000") != 0)
+    {
+        fprintf(stderr, "Test 3 (Lower bound of a shared score) failed\n");
+        return 1;
+    }
+
+    node = skiplist_lower_bound(list, 600.5, false, &rank);
+    if (!node || rank != 601 || node->score != 601 || skiplist_lower_bound(list, 1000, false, NULL))
+    {
+        fprintf(stderr, "Test 3 (Lower bound between scores) failed\n");
+        return 1;
+    }
+
+    // an exclusive bound skips every member with the score
+    node = skiplist_lower_bound(list, 0, true, &rank);
+    if (!node || rank != 500 || node->score != 500 || skiplist_lower_bound(list, 999, true, &rank) || rank != 1000)
+    {
+        fprintf(stderr, "Test 3 (Exclusive lower bound) failed\n");
+        return 1;
+    }
+
+    // Test 4: delete every other member
+    for (int n = 0; n < 1000; n += 2)
+    {
+        sprintf(member, "m%04d", n);
+        if (!skiplist_delete(list, member, n < 500 ? 0 : n))
+        {
+            fprintf(stderr, "Test 4 (Delete %s) failed\n", member);
+            return 1;
+        }
+    }
+
+    if (skiplist_delete(list, "m0000", 0) || skiplist_delete(list, "m0001", 5) || list->length != 500 || !check_list(list) || skiplist_rank(list, "m0501", 501) != 250)
+    {
+        fprintf(stderr, "Test 4 (Delete) failed\n");
+        return 1;
+    }
+
+    // delete the rest, the list is empty again
+    for (int n = 1; n < 1000; n += 2)
+    {
+        sprintf(member, "m%04d", n);
+        skiplist_delete(list, member, n < 500 ? 0 : n);
+    }
+
+    if (list->length != 0 || list->tail || list->level != 1 || !check_list(list))
+    {
+        fprintf(stderr, "Test 4 (Delete all) failed\n");
+        return 1;
+    }
+    skiplist_free(list);
+
+    // Test 5: build from sorted members, then update it like any other list
+    char *members[100];
+    double scores[100];
+    for (int i = 0; i < 100; i++)
+    {
+        members[i] = malloc(16);
+        sprintf(members[i], "b%03d", i);
+        scores[i] = i / 10;
+    }
+
+    list = skiplist_create();
+    skiplist_build_sorted(list, members, scores, 100);
+
+    if (list->length != 100 || !check_list(list) || skiplist_rank(list, "b042", 4) != 42)
+    {
+        fprintf(stderr, "Test 5 (Build from sorted members) failed\n");
+        return 1;
+    }
+
+    skiplist_insert(list, "a", 4);
+    skiplist_delete(list, "b099", 9);
+    if (list->length != 100 || !check_list(list) || skiplist_rank(list, "a", 4) != 40)
+    {
+        fprintf(stderr, "Test 5 (Update a built list) failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        free(members[i]);
+    }
+    skiplist_free(list);
+
+    printf("All tests passed\n");
+
+    return 0;
+}
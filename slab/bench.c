@@ -0,0 +1,116 @@
+#include "slab.h"
+#include <time.h>
+
+// node churn microbenchmark, compares the slab allocator with malloc on the allocation pattern of ZADD updates and list pushes and pops
+
+#define LIVE_NODES (1 << 18)
+#define CHURN_OPS (1 << 24)
+
+// sizes of the nodes the data structures allocate, a hash node with a short inline key, an AVL node and a list node
+static const size_t node_sizes[] = {64, 56, 32, 80, 96};
+#define NUM_NODE_SIZES (sizeof(node_sizes) / sizeof(node_sizes[0]))
+
+double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// resident memory of the process, in KiB
+long rss_kb()
+{
+    long pages = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file)
+    {
+        if (fscanf(file, "%*d %ld", &pages) != 1)
+        {
+            pages = 0;
+        }
+        fclose(file);
+    }
+
+    return pages * 4;
+}
+
+/**
+ * @brief Keeps LIVE_NODES nodes alive and replaces a random one at every step, like a sorted set whose members keep being updated
+ *
+ * @param use_slab allocate from the slabs instead of malloc
+ */
+void churn(int use_slab)
+{
+    void **live = calloc(LIVE_NODES, sizeof(void *));
+    unsigned int seed = 12345;
+    long rss_start = rss_kb();
+
+    for (int i = 0; i < LIVE_NODES; i++)
+    {
+        size_t size = node_sizes[i % NUM_NODE_SIZES];
+        live[i] = use_slab ? slab_alloc(size) : malloc(size);
+        memset(live[i], 0, size);
+    }
+
+    double start = now_sec();
+
+    for (int i = 0; i < CHURN_OPS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int victim = (seed >> 8) % LIVE_NODES;
+        size_t size = node_sizes[(seed >> 4) % NUM_NODE_SIZES];
+
+        if (use_slab)
+        {
+            slab_free(live[victim]);
+            live[victim] = slab_alloc(size);
+        }
+        else
+        {
+            free(live[victim]);
+            live[victim] = malloc(size);
+        }
+
+        // touch the node, as the data structures initialize it
+        *(long *)live[victim] = i;
+    }
+
+    double ns_per_op = (now_sec() - start) * 1e9 / CHURN_OPS;
+
+    printf("%-8s %6.1f ns per free + alloc, RSS grew by %ld KiB\n", use_slab ? "slab" : "malloc", ns_per_op, rss_kb() - rss_start);
+
+    for (int i = 0; i < LIVE_NODES; i++)
+    {
+        if (use_slab)
+        {
+            slab_free(live[i]);
+        }
+        else
+        {
+            free(live[i]);
+        }
+    }
+
+    free(live);
+}
+
+int main()
+{
+    printf("%d live nodes of %zu sizes, %d random replacements\n", LIVE_NODES, NUM_NODE_SIZES, CHURN_OPS);
+
+    churn(0);
+    churn(1);
+
+    // occupancy of the slabs once every node was freed, the slabs stay around for reuse
+    SlabInfo info[256];
+    int num_slabs = slab_occupancy(info, 256);
+    long used = 0;
+    for (int i = 0; i < num_slabs && i < 256; i++)
+    {
+        used += info[i].used;
+    }
+
+    printf("%d slabs kept, %ld objects used\n", num_slabs, used);
+
+    return 0;
+}
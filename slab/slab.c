@@ -0,0 +1,239 @@
+// * This file contains a size class slab allocator for the small nodes of the data structures (hash nodes, AVL nodes, list nodes). Objects of one size class are carved out of 64 KiB slabs, and freed objects go onto a free list of the current thread, so allocating and freeing a node under churn is a couple of pointer moves instead of a trip through malloc. Keeping every size in its own slabs also stops nodes of different sizes from fragmenting each other. Slabs are never returned to the system, their objects are reused instead.
+
+#include "slab.h"
+
+// objects of one size class handed out by the current thread, freed objects are reused first, then the rest of the current slab
+typedef struct
+{
+    // freed objects, linked through their first bytes
+    void *free_list;
+
+    // slab new objects are carved from, and offset of its first unused byte
+    Slab *current;
+    uint32_t bump;
+} SlabCache;
+
+static __thread SlabCache slab_caches[SLAB_NUM_CLASSES];
+
+// registry of every slab of every thread, only touched when a slab is created or the occupancy is reported
+static Slab *slab_registry = NULL;
+static pthread_mutex_t slab_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// objects too large for a size class, each in a block of its own
+static long slab_large_blocks = 0;
+
+/**
+ * @brief Returns the size class of an object size
+ *
+ * @param size size of the object, at most SLAB_MAX_OBJECT_SIZE
+ *
+ * @return int index of the smallest size class holding the object
+ */
+int slab_class_index(size_t size)
+{
+    if (size <= 128)
+    {
+        return (size <= 16) ? 0 : (int)((size + 15) / 16) - 1;
+    }
+
+    // 4 classes per power of 2, e.g. 160, 192, 224 and 256 for sizes in (128, 256]
+    int power = 63 - __builtin_clzll(size - 1);
+    int step = power - 2;
+
+    return 8 + (power - 7) * 4 + (int)((size - 1) >> step) - 4;
+}
+
+/**
+ * @brief Returns the size of the objects of a size class
+ *
+ * @param class_index index of the size class
+ *
+ * @return uint32_t object size, a multiple of 16
+ */
+uint32_t slab_class_size(int class_index)
+{
+    if (class_index < 8)
+    {
+        return (class_index + 1) * 16;
+    }
+
+    int power = 7 + (class_index - 8) / 4;
+    int multiple = (class_index - 8) % 4 + 5;
+
+    return multiple << (power - 2);
+}
+
+/**
+ * @brief Allocates a new slab for a size class and adds it to the registry
+ *
+ * @param class_index size class of the slab
+ *
+ * @return Slab* the empty slab
+ */
+static Slab *slab_new(int class_index)
+{
+    Slab *slab = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+    if (slab == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    slab->object_size = slab_class_size(class_index);
+    slab->capacity = (SLAB_SIZE - SLAB_HEADER_SIZE) / slab->object_size;
+    slab->class_index = class_index;
+    slab->used = 0;
+
+    pthread_mutex_lock(&slab_registry_lock);
+    slab->next = slab_registry;
+    slab_registry = slab;
+    pthread_mutex_unlock(&slab_registry_lock);
+
+    return slab;
+}
+
+/**
+ * @brief Allocates an object, from the slabs of its size class unless it is larger than SLAB_MAX_OBJECT_SIZE
+ *
+ * The memory is not initialized. Objects are 16 byte aligned and must be freed with slab_free().
+ *
+ * @param size size of the object
+ *
+ * @return void* the object
+ */
+void *slab_alloc(size_t size)
+{
+    if (size > SLAB_MAX_OBJECT_SIZE)
+    {
+        // a block of its own, its header marks it as a large object
+        size_t block_size = (SLAB_HEADER_SIZE + size + SLAB_SIZE - 1) & ~(size_t)(SLAB_SIZE - 1);
+
+        Slab *block = aligned_alloc(SLAB_SIZE, block_size);
+        if (block == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        block->object_size = 0;
+        block->capacity = 1;
+        block->used = 1;
+        __atomic_add_fetch(&slab_large_blocks, 1, __ATOMIC_RELAXED);
+
+        return (char *)block + SLAB_HEADER_SIZE;
+    }
+
+    int class_index = slab_class_index(size);
+    SlabCache *cache = &slab_caches[class_index];
+
+    void *object = cache->free_list;
+    Slab *slab;
+
+    if (object)
+    {
+        cache->free_list = *(void **)object;
+        slab = (Slab *)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1));
+    }
+    else
+    {
+        uint32_t object_size = slab_class_size(class_index);
+
+        if (!cache->current || cache->bump + object_size > SLAB_SIZE)
+        {
+            cache->current = slab_new(class_index);
+            cache->bump = SLAB_HEADER_SIZE;
+        }
+
+        slab = cache->current;
+        object = (char *)slab + cache->bump;
+        cache->bump += object_size;
+    }
+
+    __atomic_add_fetch(&slab->used, 1, __ATOMIC_RELAXED);
+
+    return object;
+}
+
+/**
+ * @brief Allocates a zeroed object, like calloc()
+ *
+ * @param size size of the object
+ *
+ * @return void* the zeroed object
+ */
+void *slab_zalloc(size_t size)
+{
+    void *object = slab_alloc(size);
+    memset(object, 0, size);
+
+    return object;
+}
+
+/**
+ * @brief Frees an object allocated with slab_alloc(), it goes onto the free list of the current thread
+ *
+ * @param ptr the object, NULL is ignored
+ */
+void slab_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    Slab *slab = (Slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+
+    if (slab->object_size == 0)
+    {
+        __atomic_sub_fetch(&slab_large_blocks, 1, __ATOMIC_RELAXED);
+        free(slab);
+        return;
+    }
+
+    __atomic_sub_fetch(&slab->used, 1, __ATOMIC_RELAXED);
+
+    SlabCache *cache = &slab_caches[slab->class_index];
+    *(void **)ptr = cache->free_list;
+    cache->free_list = ptr;
+}
+
+/**
+ * @brief Reports the occupancy of every slab, of every thread
+ *
+ * @param info array to fill with one entry per slab, most recently created slabs first
+ * @param max_slabs size of the array
+ *
+ * @return int number of slabs, may be larger than max_slabs in which case only the first max_slabs entries are filled
+ */
+int slab_occupancy(SlabInfo *info, int max_slabs)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&slab_registry_lock);
+
+    for (Slab *slab = slab_registry; slab; slab = slab->next)
+    {
+        if (count < max_slabs)
+        {
+            info[count].object_size = slab->object_size;
+            info[count].capacity = slab->capacity;
+            info[count].used = __atomic_load_n(&slab->used, __ATOMIC_RELAXED);
+        }
+
+        count++;
+    }
+
+    pthread_mutex_unlock(&slab_registry_lock);
+
+    return count;
+}
+
+/**
+ * @brief Number of objects too large for a size class that are currently allocated
+ *
+ * @return long number of large objects
+ */
+long slab_large_count()
+{
+    return __atomic_load_n(&slab_large_blocks, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef SLAB_H
+#define SLAB_H
+
+// every slab is a block of this many bytes aligned on its size, so the slab of an object is found by masking the address of the object
+#define SLAB_SIZE 65536
+// the header of a slab takes the first bytes of the block, objects start after it
+#define SLAB_HEADER_SIZE 64
+
+// objects larger than this don't fit a size class, they get a block of their own
+#define SLAB_MAX_OBJECT_SIZE 8192
+// size classes are 16 bytes apart up to 128 bytes, then 4 classes per power of 2 up to SLAB_MAX_OBJECT_SIZE
+#define SLAB_NUM_CLASSES 32
+
+typedef struct Slab
+{
+    // all the slabs are kept in a registry, to report their occupancy
+    struct Slab *next;
+
+    // size of the objects of the slab and number of objects it holds
+    uint32_t object_size;
+    uint32_t capacity;
+    int class_index;
+
+    // number of objects handed out, updated atomically since an object may be freed by another thread than the one that allocated it
+    int used;
+} Slab;
+
+// occupancy of one slab
+typedef struct
+{
+    uint32_t object_size;
+    uint32_t capacity;
+    int used;
+} SlabInfo;
+
+void *slab_alloc(size_t size);
+void *slab_zalloc(size_t size);
+void slab_free(void *ptr);
+
+int slab_class_index(size_t size);
+uint32_t slab_class_size(int class_index);
+
+int slab_occupancy(SlabInfo *info, int max_slabs);
+long slab_large_count();
+
+#endif
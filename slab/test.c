@@ -0,0 +1,149 @@
+// test the slab allocator
+#include "slab.h"
+
+// frees objects allocated by the main thread from another thread
+void *free_objects(void *arg)
+{
+    void **objects = (void **)arg;
+
+    for (int i = 0; i < 100; i++)
+    {
+        slab_free(objects[i]);
+    }
+
+    return NULL;
+}
+
+// returns the occupancy of all the slabs of one object size
+int used_objects(uint32_t object_size, int *num_slabs)
+{
+    SlabInfo info[64];
+    int count = slab_occupancy(info, 64);
+    int used = 0;
+
+    *num_slabs = 0;
+    for (int i = 0; i < count && i < 64; i++)
+    {
+        if (info[i].object_size == object_size)
+        {
+            used += info[i].used;
+            (*num_slabs)++;
+        }
+    }
+
+    return used;
+}
+
+int main()
+{
+    // test the size classes, every size fits its class and the classes grow
+    for (size_t size = 1; size <= SLAB_MAX_OBJECT_SIZE; size++)
+    {
+        int class_index = slab_class_index(size);
+        if (class_index < 0 || class_index >= SLAB_NUM_CLASSES || slab_class_size(class_index) < size || (class_index > 0 && slab_class_size(class_index - 1) >= size))
+        {
+            fprintf(stderr, "size %zu should be in the smallest class holding it\n", size);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (slab_class_size(SLAB_NUM_CLASSES - 1) != SLAB_MAX_OBJECT_SIZE)
+    {
+        fprintf(stderr, "the last class should hold SLAB_MAX_OBJECT_SIZE\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test objects are aligned and don't overlap
+    void *objects[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        objects[i] = slab_alloc(40);
+        if ((uintptr_t)objects[i] % 16 != 0)
+        {
+            fprintf(stderr, "objects should be 16 byte aligned\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(objects[i], i % 256, 40);
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        unsigned char *bytes = objects[i];
+        if (bytes[0] != i % 256 || bytes[39] != i % 256)
+        {
+            fprintf(stderr, "objects should not overlap\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // test the occupancy, 1000 objects of 48 bytes span 1 slab
+    int num_slabs;
+    if (used_objects(48, &num_slabs) != 1000 || num_slabs != 1)
+    {
+        fprintf(stderr, "48 byte slabs should hold 1000 objects in 1 slab\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test freed objects are reused before new ones are carved
+    void *freed = objects[500];
+    slab_free(freed);
+
+    if (used_objects(48, &num_slabs) != 999)
+    {
+        fprintf(stderr, "freed object should not be counted as used\n");
+        exit(EXIT_FAILURE);
+    }
+
+    objects[500] = slab_alloc(48);
+    if (objects[500] != freed)
+    {
+        fprintf(stderr, "freed object should be reused\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // test zeroed allocation
+    char *zeroed = slab_zalloc(100);
+    for (int i = 0; i < 100; i++)
+    {
+        if (zeroed[i] != 0)
+        {
+            fprintf(stderr, "slab_zalloc should zero the object\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    slab_free(zeroed);
+
+    // test objects can be freed by another thread
+    pthread_t thread;
+    pthread_create(&thread, NULL, free_objects, objects);
+    pthread_join(thread, NULL);
+
+    if (used_objects(48, &num_slabs) != 900)
+    {
+        fprintf(stderr, "objects freed by another thread should not be counted as used\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 100; i < 1000; i++)
+    {
+        slab_free(objects[i]);
+    }
+
+    // test large objects get a block of their own
+    char *large = slab_alloc(3 * SLAB_SIZE);
+    memset(large, 1, 3 * SLAB_SIZE);
+    if (slab_large_count() != 1)
+    {
+        fprintf(stderr, "large object should be counted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    slab_free(large);
+    if (slab_large_count() != 0)
+    {
+        fprintf(stderr, "large object should be freed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
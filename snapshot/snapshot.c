@@ -0,0 +1,521 @@
+// * This file contains the binary snapshot of a keyspace. Entries are tagged with their type and length prefixed, so loading one needs no parsing, and sorted sets are stored by ascending score and name so that their ordered index is built without searching.
+
+#include "snapshot.h"
+
+/**
+ * @brief Writes bytes to the snapshot
+ *
+ * @return bool true on success
+ */
+static bool snapshot_write(FILE *file, const void *data, size_t len)
+{
+    return len == 0 || fwrite(data, 1, len, file) == len;
+}
+
+// writes a length prefixed string
+static bool snapshot_write_string(FILE *file, const char *data, uint32_t len)
+{
+    return snapshot_write(file, &len, sizeof(len)) && snapshot_write(file, data, len);
+}
+
+// writes the members of a sorted set in ascending order of score
+static bool snapshot_write_zset_members(FILE *file, ZSet *zset)
+{
+    ZSetIter iter;
+    zset_iter_at(zset, 0, &iter);
+
+    char *name;
+    double score;
+    while (zset_iter_next(&iter, &name, &score))
+    {
+        if (!snapshot_write(file, &score, sizeof(score)) || !snapshot_write_string(file, name, strlen(name)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes the start of a snapshot
+ *
+ * @param file file to write to
+ * @param num_entries number of entries the snapshot will hold, used to check it is complete when loaded
+ *
+ * @return bool true on success
+ */
+bool snapshot_write_header(FILE *file, uint64_t num_entries)
+{
+    return snapshot_write(file, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) && snapshot_write(file, &num_entries, sizeof(num_entries));
+}
+
+/**
+ * @brief Writes every entry of a hash table to the snapshot, a sharded keyspace is written one shard after the other
+ *
+ * @param file file to write to
+ * @param table hash table to write
+ *
+ * @return bool true on success
+ */
+bool snapshot_write_table(FILE *file, HashTable *table)
+{
+    int pos = 0;
+    HashNode *node;
+
+    while ((node = hnext(table, &pos)) != NULL)
+    {
+        uint8_t type = node->valueType;
+        bool ok = snapshot_write(file, &type, sizeof(type)) && snapshot_write_string(file, node->key, node->keyLen);
+
+        switch (node->valueType)
+        {
+        case STRING:
+        {
+            // strings not stored in the node were allocated by hinit() and are null terminated
+            uint32_t len = (node->flags & HN_VALUE_INLINE) ? node->valueLen : strlen(node->value);
+            ok = ok && snapshot_write_string(file, node->value, len);
+            break;
+        }
+
+        case INTEGER:
+            ok = ok && snapshot_write(file, &node->intValue, sizeof(node->intValue));
+            break;
+
+        case FLOAT:
+            ok = ok && snapshot_write(file, &node->floatValue, sizeof(node->floatValue));
+            break;
+
+        case HASHTABLE:
+        {
+            HashMap *hash = (HashMap *)node->value;
+            uint32_t count = hmap_size(hash);
+            ok = ok && snapshot_write(file, &count, sizeof(count));
+
+            int field_pos = 0;
+            char *field, *value;
+            uint32_t field_len, value_len;
+            while (ok && hmap_next(hash, &field_pos, &field, &field_len, &value, &value_len))
+            {
+                ok = snapshot_write_string(file, field, field_len) && snapshot_write_string(file, value, value_len);
+            }
+            break;
+        }
+
+        case LIST:
+        {
+            List *list = (List *)node->value;
+            uint32_t count = list->size;
+            ok = ok && snapshot_write(file, &count, sizeof(count));
+
+            for (ListNode *elem = list->head; ok && elem; elem = elem->next)
+            {
+                ok = snapshot_write_string(file, elem->data, strlen(elem->data));
+            }
+            break;
+        }
+
+        case ZSET:
+        {
+            ZSet *zset = (ZSet *)node->value;
+            uint32_t count = zset_size(zset);
+            ok = ok && snapshot_write(file, &count, sizeof(count)) && snapshot_write_zset_members(file, zset);
+            break;
+        }
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes the end of a snapshot
+ *
+ * @param file file to write to
+ *
+ * @return bool true on success
+ */
+bool snapshot_write_end(FILE *file)
+{
+    uint8_t tag = SNAPSHOT_EOF;
+
+    return snapshot_write(file, &tag, sizeof(tag));
+}
+
+/**
+ * @brief Checks if a file starts with a snapshot
+ *
+ * @param file file positioned at its start
+ *
+ * @return int version of the snapshot the file starts with, the file is then positioned after the magic. 0 if it is not a snapshot, it is then positioned back at its start
+ */
+int snapshot_detect(FILE *file)
+{
+    char magic[SNAPSHOT_MAGIC_SIZE];
+
+    if (fread(magic, 1, SNAPSHOT_MAGIC_SIZE, file) == SNAPSHOT_MAGIC_SIZE)
+    {
+        if (memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) == 0)
+        {
+            return SNAPSHOT_VERSION;
+        }
+
+        if (memcmp(magic, SNAPSHOT_MAGIC_V1, SNAPSHOT_MAGIC_SIZE) == 0)
+        {
+            return 1;
+        }
+    }
+
+    clearerr(file);
+    rewind(file);
+
+    return 0;
+}
+
+/**
+ * @brief Reads bytes from the snapshot
+ *
+ * @return bool true if all the bytes were read
+ */
+static bool snapshot_read(FILE *file, void *data, size_t len)
+{
+    return len == 0 || fread(data, 1, len, file) == len;
+}
+
+// buffer strings are read into before they are copied to their node, grown as needed
+typedef struct
+{
+    char *data;
+    uint32_t capacity;
+} SnapshotBuffer;
+
+/**
+ * @brief Reads a length prefixed string, null terminated
+ *
+ * @param file file to read from
+ * @param buffer buffer to read into, grown to fit the string
+ * @param len length of the string
+ *
+ * @return char* the string, NULL if the file ended
+ */
+static char *snapshot_read_string(FILE *file, SnapshotBuffer *buffer, uint32_t *len)
+{
+    if (!snapshot_read(file, len, sizeof(*len)))
+    {
+        return NULL;
+    }
+
+    if (*len >= buffer->capacity)
+    {
+        uint32_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity <= *len)
+        {
+            capacity *= 2;
+        }
+
+        buffer->data = realloc(buffer->data, capacity);
+        if (!buffer->data)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        buffer->capacity = capacity;
+    }
+
+    if (!snapshot_read(file, buffer->data, *len))
+    {
+        return NULL;
+    }
+
+    buffer->data[*len] = '\0';
+
+    return buffer->data;
+}
+
+// reads the fields of a hash
+static HashMap *snapshot_load_hash(FILE *file, SnapshotBuffer *field, SnapshotBuffer *value)
+{
+    uint32_t count, field_len, value_len;
+    if (!snapshot_read(file, &count, sizeof(count)))
+    {
+        return NULL;
+    }
+
+    // a hash too large to be compact gets a table sized for its fields, bounded in case the count is corrupt
+    HashMap *hash = hmap_init();
+    hmap_reserve(hash, count < (1 << 20) ? count : (1 << 20));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!snapshot_read_string(file, field, &field_len) || !snapshot_read_string(file, value, &value_len))
+        {
+            hmap_free_contents(hash);
+            free(hash);
+            return NULL;
+        }
+
+        hmap_set(hash, field->data, field_len, value->data, value_len);
+    }
+
+    return hash;
+}
+
+// reads the elements of a list
+static List *snapshot_load_list(FILE *file, SnapshotBuffer *value)
+{
+    uint32_t count, len;
+    if (!snapshot_read(file, &count, sizeof(count)))
+    {
+        return NULL;
+    }
+
+    List *list = list_init();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!snapshot_read_string(file, value, &len))
+        {
+            list_free_contents(list);
+            free(list);
+            return NULL;
+        }
+
+        list_rinsert(list, value->data, LIST_TYPE_STRING);
+    }
+
+    return list;
+}
+
+// reads a score of a sorted set, version 1 snapshots stored it as a float
+static bool snapshot_read_score(FILE *file, int version, double *score)
+{
+    if (version == 1)
+    {
+        float narrow;
+        if (!snapshot_read(file, &narrow, sizeof(narrow)))
+        {
+            return false;
+        }
+
+        *score = narrow;
+        return true;
+    }
+
+    return snapshot_read(file, score, sizeof(double));
+}
+
+// reads the members of a sorted set, they are stored by ascending score (and name for equal scores) so the ordered index is built directly
+static ZSet *snapshot_load_zset(FILE *file, int version, SnapshotBuffer *value)
+{
+    uint32_t count, len;
+    if (!snapshot_read(file, &count, sizeof(count)))
+    {
+        return NULL;
+    }
+
+    char **names = malloc(sizeof(char *) * (count ? count : 1));
+    double *scores = malloc(sizeof(double) * (count ? count : 1));
+    if (!names || !scores)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t loaded = 0;
+    bool ok = true;
+
+    for (; loaded < count && ok; loaded++)
+    {
+        ok = snapshot_read_score(file, version, &scores[loaded]) && snapshot_read_string(file, value, &len);
+        names[loaded] = ok ? strdup(value->data) : NULL;
+    }
+
+    ZSet *zset = NULL;
+    if (ok)
+    {
+        zset = zset_init();
+
+        // members with equal scores are expected by name, a snapshot written in another order is inserted one member at a time
+        bool sorted = true;
+        for (uint32_t i = 1; i < count && sorted; i++)
+        {
+            sorted = scores[i - 1] < scores[i] || (scores[i - 1] == scores[i] && strcmp(names[i - 1], names[i]) < 0);
+        }
+
+        if (sorted)
+        {
+            zset_build_sorted(zset, names, scores, count);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                zset_add(zset, names[i], scores[i]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < loaded; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+    free(scores);
+
+    return zset;
+}
+
+// smallest entry of a snapshot: type, key length and an empty key, and an empty string value
+#define SNAPSHOT_MIN_ENTRY_SIZE (1 + 4 + 4)
+
+// grows the tables up front so that loading the snapshot does not resize them, the count is bounded by the file size in case the header is corrupt
+static void snapshot_reserve(FILE *file, HashTable **tables, int num_tables, uint64_t num_entries)
+{
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && num_entries > (uint64_t)st.st_size / SNAPSHOT_MIN_ENTRY_SIZE)
+    {
+        num_entries = st.st_size / SNAPSHOT_MIN_ENTRY_SIZE;
+    }
+
+    uint64_t per_table = num_entries / num_tables + 1;
+
+    for (int i = 0; i < num_tables; i++)
+    {
+        uint64_t size = tables[i]->size + per_table;
+        if ((uint64_t)(tables[i]->mask + 1) / 8 * 7 <= size && size < INT32_MAX / 2)
+        {
+            hresize(tables[i], size);
+        }
+    }
+}
+
+/**
+ * @brief Loads the entries of a snapshot into hash tables
+ *
+ * @param file file positioned after the magic, see snapshot_detect(). It is positioned after the snapshot once loaded
+ * @param version version of the snapshot, returned by snapshot_detect()
+ * @param tables tables to load the entries into, the keys must not be in them already
+ * @param num_tables number of tables
+ * @param table_for_key returns the index of the table an entry is loaded into, NULL to load everything into the first table
+ *
+ * @return long number of entries loaded, -1 if the snapshot is truncated or corrupt
+ */
+long snapshot_load(FILE *file, int version, HashTable **tables, int num_tables, SnapshotTableForKey table_for_key)
+{
+    uint64_t num_entries;
+    if (!snapshot_read(file, &num_entries, sizeof(num_entries)))
+    {
+        return -1;
+    }
+
+    snapshot_reserve(file, tables, num_tables, num_entries);
+
+    SnapshotBuffer key = {0}, field = {0}, value = {0};
+    long loaded = 0;
+    bool ok = true;
+
+    while (ok)
+    {
+        uint8_t type;
+        uint32_t key_len;
+
+        if (!snapshot_read(file, &type, sizeof(type)))
+        {
+            ok = false;
+            break;
+        }
+
+        if (type == SNAPSHOT_EOF)
+        {
+            break;
+        }
+
+        if (!snapshot_read_string(file, &key, &key_len))
+        {
+            ok = false;
+            break;
+        }
+
+        HashNode *node = NULL;
+
+        switch (type)
+        {
+        case STRING:
+        {
+            uint32_t value_len;
+            if (snapshot_read_string(file, &value, &value_len))
+            {
+                node = hinit_inline(key.data, key_len, STRING, value.data, value_len);
+            }
+            break;
+        }
+
+        case INTEGER:
+        {
+            int64_t number;
+            if (snapshot_read(file, &number, sizeof(number)))
+            {
+                node = hinit_int(key.data, key_len, number);
+            }
+            break;
+        }
+
+        case FLOAT:
+        {
+            double number;
+            if (snapshot_read(file, &number, sizeof(number)))
+            {
+                node = hinit_float(key.data, key_len, number);
+            }
+            break;
+        }
+
+        case HASHTABLE:
+        {
+            HashMap *hash = snapshot_load_hash(file, &field, &value);
+            node = hash ? hinit_key(key.data, key_len, HASHTABLE, hash) : NULL;
+            break;
+        }
+
+        case LIST:
+        {
+            List *list = snapshot_load_list(file, &value);
+            node = list ? hinit_key(key.data, key_len, LIST, list) : NULL;
+            break;
+        }
+
+        case ZSET:
+        {
+            ZSet *zset = snapshot_load_zset(file, version, &value);
+            node = zset ? hinit_key(key.data, key_len, ZSET, zset) : NULL;
+            break;
+        }
+        }
+
+        if (!node)
+        {
+            ok = false;
+            break;
+        }
+
+        int index = (table_for_key && num_tables > 1) ? table_for_key(key.data) : 0;
+        hinsert(tables[index], node);
+        loaded++;
+    }
+
+    free(key.data);
+    free(field.data);
+    free(value.data);
+
+    if (!ok || (uint64_t)loaded != num_entries)
+    {
+        return -1;
+    }
+
+    return loaded;
+}
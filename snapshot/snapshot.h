@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// ZSet includes the AVLTree, skipList and HashTable headers
+#include "../ZSet/ZSet.h"
+#include "../list/list.h"
+#include "../hashMap/hashMap.h"
+
+// a snapshot starts with this magic, which tells it apart from an AOF made of commands
+#define SNAPSHOT_MAGIC "LITEDBS2"
+#define SNAPSHOT_MAGIC_SIZE 8
+
+// version of the snapshots written, the last character of the magic. Version 1 stored the scores of sorted sets as floats and is still loaded
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_MAGIC_V1 "LITEDBS1"
+
+// tag following the last entry of a snapshot, the entries are tagged with their ValueType
+#define SNAPSHOT_EOF 0xff
+
+// size of the stdio buffer used while writing or loading a snapshot
+#define SNAPSHOT_IO_BUFFER_SIZE (1 << 20)
+
+/*
+ * Binary dump of a keyspace, all numbers are in the byte order of the host:
+ *
+ *   magic, uint64 number of entries
+ *   every entry: uint8 ValueType, uint32 key length, key, value
+ *     STRING     uint32 length, bytes
+ *     INTEGER    int64
+ *     FLOAT      double
+ *     HASHTABLE  uint32 number of fields, every field: uint32 length, field, uint32 length, value
+ *     LIST       uint32 number of elements, every element: uint32 length, bytes, from head to tail
+ *     ZSET       uint32 number of members, every member: double score (float in version 1), uint32 length, name, by ascending score then name
+ *   uint8 SNAPSHOT_EOF
+ */
+
+// selects the table an entry is loaded into, e.g. the shard owning the key
+typedef int (*SnapshotTableForKey)(char *key);
+
+bool snapshot_write_header(FILE *file, uint64_t num_entries);
+bool snapshot_write_table(FILE *file, HashTable *table);
+bool snapshot_write_end(FILE *file);
+int snapshot_detect(FILE *file);
+long snapshot_load(FILE *file, int version, HashTable **tables, int num_tables, SnapshotTableForKey table_for_key);
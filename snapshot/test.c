@@ -0,0 +1,245 @@
+// test the snapshot of a keyspace
+#include "snapshot.h"
+
+// loads the keys starting with a digit into the second table
+int table_for_key(char *key)
+{
+    return (key[0] >= '0' && key[0] <= '9') ? 1 : 0;
+}
+
+// frees a table holding hashes, lists and sorted sets
+void free_keyspace(HashTable *table)
+{
+    int pos = 0;
+    HashNode *node;
+
+    while ((node = hnext(table, &pos)) != NULL)
+    {
+        if (node->valueType == HASHTABLE)
+        {
+            hmap_free_contents(node->value);
+        }
+        else if (node->valueType == LIST)
+        {
+            list_free_contents(node->value);
+        }
+        else if (node->valueType == ZSET)
+        {
+            zset_free_contents(node->value);
+        }
+    }
+
+    hfree_table(table);
+}
+
+int main()
+{
+    HashTable *table = hcreate(16);
+
+    // one entry of every type, strings may hold any byte
+    hinsert(table, hinit_inline("string", 6, STRING, "hello world\n\0!", 14));
+    hinsert(table, hinit(strdup("heap_string"), STRING, strdup("heap value")));
+    hinsert(table, hinit_int("42counter", 9, -1234567890123LL));
+    hinsert(table, hinit_float("float", 5, 2.5));
+
+    HashMap *hash = hmap_init();
+    hmap_set(hash, "field", 5, "value", 5);
+    hmap_set(hash, "other", 5, "", 0);
+
+    // too many fields to be compact
+    char name[16];
+    for (int i = 0; i < 200; i++)
+    {
+        int len = sprintf(name, "f%d", i);
+        hmap_set(hash, name, len, name, len);
+    }
+    hinsert(table, hinit_key("hash", 4, HASHTABLE, hash));
+
+    List *list = list_init();
+    list_rinsert(list, "first", LIST_TYPE_STRING);
+    list_rinsert(list, "second", LIST_TYPE_STRING);
+    list_rinsert(list, "third", LIST_TYPE_STRING);
+    hinsert(table, hinit_key("list", 4, LIST, list));
+
+    // the sorted set is too large to be compact, its scores need more digits than a float has
+    zset_default_engine = ZSET_ENGINE_SKIPLIST;
+    zset_max_compact_entries = 64;
+    ZSet *zset = zset_init();
+    for (int i = 0; i < 100; i++)
+    {
+        sprintf(name, "member%d", i);
+        zset_add(zset, name, ((i * 37) % 100) - 50 + 0.1);
+    }
+    hinsert(table, hinit_key("9zset", 5, ZSET, zset));
+
+    FILE *file = tmpfile();
+    if (!snapshot_write_header(file, table->size) || !snapshot_write_table(file, table) || !snapshot_write_end(file))
+    {
+        fprintf(stderr, "Test 1 (Write a snapshot) failed\n");
+        return 1;
+    }
+
+    // commands may follow the snapshot
+    fputs("SET after snapshot\n", file);
+    rewind(file);
+
+    // Test 2: load it into two tables, the sorted set is written from a skip list and loaded into an AVL tree
+    HashTable *tables[2] = {hcreate(16), hcreate(16)};
+    zset_default_engine = ZSET_ENGINE_AVL;
+
+    if (snapshot_detect(file) != SNAPSHOT_VERSION || snapshot_load(file, SNAPSHOT_VERSION, tables, 2, table_for_key) != table->size)
+    {
+        fprintf(stderr, "Test 2 (Load a snapshot) failed\n");
+        return 1;
+    }
+
+    char line[64];
+    if (!fgets(line, sizeof(line), file) || strcmp(line, "SET after snapshot\n") != 0)
+    {
+        fprintf(stderr, "Test 2 (Read the commands after the snapshot) failed\n");
+        return 1;
+    }
+
+    if (tables[0]->size != 5 || tables[1]->size != 2)
+    {
+        fprintf(stderr, "Test 2 (Entries loaded into their table) failed\n");
+        return 1;
+    }
+
+    // Test 3: every value was restored
+    HashNode *node = hget(tables[0], "string");
+    if (!node || node->valueLen != 14 || memcmp(node->value, "hello world\n\0!", 14) != 0)
+    {
+        fprintf(stderr, "Test 3 (String) failed\n");
+        return 1;
+    }
+
+    node = hget(tables[0], "heap_string");
+    if (!node || strcmp(node->value, "heap value") != 0)
+    {
+        fprintf(stderr, "Test 3 (Heap allocated string) failed\n");
+        return 1;
+    }
+
+    node = hget(tables[1], "42counter");
+    if (!node || node->valueType != INTEGER || node->intValue != -1234567890123LL)
+    {
+        fprintf(stderr, "Test 3 (Integer) failed\n");
+        return 1;
+    }
+
+    node = hget(tables[0], "float");
+    if (!node || node->valueType != FLOAT || node->floatValue != 2.5)
+    {
+        fprintf(stderr, "Test 3 (Float) failed\n");
+        return 1;
+    }
+
+    node = hget(tables[0], "hash");
+    char *field;
+    if (!node || !hmap_get(node->value, "field", &field, NULL) || strcmp(field, "value") != 0 || hmap_size(node->value) != 202 || hmap_is_compact(node->value) || !hmap_get(node->value, "f199", &field, NULL))
+    {
+        fprintf(stderr, "Test 3 (Hash) failed\n");
+        return 1;
+    }
+
+    node = hget(tables[0], "list");
+    if (!node || ((List *)node->value)->size != 3 || strcmp(list_iget(node->value, 2)->data, "third") != 0)
+    {
+        fprintf(stderr, "Test 3 (List) failed\n");
+        return 1;
+    }
+
+    double score;
+    node = hget(tables[1], "9zset");
+    ZSet *loaded = node ? node->value : NULL;
+    if (!loaded || loaded->engine != ZSET_ENGINE_AVL || zset_size(loaded) != 100 || !zset_score(loaded, "member37", &score) || score != ((37 * 37) % 100) - 50 + 0.1)
+    {
+        fprintf(stderr, "Test 3 (Sorted set) failed\n");
+        return 1;
+    }
+
+    // the tree was built balanced, and is in score order
+    AVLNode *min = get_min_node(loaded->avl_tree);
+    if (loaded->avl_tree->height > 7 || min->value != -50 + 0.1 || avl_offset(min, 99)->value != 49 + 0.1)
+    {
+        fprintf(stderr, "Test 3 (Sorted set order) failed\n");
+        return 1;
+    }
+
+    free_keyspace(tables[0]);
+    free_keyspace(tables[1]);
+
+    // Test 4: a truncated snapshot is detected
+    long size = ftell(file);
+    rewind(file);
+
+    char *data = malloc(size);
+    if (fread(data, 1, size, file) != (size_t)size)
+    {
+        return 1;
+    }
+    fclose(file);
+
+    file = tmpfile();
+    fwrite(data, 1, size / 2, file);
+    rewind(file);
+
+    tables[0] = hcreate(16);
+    if (!snapshot_detect(file) || snapshot_load(file, SNAPSHOT_VERSION, tables, 1, NULL) != -1)
+    {
+        fprintf(stderr, "Test 4 (Truncated snapshot) failed\n");
+        return 1;
+    }
+    free_keyspace(tables[0]);
+    fclose(file);
+    free(data);
+
+    // Test 5: a file of commands is not a snapshot, and is left at its start
+    file = tmpfile();
+    fputs("SET key value\n", file);
+    rewind(file);
+
+    if (snapshot_detect(file) || ftell(file) != 0)
+    {
+        fprintf(stderr, "Test 5 (Detect a file of commands) failed\n");
+        return 1;
+    }
+    fclose(file);
+
+    // Test 6: the float scores of a version 1 snapshot are loaded as doubles
+    file = tmpfile();
+    uint64_t num_entries = 1;
+    uint8_t type = ZSET;
+    uint32_t len = 4, count = 1;
+    float old_score = 1.5;
+    fwrite(SNAPSHOT_MAGIC_V1, 1, SNAPSHOT_MAGIC_SIZE, file);
+    fwrite(&num_entries, sizeof(num_entries), 1, file);
+    fwrite(&type, sizeof(type), 1, file);
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite("zset", 1, len, file);
+    fwrite(&count, sizeof(count), 1, file);
+    fwrite(&old_score, sizeof(old_score), 1, file);
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite("name", 1, len, file);
+    type = SNAPSHOT_EOF;
+    fwrite(&type, sizeof(type), 1, file);
+    rewind(file);
+
+    tables[0] = hcreate(16);
+    int version = snapshot_detect(file);
+    node = version == 1 && snapshot_load(file, version, tables, 1, NULL) == 1 ? hget(tables[0], "zset") : NULL;
+    if (!node || !zset_score(node->value, "name", &score) || score != 1.5)
+    {
+        fprintf(stderr, "Test 6 (Version 1 snapshot) failed\n");
+        return 1;
+    }
+    free_keyspace(tables[0]);
+    fclose(file);
+
+    free_keyspace(table);
+
+    printf("All tests passed\n");
+
+    return 0;
+}